@@ -19,24 +19,32 @@ public:
 			.SetPosition( pos );
 		ent.Add<Bat::CharacterControllerComponent>( box );
 
-		auto& behaviour = ent.Add<Bat::BehaviourTree>();
-		behaviour.root_node = MakeBehaviour( target_ent );
+		ent.Add<Bat::BehaviourTreeComponent>( MakeBehaviour( target_ent ) );
 	}
 	Bat::Vec3 GetPosition() const { return ent.Get<Bat::TransformComponent>().GetPosition(); }
 	Bat::Entity GetEntity() const { return ent; }
 private:
-	std::unique_ptr<Bat::BehaviourNode> MakeBehaviour( Bat::Entity target_ent )
+	std::shared_ptr<const Bat::BehaviourTree> MakeBehaviour( Bat::Entity target_ent )
 	{
-		auto sequence = std::make_unique<Bat::SequenceNode>();
-		sequence->Add( CheckIfVisible( target_ent ) );
-		sequence->Add( Chase( target_ent ) );
-		sequence->Add( Gotcha() );
-		sequence->Add( WaitUntilGone( target_ent ) );
-		return sequence;
+		// plays sounds and moves a physics controller, so it has to run on the main thread
+		return Bat::BehaviourTreeBuilder()
+			.MainThread()
+			.Sequence()
+				.Action( CheckIfVisible( target_ent ) )
+				.Action( Chase( target_ent ) )
+				.Action( Gotcha() )
+				// wait until gone
+				.LoopUntilSuccess()
+					.Inverse()
+						.Action( CheckIfVisible( target_ent ) )
+					.End()
+				.End()
+			.End()
+			.Build();
 	}
-	std::unique_ptr<Bat::BehaviourNode> CheckIfVisible( Bat::Entity target_ent )
+	Bat::ActionCallback_t CheckIfVisible( Bat::Entity target_ent )
 	{
-		return std::make_unique<Bat::ActionNode>( [=]( Bat::Entity e ) {
+		return [=]( Bat::Entity e ) {
 			const auto& target_transform = target_ent.Get<Bat::TransformComponent>();
 			Bat::Vec3 target_pos = target_transform.GetPosition();
 			const auto& my_transform = e.Get<Bat::TransformComponent>();
@@ -49,11 +57,11 @@ private:
 				return Bat::BehaviourResult::SUCCEEDED;
 			}
 			return Bat::BehaviourResult::FAILED;
-		} );
+		};
 	}
-	std::unique_ptr<Bat::BehaviourNode> Chase( Bat::Entity target_ent )
+	Bat::ActionCallback_t Chase( Bat::Entity target_ent )
 	{
-		return std::make_unique<Bat::ActionNode>( [=]( Bat::Entity e ) {
+		return [=]( Bat::Entity e ) {
 			auto& controller = e.Get<Bat::CharacterControllerComponent>();
 			const auto& target_transform = target_ent.Get<Bat::TransformComponent>();
 			Bat::Vec3 target_pos = target_transform.GetPosition();
@@ -82,25 +90,16 @@ private:
 			controller.Move( delta * dist, Bat::g_pGlobals->deltatime );
 
 			return Bat::BehaviourResult::RUNNING;
-		} );
+		};
 	}
-	std::unique_ptr<Bat::BehaviourNode> Gotcha()
+	Bat::ActionCallback_t Gotcha()
 	{
-		return std::make_unique<Bat::ActionNode>( []( Bat::Entity e ) {
+		return []( Bat::Entity e ) {
 			const auto& my_transform = e.Get<Bat::TransformComponent>();
 			Bat::Vec3 pos = my_transform.GetPosition();
 			snd->Play( "Assets/Ignore/gotcha.wav" );
 			return Bat::BehaviourResult::SUCCEEDED;
-		} );
-	}
-	std::unique_ptr<Bat::BehaviourNode> WaitUntilGone( Bat::Entity target_ent )
-	{
-		auto invert = std::make_unique<Bat::InverseNode>();
-		invert->SetChild( CheckIfVisible( target_ent ) );
-
-		auto loop = std::make_unique<Bat::LoopUntilSuccessNode>();
-		loop->SetChild( std::move( invert ) );
-		return loop;
+		};
 	}
 private:
 	float speed = 5.0f;
@@ -2,9 +2,11 @@
 
 #include <Core/Entry.h>
 #include <filesystem>
+#include <Util/FrameTimer.h>
 
 #include "MoveableCharacter.h"
 #include "AiCharacter.h"
+#include "LegacyEventDispatcher.h"
 #include "Sound.h"
 #include "TypeToString.h"
 
@@ -29,7 +31,9 @@ Demo::Demo( Renderer& gfx, Window& wnd )
 	gfx( gfx ),
 	wnd( wnd ),
 	camera( wnd.input, 2.0f, 1.0f ),
+	spatial_system( world, hier_system ),
 	physics_system( world ),
+	crowd_system( world, navmesh_system, 0 ),
 	controller_system( world )
 {
 	InitializeSound();
@@ -44,7 +48,8 @@ Demo::Demo( Renderer& gfx, Window& wnd )
 	scale_node = scene.AddChild( world.CreateEntity() );
 	scale_node->Get().Get<TransformComponent>()
 		.SetScale( 0.5f );
-	scale_node->AddChild( loader.Load( "Assets/Ignore/Sponza/sponza.gltf" ) );
+	// level geometry never moves, so its shadows come from the cached static cascades
+	scale_node->AddChild( loader.Load( "Assets/Ignore/Sponza/sponza.gltf", RenderFlags::STATIC ) );
 	Entity floor = scene.AddChild( world.CreateEntity() )->Get();
 	floor.Get<TransformComponent>()
 		.SetPosition( { 0.0f, -2.0f, 0.0f } )
@@ -54,7 +59,11 @@ Demo::Demo( Renderer& gfx, Window& wnd )
 
 	BAT_LOG( TypeToString::DumpComponents( floor ) );
 
-	navmesh_system.Bake();
+	// navmesh gathers its input from the spatial index, unchanged tiles are loaded from the cache.
+	// the loader's component events are queued, the spatial index only finds out about the models once they're flushed
+	EventDispatcher::FlushQueuedEvents();
+	spatial_system.Update( world, 0.0f );
+	navmesh_system.Bake( "Assets/Ignore/Sponza/sponza.navmesh" );
 
 	//player.Initialize( scene, { 0.0f, 1.0f, 0.0f } );
 	//ai.Initialize( scene, { 1.0f, 0.5f, 2.0f }, navmesh_system, player.GetEntity() );
@@ -116,6 +125,686 @@ Demo::Demo( Renderer& gfx, Window& wnd )
 
 	wnd.input.AddEventListener<KeyPressedEvent>( *this );
 
+	// main thread behaviour trees can do pretty much anything, so they get the start of the frame to themselves.
+	// the rest are ticked in parallel internally
+	scheduler.AddSystem( "behaviour", SystemAccess()
+		.Exclusive()
+		.MainThread(), [this]( EntityManager& world, float dt )
+	{
+		behaviour_system.Update( world );
+	} );
+	// physics system creates actors in the physics scene, keep it on the main thread
+	scheduler.AddSystem( "physics", SystemAccess()
+		.Writes<PhysicsComponent, TransformComponent>()
+		.Reads<ModelComponent>()
+		.MainThread(), physics_system );
+	// sampling and blending only touches animation components, so it runs alongside physics
+	scheduler.AddSystem( "animation", SystemAccess()
+		.Writes<AnimationComponent>(), anim_system );
+	// path requests are thread safe and don't touch any components
+	scheduler.AddSystem( "navmesh", SystemAccess(), navmesh_system );
+	scheduler.AddSystem( "animation_pose", SystemAccess()
+		.Writes<TransformComponent>()
+		.Reads<AnimationComponent>(), [this]( EntityManager& world, float dt )
+	{
+		anim_system.ApplyPoses( world );
+	} );
+	scheduler.AddSystem( "character_controller", SystemAccess()
+		.Writes<TransformComponent>()
+		.Reads<CharacterControllerComponent>(), controller_system );
+	// only queries the navmesh, safe alongside the navmesh system's path requests
+	scheduler.AddSystem( "crowd", SystemAccess()
+		.Writes<TransformComponent, CrowdAgentComponent>(), crowd_system );
+	// after everything that moves transforms around
+	scheduler.AddSystem( "hierarchy", SystemAccess()
+		.Writes<TransformComponent>(), hier_system );
+	// refits moved models/lights, needs up to date world transforms
+	scheduler.AddSystem( "spatial_index", SystemAccess()
+		.Reads<TransformComponent, ModelComponent, LightComponent>(), spatial_system );
+	// has its own random number generator, runs alongside the spatial index once emitters have their world transforms
+	scheduler.AddSystem( "particles", SystemAccess()
+		.Writes<ParticleEmitterComponent>()
+		.Reads<TransformComponent>(), [this]( EntityManager& world, float dt )
+	{
+		particle_system.Update( world, dt, scheduler.GetCommandQueue() );
+	} );
+
+	g_Console.AddCommand( "system_timings", [&scheduler = scheduler]( const CommandArgs_t& args )
+	{
+		BAT_LOG( "%s", scheduler.GetTimingReport() );
+	} );
+
+	// Heap allocations made while rendering the last frame. Only scene rendering and debug draws are guaranteed to
+	// stay at 0 once the scene has been drawn a few times, the whole frame count (BeginFrame to EndFrame) also includes
+	// OnRender, the console, UI and ImGui
+	g_Console.AddCommand( "frame_alloc_stats", [&gfx = gfx]( const CommandArgs_t& args )
+	{
+		BAT_LOG( "Scene heap allocations: %llu, whole frame: %llu, frame allocator: %zu bytes",
+			(unsigned long long)gfx.GetSceneHeapAllocations(),
+			(unsigned long long)gfx.GetFrameHeapAllocations(),
+			gfx.GetFrameAllocatorBytes() );
+	} );
+
+	// Compares scalar and batch frustum culling of random boxes around the camera
+	// Usage: cull_benchmark [num_boxes]
+	g_Console.AddCommand( "cull_benchmark", [&cam = camera]( const CommandArgs_t& args )
+	{
+		const size_t num_boxes = (args.size() > 1) ? (size_t)std::stoul( std::string( args[1] ) ) : 100000;
+		const Vec3 origin = cam.GetPosition();
+
+		std::vector<AABB> aabbs;
+		BoxesSoA boxes;
+		aabbs.reserve( num_boxes );
+		boxes.Reserve( num_boxes );
+		for( size_t i = 0; i < num_boxes; i++ )
+		{
+			const Vec3 centre = origin + Vec3{ Math::GetRandomFloat( -500.0f, 500.0f ), Math::GetRandomFloat( -500.0f, 500.0f ), Math::GetRandomFloat( -500.0f, 500.0f ) };
+			const float size = Math::GetRandomFloat( 0.5f, 10.0f );
+			aabbs.emplace_back( centre - Vec3{ size, size, size }, centre + Vec3{ size, size, size } );
+			boxes.Add( aabbs.back() );
+		}
+
+		const Frustum& frustum = cam.GetFrustum();
+		std::vector<uint64_t> mask( (num_boxes + 63) / 64 );
+		std::vector<uint32_t> indices( num_boxes );
+
+		FrameTimer timer;
+		size_t scalar_visible = 0;
+		for( const AABB& aabb : aabbs )
+		{
+			scalar_visible += frustum.IsBoxInside( aabb.mins, aabb.maxs );
+		}
+		const float scalar_time = timer.Mark();
+
+		frustum.CullBoxes( boxes, mask.data() );
+		const float mask_time = timer.Mark();
+
+		const size_t batch_visible = frustum.CullBoxesCompact( boxes, indices.data() );
+		const float compact_time = timer.Mark();
+
+		BAT_LOG( "Culled %i boxes, %i visible", (int)num_boxes, (int)batch_visible );
+		BAT_LOG( "  Scalar:          %.3fms (%i visible)", scalar_time * 1000.0f, (int)scalar_visible );
+		BAT_LOG( "  Batch (mask):    %.3fms", mask_time * 1000.0f );
+		BAT_LOG( "  Batch (indices): %.3fms", compact_time * 1000.0f );
+	} );
+
+	// Dispatches events to the same listeners through EventDispatcher and the dispatcher it replaced
+	// Usage: event_benchmark [num_events] [num_listeners]
+	g_Console.AddCommand( "event_benchmark", []( const CommandArgs_t& args )
+	{
+		const size_t num_events = (args.size() > 1) ? (size_t)std::stoul( std::string( args[1] ) ) : 1000000;
+		const size_t num_listeners = (args.size() > 2) ? (size_t)std::stoul( std::string( args[2] ) ) : 4;
+
+		struct BenchmarkEvent
+		{
+			int value;
+		};
+		struct BenchmarkListener
+		{
+			void OnEvent( const BenchmarkEvent& e ) { sum += e.value; }
+			int64_t sum = 0;
+		};
+		// DispatchEvent is only available to the dispatching class
+		class BenchmarkEmitter : public EventDispatcher
+		{
+		public:
+			void Emit( int value ) { DispatchEvent<BenchmarkEvent>( value ); }
+		};
+
+		std::vector<BenchmarkListener> listeners( num_listeners );
+		LegacyEventDispatcher legacy;
+		BenchmarkEmitter emitter;
+		for( BenchmarkListener& listener : listeners )
+		{
+			legacy.AddEventListener<BenchmarkEvent>( listener );
+			emitter.AddEventListener<BenchmarkEvent>( listener );
+		}
+
+		FrameTimer timer;
+		for( size_t i = 0; i < num_events; i++ )
+		{
+			legacy.DispatchEvent<BenchmarkEvent>( (int)i );
+		}
+		const float legacy_time = timer.Mark();
+
+		for( size_t i = 0; i < num_events; i++ )
+		{
+			emitter.Emit( (int)i );
+		}
+		const float delegate_time = timer.Mark();
+
+		// every listener sees each event once per dispatcher
+		const int64_t expected = 2 * ( (int64_t)num_events * ( (int64_t)num_events - 1 ) / 2 );
+		for( const BenchmarkListener& listener : listeners )
+		{
+			if( listener.sum != expected )
+			{
+				BAT_WARN( "Listener missed events, sum %lld expected %lld", (long long)listener.sum, (long long)expected );
+				break;
+			}
+		}
+
+		BAT_LOG( "Dispatched %i events to %i listeners", (int)num_events, (int)num_listeners );
+		BAT_LOG( "  std::function: %.3fms", legacy_time * 1000.0f );
+		BAT_LOG( "  Delegate:      %.3fms", delegate_time * 1000.0f );
+	} );
+
+	// Renders the scene through a copy of the render graph on a headless device and reports the draws, state changes,
+	// uploads and recording time of every pass. Frames are diffed against the first one, and the last frame against
+	// the previous run, so changing a render setting between runs shows which passes it affected.
+	// Usage: render_benchmark [frames]
+	g_Console.AddCommand( "render_benchmark", [this]( const CommandArgs_t& args )
+	{
+		const size_t num_frames = (args.size() > 1) ? (size_t)std::stoul( std::string( args[1] ) ) : 100;
+
+		// everything in the graph creates and renders through the global device. Meshes, shaders and pipelines
+		// were already created by the real device, the headless context only records them.
+		IGPUDevice* pRealDevice = gpu;
+		std::unique_ptr<IGPUDevice> pHeadless( CreateHeadlessGPUDevice( wnd.GetWidth(), wnd.GetHeight() ) );
+		GPUCommandLog& log = GetHeadlessCommandLog( pHeadless.get() );
+		gpu = pHeadless.get();
+
+		GPUCommandLog first_frame;
+		size_t changed_frames = 0;
+		float render_time = 0.0f;
+		{
+			RenderGraph graph;
+			renderbuilder.Make( gfx, wnd, &graph );
+
+			FrameTimer timer;
+			for( size_t i = 0; i < num_frames; i++ )
+			{
+				log.Clear();
+				ShaderManager::BindShaderGlobals( &camera, { (float)wnd.GetWidth(), (float)wnd.GetHeight() }, gpu->GetContext() );
+
+				timer.Mark();
+				graph.Render( camera, scene, gpu->GetBackbuffer() );
+				render_time += timer.Mark();
+
+				if( i == 0 )
+				{
+					first_frame = log;
+				}
+				else if( !GPUCommandLog::Diff( first_frame, log ).empty() )
+				{
+					changed_frames++;
+				}
+			}
+		}
+
+		gpu = pRealDevice;
+		// scratch targets are pooled globally, don't hand headless ones to the real device
+		ScratchRenderTarget::Clear();
+
+		BAT_LOG( "Rendered %i frames headless, %.3fms per frame", (int)num_frames, render_time * 1000.0f / std::max( num_frames, (size_t)1 ) );
+		BAT_LOG( "%s", log.GetReport() );
+		if( changed_frames )
+		{
+			BAT_WARN( "%i frames differ from the first one:\n%s", (int)changed_frames, GPUCommandLog::Diff( first_frame, log ) );
+		}
+
+		if( !render_benchmark_log.GetCommands().empty() )
+		{
+			const std::string diff = GPUCommandLog::Diff( render_benchmark_log, log );
+			BAT_LOG( "Changes since the previous run:\n%s", diff.empty() ? "none" : diff );
+		}
+		render_benchmark_log = log;
+	} );
+
+	// Bins random lights into clusters for the camera's projection and checks the assignment against brute force,
+	// doesn't need a scene or the GPU
+	// Usage: light_cluster_test [num_lights]
+	g_Console.AddCommand( "light_cluster_test", [&cam = camera]( const CommandArgs_t& args )
+	{
+		const size_t num_lights = (args.size() > 1) ? (size_t)std::stoul( std::string( args[1] ) ) : 256;
+		const float tan_half_fov_y = tanf( Math::DegToRad( cam.GetFOV() ) * 0.5f );
+		const float tan_half_fov_x = tan_half_fov_y * cam.GetAspectRatio();
+		const float max_z = cam.GetFar() * 0.5f;
+
+		// view space spheres, some partially outside the frustum
+		std::vector<Vec4> spheres;
+		for( size_t i = 0; i < num_lights; i++ )
+		{
+			const float z = Math::GetRandomFloat( -10.0f, max_z );
+			const float x = Math::GetRandomFloat( -1.2f, 1.2f ) * tan_half_fov_x * std::abs( z );
+			const float y = Math::GetRandomFloat( -1.2f, 1.2f ) * tan_half_fov_y * std::abs( z );
+			spheres.push_back( { x, y, z, Math::GetRandomFloat( 0.5f, 20.0f ) } );
+		}
+
+		LightClusters clusters;
+		FrameTimer timer;
+		clusters.Assign( cam, spheres );
+		const float assign_time = timer.Mark();
+
+		// every assigned light has to touch its cluster
+		size_t false_positives = 0;
+		size_t total_indices = 0;
+		for( uint32_t cluster = 0; cluster < LightClusters::NUM_CLUSTERS; cluster++ )
+		{
+			const uint16_t* lights = clusters.GetClusterLights( cluster );
+			const size_t count = clusters.GetClusterLightCount( cluster );
+			for( size_t i = 0; i < count; i++ )
+			{
+				const Vec4& s = spheres[lights[i]];
+				false_positives += !AABBTree::SphereOverlaps( clusters.GetClusterBounds( cluster ), { s.x, s.y, s.z }, s.w );
+			}
+			total_indices += count;
+		}
+
+		// every point lit by a light has to find that light in its cluster
+		const size_t num_samples = 100000;
+		size_t lit_samples = 0;
+		size_t missed = 0;
+		for( size_t sample = 0; sample < num_samples; sample++ )
+		{
+			const float z = Math::GetRandomFloat( cam.GetNear(), max_z );
+			const Vec3 p = { Math::GetRandomFloat( -1.0f, 1.0f ) * tan_half_fov_x * z, Math::GetRandomFloat( -1.0f, 1.0f ) * tan_half_fov_y * z, z };
+			const uint32_t cluster = clusters.GetClusterIndex( p );
+			const uint16_t* lights = clusters.GetClusterLights( cluster );
+			const size_t count = clusters.GetClusterLightCount( cluster );
+
+			for( size_t i = 0; i < spheres.size(); i++ )
+			{
+				const Vec3 d = p - Vec3{ spheres[i].x, spheres[i].y, spheres[i].z };
+				if( d.LengthSq() <= spheres[i].w * spheres[i].w )
+				{
+					lit_samples++;
+					missed += !std::binary_search( lights, lights + count, (uint16_t)i );
+				}
+			}
+		}
+
+		const bool passed = ( false_positives == 0 && missed == 0 && clusters.GetNumDroppedLights() == 0 );
+		BAT_LOG( "Light cluster test %s: %i lights in %.3fms, %.2f lights per cluster",
+			passed ? "passed" : "FAILED", (int)num_lights, assign_time * 1000.0f, (float)total_indices / LightClusters::NUM_CLUSTERS );
+		BAT_LOG( "  Lights outside their cluster: %i", (int)false_positives );
+		BAT_LOG( "  Lit samples missing their light: %i/%i", (int)missed, (int)lit_samples );
+		BAT_LOG( "  Dropped: %i", (int)clusters.GetNumDroppedLights() );
+	} );
+
+	// Rebuilds the navmesh tiles around the camera, e.g. after moving a prop
+	// Usage: navmesh_rebuild [radius]
+	g_Console.AddCommand( "navmesh_rebuild", [&cam = camera, &navmesh_system = navmesh_system]( const CommandArgs_t& args )
+	{
+		const float radius = (args.size() > 1) ? std::stof( std::string( args[1] ) ) : 5.0f;
+		const Vec3 pos = cam.GetPosition();
+		navmesh_system.RebuildTiles( 0, AABB( pos - Vec3{ radius, radius, radius }, pos + Vec3{ radius, radius, radius } ) );
+	} );
+
+	// Queues random path requests around the camera, runs the async path service until they finish and
+	// checks the results against synchronous queries
+	// Usage: path_request_test [count] [radius]
+	g_Console.AddCommand( "path_request_test", [&cam = camera, &navmesh_system = navmesh_system]( const CommandArgs_t& args )
+	{
+		const size_t count = (args.size() > 1) ? (size_t)std::stoul( std::string( args[1] ) ) : 2000;
+		const float radius = (args.size() > 2) ? std::stof( std::string( args[2] ) ) : 20.0f;
+		const Vec3 origin = cam.GetPosition();
+
+		std::vector<std::pair<Vec3, Vec3>> endpoints;
+		std::vector<PathRequestHandle_t> requests;
+		for( size_t i = 0; i < count; i++ )
+		{
+			const Vec3 start = origin + Vec3{ Math::GetRandomFloat( -radius, radius ), -1.0f, Math::GetRandomFloat( -radius, radius ) };
+			const Vec3 end = origin + Vec3{ Math::GetRandomFloat( -radius, radius ), -1.0f, Math::GetRandomFloat( -radius, radius ) };
+			const PathRequestHandle_t request = navmesh_system.RequestPath( 0, start, end );
+			if( request == INVALID_PATH_REQUEST )
+			{
+				break;
+			}
+			endpoints.emplace_back( start, end );
+			requests.push_back( request );
+		}
+
+		FrameTimer timer;
+		int num_updates = 0;
+		float max_update_time = 0.0f;
+		bool pending = true;
+		while( pending )
+		{
+			timer.Mark();
+			navmesh_system.Update( world, 0.0f );
+			max_update_time = std::max( max_update_time, timer.Mark() );
+			num_updates++;
+
+			pending = false;
+			for( PathRequestHandle_t request : requests )
+			{
+				pending |= ( navmesh_system.GetPathStatus( 0, request ) == PathRequestStatus::PENDING );
+			}
+		}
+
+		size_t succeeded = 0, partial = 0, failed = 0, mismatched = 0;
+		for( size_t i = 0; i < requests.size(); i++ )
+		{
+			const PathRequestStatus status = navmesh_system.GetPathStatus( 0, requests[i] );
+			succeeded += ( status == PathRequestStatus::SUCCEEDED );
+			partial += ( status == PathRequestStatus::PARTIAL );
+			failed += ( status == PathRequestStatus::FAILED );
+
+			if( status == PathRequestStatus::SUCCEEDED )
+			{
+				size_t num_corners;
+				const Vec3* corners = navmesh_system.GetPathCorners( 0, requests[i], &num_corners );
+				const std::vector<Vec3> path = navmesh_system.GetPath( 0, endpoints[i].first, endpoints[i].second );
+				if( path.size() != num_corners || ( num_corners > 0 && ( corners[num_corners - 1] - path.back() ).LengthSq() > 0.0001f ) )
+				{
+					mismatched++;
+				}
+			}
+
+			navmesh_system.ReleasePathRequest( 0, requests[i] );
+		}
+
+		BAT_LOG( "Path request test %s: %i requests over %i updates, slowest update %.3fms",
+			mismatched == 0 ? "passed" : "FAILED", (int)requests.size(), num_updates, max_update_time * 1000.0f );
+		BAT_LOG( "  Succeeded: %i, partial: %i, failed: %i", (int)succeeded, (int)partial, (int)failed );
+		BAT_LOG( "  Different from synchronous query: %i", (int)mismatched );
+	} );
+
+	// Spawns agents around the camera that walk between random points and times the crowd updates
+	// Usage: crowd_benchmark [agents] [frames] [radius]
+	g_Console.AddCommand( "crowd_benchmark", [&scene = scene, &cam = camera, &navmesh_system = navmesh_system, &crowd_system = crowd_system]( const CommandArgs_t& args )
+	{
+		const size_t count = (args.size() > 1) ? (size_t)std::stoul( std::string( args[1] ) ) : 5000;
+		const int frames = (args.size() > 2) ? std::stoi( std::string( args[2] ) ) : 600;
+		const float radius = (args.size() > 3) ? std::stof( std::string( args[3] ) ) : 20.0f;
+		const Vec3 origin = cam.GetPosition();
+
+		// snapped to the navmesh so agents start on it wherever the camera is, only gives up on points far from it
+		auto random_point = [&]( Vec3* point_out )
+		{
+			for( int attempt = 0; attempt < 16; attempt++ )
+			{
+				const Vec3 pos = origin + Vec3{ Math::GetRandomFloat( -radius, radius ), -1.0f, Math::GetRandomFloat( -radius, radius ) };
+				NavPolyRef_t poly;
+				if( navmesh_system.FindNearestPoint( 0, pos, point_out, &poly ) )
+				{
+					return true;
+				}
+			}
+			return false;
+		};
+
+		std::vector<Entity> agents;
+		agents.reserve( count );
+		for( size_t i = 0; i < count; i++ )
+		{
+			Vec3 start, target;
+			if( !random_point( &start ) || !random_point( &target ) )
+			{
+				continue;
+			}
+
+			Entity e = scene.AddChild( world.CreateEntity() )->Get();
+			e.Get<TransformComponent>()
+				.SetPosition( start );
+			e.Add<CrowdAgentComponent>()
+				.SetTarget( target );
+			agents.push_back( e );
+		}
+
+		if( agents.size() < count )
+		{
+			BAT_WARN( "Only found navmesh for %i/%i agents, move the camera over the navmesh", (int)agents.size(), (int)count );
+			if( agents.empty() )
+			{
+				return;
+			}
+		}
+
+		const float dt = 1.0f / 60.0f;
+		FrameTimer timer;
+		float total_time = 0.0f;
+		float max_update_time = 0.0f;
+		size_t arrivals = 0;
+		for( int frame = 0; frame < frames; frame++ )
+		{
+			timer.Mark();
+			navmesh_system.Update( world, dt );
+			crowd_system.Update( world, dt );
+			const float update_time = timer.Mark();
+			total_time += update_time;
+			max_update_time = std::max( max_update_time, update_time );
+
+			for( Entity e : agents )
+			{
+				auto& agent = e.Get<CrowdAgentComponent>();
+				Vec3 target;
+				if( agent.HasReachedTarget() && random_point( &target ) )
+				{
+					agent.SetTarget( target );
+					arrivals++;
+				}
+			}
+		}
+
+		BAT_LOG( "Crowd benchmark: %i agents over %i frames, average update %.3fms, slowest %.3fms",
+			(int)crowd_system.GetAgentCount(), frames, total_time / frames * 1000.0f, max_update_time * 1000.0f );
+		BAT_LOG( "  Targets reached: %i", (int)arrivals );
+
+		// newest children are at the front of the list, removing them in reverse is quick
+		for( auto it = agents.rbegin(); it != agents.rend(); ++it )
+		{
+			scene.RemoveChild( *it );
+			world.DestroyEntity( *it );
+		}
+	} );
+
+	// Ticks shared behaviour trees for lots of entities that pace back and forth, and times the updates
+	// Usage: behaviour_benchmark [entities] [frames]
+	g_Console.AddCommand( "behaviour_benchmark", [&scene = scene, &behaviour_system = behaviour_system]( const CommandArgs_t& args )
+	{
+		const size_t count = (args.size() > 1) ? (size_t)std::stoul( std::string( args[1] ) ) : 10000;
+		const int frames = (args.size() > 2) ? std::stoi( std::string( args[2] ) ) : 600;
+
+		// only touches local positions, world positions are lazily computed from the parent's
+		auto walk_to = []( float x )
+		{
+			return [x]( Entity e )
+			{
+				auto& t = e.Get<TransformComponent>();
+				const Vec3 pos = t.GetLocalPosition();
+				const float step = std::clamp( x - pos.x, -0.1f, 0.1f );
+				t.SetLocalPosition( { pos.x + step, pos.y, pos.z } );
+				return ( fabsf( x - pos.x ) < 0.01f ) ? BehaviourResult::SUCCEEDED : BehaviourResult::RUNNING;
+			};
+		};
+
+		const std::shared_ptr<const BehaviourTree> tree = BehaviourTreeBuilder()
+			.Sequence()
+				.Action( walk_to( 10.0f ) )
+				.Selector()
+					.Inverse().Action( walk_to( 0.0f ) ).End()
+					.Action( walk_to( 5.0f ) )
+				.End()
+			.End()
+			.Build();
+
+		std::vector<Entity> entities;
+		entities.reserve( count );
+		for( size_t i = 0; i < count; i++ )
+		{
+			Entity e = scene.AddChild( world.CreateEntity() )->Get();
+			e.Get<TransformComponent>()
+				.SetLocalPosition( { Math::GetRandomFloat( 0.0f, 10.0f ), 0.0f, (float)i } );
+			e.Add<BehaviourTreeComponent>( tree );
+			entities.push_back( e );
+		}
+
+		FrameTimer timer;
+		float total_time = 0.0f;
+		float max_update_time = 0.0f;
+		for( int frame = 0; frame < frames; frame++ )
+		{
+			timer.Mark();
+			behaviour_system.Update( world );
+			const float update_time = timer.Mark();
+			total_time += update_time;
+			max_update_time = std::max( max_update_time, update_time );
+		}
+
+		BAT_LOG( "Behaviour benchmark: %i entities over %i frames, average update %.3fms, slowest %.3fms",
+			(int)count, frames, total_time / frames * 1000.0f, max_update_time * 1000.0f );
+		BAT_LOG( "  %i nodes shared by every entity, %i bytes per entity", (int)tree->GetNodeCount(), (int)sizeof( BehaviourTreeComponent ) );
+
+		for( auto it = entities.rbegin(); it != entities.rend(); ++it )
+		{
+			scene.RemoveChild( *it );
+			world.DestroyEntity( *it );
+		}
+	} );
+
+	// Animates copies of a model's skeleton and times the animation and hierarchy updates, the target is 2ms for 500 characters
+	// Usage: animation_benchmark <model> [characters] [frames]
+	g_Console.AddCommand( "animation_benchmark", [&scene = scene, &anim_system = anim_system, &hier_system = hier_system]( const CommandArgs_t& args )
+	{
+		if( args.size() < 2 )
+		{
+			BAT_WARN( "Usage: animation_benchmark <model> [characters] [frames]" );
+			return;
+		}
+
+		const size_t count = (args.size() > 2) ? (size_t)std::stoul( std::string( args[2] ) ) : 500;
+		const int frames = (args.size() > 3) ? std::stoi( std::string( args[3] ) ) : 300;
+
+		// roots are the scene's children, entities is everything the benchmark created
+		std::vector<Entity> roots;
+		std::vector<Entity> entities;
+		auto gather = [&entities]( SceneNode& node, auto& self ) -> void
+		{
+			entities.push_back( node.Get() );
+			for( SceneNode& child : node )
+			{
+				self( child, self );
+			}
+		};
+		auto cleanup = [&scene, &roots, &entities]()
+		{
+			// children are added to the front, removing the newest first only ever removes the first child
+			for( auto it = roots.rbegin(); it != roots.rend(); ++it )
+			{
+				scene.RemoveChild( *it );
+			}
+			for( Entity e : entities )
+			{
+				world.DestroyEntity( e );
+			}
+		};
+
+		SceneLoader loader;
+		SceneNode* model = scene.AddChild( loader.Load( std::string( args[1] ) ) );
+		roots.push_back( model->Get() );
+		gather( *model, gather );
+
+		Entity source;
+		bool found = false;
+		for( Entity e : entities )
+		{
+			if( e.Has<AnimationComponent>() && !e.Get<AnimationComponent>().clips.empty() )
+			{
+				source = e;
+				found = true;
+				break;
+			}
+		}
+		if( !found )
+		{
+			BAT_WARN( "'%s' has no animations", std::string( args[1] ) );
+			cleanup();
+			return;
+		}
+
+		// every character gets its own bone nodes, clips are shared with the loaded model
+		AnimationComponent& src = source.Get<AnimationComponent>();
+		const size_t num_bones = src.bind_pose.bones.size();
+		const size_t side = (size_t)ceilf( sqrtf( (float)count ) );
+
+		entities.reserve( entities.size() + count * ( num_bones + 1 ) );
+		std::vector<SceneNode*> nodes( num_bones );
+		for( size_t i = 0; i < count; i++ )
+		{
+			SceneNode* root = scene.AddChild( world.CreateEntity() );
+			roots.push_back( root->Get() );
+			entities.push_back( root->Get() );
+			root->Get().Get<TransformComponent>()
+				.SetPosition( { (float)( i % side ) * 2.0f, 0.0f, (float)( i / side ) * 2.0f } );
+
+			auto& anim = root->Get().Add<AnimationComponent>();
+			anim.bind_pose = src.bind_pose;
+			anim.bones = src.bones;
+			for( size_t bone = 0; bone < num_bones; bone++ )
+			{
+				const int parent = anim.bind_pose.bones[bone].parent_index;
+				nodes[bone] = ( bone == 0 || parent < 0 ? root : nodes[parent] )->AddChild( world.CreateEntity() );
+				anim.bind_pose.bones[bone].entity = nodes[bone]->Get();
+				entities.push_back( nodes[bone]->Get() );
+			}
+
+			AnimationClip* clip = &src.clips[i % src.clips.size()];
+			AnimationState state( clip );
+			state.SetLooping( true );
+			state.SetTimestamp( Math::GetRandomFloat( 0.0f, clip->duration ) );
+			anim.states.push_back( state );
+		}
+
+		// first update rebuilds the hierarchy and sizes the scratch poses
+		anim_system.Update( world, 0.0f );
+		anim_system.ApplyPoses( world );
+		hier_system.Update( world, 0.0f );
+
+		const float dt = 1.0f / 60.0f;
+		FrameTimer timer;
+		float anim_total = 0.0f;
+		float anim_max = 0.0f;
+		float hier_total = 0.0f;
+		float hier_max = 0.0f;
+		for( int frame = 0; frame < frames; frame++ )
+		{
+			timer.Mark();
+			anim_system.Update( world, dt );
+			anim_system.ApplyPoses( world );
+			const float anim_time = timer.Mark();
+			hier_system.Update( world, dt );
+			const float hier_time = timer.Mark();
+
+			anim_total += anim_time;
+			anim_max = std::max( anim_max, anim_time );
+			hier_total += hier_time;
+			hier_max = std::max( hier_max, hier_time );
+		}
+
+		BAT_LOG( "Animation benchmark: %i characters with %i bones over %i frames", (int)count, (int)num_bones, frames );
+		BAT_LOG( "  animation average %.3fms, slowest %.3fms", anim_total / frames * 1000.0f, anim_max * 1000.0f );
+		BAT_LOG( "  hierarchy average %.3fms, slowest %.3fms", hier_total / frames * 1000.0f, hier_max * 1000.0f );
+		BAT_LOG( "  combined average %.3fms (target 2ms for 500 characters)", ( anim_total + hier_total ) / frames * 1000.0f );
+
+		cleanup();
+	} );
+
+	// Emits a burst of sparks in front of the camera, the emitter is removed through the command queue once it's done
+	// Usage: spawn_emitter [duration]
+	g_Console.AddCommand( "spawn_emitter", [&scene = scene, &cam = camera]( const CommandArgs_t& args )
+	{
+		const float duration = (args.size() > 1) ? std::stof( std::string( args[1] ) ) : 1.0f;
+
+		Entity e = world.CreateEntity();
+		scene.AddChild( e );
+		e.Get<TransformComponent>()
+			.SetPosition( cam.GetPosition() + cam.GetLookAtVector() * 2.0f );
+		auto& emitter = e.Add<ParticleEmitterComponent>( ResourceManager::GetTexture( "Assets/Ignore/particles/fire_02.png" ) );
+		emitter.particles_per_sec = 100.0f;
+		emitter.lifetime = 0.5f;
+		emitter.start_scale = 0.05f;
+		emitter.end_scale = 0.02f;
+		emitter.gradient.AddStop( Colour( 255, 255, 200 ), 0.0f )
+			.AddStop( Colour( 255, 120, 0 ), 1.0f );
+		emitter.end_alpha = 0.0f;
+		emitter.force_multiplier = 1.0f;
+		emitter.normal = { 0.0f, 2.0f, 0.0f };
+		emitter.rand_velocity_range = { 2.0f, 1.0f, 2.0f };
+		emitter.duration = duration;
+	} );
+
 	g_Console.AddCommand( "load_scene", [&scene = scene, &cam = camera, &gfx = gfx]( const CommandArgs_t& args )
 	{
 		std::string filepath = std::string( args[1] );
@@ -189,11 +878,7 @@ void Demo::OnUpdate( float deltatime )
 		.SetRotation( camera.GetRotation() );
 	snd->SetListenerPosition( camera.GetPosition(), camera.GetLookAtVector() );
 
-	physics_system.Update( world, deltatime );
-	anim_system.Update( world, deltatime );
-	particle_system.Update( world, deltatime );
-	behaviour_system.Update( world );
-	controller_system.Update( world, deltatime );
+	scheduler.Run( world, deltatime );
 
 	if( physics_simulate )
 	{
@@ -396,6 +1081,7 @@ void Demo::OnRender()
 		if( ImGui::Begin( "Application" ) )
 		{
 			ImGui::Text( "FPS: %s", fps_string.c_str() );
+			ImGui::Text( "Heap allocs: scene %llu, frame %llu", (unsigned long long)gfx.GetSceneHeapAllocations(), (unsigned long long)gfx.GetFrameHeapAllocations() );
 			ImGui::Text( "Pos: %.2f %.2f %.2f", camera.GetPosition().x, camera.GetPosition().y, camera.GetPosition().z );
 
 			if( ImGui::CollapsingHeader( "Render Passes" ) )
@@ -427,6 +1113,13 @@ void Demo::OnRender()
 	if( draw_navmesh )
 	{
 		navmesh_system.Draw( 0 );
+		crowd_system.Draw();
+	}
+
+	AABB selected_bounds;
+	if( selected_entity != Entity::INVALID && spatial_system.GetBounds( SpatialCategory::MODEL, selected_entity, &selected_bounds ) )
+	{
+		DebugDraw::Box( selected_bounds.mins, selected_bounds.maxs, Colours::Green );
 	}
 }
 
@@ -487,12 +1180,9 @@ void Demo::OnEvent( const KeyPressedEvent& e )
 	}
 	else if( e.key == 'P' )
 	{
-		for( Entity ent : world )
+		for( auto [ent, light, phys] : world.View<LightComponent, PhysicsComponent>() )
 		{
-			if( ent.Has<LightComponent>() && ent.Has<PhysicsComponent>() )
-			{
-				ent.Get<PhysicsComponent>().AddLinearImpulse( { 0.0f, 10.0f, 0.0f } );
-			}
+			phys.AddLinearImpulse( { 0.0f, 10.0f, 0.0f } );
 		}
 	}
 	else if( e.key == 'I' )
@@ -530,6 +1220,8 @@ void Demo::OnEvent( const MouseButtonPressedEvent& e )
 {
 	if( e.button == Input::MouseButton::Left )
 	{
+		// select whatever model is under the crosshair
+		selected_entity = spatial_system.Raycast( SpatialCategory::MODEL, camera.GetPosition(), camera.GetLookAtVector(), 1000.0f );
 	}
 }
 
@@ -37,20 +37,26 @@ private:
 
 	bool physics_simulate = true;
 	bool draw_navmesh = false;
+	Bat::Entity selected_entity;
 
 	float timestamp = 0.0f;
 	float anim_timescale = 1.0f;
 	int selected_anim = 0;
 
 	Bat::HierarchySystem hier_system;
+	Bat::SpatialIndexSystem spatial_system;
 	Bat::PhysicsSystem physics_system;
 	Bat::AnimationSystem anim_system;
 	Bat::ParticleSystem particle_system;
 	Bat::NavMeshSystem navmesh_system;
+	Bat::CrowdSystem crowd_system;
 	Bat::BehaviourTreeSystem behaviour_system;
 	Bat::CharacterControllerSystem controller_system;
+	Bat::SystemScheduler scheduler;
 
 	RenderBuilder renderbuilder;
+	// last frame of the previous render_benchmark run
+	Bat::GPUCommandLog render_benchmark_log;
 
 	bool imgui_menu_enabled = false;
 
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <functional>
+#include <typeindex>
+#include <unordered_map>
+#include <vector>
+
+// The EventDispatcher listener storage before it moved to Delegate, kept so event_benchmark can compare against it.
+// Listeners are a std::bind inside an EventCallbackWrapper inside a std::function, and dispatching copies each one.
+class LegacyEventDispatcher
+{
+public:
+	template <typename Event, typename Listener>
+	void AddEventListener( Listener& listener )
+	{
+		void (Listener::*listen_func)(const Event&) = &Listener::OnEvent;
+		auto wrapper = EventCallbackWrapper<Event>( std::bind( listen_func, &listener, std::placeholders::_1 ) );
+		m_Callbacks[std::type_index( typeid(Event) )].emplace_back( &listener, wrapper );
+	}
+
+	template <typename Event, typename... Args>
+	void DispatchEvent( Args&&... args )
+	{
+		const auto& listeners = m_Callbacks[std::type_index( typeid(Event) )];
+		if( listeners.empty() )
+		{
+			return;
+		}
+
+		Event e = Event{ std::forward<Args>( args )... };
+		for( auto listener : listeners )
+		{
+			listener.callback( &e );
+		}
+	}
+private:
+	// erases event type and does a conversion back when called
+	template <typename Event>
+	struct EventCallbackWrapper
+	{
+		explicit EventCallbackWrapper( std::function<void( const Event& )> callback )
+			:
+			callback( callback )
+		{}
+		void operator()( const void* event )
+		{
+			callback( *(static_cast<const Event*>(event)) );
+		}
+		std::function<void( const Event& )> callback;
+	};
+
+	struct EventListener
+	{
+		EventListener( void* pAddress, std::function<void( const void* )> cb )
+			:
+			address( pAddress ),
+			callback( cb )
+		{}
+
+		void* address;
+		std::function<void( const void* )> callback;
+	};
+
+	std::unordered_map<std::type_index, std::vector<EventListener>> m_Callbacks{ 20 };
+};
@@ -32,21 +32,18 @@ void RenderBuilder::MakeForwardPipeline( const Bat::Renderer& gfx, const Bat::Wi
 	// render texture to draw scene to
 	if( post_process_count )
 	{
+		graph->AddRenderTargetResource( "target",
+			std::unique_ptr<IRenderTarget>( gpu->CreateRenderTarget( wnd.GetWidth(), wnd.GetHeight(), TEX_FORMAT_R32G32B32A32_FLOAT, ms_quality, ms_samples ) ) );
+
+		// post process intermediates, only allocated by the graph if a pass ends up using them
+		RenderTargetDesc intermediate_desc;
+		intermediate_desc.width = wnd.GetWidth();
+		intermediate_desc.height = wnd.GetHeight();
+		intermediate_desc.format = TEX_FORMAT_R32G32B32A32_FLOAT;
+		graph->AddTransientRenderTargetResource( "target2", intermediate_desc );
 		if( msaa_enabled )
 		{
-			graph->AddRenderTargetResource( "target",
-				std::unique_ptr<IRenderTarget>( gpu->CreateRenderTarget( wnd.GetWidth(), wnd.GetHeight(), TEX_FORMAT_R32G32B32A32_FLOAT, ms_quality, ms_samples ) ) );
-			graph->AddRenderTargetResource( "target2",
-				std::unique_ptr<IRenderTarget>( gpu->CreateRenderTarget( wnd.GetWidth(), wnd.GetHeight(), TEX_FORMAT_R32G32B32A32_FLOAT ) ) );
-			graph->AddRenderTargetResource( "resolve_target",
-				std::unique_ptr<IRenderTarget>( gpu->CreateRenderTarget( wnd.GetWidth(), wnd.GetHeight(), TEX_FORMAT_R32G32B32A32_FLOAT ) ) );
-		}
-		else
-		{
-			graph->AddRenderTargetResource( "target",
-				std::unique_ptr<IRenderTarget>( gpu->CreateRenderTarget( wnd.GetWidth(), wnd.GetHeight(), TEX_FORMAT_R32G32B32A32_FLOAT, ms_quality, ms_samples ) ) );
-			graph->AddRenderTargetResource( "target2",
-				std::unique_ptr<IRenderTarget>( gpu->CreateRenderTarget( wnd.GetWidth(), wnd.GetHeight(), TEX_FORMAT_R32G32B32A32_FLOAT, ms_quality, ms_samples ) ) );
+			graph->AddTransientRenderTargetResource( "resolve_target", intermediate_desc );
 		}
 	}
 	else
@@ -209,6 +206,8 @@ void RenderBuilder::MakeForwardPipeline( const Bat::Renderer& gfx, const Bat::Wi
 			graph->MarkOutput( "tonemapping.dst" );
 		}
 	}
+
+	graph->Compile();
 }
 
 void RenderBuilder::DrawSettings( const Bat::Renderer& gfx, const Bat::Window& wnd, Bat::RenderGraph* graph )
@@ -1,4 +1,5 @@
 #pragma once
 
 #include "AI/BehaviourTree.h"
+#include "AI/Crowd.h"
 #include "AI/NavMesh.h"
\ No newline at end of file
@@ -1,22 +1,247 @@
 #include "PCH.h"
 #include "BehaviourTree.h"
 
+#include "Util/JobSystem.h"
+
 namespace Bat
 {
-	BAT_COMPONENT_BEGIN( BehaviourTree );
+	BAT_COMPONENT_BEGIN( BehaviourTreeComponent );
 	BAT_COMPONENT_END();
 
+	// Entities per job
+	static constexpr uint32_t BEHAVIOUR_GROUP_SIZE = 64;
+
+	BehaviourResult BehaviourTree::Tick( Entity e, uint16_t* state ) const
+	{
+		if( m_vNodes.empty() )
+		{
+			return BehaviourResult::FAILED;
+		}
+
+		return TickNode( 0, e, state );
+	}
+
+	BehaviourResult BehaviourTree::TickNode( uint16_t index, Entity e, uint16_t* state ) const
+	{
+		const Node& node = m_vNodes[index];
+		switch( node.type )
+		{
+		case BehaviourNodeType::SEQUENCE:
+		case BehaviourNodeType::SELECTOR:
+		{
+			uint16_t& current = state[node.data];
+			const uint16_t first_child = (uint16_t)( index + 1 );
+			const uint16_t child = (uint16_t)( first_child + current );
+
+			const BehaviourResult result = TickNode( child, e, state );
+			if( result == BehaviourResult::RUNNING )
+			{
+				return BehaviourResult::RUNNING;
+			}
+
+			// sequences move on to the next child when one succeeds, selectors when one fails
+			const BehaviourResult next_on = ( node.type == BehaviourNodeType::SEQUENCE ) ? BehaviourResult::SUCCEEDED : BehaviourResult::FAILED;
+			const uint16_t next_child = m_vNodes[child].end;
+			if( result != next_on || next_child == node.end )
+			{
+				current = 0;
+				return result;
+			}
+
+			current = (uint16_t)( next_child - first_child );
+			return BehaviourResult::RUNNING;
+		}
+		case BehaviourNodeType::LOOP_UNTIL_SUCCESS:
+		{
+			const BehaviourResult result = TickNode( (uint16_t)( index + 1 ), e, state );
+			return ( result == BehaviourResult::SUCCEEDED ) ? BehaviourResult::SUCCEEDED : BehaviourResult::RUNNING;
+		}
+		case BehaviourNodeType::INVERSE:
+		{
+			const BehaviourResult result = TickNode( (uint16_t)( index + 1 ), e, state );
+			switch( result )
+			{
+			case BehaviourResult::RUNNING:
+				return BehaviourResult::RUNNING;
+			case BehaviourResult::SUCCEEDED:
+				return BehaviourResult::FAILED;
+			case BehaviourResult::FAILED:
+				return BehaviourResult::SUCCEEDED;
+			}
+			break;
+		}
+		case BehaviourNodeType::ACTION:
+			return m_vActions[node.data]( e );
+		}
+
+		ASSERT( false, "Unhandled behaviour node" );
+		return BehaviourResult::RUNNING;
+	}
+
+	BehaviourTreeBuilder& BehaviourTreeBuilder::Sequence()
+	{
+		return Open( BehaviourNodeType::SEQUENCE );
+	}
+
+	BehaviourTreeBuilder& BehaviourTreeBuilder::Selector()
+	{
+		return Open( BehaviourNodeType::SELECTOR );
+	}
+
+	BehaviourTreeBuilder& BehaviourTreeBuilder::LoopUntilSuccess()
+	{
+		return Open( BehaviourNodeType::LOOP_UNTIL_SUCCESS );
+	}
+
+	BehaviourTreeBuilder& BehaviourTreeBuilder::Inverse()
+	{
+		return Open( BehaviourNodeType::INVERSE );
+	}
+
+	BehaviourTreeBuilder& BehaviourTreeBuilder::Action( ActionCallback_t callback )
+	{
+		AddNode( BehaviourNodeType::ACTION, (uint16_t)m_vActions.size() );
+		m_vNodes.back().end = (uint16_t)m_vNodes.size();
+		m_vActions.push_back( std::move( callback ) );
+
+		return *this;
+	}
+
+	BehaviourTreeBuilder& BehaviourTreeBuilder::End()
+	{
+		ASSERT( !m_vOpenNodes.empty(), "End() without an open behaviour node" );
+
+		const uint16_t index = m_vOpenNodes.back();
+		m_vOpenNodes.pop_back();
+
+		BehaviourTree::Node& node = m_vNodes[index];
+		node.end = (uint16_t)m_vNodes.size();
+
+		const bool is_composite = ( node.type == BehaviourNodeType::SEQUENCE || node.type == BehaviourNodeType::SELECTOR );
+		const bool has_children = ( node.end > index + 1 );
+		ASSERT( has_children, "Behaviour node has no children" );
+		ASSERT( is_composite || m_vNodes[index + 1].end == node.end, "Decorator behaviour nodes take exactly one child" );
+
+		return *this;
+	}
+
+	BehaviourTreeBuilder& BehaviourTreeBuilder::MainThread()
+	{
+		m_bMainThread = true;
+		return *this;
+	}
+
+	std::shared_ptr<const BehaviourTree> BehaviourTreeBuilder::Build()
+	{
+		ASSERT( m_vOpenNodes.empty(), "Behaviour tree has %i unclosed nodes", (int)m_vOpenNodes.size() );
+		ASSERT( m_vNodes.empty() || m_vNodes[0].end == m_vNodes.size(), "Behaviour tree must have a single root" );
+
+		auto tree = std::make_shared<BehaviourTree>();
+		tree->m_vNodes = std::move( m_vNodes );
+		tree->m_vActions = std::move( m_vActions );
+		tree->m_iNumComposites = m_iNumComposites;
+		tree->m_bMainThread = m_bMainThread;
+
+		m_vNodes.clear();
+		m_vActions.clear();
+		m_iNumComposites = 0;
+		m_bMainThread = false;
+
+		return tree;
+	}
+
+	BehaviourTreeBuilder& BehaviourTreeBuilder::Open( BehaviourNodeType type )
+	{
+		uint16_t data = 0;
+		if( type == BehaviourNodeType::SEQUENCE || type == BehaviourNodeType::SELECTOR )
+		{
+			ASSERT( m_iNumComposites < BehaviourTree::MAX_COMPOSITES, "Behaviour tree has too many sequences/selectors" );
+			data = (uint16_t)m_iNumComposites++;
+		}
+
+		m_vOpenNodes.push_back( (uint16_t)m_vNodes.size() );
+		AddNode( type, data );
+
+		return *this;
+	}
+
+	void BehaviourTreeBuilder::AddNode( BehaviourNodeType type, uint16_t data )
+	{
+		ASSERT( m_vNodes.size() < UINT16_MAX, "Behaviour tree has too many nodes" );
+
+		BehaviourTree::Node node;
+		node.type = type;
+		node.end = 0;
+		node.data = data;
+		m_vNodes.push_back( node );
+	}
+
+	BehaviourTreeComponent::BehaviourTreeComponent( std::shared_ptr<const BehaviourTree> tree )
+		:
+		m_pTree( std::move( tree ) )
+	{}
+
+	void BehaviourTreeComponent::Reset()
+	{
+		std::fill( std::begin( m_State ), std::end( m_State ), (uint16_t)0 );
+	}
+
 	void BehaviourTreeSystem::Update( EntityManager& world )
 	{
-		for( Entity e : world )
+		m_vParallelTicks.clear();
+		m_vMainThreadTicks.clear();
+		world.ForEachComponent<BehaviourTreeComponent>( [this]( Entity e, BehaviourTreeComponent& behaviour )
+		{
+			if( !behaviour.m_pTree )
+			{
+				return;
+			}
+
+			if( behaviour.m_pTree->RequiresMainThread() )
+			{
+				m_vMainThreadTicks.push_back( e );
+			}
+			else
+			{
+				m_vParallelTicks.emplace_back( e, &behaviour );
+			}
+		} );
+
+		if( !m_vParallelTicks.empty() )
+		{
+			JobCounter counter;
+			JobSystem::Dispatch( (uint32_t)m_vParallelTicks.size(), BEHAVIOUR_GROUP_SIZE, [this]( JobDispatchArgs args )
+			{
+				auto& [e, behaviour] = m_vParallelTicks[args.jobIndex];
+				behaviour->m_pTree->Tick( e, behaviour->m_State );
+			}, &counter );
+			JobSystem::Wait( counter );
+		}
+
+		// these can add/remove components and move the component around, so they tick a copy of the state
+		for( Entity e : m_vMainThreadTicks )
 		{
-			if( e.Has<BehaviourTree>() )
+			if( world.IsStale( e ) || !e.Has<BehaviourTreeComponent>() )
+			{
+				continue;
+			}
+
+			auto& behaviour = e.Get<BehaviourTreeComponent>();
+			const std::shared_ptr<const BehaviourTree> tree = behaviour.m_pTree;
+			if( !tree )
+			{
+				continue;
+			}
+
+			uint16_t state[BehaviourTree::MAX_COMPOSITES];
+			std::copy( std::begin( behaviour.m_State ), std::end( behaviour.m_State ), state );
+			tree->Tick( e, state );
+
+			// unless an action replaced the component, which starts the new tree from its root
+			if( !world.IsStale( e ) && e.Has<BehaviourTreeComponent>() && e.Get<BehaviourTreeComponent>().m_pTree == tree )
 			{
-				auto& tree = e.Get<BehaviourTree>();
-				if( tree.root_node )
-				{
-					tree.root_node->Go( e );
-				}
+				auto& ticked = e.Get<BehaviourTreeComponent>();
+				std::copy( std::begin( state ), std::end( state ), ticked.m_State );
 			}
 		}
 	}
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <functional>
+#include <memory>
 #include "Core/Entity.h"
 
 namespace Bat
@@ -12,168 +13,119 @@ namespace Bat
 		FAILED
 	};
 
-	class BehaviourNode
+	enum class BehaviourNodeType : uint8_t
 	{
-	public:
-		virtual ~BehaviourNode() = default;
-
-		virtual BehaviourResult Go( Entity e ) = 0;
+		// ticks its children in order until one fails, one child per tick
+		SEQUENCE,
+		// ticks its children in order until one succeeds, one child per tick
+		SELECTOR,
+		// keeps running its child until it succeeds
+		LOOP_UNTIL_SUCCESS,
+		// swaps its child's success and failure
+		INVERSE,
+		ACTION
 	};
 
-	class SequenceNode : public BehaviourNode
-	{
-	public:
-		SequenceNode& Add( std::unique_ptr<BehaviourNode> node )
-		{
-			m_Nodes.push_back( std::move( node ) );
-			return *this;
-		}
-
-		virtual BehaviourResult Go( Entity e ) override
-		{
-			auto& node = m_Nodes[m_CurrentNode];
-			
-			BehaviourResult result = node->Go( e );
-			switch( result )
-			{
-			case BehaviourResult::RUNNING:
-				return BehaviourResult::RUNNING;
-			case BehaviourResult::SUCCEEDED:
-				m_CurrentNode++;
-				if( m_CurrentNode == m_Nodes.size() )
-				{
-					m_CurrentNode = 0;
-					return BehaviourResult::SUCCEEDED;
-				}
-				return BehaviourResult::RUNNING;
-			case BehaviourResult::FAILED:
-				m_CurrentNode = 0;
-				return BehaviourResult::FAILED;
-			}
-
-			ASSERT( false, "Unhandled behaviour result" );
-			return BehaviourResult::RUNNING;
-		}
-	private:
-		size_t m_CurrentNode = 0;
-		std::vector<std::unique_ptr<BehaviourNode>> m_Nodes;
-	};
+	using ActionCallback_t = std::function<BehaviourResult( Entity e )>;
 
-	class SelectorNode : public BehaviourNode
+	// Immutable behaviour tree, shared by every entity running it. Nodes are stored depth first in a flat array
+	// so a node's children directly follow it. Which child each sequence/selector is on is the only thing that
+	// differs between entities, that lives in their BehaviourTreeComponent.
+	class BehaviourTree
 	{
 	public:
-		SelectorNode& Add( std::unique_ptr<BehaviourNode> node )
-		{
-			m_Nodes.push_back( std::move( node ) );
-			return *this;
-		}
+		// Sequences and selectors a tree can have, each takes a slot in every entity's state
+		static constexpr size_t MAX_COMPOSITES = 16;
 
-		virtual BehaviourResult Go( Entity e ) override
+		struct Node
 		{
-			auto& node = m_Nodes[m_CurrentNode];
-
-			BehaviourResult result = node->Go( e );
-			switch( result )
-			{
-			case BehaviourResult::RUNNING:
-				return BehaviourResult::RUNNING;
-			case BehaviourResult::SUCCEEDED:
-				m_CurrentNode = 0;
-				return BehaviourResult::SUCCEEDED;
-			case BehaviourResult::FAILED:
-				m_CurrentNode++;
-				if( m_CurrentNode == m_Nodes.size() )
-				{
-					m_CurrentNode = 0;
-					return BehaviourResult::FAILED;
-				}
-				return BehaviourResult::RUNNING;
-			}
-
-			ASSERT( false, "Unhandled behaviour result" );
-			return BehaviourResult::RUNNING;
-		}
+			BehaviourNodeType type;
+			// index one past the last node of this subtree, which is also the next sibling
+			uint16_t end;
+			// state slot for sequences/selectors, index into the actions for actions
+			uint16_t data;
+		};
+
+		// Advances the tree by one step for the entity, state is the entity's slot per composite
+		BehaviourResult Tick( Entity e, uint16_t* state ) const;
+
+		size_t GetNodeCount() const { return m_vNodes.size(); }
+		size_t GetCompositeCount() const { return m_iNumComposites; }
+		// Whether the tree's actions have to run on the main thread, otherwise entities are ticked in parallel
+		bool RequiresMainThread() const { return m_bMainThread; }
 	private:
-		size_t m_CurrentNode = 0;
-		std::vector<std::unique_ptr<BehaviourNode>> m_Nodes;
-	};
-
-	class LoopUntilSuccessNode : public BehaviourNode
-	{
-	public:
-		void SetChild( std::unique_ptr<BehaviourNode> node )
-		{
-			m_Node = std::move( node );
-		}
+		friend class BehaviourTreeBuilder;
 
-		virtual BehaviourResult Go( Entity e ) override
-		{
-			BehaviourResult result = m_Node->Go( e );
-			switch( result )
-			{
-			case BehaviourResult::RUNNING:
-				return BehaviourResult::RUNNING;
-			case BehaviourResult::SUCCEEDED:
-				return BehaviourResult::SUCCEEDED;
-			case BehaviourResult::FAILED:
-				return BehaviourResult::RUNNING;
-			}
-
-			ASSERT( false, "Unhandled behaviour result" );
-			return BehaviourResult::RUNNING;
-		}
+		BehaviourResult TickNode( uint16_t index, Entity e, uint16_t* state ) const;
 	private:
-		std::unique_ptr<BehaviourNode> m_Node;
+		std::vector<Node> m_vNodes;
+		// actions are shared too, anything they capture is the same for every entity
+		std::vector<ActionCallback_t> m_vActions;
+		size_t m_iNumComposites = 0;
+		bool m_bMainThread = false;
 	};
 
-	class InverseNode : public BehaviourNode
+	// Builds a BehaviourTree depth first, every sequence/selector/decorator is closed with End():
+	//   BehaviourTreeBuilder()
+	//       .Sequence()
+	//           .Action( check )
+	//           .Inverse().Action( other_check ).End()
+	//       .End()
+	//       .Build();
+	class BehaviourTreeBuilder
 	{
 	public:
-		void SetChild( std::unique_ptr<BehaviourNode> node )
-		{
-			m_Node = std::move( node );
-		}
-
-		virtual BehaviourResult Go( Entity e ) override
-		{
-			BehaviourResult result = m_Node->Go( e );
-			switch( result )
-			{
-			case BehaviourResult::RUNNING:
-				return BehaviourResult::RUNNING;
-			case BehaviourResult::SUCCEEDED:
-				return BehaviourResult::FAILED;
-			case BehaviourResult::FAILED:
-				return BehaviourResult::SUCCEEDED;
-			}
-
-			ASSERT( false, "Unhandled behaviour result" );
-			return BehaviourResult::RUNNING;
-		}
+		BehaviourTreeBuilder& Sequence();
+		BehaviourTreeBuilder& Selector();
+		BehaviourTreeBuilder& LoopUntilSuccess();
+		BehaviourTreeBuilder& Inverse();
+		BehaviourTreeBuilder& Action( ActionCallback_t callback );
+		// Closes the last opened sequence, selector or decorator
+		BehaviourTreeBuilder& End();
+		// Actions aren't safe to run in parallel for different entities, e.g. they touch other entities or
+		// add/remove components. Entities running the tree are ticked on the main thread instead.
+		BehaviourTreeBuilder& MainThread();
+
+		std::shared_ptr<const BehaviourTree> Build();
+	private:
+		BehaviourTreeBuilder& Open( BehaviourNodeType type );
+		void AddNode( BehaviourNodeType type, uint16_t data );
 	private:
-		std::unique_ptr<BehaviourNode> m_Node;
+		std::vector<BehaviourTree::Node> m_vNodes;
+		std::vector<ActionCallback_t> m_vActions;
+		// nodes that haven't been closed yet
+		std::vector<uint16_t> m_vOpenNodes;
+		size_t m_iNumComposites = 0;
+		bool m_bMainThread = false;
 	};
 
-	using ActionCallback_t = std::function<BehaviourResult( Entity e )>;
-	class ActionNode : public BehaviourNode
+	// Runs a shared behaviour tree, the entity's own progress through it is a few bytes stored inline
+	class BehaviourTreeComponent
 	{
 	public:
-		ActionNode( ActionCallback_t callback ) : m_Callback( callback ) {}
+		BAT_COMPONENT( BEHAVIOUR_TREE );
 
-		virtual BehaviourResult Go( Entity e ) override { return m_Callback( e ); }
+		BehaviourTreeComponent( std::shared_ptr<const BehaviourTree> tree );
+
+		const std::shared_ptr<const BehaviourTree>& GetTree() const { return m_pTree; }
+		// Starts again from the root
+		void Reset();
 	private:
-		ActionCallback_t m_Callback;
-	};
+		friend class BehaviourTreeSystem;
 
-	struct BehaviourTree
-	{
-		BAT_COMPONENT( BEHAVIOUR_TREE );
-		std::unique_ptr<BehaviourNode> root_node;
+		std::shared_ptr<const BehaviourTree> m_pTree;
+		// running child of each sequence/selector, as an offset from its first child
+		uint16_t m_State[BehaviourTree::MAX_COMPOSITES] = {};
 	};
 
 	class BehaviourTreeSystem
 	{
 	public:
+		// Ticks every entity's tree once. Trees that don't need the main thread are ticked in parallel batches on
+		// the job system, their actions may only touch the entity they are ticking.
 		void Update( EntityManager& world );
+	private:
+		std::vector<std::pair<Entity, BehaviourTreeComponent*>> m_vParallelTicks;
+		std::vector<Entity> m_vMainThreadTicks;
 	};
-}
\ No newline at end of file
+}
@@ -0,0 +1,849 @@
+#include "PCH.h"
+#include "Crowd.h"
+
+#include <cfloat>
+
+#include "Core/CoreEntityComponents.h"
+#include "Graphics/DebugDraw.h"
+#include "Util/JobSystem.h"
+
+namespace Bat
+{
+	BAT_COMPONENT_BEGIN( CrowdAgentComponent );
+		BAT_COMPONENT_MEMBER( radius );
+		BAT_COMPONENT_MEMBER( max_speed );
+		BAT_COMPONENT_MEMBER( max_acceleration );
+	BAT_COMPONENT_END();
+
+	// Agents per job
+	static constexpr uint32_t AGENT_GROUP_SIZE = 64;
+	// Seconds between each agent's attempts to shortcut its path
+	static constexpr float OPTIMIZE_INTERVAL = 0.5f;
+	// How many corners ahead a shortcut is looked for
+	static constexpr uint8_t OPTIMIZE_LOOKAHEAD = 3;
+	// Agents further apart than this vertically are on different floors and ignore each other
+	static constexpr float NEIGHBOUR_MAX_HEIGHT_DIFFERENCE = 2.0f;
+
+	// Velocity sampling, the same as dtObstacleAvoidanceQuery's "good" quality
+	static constexpr int AVOIDANCE_DIVS = 7;
+	static constexpr int AVOIDANCE_RINGS = 2;
+	static constexpr int AVOIDANCE_DEPTH = 2;
+	static constexpr int AVOIDANCE_SAMPLES = 1 + AVOIDANCE_DIVS * AVOIDANCE_RINGS;
+	static constexpr float AVOIDANCE_VELOCITY_BIAS = 0.4f;
+	static constexpr float AVOIDANCE_WEIGHT_DESIRED = 2.0f;
+	static constexpr float AVOIDANCE_WEIGHT_CURRENT = 0.75f;
+	static constexpr float AVOIDANCE_WEIGHT_SIDE = 0.75f;
+	static constexpr float AVOIDANCE_WEIGHT_TOI = 2.5f;
+	static constexpr float AVOIDANCE_HORIZON = 2.5f;
+
+	// Agents only move in the xz plane, height comes from the navmesh
+	static float Dot2D( const Vec3& a, const Vec3& b )
+	{
+		return a.x * b.x + a.z * b.z;
+	}
+
+	static float LengthSq2D( const Vec3& v )
+	{
+		return v.x * v.x + v.z * v.z;
+	}
+
+	static float DistanceSq2D( const Vec3& a, const Vec3& b )
+	{
+		const float dx = b.x - a.x;
+		const float dz = b.z - a.z;
+		return dx * dx + dz * dz;
+	}
+
+	// Everything about a neighbour that doesn't depend on the velocity being scored
+	struct AvoidanceNeighbour
+	{
+		// relative position and velocity sum, so the relative velocity of a sample is sample * 2 - velocity_sum
+		Vec3 offset;
+		Vec3 velocity_sum;
+		Vec3 dir;
+		Vec3 side;
+		// |offset|^2 - (r0 + r1)^2, negative when overlapping
+		float separation;
+	};
+
+	// Time the agent first touches the neighbour moving at relative velocity v, returns false if it never does
+	static bool SweepNeighbour( const AvoidanceNeighbour& n, const Vec3& v, float* tmin, float* tmax )
+	{
+		float a = Dot2D( v, v );
+		if( a < 1e-6f )
+		{
+			return false;
+		}
+
+		const float b = Dot2D( v, n.offset );
+		const float d = b * b - a * n.separation;
+		if( d < 0.0f )
+		{
+			return false;
+		}
+
+		a = 1.0f / a;
+		const float rd = sqrtf( d );
+		*tmin = ( b - rd ) * a;
+		*tmax = ( b + rd ) * a;
+		return true;
+	}
+
+	// Sampling pattern in the space of the desired direction, x is along it. Ring offsets alternate so samples
+	// on neighbouring rings don't line up.
+	struct AvoidancePattern
+	{
+		float x[AVOIDANCE_SAMPLES];
+		float z[AVOIDANCE_SAMPLES];
+
+		AvoidancePattern()
+		{
+			x[0] = 0.0f;
+			z[0] = 0.0f;
+
+			int n = 1;
+			const float da = Math::PI * 2.0f / AVOIDANCE_DIVS;
+			for( int ring = 0; ring < AVOIDANCE_RINGS; ring++ )
+			{
+				const float r = (float)( AVOIDANCE_RINGS - ring ) / AVOIDANCE_RINGS;
+				float a = da * ( ring & 1 ) * 0.5f;
+				for( int div = 0; div < AVOIDANCE_DIVS; div++ )
+				{
+					x[n] = cosf( a ) * r;
+					z[n] = sinf( a ) * r;
+					n++;
+					a += da;
+				}
+			}
+		}
+	};
+	static const AvoidancePattern g_AvoidancePattern;
+
+	void CrowdAgentComponent::SetTarget( const Vec3& target )
+	{
+		m_vecTarget = target;
+		m_bHasTarget = true;
+		m_bReachedTarget = false;
+		m_iTargetVersion++;
+	}
+
+	void CrowdAgentComponent::ClearTarget()
+	{
+		m_bHasTarget = false;
+		m_bReachedTarget = false;
+		m_iTargetVersion++;
+	}
+
+	CrowdSystem::CrowdSystem( EntityManager& world, NavMeshSystem& navmesh_system, NavMeshHandle_t navmesh )
+		:
+		m_World( world ),
+		m_NavMeshSystem( navmesh_system ),
+		m_hNavMesh( navmesh )
+	{
+		world.AddEventListener<ComponentAddedEvent<CrowdAgentComponent>>( *this );
+		world.AddEventListener<ComponentRemovedEvent<CrowdAgentComponent>>( *this );
+		world.AddEventListener<EntityDestroyedEvent>( *this );
+
+		for( auto [e, agent] : world.View<CrowdAgentComponent>() )
+		{
+			m_vPending.push_back( e.GetId() );
+		}
+	}
+
+	CrowdSystem::~CrowdSystem()
+	{
+		m_World.RemoveEventListener<ComponentAddedEvent<CrowdAgentComponent>>( *this );
+		m_World.RemoveEventListener<ComponentRemovedEvent<CrowdAgentComponent>>( *this );
+		m_World.RemoveEventListener<EntityDestroyedEvent>( *this );
+	}
+
+	void CrowdSystem::OnEvent( const ComponentAddedEvent<CrowdAgentComponent>& e )
+	{
+		// transform probably isn't set up yet, insert on the next update
+		m_vPending.push_back( e.entity.GetId() );
+	}
+
+	void CrowdSystem::OnEvent( const ComponentRemovedEvent<CrowdAgentComponent>& e )
+	{
+		Remove( e.entity.GetId() );
+	}
+
+	void CrowdSystem::OnEvent( const EntityDestroyedEvent& e )
+	{
+		Remove( e.entity.GetId() );
+	}
+
+	void CrowdSystem::Update( EntityManager& world, float dt )
+	{
+		SyncAgents( world );
+
+		const uint32_t num_agents = (uint32_t)m_vEntities.size();
+		if( !num_agents || dt <= 0.0f )
+		{
+			return;
+		}
+
+		BuildGrid();
+
+		// everything here reads other agents' positions and velocities, so they can't change until it's done
+		JobCounter counter;
+		JobSystem::Dispatch( num_agents, AGENT_GROUP_SIZE, [this, dt]( JobDispatchArgs args )
+		{
+			FindNeighbours( args.jobIndex );
+			UpdateSteering( args.jobIndex, dt );
+			UpdateAvoidance( args.jobIndex );
+		}, &counter );
+		JobSystem::Wait( counter );
+
+		JobSystem::Dispatch( num_agents, AGENT_GROUP_SIZE, [this, dt]( JobDispatchArgs args )
+		{
+			Integrate( args.jobIndex, dt );
+		}, &counter );
+		JobSystem::Wait( counter );
+
+		for( size_t i = 0; i < num_agents; i++ )
+		{
+			Entity e( world, m_vEntities[i] );
+			auto& agent = e.Get<CrowdAgentComponent>();
+			agent.m_vecVelocity = m_vVelocities[i];
+			agent.m_bReachedTarget = ( m_vReachedTargets[i] != 0 );
+
+			if( m_vMoved[i] )
+			{
+				e.Get<TransformComponent>().SetPosition( m_vPositions[i] );
+				m_vMoved[i] = 0;
+			}
+		}
+	}
+
+	void CrowdSystem::Insert( Entity entity )
+	{
+		if( m_mapEntityToAgent.count( entity.GetId().Raw() ) )
+		{
+			return;
+		}
+
+		const size_t index = m_vEntities.size();
+		ResizeAgents( index + 1 );
+
+		const auto& agent = entity.Get<CrowdAgentComponent>();
+		m_vEntities[index] = entity.GetId();
+		m_vStates[index] = AgentState::OFF_MESH;
+		m_vPositions[index] = entity.Get<TransformComponent>().GetPosition();
+		m_vVelocities[index] = { 0.0f, 0.0f, 0.0f };
+		m_vDesiredVelocities[index] = { 0.0f, 0.0f, 0.0f };
+		m_vNewVelocities[index] = { 0.0f, 0.0f, 0.0f };
+		m_vDisplacements[index] = { 0.0f, 0.0f, 0.0f };
+		m_vPolys[index] = 0;
+		m_vTargets[index] = agent.m_vecTarget;
+		// picks up the current target on the first sync
+		m_vTargetVersions[index] = agent.m_iTargetVersion - 1;
+		m_vPathRequests[index] = INVALID_PATH_REQUEST;
+		m_vNumCorners[index] = 0;
+		m_vCurrentCorners[index] = 0;
+		m_vPathsTruncated[index] = 0;
+		m_vReachedTargets[index] = 0;
+		m_vMoved[index] = 0;
+		// stagger shortcut attempts so they don't all land on the same update
+		m_vOptimizeTimers[index] = OPTIMIZE_INTERVAL * ( index % 16 ) / 16.0f;
+		m_vNumNeighbours[index] = 0;
+
+		m_mapEntityToAgent[entity.GetId().Raw()] = index;
+	}
+
+	void CrowdSystem::Remove( Entity::Id entity )
+	{
+		auto it = m_mapEntityToAgent.find( entity.Raw() );
+		if( it == m_mapEntityToAgent.end() )
+		{
+			return;
+		}
+
+		const size_t index = it->second;
+		m_mapEntityToAgent.erase( it );
+
+		if( m_vPathRequests[index] != INVALID_PATH_REQUEST )
+		{
+			m_NavMeshSystem.ReleasePathRequest( m_hNavMesh, m_vPathRequests[index] );
+		}
+
+		// move the last agent into the hole
+		const size_t last = m_vEntities.size() - 1;
+		if( index != last )
+		{
+			m_vEntities[index] = m_vEntities[last];
+			m_vStates[index] = m_vStates[last];
+			m_vPositions[index] = m_vPositions[last];
+			m_vVelocities[index] = m_vVelocities[last];
+			m_vDesiredVelocities[index] = m_vDesiredVelocities[last];
+			m_vNewVelocities[index] = m_vNewVelocities[last];
+			m_vDisplacements[index] = m_vDisplacements[last];
+			m_vRadii[index] = m_vRadii[last];
+			m_vMaxSpeeds[index] = m_vMaxSpeeds[last];
+			m_vMaxAccelerations[index] = m_vMaxAccelerations[last];
+			m_vPolys[index] = m_vPolys[last];
+			m_vTargets[index] = m_vTargets[last];
+			m_vTargetVersions[index] = m_vTargetVersions[last];
+			m_vPathRequests[index] = m_vPathRequests[last];
+			std::copy_n( &m_vCorners[last * MAX_AGENT_CORNERS], MAX_AGENT_CORNERS, &m_vCorners[index * MAX_AGENT_CORNERS] );
+			m_vNumCorners[index] = m_vNumCorners[last];
+			m_vCurrentCorners[index] = m_vCurrentCorners[last];
+			m_vPathsTruncated[index] = m_vPathsTruncated[last];
+			m_vReachedTargets[index] = m_vReachedTargets[last];
+			m_vMoved[index] = m_vMoved[last];
+			m_vOptimizeTimers[index] = m_vOptimizeTimers[last];
+			// neighbours get found again before they're used
+			m_vNumNeighbours[index] = 0;
+
+			m_mapEntityToAgent[m_vEntities[index].Raw()] = index;
+		}
+
+		ResizeAgents( last );
+	}
+
+	void CrowdSystem::ResizeAgents( size_t count )
+	{
+		m_vEntities.resize( count );
+		m_vStates.resize( count );
+		m_vPositions.resize( count );
+		m_vVelocities.resize( count );
+		m_vDesiredVelocities.resize( count );
+		m_vNewVelocities.resize( count );
+		m_vDisplacements.resize( count );
+		m_vRadii.resize( count );
+		m_vMaxSpeeds.resize( count );
+		m_vMaxAccelerations.resize( count );
+		m_vPolys.resize( count );
+		m_vTargets.resize( count );
+		m_vTargetVersions.resize( count );
+		m_vPathRequests.resize( count );
+		m_vCorners.resize( count * MAX_AGENT_CORNERS );
+		m_vNumCorners.resize( count );
+		m_vCurrentCorners.resize( count );
+		m_vPathsTruncated.resize( count );
+		m_vReachedTargets.resize( count );
+		m_vMoved.resize( count );
+		m_vOptimizeTimers.resize( count );
+		m_vNeighbours.resize( count * MAX_NEIGHBOURS );
+		m_vNumNeighbours.resize( count );
+		m_vAgentCells.resize( count );
+		m_vCellAgents.resize( count );
+	}
+
+	void CrowdSystem::SyncAgents( EntityManager& world )
+	{
+		std::vector<Entity::Id> pending = std::move( m_vPending );
+		m_vPending.clear();
+		for( Entity::Id id : pending )
+		{
+			Entity e( world, id );
+			if( world.IsStale( e ) || !e.Has<CrowdAgentComponent>() )
+			{
+				continue;
+			}
+
+			// not in the scene yet, try again next update
+			if( !e.Has<TransformComponent>() )
+			{
+				m_vPending.push_back( id );
+				continue;
+			}
+
+			Insert( e );
+		}
+
+		for( size_t i = 0; i < m_vEntities.size(); i++ )
+		{
+			Entity e( world, m_vEntities[i] );
+			const auto& agent = e.Get<CrowdAgentComponent>();
+			m_vRadii[i] = agent.radius;
+			m_vMaxSpeeds[i] = agent.max_speed;
+			m_vMaxAccelerations[i] = agent.max_acceleration;
+
+			if( m_vStates[i] == AgentState::OFF_MESH )
+			{
+				Vec3 point;
+				if( !m_NavMeshSystem.FindNearestPoint( m_hNavMesh, m_vPositions[i], &point, &m_vPolys[i] ) )
+				{
+					continue;
+				}
+
+				m_vPositions[i] = point;
+				m_vStates[i] = AgentState::IDLE;
+				m_vMoved[i] = 1;
+				if( agent.m_bHasTarget )
+				{
+					m_vStates[i] = AgentState::WAITING_FOR_PATH;
+				}
+			}
+
+			if( agent.m_iTargetVersion != m_vTargetVersions[i] )
+			{
+				m_vTargetVersions[i] = agent.m_iTargetVersion;
+				m_vTargets[i] = agent.m_vecTarget;
+				m_vNumCorners[i] = 0;
+				m_vCurrentCorners[i] = 0;
+				m_vReachedTargets[i] = 0;
+
+				if( m_vPathRequests[i] != INVALID_PATH_REQUEST )
+				{
+					m_NavMeshSystem.ReleasePathRequest( m_hNavMesh, m_vPathRequests[i] );
+					m_vPathRequests[i] = INVALID_PATH_REQUEST;
+				}
+
+				m_vStates[i] = agent.m_bHasTarget ? AgentState::WAITING_FOR_PATH : AgentState::IDLE;
+			}
+
+			if( m_vStates[i] != AgentState::WAITING_FOR_PATH )
+			{
+				continue;
+			}
+
+			// queue is full, try again next update
+			if( m_vPathRequests[i] == INVALID_PATH_REQUEST )
+			{
+				m_vPathRequests[i] = m_NavMeshSystem.RequestPath( m_hNavMesh, m_vPositions[i], m_vTargets[i] );
+				continue;
+			}
+
+			const PathRequestStatus status = m_NavMeshSystem.GetPathStatus( m_hNavMesh, m_vPathRequests[i] );
+			if( status == PathRequestStatus::PENDING )
+			{
+				continue;
+			}
+
+			size_t num_corners = 0;
+			const Vec3* corners = m_NavMeshSystem.GetPathCorners( m_hNavMesh, m_vPathRequests[i], &num_corners );
+			const size_t num_kept = std::min( num_corners, MAX_AGENT_CORNERS );
+			std::copy_n( corners, num_kept, &m_vCorners[i * MAX_AGENT_CORNERS] );
+			m_vNumCorners[i] = (uint8_t)num_kept;
+			m_vCurrentCorners[i] = 0;
+			m_vPathsTruncated[i] = ( num_corners > MAX_AGENT_CORNERS || num_corners >= NavMeshSystem::MAX_PATH_CORNERS );
+
+			m_NavMeshSystem.ReleasePathRequest( m_hNavMesh, m_vPathRequests[i] );
+			m_vPathRequests[i] = INVALID_PATH_REQUEST;
+
+			// unreachable targets leave the agent standing where it is
+			m_vStates[i] = num_kept ? AgentState::MOVING : AgentState::IDLE;
+		}
+	}
+
+	uint32_t CrowdSystem::GetCellHash( int x, int z ) const
+	{
+		const uint32_t mask = (uint32_t)m_vCellStarts.size() - 2;
+		return ( ( (uint32_t)x * 73856093u ) ^ ( (uint32_t)z * 19349663u ) ) & mask;
+	}
+
+	void CrowdSystem::BuildGrid()
+	{
+		const size_t num_agents = m_vEntities.size();
+		m_flCellSize = m_flNeighbourRange;
+
+		// power of two table roughly twice the agent count, plus an end marker
+		size_t table_size = 64;
+		while( table_size < num_agents * 2 )
+		{
+			table_size *= 2;
+		}
+		m_vCellStarts.assign( table_size + 1, 0 );
+
+		// agents off the navmesh aren't avoided, leaving them out means neighbour searches don't need their state
+		const float inv_cell_size = 1.0f / m_flCellSize;
+		for( size_t i = 0; i < num_agents; i++ )
+		{
+			if( m_vStates[i] == AgentState::OFF_MESH )
+			{
+				m_vAgentCells[i] = UINT32_MAX;
+				continue;
+			}
+
+			const uint32_t cell = GetCellHash( (int)floorf( m_vPositions[i].x * inv_cell_size ), (int)floorf( m_vPositions[i].z * inv_cell_size ) );
+			m_vAgentCells[i] = cell;
+			m_vCellStarts[cell + 1]++;
+		}
+
+		for( size_t cell = 1; cell <= table_size; cell++ )
+		{
+			m_vCellStarts[cell] += m_vCellStarts[cell - 1];
+		}
+
+		// filling moves each bucket's start to its end, which is where the next bucket starts, so shift them back after
+		for( size_t i = 0; i < num_agents; i++ )
+		{
+			if( m_vAgentCells[i] != UINT32_MAX )
+			{
+				m_vCellAgents[m_vCellStarts[m_vAgentCells[i]]++] = (uint32_t)i;
+			}
+		}
+		for( size_t cell = table_size; cell > 0; cell-- )
+		{
+			m_vCellStarts[cell] = m_vCellStarts[cell - 1];
+		}
+		m_vCellStarts[0] = 0;
+	}
+
+	void CrowdSystem::FindNeighbours( size_t agent )
+	{
+		uint32_t* neighbours = &m_vNeighbours[agent * MAX_NEIGHBOURS];
+		float distances[MAX_NEIGHBOURS];
+		size_t num_neighbours = 0;
+
+		const Vec3& pos = m_vPositions[agent];
+		const float range = m_flNeighbourRange;
+		const float inv_cell_size = 1.0f / m_flCellSize;
+		const int min_x = (int)floorf( ( pos.x - range ) * inv_cell_size );
+		const int max_x = (int)floorf( ( pos.x + range ) * inv_cell_size );
+		const int min_z = (int)floorf( ( pos.z - range ) * inv_cell_size );
+		const int max_z = (int)floorf( ( pos.z + range ) * inv_cell_size );
+
+		Vec3 displacement = { 0.0f, 0.0f, 0.0f };
+
+		// different cells can hash to the same bucket, scanning each bucket once means no agent is a candidate twice
+		// (and pushed apart twice). cells are as big as the range so the query is 3x3, rounding can make it 4 wide.
+		constexpr size_t MAX_QUERY_CELLS = 16;
+		ASSERT( (size_t)( max_x - min_x + 1 ) * (size_t)( max_z - min_z + 1 ) <= MAX_QUERY_CELLS, "Neighbour query covers too many cells" );
+		uint32_t visited_cells[MAX_QUERY_CELLS];
+		size_t num_visited = 0;
+
+		for( int z = min_z; z <= max_z; z++ )
+		{
+			for( int x = min_x; x <= max_x; x++ )
+			{
+				const uint32_t cell = GetCellHash( x, z );
+				if( std::find( visited_cells, visited_cells + num_visited, cell ) != visited_cells + num_visited )
+				{
+					continue;
+				}
+				visited_cells[num_visited++] = cell;
+
+				for( uint32_t k = m_vCellStarts[cell]; k < m_vCellStarts[cell + 1]; k++ )
+				{
+					const uint32_t other = m_vCellAgents[k];
+					if( other == agent )
+					{
+						continue;
+					}
+
+					const Vec3& other_pos = m_vPositions[other];
+					if( std::abs( other_pos.y - pos.y ) > NEIGHBOUR_MAX_HEIGHT_DIFFERENCE )
+					{
+						continue;
+					}
+
+					const float dist_sq = DistanceSq2D( pos, other_pos );
+					if( dist_sq > range * range )
+					{
+						continue;
+					}
+
+					// push apart if overlapping, split evenly between both agents
+					const float min_dist = m_vRadii[agent] + m_vRadii[other];
+					if( dist_sq < min_dist * min_dist )
+					{
+						const float dist = sqrtf( dist_sq );
+						const float penetration = ( min_dist - dist ) * 0.5f;
+						if( dist > 0.0001f )
+						{
+							displacement = displacement + Vec3{ pos.x - other_pos.x, 0.0f, pos.z - other_pos.z } * ( penetration / dist );
+						}
+						else
+						{
+							// exactly on top of each other, separate along an arbitrary consistent axis
+							displacement.x += ( agent < other ) ? -penetration : penetration;
+						}
+					}
+
+					// insertion sort, keeping the nearest
+					if( num_neighbours == MAX_NEIGHBOURS && dist_sq >= distances[MAX_NEIGHBOURS - 1] )
+					{
+						continue;
+					}
+
+					size_t slot = std::min( num_neighbours, MAX_NEIGHBOURS - 1 );
+					while( slot > 0 && distances[slot - 1] > dist_sq )
+					{
+						distances[slot] = distances[slot - 1];
+						neighbours[slot] = neighbours[slot - 1];
+						slot--;
+					}
+					distances[slot] = dist_sq;
+					neighbours[slot] = other;
+					num_neighbours = std::min( num_neighbours + 1, MAX_NEIGHBOURS );
+				}
+			}
+		}
+
+		m_vNumNeighbours[agent] = (uint8_t)num_neighbours;
+		m_vDisplacements[agent] = displacement;
+	}
+
+	void CrowdSystem::UpdateSteering( size_t agent, float dt )
+	{
+		m_vDesiredVelocities[agent] = { 0.0f, 0.0f, 0.0f };
+		if( m_vStates[agent] != AgentState::MOVING )
+		{
+			return;
+		}
+
+		const Vec3& pos = m_vPositions[agent];
+		const Vec3* corners = &m_vCorners[agent * MAX_AGENT_CORNERS];
+		const uint8_t num_corners = m_vNumCorners[agent];
+		uint8_t& current = m_vCurrentCorners[agent];
+		const float radius = m_vRadii[agent];
+
+		// corners are hard to hit exactly while avoiding others, anything within the agent's radius counts
+		while( current + 1 < num_corners && DistanceSq2D( pos, corners[current] ) < radius * radius )
+		{
+			current++;
+		}
+
+		// corridor optimisation, skip ahead to the furthest of the next few corners that can be walked to directly
+		m_vOptimizeTimers[agent] -= dt;
+		if( m_vOptimizeTimers[agent] <= 0.0f && current + 1 < num_corners )
+		{
+			m_vOptimizeTimers[agent] += OPTIMIZE_INTERVAL;
+
+			const uint8_t furthest = (uint8_t)std::min<int>( current + OPTIMIZE_LOOKAHEAD, num_corners - 1 );
+			for( uint8_t corner = furthest; corner > current; corner-- )
+			{
+				if( m_NavMeshSystem.IsLineWalkable( m_hNavMesh, m_vPolys[agent], pos, corners[corner] ) )
+				{
+					current = corner;
+					break;
+				}
+			}
+		}
+
+		const Vec3 to_corner = corners[current] - pos;
+		const float dist = sqrtf( LengthSq2D( to_corner ) );
+		const bool last_corner = ( current + 1 == num_corners );
+
+		if( last_corner && dist < radius * 0.5f )
+		{
+			if( m_vPathsTruncated[agent] )
+			{
+				// end of a long path, get the next part
+				m_vStates[agent] = AgentState::WAITING_FOR_PATH;
+			}
+			else
+			{
+				m_vStates[agent] = AgentState::IDLE;
+				m_vReachedTargets[agent] = 1;
+			}
+			return;
+		}
+
+		if( dist < 0.0001f )
+		{
+			return;
+		}
+
+		// slow down into the final corner
+		float speed = m_vMaxSpeeds[agent];
+		if( last_corner )
+		{
+			speed *= std::min( 1.0f, dist / ( radius * 2.0f ) );
+		}
+
+		m_vDesiredVelocities[agent] = Vec3{ to_corner.x, 0.0f, to_corner.z } * ( speed / dist );
+	}
+
+	void CrowdSystem::UpdateAvoidance( size_t agent )
+	{
+		const Vec3& desired = m_vDesiredVelocities[agent];
+		const size_t num_neighbours = m_vNumNeighbours[agent];
+		if( m_vStates[agent] != AgentState::MOVING || num_neighbours == 0 )
+		{
+			m_vNewVelocities[agent] = desired;
+			return;
+		}
+
+		const Vec3& pos = m_vPositions[agent];
+		const Vec3& vel = m_vVelocities[agent];
+		const float radius = m_vRadii[agent];
+		const float max_speed = m_vMaxSpeeds[agent];
+		const float inv_max_speed = ( max_speed > 0.0f ) ? 1.0f / max_speed : 0.0f;
+		const uint32_t* neighbours = &m_vNeighbours[agent * MAX_NEIGHBOURS];
+
+		// direction to each neighbour and the side to pass it on, picked from how the two are moving relative
+		// to each other so both agents agree
+		AvoidanceNeighbour avoid[MAX_NEIGHBOURS];
+		for( size_t n = 0; n < num_neighbours; n++ )
+		{
+			const uint32_t other = neighbours[n];
+			const Vec3& other_pos = m_vPositions[other];
+			const Vec3& other_vel = m_vVelocities[other];
+			AvoidanceNeighbour& an = avoid[n];
+
+			an.offset = { other_pos.x - pos.x, 0.0f, other_pos.z - pos.z };
+			const float len_sq = LengthSq2D( an.offset );
+			const float r = radius + m_vRadii[other];
+			an.separation = len_sq - r * r;
+
+			an.dir = an.offset;
+			if( len_sq > 0.0001f * 0.0001f )
+			{
+				an.dir = an.dir * ( 1.0f / sqrtf( len_sq ) );
+			}
+
+			const Vec3 dv = other_vel - vel;
+			const float area = an.dir.x * dv.z - an.dir.z * dv.x;
+			an.side = ( area < 0.01f ) ? Vec3{ -an.dir.z, 0.0f, an.dir.x } : Vec3{ an.dir.z, 0.0f, -an.dir.x };
+			an.velocity_sum = { vel.x + other_vel.x, 0.0f, vel.z + other_vel.z };
+		}
+
+		// most agents aren't on a collision course with anyone, they keep their desired velocity and skip sampling
+		bool clear = true;
+		for( size_t n = 0; n < num_neighbours && clear; n++ )
+		{
+			const Vec3 vab = desired * 2.0f - avoid[n].velocity_sum;
+			float tmin, tmax;
+			clear = ( avoid[n].separation > 0.0f ) &&
+				( !SweepNeighbour( avoid[n], vab, &tmin, &tmax ) || tmin < 0.0f || tmin >= AVOIDANCE_HORIZON );
+		}
+		if( clear )
+		{
+			m_vNewVelocities[agent] = desired;
+			return;
+		}
+
+		auto score_sample = [&]( const Vec3& candidate )
+		{
+			const float desired_penalty = AVOIDANCE_WEIGHT_DESIRED * sqrtf( DistanceSq2D( candidate, desired ) ) * inv_max_speed;
+			const float current_penalty = AVOIDANCE_WEIGHT_CURRENT * sqrtf( DistanceSq2D( candidate, vel ) ) * inv_max_speed;
+
+			float min_toi = AVOIDANCE_HORIZON;
+			float side = 0.0f;
+			for( size_t n = 0; n < num_neighbours; n++ )
+			{
+				const AvoidanceNeighbour& an = avoid[n];
+
+				// reciprocal, each agent takes half the responsibility for avoiding the other
+				const Vec3 vab = candidate * 2.0f - an.velocity_sum;
+
+				side += std::clamp( std::min( Dot2D( an.dir, vab ) * 0.5f + 0.5f, Dot2D( an.side, vab ) * 2.0f ), 0.0f, 1.0f );
+
+				float tmin, tmax;
+				if( !SweepNeighbour( an, vab, &tmin, &tmax ) )
+				{
+					continue;
+				}
+
+				// already overlapping, prefer velocities that get out quickly
+				if( tmin < 0.0f && tmax > 0.0f )
+				{
+					tmin = -tmin * 0.5f;
+				}
+
+				if( tmin >= 0.0f && tmin < min_toi )
+				{
+					min_toi = tmin;
+				}
+			}
+			side /= num_neighbours;
+
+			const float side_penalty = AVOIDANCE_WEIGHT_SIDE * side;
+			const float toi_penalty = AVOIDANCE_WEIGHT_TOI * ( 1.0f / ( 0.1f + min_toi / AVOIDANCE_HORIZON ) );
+			return desired_penalty + current_penalty + side_penalty + toi_penalty;
+		};
+
+		// pattern is oriented along the desired velocity
+		Vec3 forward = { 1.0f, 0.0f, 0.0f };
+		const float desired_len = sqrtf( LengthSq2D( desired ) );
+		if( desired_len > 0.0001f )
+		{
+			forward = Vec3{ desired.x, 0.0f, desired.z } * ( 1.0f / desired_len );
+		}
+		const Vec3 right = { -forward.z, 0.0f, forward.x };
+
+		// adaptive sampling, each pass refines around the best sample of the last with half the radius
+		Vec3 centre = desired * AVOIDANCE_VELOCITY_BIAS;
+		float sample_radius = max_speed * ( 1.0f - AVOIDANCE_VELOCITY_BIAS );
+		for( int depth = 0; depth < AVOIDANCE_DEPTH; depth++ )
+		{
+			float best_penalty = FLT_MAX;
+			Vec3 best = centre;
+			for( int s = 0; s < AVOIDANCE_SAMPLES; s++ )
+			{
+				const float x = g_AvoidancePattern.x[s] * sample_radius;
+				const float z = g_AvoidancePattern.z[s] * sample_radius;
+				const Vec3 candidate = { centre.x + forward.x * x + right.x * z, 0.0f, centre.z + forward.z * x + right.z * z };
+				if( LengthSq2D( candidate ) > ( max_speed + 0.001f ) * ( max_speed + 0.001f ) )
+				{
+					continue;
+				}
+
+				const float penalty = score_sample( candidate );
+				if( penalty < best_penalty )
+				{
+					best_penalty = penalty;
+					best = candidate;
+				}
+			}
+
+			centre = best;
+			sample_radius *= 0.5f;
+		}
+
+		m_vNewVelocities[agent] = centre;
+	}
+
+	void CrowdSystem::Integrate( size_t agent, float dt )
+	{
+		if( m_vStates[agent] == AgentState::OFF_MESH )
+		{
+			return;
+		}
+
+		// limit acceleration
+		Vec3 dv = m_vNewVelocities[agent] - m_vVelocities[agent];
+		const float max_dv = m_vMaxAccelerations[agent] * dt;
+		const float dv_len_sq = LengthSq2D( dv );
+		if( dv_len_sq > max_dv * max_dv )
+		{
+			dv = dv * ( max_dv / sqrtf( dv_len_sq ) );
+		}
+		Vec3 vel = m_vVelocities[agent] + dv;
+		if( LengthSq2D( vel ) < 0.0001f )
+		{
+			vel = { 0.0f, 0.0f, 0.0f };
+		}
+
+		const Vec3 delta = vel * dt + m_vDisplacements[agent];
+		if( LengthSq2D( delta ) < 1e-8f )
+		{
+			m_vVelocities[agent] = vel;
+			return;
+		}
+
+		const Vec3& pos = m_vPositions[agent];
+		const Vec3 new_pos = m_NavMeshSystem.MoveAlongSurface( m_hNavMesh, &m_vPolys[agent], pos, pos + delta );
+
+		m_vPositions[agent] = new_pos;
+		m_vVelocities[agent] = vel;
+		m_vMoved[agent] = 1;
+	}
+
+	void CrowdSystem::Draw() const
+	{
+		for( size_t i = 0; i < m_vEntities.size(); i++ )
+		{
+			const Vec3 offset = { 0.0f, 0.1f, 0.0f };
+			const Vec3& pos = m_vPositions[i];
+			DebugDraw::Line( pos + offset, pos + offset + m_vVelocities[i], Colours::Green );
+
+			if( m_vStates[i] != AgentState::MOVING )
+			{
+				continue;
+			}
+
+			const Vec3* corners = &m_vCorners[i * MAX_AGENT_CORNERS];
+			Vec3 prev = pos;
+			for( uint8_t corner = m_vCurrentCorners[i]; corner < m_vNumCorners[i]; corner++ )
+			{
+				DebugDraw::Line( prev + offset, corners[corner] + offset, Colours::White );
+				prev = corners[corner];
+			}
+		}
+	}
+}
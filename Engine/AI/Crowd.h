@@ -0,0 +1,148 @@
+#pragma once
+
+#include <vector>
+#include <unordered_map>
+#include "Core/Entity.h"
+#include "Events/EntityEvents.h"
+#include "NavMesh.h"
+
+namespace Bat
+{
+	// Makes an entity an agent that the CrowdSystem steers over the navmesh. The crowd owns the entity's position,
+	// it follows a path to its target while avoiding other agents.
+	class CrowdAgentComponent
+	{
+	public:
+		BAT_COMPONENT( CROWD_AGENT );
+
+		// Starts moving towards target, the path is requested on the next crowd update
+		void SetTarget( const Vec3& target );
+		// Stops where it is
+		void ClearTarget();
+		bool HasTarget() const { return m_bHasTarget; }
+		const Vec3& GetTarget() const { return m_vecTarget; }
+		// Whether the agent has arrived at its target, or as close to it as the navmesh allows
+		bool HasReachedTarget() const { return m_bReachedTarget; }
+		// Velocity the agent moved at in the last crowd update
+		const Vec3& GetVelocity() const { return m_vecVelocity; }
+	public:
+		float radius = 0.3f;
+		float max_speed = 3.5f;
+		float max_acceleration = 8.0f;
+	private:
+		friend class CrowdSystem;
+
+		Vec3 m_vecTarget = { 0.0f, 0.0f, 0.0f };
+		bool m_bHasTarget = false;
+		// bumped whenever the target changes so the crowd knows to request a new path
+		uint32_t m_iTargetVersion = 0;
+		bool m_bReachedTarget = false;
+		Vec3 m_vecVelocity = { 0.0f, 0.0f, 0.0f };
+	};
+
+	// Moves every CrowdAgentComponent over a navmesh with local avoidance, along the lines of DetourCrowd:
+	//  - paths come from the navmesh system's async path requests, agents shortcut to later corners whenever a
+	//    navmesh raycast says the way is clear (corridor optimisation)
+	//  - neighbours are found with a hashed uniform grid rebuilt every update
+	//  - velocities are picked by adaptively sampling each agent's velocity obstacle against its neighbours,
+	//    overlapping agents are pushed apart
+	//  - movement is constrained to the navmesh surface
+	// Agent state is kept as structure of arrays and steering/integration run in parallel on the job system.
+	// The navmesh system has to be updated too for path requests to complete.
+	class CrowdSystem
+	{
+	public:
+		// Nearest neighbours each agent avoids
+		static constexpr size_t MAX_NEIGHBOURS = 6;
+		// Path corners an agent keeps, longer paths get requested again once the agent reaches the last one
+		static constexpr size_t MAX_AGENT_CORNERS = 16;
+
+		CrowdSystem( EntityManager& world, NavMeshSystem& navmesh_system, NavMeshHandle_t navmesh );
+		~CrowdSystem();
+		CrowdSystem( const CrowdSystem& ) = delete;
+		CrowdSystem& operator=( const CrowdSystem& ) = delete;
+		CrowdSystem( CrowdSystem&& ) = delete;
+		CrowdSystem& operator=( CrowdSystem&& ) = delete;
+
+		void Update( EntityManager& world, float dt );
+
+		void OnEvent( const ComponentAddedEvent<CrowdAgentComponent>& e );
+		void OnEvent( const ComponentRemovedEvent<CrowdAgentComponent>& e );
+		void OnEvent( const EntityDestroyedEvent& e );
+
+		size_t GetAgentCount() const { return m_vEntities.size(); }
+		// Agents within this distance of each other are considered for avoidance
+		void SetNeighbourRange( float range ) { m_flNeighbourRange = range; }
+
+		// Draws each agent's velocity and remaining path
+		void Draw() const;
+	private:
+		enum class AgentState : uint8_t
+		{
+			IDLE,
+			WAITING_FOR_PATH,
+			MOVING,
+			OFF_MESH // couldn't be placed on the navmesh, tried again every update
+		};
+
+		void Insert( Entity entity );
+		void Remove( Entity::Id entity );
+		void ResizeAgents( size_t count );
+
+		// Serial, picks up component changes and finished path requests
+		void SyncAgents( EntityManager& world );
+		void BuildGrid();
+		uint32_t GetCellHash( int x, int z ) const;
+
+		// Parallel passes, each only writes to its own agent
+		void FindNeighbours( size_t agent );
+		void UpdateSteering( size_t agent, float dt );
+		void UpdateAvoidance( size_t agent );
+		void Integrate( size_t agent, float dt );
+	private:
+		EntityManager& m_World;
+		NavMeshSystem& m_NavMeshSystem;
+		NavMeshHandle_t m_hNavMesh;
+
+		float m_flNeighbourRange = 3.0f;
+
+		// agent state, indexed by agent
+		std::vector<Entity::Id> m_vEntities;
+		std::vector<AgentState> m_vStates;
+		std::vector<Vec3> m_vPositions;
+		std::vector<Vec3> m_vVelocities;
+		std::vector<Vec3> m_vDesiredVelocities;
+		std::vector<Vec3> m_vNewVelocities;
+		// push out of overlapping neighbours
+		std::vector<Vec3> m_vDisplacements;
+		std::vector<float> m_vRadii;
+		std::vector<float> m_vMaxSpeeds;
+		std::vector<float> m_vMaxAccelerations;
+		std::vector<NavPolyRef_t> m_vPolys;
+		std::vector<Vec3> m_vTargets;
+		std::vector<uint32_t> m_vTargetVersions;
+		std::vector<PathRequestHandle_t> m_vPathRequests;
+		// MAX_AGENT_CORNERS per agent
+		std::vector<Vec3> m_vCorners;
+		std::vector<uint8_t> m_vNumCorners;
+		std::vector<uint8_t> m_vCurrentCorners;
+		// path ended before the target because it had too many corners
+		std::vector<uint8_t> m_vPathsTruncated;
+		std::vector<uint8_t> m_vReachedTargets;
+		std::vector<uint8_t> m_vMoved;
+		std::vector<float> m_vOptimizeTimers;
+		// MAX_NEIGHBOURS per agent, nearest first
+		std::vector<uint32_t> m_vNeighbours;
+		std::vector<uint8_t> m_vNumNeighbours;
+
+		std::unordered_map<uint64_t, size_t> m_mapEntityToAgent;
+		// entities that got an agent component since the last update
+		std::vector<Entity::Id> m_vPending;
+
+		// agents bucketed by the hash of their grid cell, cell size is the neighbour range
+		std::vector<uint32_t> m_vCellStarts;
+		std::vector<uint32_t> m_vCellAgents;
+		std::vector<uint32_t> m_vAgentCells;
+		float m_flCellSize = 3.0f;
+	};
+}
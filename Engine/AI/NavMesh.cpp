@@ -1,14 +1,22 @@
 #include "PCH.h"
 #include "NavMesh.h"
 
+#include <atomic>
 #include <memory>
+#include <mutex>
 #include <Recast/Recast.h>
 #include <Detour/DetourNavMesh.h>
 #include <Detour/DetourNavMeshBuilder.h>
 #include <Detour/DetourNavMeshQuery.h>
+#include <Detour/DetourCommon.h>
 #include "Graphics/Model.h"
 #include "Graphics/DebugDraw.h"
+#include "Graphics/SpatialIndex.h"
 #include "Core/CoreEntityComponents.h"
+#include "Core/Globals.h"
+#include "Util/FileSystem.h"
+#include "Util/FrameTimer.h"
+#include "Util/JobSystem.h"
 
 namespace Bat
 {
@@ -49,214 +57,429 @@ namespace Bat
 		}
 	};
 
+	// Agent and voxelisation settings shared by every tile
+	static constexpr float AGENT_HEIGHT = 0.7f;
+	static constexpr float AGENT_RADIUS = 0.1f;
+	static constexpr float AGENT_MAX_CLIMB = 0.1f;
+	static constexpr float CELL_SIZE = 0.1f;
+	static constexpr float CELL_HEIGHT = 0.05f;
+	// Width of a tile in cells, not counting the border
+	static constexpr int TILE_SIZE = 128;
+	// dtPolyRef is 32 bits, salt takes the rest
+	static constexpr int MAX_TILE_AND_POLY_BITS = 22;
+	// Polygon corridor length for async path requests
+	static constexpr int MAX_PATH_POLYS = 256;
+	// Node pool size of each path lane's query
+	static constexpr int PATH_LANE_NODES = 2048;
+	// Node pool size of the per thread queries, only moveAlongSurface uses it
+	static constexpr int THREAD_QUERY_NODES = 128;
+	static constexpr float PATH_POLY_EXTENTS[3] = { 2.0f, 4.0f, 2.0f };
+
+	// Nav mesh cache file, bump the version whenever the file layout or the tile build pipeline changes
+	static constexpr uint32_t NAVMESH_CACHE_MAGIC = 0x564E4142; // 'BANV'
+	static constexpr uint32_t NAVMESH_CACHE_VERSION = 1;
+	// Tile data in the cache starts at multiples of this so Detour can use it in place
+	static constexpr size_t NAVMESH_CACHE_ALIGNMENT = 16;
+
+	// Everything the tile grid depends on, a cache is only used if its header matches exactly
+	struct NavMeshCacheHeader
+	{
+		uint32_t magic;
+		uint32_t version;
+		// rcConfig and agent settings
+		uint64_t config_hash;
+		dtNavMeshParams params;
+		float bounds_mins[3];
+		float bounds_maxs[3];
+		int32_t tiles_x;
+		int32_t tiles_y;
+		int32_t detour_version;
+	};
+
+	// Header is followed by one of these per tile, row major, then the tile data
+	struct NavMeshCacheTile
+	{
+		// hash of the tile's input triangles and the config, tile is rebuilt if it changes
+		uint64_t input_hash;
+		uint64_t offset;
+		// 0 if the tile has nothing walkable
+		uint32_t size;
+		uint32_t padding;
+	};
+
+	// A tile's data during a cached bake, either built or pointing into the mapped cache
+	struct CachedTile
+	{
+		uint64_t input_hash;
+		unsigned char* data;
+		int data_size;
+		// data was built this time and is owned by us rather than the mapping
+		bool built;
+	};
+
+	// FNV-1a
+	static uint64_t HashBytes( const void* data, size_t size, uint64_t hash = 14695981039346656037ull )
+	{
+		const auto* bytes = static_cast<const unsigned char*>( data );
+		for( size_t i = 0; i < size; i++ )
+		{
+			hash ^= bytes[i];
+			hash *= 1099511628211ull;
+		}
+
+		return hash;
+	}
+
+	// splitmix64 finaliser, spreads FNV's weak high bits before hashes get summed
+	static uint64_t MixHash( uint64_t hash )
+	{
+		hash ^= hash >> 30;
+		hash *= 0xBF58476D1CE4E5B9ull;
+		hash ^= hash >> 27;
+		hash *= 0x94D049BB133111EBull;
+		hash ^= hash >> 31;
+
+		return hash;
+	}
+
+	// World space triangles for a rectangle of tiles, along with which triangles touch each tile
+	struct NavMeshInput
+	{
+		int min_tx, min_ty;
+		int max_tx, max_ty;
+		std::vector<float> verts;
+		std::vector<int> tris;
+		// per triangle
+		std::vector<unsigned char> areas;
+		// indices into tris/3 for each tile in the rectangle, row major
+		std::vector<std::vector<int>> tile_tris;
+
+		const std::vector<int>& GetTileTris( int tx, int ty ) const
+		{
+			return tile_tris[( ty - min_ty ) * ( max_tx - min_tx + 1 ) + ( tx - min_tx )];
+		}
+	};
+
+	// Slot in a navmesh's preallocated pool of path requests
+	struct PathRequest
+	{
+		Vec3 start;
+		Vec3 end;
+		Vec3 corners[NavMeshSystem::MAX_PATH_CORNERS];
+		int num_corners = 0;
+		std::atomic<uint16_t> generation{ 0 };
+		std::atomic<PathRequestStatus> status{ PathRequestStatus::INVALID };
+		std::atomic<bool> cancelled{ false };
+	};
+
+	// Works through one sliced path search at a time with its own query object, a search can span several updates
+	struct PathLane
+	{
+		dtNavMeshQueryAuto query;
+		// index of the request being searched, -1 if idle
+		int request = -1;
+		dtPolyRef polys[MAX_PATH_POLYS];
+	};
+
 	class NavMesh
 	{
 	public:
-		NavMesh()
+		// Bakes a nav mesh for the current scene. With a cache file, tiles whose input hasn't changed are
+		// loaded from it and the cache is updated with any that had to be rebuilt.
+		NavMesh( const std::string& cache_filename )
 		{
-			std::vector<Mesh*> meshes;
-			std::vector<Mat3x4> transforms;
-			for( Entity e : world )
+			m_Config.cs = CELL_SIZE;
+			m_Config.ch = CELL_HEIGHT;
+			m_Config.walkableSlopeAngle = 45.0f;
+			m_Config.walkableHeight = (int)ceilf( AGENT_HEIGHT / m_Config.ch );
+			m_Config.walkableClimb = (int)floorf( AGENT_MAX_CLIMB / m_Config.ch );
+			m_Config.walkableRadius = (int)ceilf( AGENT_RADIUS / m_Config.cs );
+			m_Config.maxEdgeLen = (int)( 12.0f / m_Config.cs );
+			m_Config.maxSimplificationError = 1.3f;
+			m_Config.minRegionArea = 2 * 2;
+			m_Config.mergeRegionArea = 20;
+			m_Config.maxVertsPerPoly = 6;
+			m_Config.detailSampleDist = 6.0f * m_Config.cs;
+			m_Config.detailSampleMaxError = 1.0f * m_Config.ch;
+
+			m_PathFilter.setIncludeFlags( 0xFFFF );
+			m_PathFilter.setExcludeFlags( 0 );
+			m_PathFilter.setAreaCost( RC_WALKABLE_AREA, 1.0f );
+
+			m_pPathRequests = std::make_unique<PathRequest[]>( NavMeshSystem::MAX_PATH_REQUESTS );
+			m_vFreePathRequests.reserve( NavMeshSystem::MAX_PATH_REQUESTS );
+			for( size_t i = NavMeshSystem::MAX_PATH_REQUESTS; i > 0; i-- )
 			{
-				if( e.Has<ModelComponent>() && e.Has<TransformComponent>() )
+				m_vFreePathRequests.push_back( (uint16_t)( i - 1 ) );
+			}
+			m_vPendingPathRequests.reserve( NavMeshSystem::MAX_PATH_REQUESTS );
+			m_vDispatchedPathRequests.reserve( NavMeshSystem::MAX_PATH_REQUESTS );
+			m_vCancelledPathRequests.reserve( NavMeshSystem::MAX_PATH_REQUESTS );
+			// tiles are built with a border of neighbouring geometry so their edges line up
+			m_Config.tileSize = TILE_SIZE;
+			m_Config.borderSize = m_Config.walkableRadius + 3;
+			m_Config.width = m_Config.tileSize + m_Config.borderSize * 2;
+			m_Config.height = m_Config.tileSize + m_Config.borderSize * 2;
+
+			const float agent_settings[3] = { AGENT_HEIGHT, AGENT_RADIUS, AGENT_MAX_CLIMB };
+			m_iConfigHash = HashBytes( agent_settings, sizeof( agent_settings ), HashBytes( &m_Config, sizeof( m_Config ) ) );
+
+			FrameTimer timer;
+
+			// navmesh covers every model in the scene
+			bool has_bounds = false;
+			for( auto [e, model, t] : world.View<ModelComponent, TransformComponent>() )
+			{
+				const AABB aabb = model.GetAABB().Transform( Mat4( t.LocalToWorldMatrix() ) );
+				if( !has_bounds )
 				{
-					auto model = e.Get<ModelComponent>();
-					auto t = e.Get<TransformComponent>();
-					for( auto& mesh : model.GetMeshes() )
-					{
-						meshes.push_back( mesh.get() );
-						transforms.push_back( t.LocalToWorldMatrix() );
-					}
+					m_Bounds = aabb;
+					has_bounds = true;
+					continue;
 				}
+
+				m_Bounds.mins = { std::min( m_Bounds.mins.x, aabb.mins.x ), std::min( m_Bounds.mins.y, aabb.mins.y ), std::min( m_Bounds.mins.z, aabb.mins.z ) };
+				m_Bounds.maxs = { std::max( m_Bounds.maxs.x, aabb.maxs.x ), std::max( m_Bounds.maxs.y, aabb.maxs.y ), std::max( m_Bounds.maxs.z, aabb.maxs.z ) };
 			}
 
-			BuildContext ctx;
+			if( !has_bounds )
+			{
+				BAT_WARN( "No models in the scene to build a nav mesh from" );
+				return;
+			}
 
-			float agent_height = 0.7f;
-			float agent_radius = 0.1f;
-			float agent_max_climb = 0.1f;
-
-			rcConfig cfg;
-			cfg.cs = 0.1f;
-			cfg.ch = 0.05f;
-			cfg.borderSize = 0;
-			cfg.walkableSlopeAngle = 45.0f;
-			cfg.walkableHeight = (int)ceilf( agent_height / cfg.ch );
-			cfg.walkableClimb = (int)floorf( agent_max_climb / cfg.ch );
-			cfg.walkableRadius = (int)ceilf( agent_radius / cfg.cs );
-			cfg.maxEdgeLen = (int)( 12.0f / cfg.cs );
-			cfg.maxSimplificationError = 1.3f;
-			cfg.minRegionArea = 2 * 2;
-			cfg.mergeRegionArea = 20;
-			cfg.maxVertsPerPoly = 6;
-			cfg.detailSampleDist = 6.0f * cfg.cs;
-			cfg.detailSampleMaxError = 1.0f * cfg.ch;
-
-			cfg.bmin[0] = -100.0f; cfg.bmin[1] = -100.0f; cfg.bmin[2] = -100.0f;
-			cfg.bmax[0] = 100.0f; cfg.bmax[1] = 100.0f; cfg.bmax[2] = 100.0f;
-			rcCalcGridSize( cfg.bmin, cfg.bmax, cfg.cs, &cfg.width, &cfg.height );
+			const float tile_world_size = m_Config.tileSize * m_Config.cs;
+			m_iTilesX = std::max( 1, (int)ceilf( ( m_Bounds.maxs.x - m_Bounds.mins.x ) / tile_world_size ) );
+			m_iTilesY = std::max( 1, (int)ceilf( ( m_Bounds.maxs.z - m_Bounds.mins.z ) / tile_world_size ) );
 
-			rcHeightfieldAuto solid = rcHeightfieldMake();
-			if( !rcCreateHeightfield( &ctx, *solid, cfg.width, cfg.height, cfg.bmin, cfg.bmax, cfg.cs, cfg.ch ) )
+			const int tile_bits = std::min( (int)dtIlog2( dtNextPow2( (unsigned int)( m_iTilesX * m_iTilesY ) ) ), 14 );
+			const int poly_bits = MAX_TILE_AND_POLY_BITS - tile_bits;
+			if( m_iTilesX * m_iTilesY > ( 1 << tile_bits ) )
+			{
+				BAT_WARN( "Nav mesh needs %i tiles but only %i can be addressed, some tiles will be missing", m_iTilesX * m_iTilesY, 1 << tile_bits );
+			}
+
+			dtNavMeshParams params;
+			params.orig[0] = m_Bounds.mins.x;
+			params.orig[1] = m_Bounds.mins.y;
+			params.orig[2] = m_Bounds.mins.z;
+			params.tileWidth = tile_world_size;
+			params.tileHeight = tile_world_size;
+			params.maxTiles = 1 << tile_bits;
+			params.maxPolys = 1 << poly_bits;
+
+			m_NavMesh = dtNavMeshMake();
+			if( dtStatusFailed( m_NavMesh->init( &params ) ) )
 			{
-				BAT_ERROR( "Could not create solid heightfield" );
+				BAT_ERROR( "Could not initialize nav mesh" );
+				m_NavMesh.reset();
 				return;
 			}
 
-			std::vector<unsigned char> triareas;
-			std::vector<float> verts;
-			std::vector<int> tris;
-			for( size_t mesh_index = 0; mesh_index < meshes.size(); mesh_index++ )
+			m_Query = dtNavMeshQueryMake();
+			m_Query->init( m_NavMesh.get(), 4096 );
+
+			// one lane and one surface query per job system thread
+			m_vPathLanes.resize( JobSystem::GetThreadCount() );
+			for( PathLane& lane : m_vPathLanes )
+			{
+				lane.query = dtNavMeshQueryMake();
+				lane.query->init( m_NavMesh.get(), PATH_LANE_NODES );
+			}
+			m_vThreadQueries.resize( JobSystem::GetThreadCount() );
+			for( dtNavMeshQueryAuto& query : m_vThreadQueries )
 			{
-				Mesh* mesh = meshes[mesh_index];
-				const Mat3x4& transform = transforms[mesh_index];
+				query = dtNavMeshQueryMake();
+				query->init( m_NavMesh.get(), THREAD_QUERY_NODES );
+			}
 
-				const auto* orig_verts = mesh->GetVertexData();
-				const auto* orig_tris = mesh->GetIndexData();
-				auto nv = (int)mesh->GetVertexCount();
-				auto nt = (int)mesh->GetIndexCount() / 3;
+			if( cache_filename.empty() )
+			{
+				const int num_built = BuildTiles( 0, 0, m_iTilesX - 1, m_iTilesY - 1 );
+				BAT_LOG( "Baked nav mesh with %i/%i tiles in %.2fs", num_built, m_iTilesX * m_iTilesY, timer.Mark() );
+				return;
+			}
 
-				verts.clear();
-				verts.reserve( nv * 3 );
-				for( int i = 0; i < nv; i++ )
-				{
-					Vec3 vert = transform * orig_verts[i];
-					verts.push_back( vert.x );
-					verts.push_back( vert.y );
-					verts.push_back( vert.z );
-				}
-				tris.clear();
-				tris.reserve( nt * 3 );
-				for( int i = 0; i < nt * 3; i++ )
-				{
-					tris.push_back( (int)orig_tris[i] );
-				}
+			int num_cached = 0;
+			const int num_built = BuildTilesCached( cache_filename, &num_cached );
+			BAT_LOG( "Baked nav mesh with %i/%i tiles in %.2fs, %i/%i tiles loaded from '%s'",
+				num_built, m_iTilesX * m_iTilesY, timer.Mark(), num_cached, m_iTilesX * m_iTilesY, cache_filename );
+		}
 
-				triareas.clear();
-				triareas.resize( nt );
+		// Rebuilds every tile touching bounds from the current scene geometry
+		void RebuildTiles( const AABB& bounds )
+		{
+			if( !m_NavMesh )
+			{
+				return;
+			}
 
-				rcMarkWalkableTriangles( &ctx, cfg.walkableSlopeAngle, verts.data(), nv, tris.data(), nt, triareas.data() );
-				if( !rcRasterizeTriangles( &ctx, verts.data(), nv, tris.data(), triareas.data(), nt, *solid ) )
+			const float tile_world_size = m_Config.tileSize * m_Config.cs;
+			const int min_tx = std::max( 0, (int)floorf( ( bounds.mins.x - m_Bounds.mins.x ) / tile_world_size ) );
+			const int min_ty = std::max( 0, (int)floorf( ( bounds.mins.z - m_Bounds.mins.z ) / tile_world_size ) );
+			const int max_tx = std::min( m_iTilesX - 1, (int)floorf( ( bounds.maxs.x - m_Bounds.mins.x ) / tile_world_size ) );
+			const int max_ty = std::min( m_iTilesY - 1, (int)floorf( ( bounds.maxs.z - m_Bounds.mins.z ) / tile_world_size ) );
+			if( min_tx > max_tx || min_ty > max_ty )
+			{
+				return;
+			}
+
+			FrameTimer timer;
+			const int num_built = BuildTiles( min_tx, min_ty, max_tx, max_ty );
+			BAT_LOG( "Rebuilt %i/%i nav mesh tiles in %.1fms", num_built, ( max_tx - min_tx + 1 ) * ( max_ty - min_ty + 1 ), timer.Mark() * 1000.0f );
+
+			// searches in progress may reference polygons that no longer exist, start them again
+			std::lock_guard<std::mutex> lock( m_PathRequestMutex );
+			for( PathLane& lane : m_vPathLanes )
+			{
+				if( lane.request != -1 )
 				{
-					BAT_ERROR( "Could not rasterize triangles" );
-					return;
+					m_vPendingPathRequests.insert( m_vPendingPathRequests.begin(), (uint16_t)lane.request );
+					lane.request = -1;
 				}
 			}
+		}
 
-			rcFilterLowHangingWalkableObstacles( &ctx, cfg.walkableClimb, *solid );
-			rcFilterLedgeSpans( &ctx, cfg.walkableHeight, cfg.walkableClimb, *solid );
-			rcFilterWalkableLowHeightSpans( &ctx, cfg.walkableHeight, *solid );
-
-			rcCompactHeightfieldAuto chf = rcCompactHeightfieldMake();
-			if( !rcBuildCompactHeightfield( &ctx, cfg.walkableHeight, cfg.walkableClimb, *solid, *chf ) )
+		PathRequestHandle_t RequestPath( const Vec3& start, const Vec3& end )
+		{
+			if( !m_NavMesh )
 			{
-				BAT_ERROR( "Could not build compact data" );
-				return;
+				return INVALID_PATH_REQUEST;
 			}
 
-			if( !rcErodeWalkableArea( &ctx, cfg.walkableRadius, *chf ) )
+			std::lock_guard<std::mutex> lock( m_PathRequestMutex );
+			if( m_vFreePathRequests.empty() )
 			{
-				BAT_ERROR( "Could not erode" );
-				return;
+				return INVALID_PATH_REQUEST;
 			}
 
-			if( !rcBuildDistanceField( &ctx, *chf ) )
+			const uint16_t index = m_vFreePathRequests.back();
+			m_vFreePathRequests.pop_back();
+
+			PathRequest& request = m_pPathRequests[index];
+			request.start = start;
+			request.end = end;
+			request.num_corners = 0;
+			request.cancelled.store( false, std::memory_order_relaxed );
+			request.status.store( PathRequestStatus::PENDING, std::memory_order_release );
+			m_vPendingPathRequests.push_back( index );
+
+			return ( (PathRequestHandle_t)request.generation.load( std::memory_order_relaxed ) << 16 ) | index;
+		}
+
+		PathRequestStatus GetPathStatus( PathRequestHandle_t handle ) const
+		{
+			const PathRequest* request = GetPathRequest( handle );
+			if( !request )
 			{
-				BAT_ERROR( "Could not build distance field" );
-				return;
+				return PathRequestStatus::INVALID;
 			}
 
-			if( !rcBuildRegions( &ctx, *chf, cfg.borderSize, cfg.minRegionArea, cfg.mergeRegionArea ) )
+			return request->status.load( std::memory_order_acquire );
+		}
+
+		const Vec3* GetPathCorners( PathRequestHandle_t handle, size_t* count ) const
+		{
+			const PathRequestStatus status = GetPathStatus( handle );
+			if( status != PathRequestStatus::SUCCEEDED && status != PathRequestStatus::PARTIAL )
 			{
-				BAT_ERROR( "Could not build watershed regions" );
-				return;
+				*count = 0;
+				return nullptr;
 			}
 
-			rcContourSetAuto cset = rcContourSetMake();
-			if( !rcBuildContours( &ctx, *chf, cfg.maxSimplificationError, cfg.maxEdgeLen, *cset ) )
+			const PathRequest* request = GetPathRequest( handle );
+			*count = (size_t)request->num_corners;
+			return request->corners;
+		}
+
+		void ReleasePathRequest( PathRequestHandle_t handle )
+		{
+			std::lock_guard<std::mutex> lock( m_PathRequestMutex );
+
+			PathRequest* request = GetPathRequest( handle );
+			if( !request )
 			{
-				BAT_ERROR( "Could not create contours" );
 				return;
 			}
 
-			m_PolyMesh = rcPolyMeshMake();
-			if( !rcBuildPolyMesh( &ctx, *cset, cfg.maxVertsPerPoly, *m_PolyMesh ) )
+			const uint16_t index = (uint16_t)( handle & 0xFFFF );
+			request->generation.fetch_add( 1, std::memory_order_relaxed );
+
+			// still queued or being searched, freed by the next update once nothing references it
+			if( request->status.load( std::memory_order_acquire ) == PathRequestStatus::PENDING )
 			{
-				BAT_ERROR( "Could not triangulate contours" );
+				request->cancelled.store( true, std::memory_order_release );
+				m_vCancelledPathRequests.push_back( index );
 				return;
 			}
 
-			m_PolyMeshDetail = rcPolyMeshDetailMake();
-			if( !rcBuildPolyMeshDetail( &ctx, *m_PolyMesh, *chf, cfg.detailSampleDist, cfg.detailSampleMaxError, *m_PolyMeshDetail ) )
+			request->status.store( PathRequestStatus::INVALID, std::memory_order_relaxed );
+			m_vFreePathRequests.push_back( index );
+		}
+
+		// Runs every lane on the job system, each getting an even share of the iteration budget.
+		// Requests made while this runs are picked up by the next update.
+		void UpdatePathRequests( int iteration_budget )
+		{
+			if( m_vPathLanes.empty() )
 			{
-				BAT_ERROR( "Could not build detail mesh" );
 				return;
 			}
 
-			for( int i = 0; i < m_PolyMesh->npolys; i++ )
 			{
-				if( m_PolyMesh->areas[i] == RC_WALKABLE_AREA )
-				{
-					m_PolyMesh->flags[i] = 1; // TODO: Update to proper flag
-				}
+				std::lock_guard<std::mutex> lock( m_PathRequestMutex );
+				m_vDispatchedPathRequests.assign( m_vPendingPathRequests.begin(), m_vPendingPathRequests.end() );
 			}
+			m_iDispatchCursor.store( 0, std::memory_order_relaxed );
 
-			dtNavMeshCreateParams params;
-			params.verts = m_PolyMesh->verts;
-			params.vertCount = m_PolyMesh->nverts;
-			params.polys = m_PolyMesh->polys;
-			params.polyFlags = m_PolyMesh->flags;
-			params.polyAreas = m_PolyMesh->areas;
-			params.polyCount = m_PolyMesh->npolys;
-			params.nvp = m_PolyMesh->nvp;
-			params.detailMeshes = m_PolyMeshDetail->meshes;
-			params.detailVerts = m_PolyMeshDetail->verts;
-			params.detailVertsCount = m_PolyMeshDetail->nverts;
-			params.detailTris = m_PolyMeshDetail->tris;
-			params.detailTriCount = m_PolyMeshDetail->ntris;
-			params.offMeshConVerts = nullptr;
-			params.offMeshConRad = nullptr;
-			params.offMeshConFlags = nullptr;
-			params.offMeshConAreas = nullptr;
-			params.offMeshConDir = nullptr;
-			params.offMeshConUserID = nullptr;
-			params.offMeshConCount = 0;
-			params.userId = 0;
-			params.tileX = 0;
-			params.tileY = 0;
-			params.tileLayer = 0;
-			rcVcopy( params.bmin, m_PolyMesh->bmin );
-			rcVcopy( params.bmax, m_PolyMesh->bmax );
-			params.walkableHeight = agent_height;
-			params.walkableRadius = agent_radius;
-			params.walkableClimb = agent_max_climb;
-			params.cs = cfg.cs;
-			params.ch = cfg.ch;
-			params.buildBvTree = false;
+			const int lane_budget = std::max( 1, iteration_budget / (int)m_vPathLanes.size() );
 
-			unsigned char* navmesh_data;
-			int navmesh_data_size;
-			if( !dtCreateNavMeshData( &params, &navmesh_data, &navmesh_data_size ) )
+			JobCounter counter;
+			JobSystem::Dispatch( (uint32_t)m_vPathLanes.size(), 1, [this, lane_budget]( JobDispatchArgs args )
+			{
+				UpdatePathLane( m_vPathLanes[args.jobIndex], lane_budget );
+			}, &counter );
+			JobSystem::Wait( counter );
+
+			std::lock_guard<std::mutex> lock( m_PathRequestMutex );
+
+			// anything requested during the update was appended after the dispatched requests
+			const size_t consumed = std::min( m_iDispatchCursor.load( std::memory_order_relaxed ), m_vDispatchedPathRequests.size() );
+			m_vPendingPathRequests.erase( m_vPendingPathRequests.begin(), m_vPendingPathRequests.begin() + consumed );
+
+			if( m_vCancelledPathRequests.empty() )
 			{
-				BAT_ERROR( "Could not build nav mesh data" );
 				return;
 			}
 
-			m_NavMesh = dtNavMeshMake();
-			dtStatus status = m_NavMesh->init( navmesh_data, navmesh_data_size, DT_TILE_FREE_DATA );
-			if( dtStatusFailed( status ) )
+			// drop cancelled requests from the queue and lanes so every cancelled slot can be freed
+			for( PathLane& lane : m_vPathLanes )
 			{
-				dtFree( navmesh_data );
-				BAT_ERROR( "Could not initialize nav mesh" );
-				return;
+				if( lane.request != -1 && m_pPathRequests[lane.request].cancelled.load( std::memory_order_relaxed ) )
+				{
+					lane.request = -1;
+				}
 			}
+			m_vPendingPathRequests.erase( std::remove_if( m_vPendingPathRequests.begin(), m_vPendingPathRequests.end(), [this]( uint16_t index )
+			{
+				return m_pPathRequests[index].cancelled.load( std::memory_order_relaxed );
+			} ), m_vPendingPathRequests.end() );
 
-			m_Query = dtNavMeshQueryMake();
-			m_Query->init( m_NavMesh.get(), 4096 );
+			for( uint16_t index : m_vCancelledPathRequests )
+			{
+				m_pPathRequests[index].status.store( PathRequestStatus::INVALID, std::memory_order_relaxed );
+				m_vFreePathRequests.push_back( index );
+			}
+			m_vCancelledPathRequests.clear();
 		}
 
 		std::vector<Vec3> GetPath( const Vec3& start, const Vec3& end ) const
 		{
+			if( !m_Query )
+			{
+				return {};
+			}
+
 			auto* s = reinterpret_cast<const float*>( &start );
 			auto* e = reinterpret_cast<const float*>( &end );
 			float poly_ext[3] = { 2.0f, 4.0f, 2.0f };
@@ -288,85 +511,802 @@ namespace Bat
 			return path;
 		}
 
-		Vec3 MoveAlongSurface( const Vec3& start, const Vec3& end )
+		bool FindNearestPoint( const Vec3& pos, Vec3* point_out, NavPolyRef_t* poly_out ) const
 		{
-			auto* s = reinterpret_cast<const float*>( &start );
-			auto* e = reinterpret_cast<const float*>( &end );
-			float poly_ext[3] = { 2.0f, 4.0f, 2.0f };
+			if( !m_NavMesh )
+			{
+				return false;
+			}
 
-			dtQueryFilter filter;
-			filter.setIncludeFlags( RC_WALKABLE_AREA );
-			filter.setExcludeFlags( 0 );
-			filter.setAreaCost( RC_WALKABLE_AREA, 1.0f );
+			dtPolyRef poly = 0;
+			GetThreadQuery()->findNearestPoly( reinterpret_cast<const float*>( &pos ), PATH_POLY_EXTENTS, &m_PathFilter, &poly, reinterpret_cast<float*>( point_out ) );
+			*poly_out = poly;
 
-			dtPolyRef pstart;
-			m_Query->findNearestPoly( s, poly_ext, &filter, &pstart, nullptr );
+			return poly != 0;
+		}
+
+		Vec3 MoveAlongSurface( NavPolyRef_t* poly, const Vec3& start, const Vec3& end ) const
+		{
+			if( !m_NavMesh )
+			{
+				return end;
+			}
+
+			const dtNavMeshQuery* query = GetThreadQuery();
+			const float* s = reinterpret_cast<const float*>( &start );
+			const float* e = reinterpret_cast<const float*>( &end );
+
+			// tile may have been rebuilt since the poly was found
+			dtPolyRef start_poly = *poly;
+			if( !start_poly || !m_NavMesh->isValidPolyRef( start_poly ) )
+			{
+				start_poly = 0;
+				query->findNearestPoly( s, PATH_POLY_EXTENTS, &m_PathFilter, &start_poly, nullptr );
+				if( !start_poly )
+				{
+					*poly = 0;
+					return end;
+				}
+			}
 
 			float result[3];
 			dtPolyRef visited[16];
-			int visited_count;
-			m_Query->moveAlongSurface( pstart, s, e, &filter, result, visited, &visited_count, 16 );
+			int visited_count = 0;
+			if( dtStatusFailed( query->moveAlongSurface( start_poly, s, e, &m_PathFilter, result, visited, &visited_count, 16 ) ) || visited_count == 0 )
+			{
+				*poly = start_poly;
+				return start;
+			}
+
+			*poly = visited[visited_count - 1];
+
+			// moveAlongSurface keeps the start height, snap onto the polygon
+			float height;
+			if( dtStatusSucceed( query->getPolyHeight( *poly, result, &height ) ) )
+			{
+				result[1] = height;
+			}
 
 			return { result[0], result[1], result[2] };
 		}
 
+		bool IsLineWalkable( NavPolyRef_t poly, const Vec3& start, const Vec3& end ) const
+		{
+			if( !m_NavMesh || !poly || !m_NavMesh->isValidPolyRef( poly ) )
+			{
+				return false;
+			}
+
+			float t;
+			float hit_normal[3];
+			dtPolyRef path[16];
+			int path_count;
+			if( dtStatusFailed( GetThreadQuery()->raycast( poly, reinterpret_cast<const float*>( &start ), reinterpret_cast<const float*>( &end ), &m_PathFilter,
+				&t, hit_normal, path, &path_count, 16 ) ) )
+			{
+				return false;
+			}
+
+			// t is FLT_MAX when nothing was hit
+			return t >= 1.0f;
+		}
+
 		void Draw() const
 		{
-			rcPolyMesh& mesh = *m_PolyMesh;
+			if( !m_NavMesh )
+			{
+				return;
+			}
 
-			const int nvp = mesh.nvp;
-			const float cs = mesh.cs;
-			const float ch = mesh.ch;
-			const Vec3 orig = { mesh.bmin[0], mesh.bmin[1], mesh.bmin[2] };
+			const dtNavMesh& navmesh = *m_NavMesh;
+			for( int i = 0; i < navmesh.getMaxTiles(); i++ )
+			{
+				const dtMeshTile* tile = navmesh.getTile( i );
+				if( !tile->header )
+				{
+					continue;
+				}
 
-			for( int i = 0; i < mesh.npolys; ++i )
+				for( int poly_index = 0; poly_index < tile->header->polyCount; poly_index++ )
+				{
+					const dtPoly& poly = tile->polys[poly_index];
+					if( poly.getType() == DT_POLYTYPE_OFFMESH_CONNECTION )
+					{
+						continue;
+					}
+
+					for( int j = 0; j < poly.vertCount; j++ )
+					{
+						const int nj = ( j + 1 ) % poly.vertCount;
+
+						// internal edges green, edges linking to another tile white, boundaries blue
+						Colour col = Colours::Green;
+						if( poly.neis[j] == 0 )
+						{
+							col = Colours::Blue;
+						}
+						else if( poly.neis[j] & DT_EXT_LINK )
+						{
+							col = Colours::White;
+						}
+
+						const float* t0 = &tile->verts[poly.verts[j] * 3];
+						const float* t1 = &tile->verts[poly.verts[nj] * 3];
+						const Vec3 v0 = { t0[0], t0[1] + 0.1f, t0[2] };
+						const Vec3 v1 = { t1[0], t1[1] + 0.1f, t1[2] };
+
+						DebugDraw::Line( v0, v1, col );
+					}
+				}
+			}
+		}
+	private:
+		// moveAlongSurface uses the query's node pool, so every thread gets its own
+		const dtNavMeshQuery* GetThreadQuery() const
+		{
+			const uint32_t thread_index = JobSystem::GetThreadIndex();
+			ASSERT( thread_index != JobSystem::INVALID_THREAD_INDEX, "Nav mesh surface queries must run on a job system thread" );
+			return m_vThreadQueries[thread_index].get();
+		}
+
+		PathRequest* GetPathRequest( PathRequestHandle_t handle ) const
+		{
+			const size_t index = handle & 0xFFFF;
+			if( handle == INVALID_PATH_REQUEST || index >= NavMeshSystem::MAX_PATH_REQUESTS )
+			{
+				return nullptr;
+			}
+
+			PathRequest& request = m_pPathRequests[index];
+			if( request.generation.load( std::memory_order_relaxed ) != ( handle >> 16 ) )
 			{
-				const unsigned short* p = &mesh.polys[i * nvp * 2];
-				for( int j = 0; j < nvp; ++j )
+				return nullptr;
+			}
+
+			return &request;
+		}
+
+		// Pulls requests off the dispatched list and advances the lane's sliced search until the budget runs out
+		void UpdatePathLane( PathLane& lane, int budget )
+		{
+			while( budget > 0 )
+			{
+				if( lane.request == -1 )
+				{
+					const size_t cursor = m_iDispatchCursor.fetch_add( 1, std::memory_order_relaxed );
+					if( cursor >= m_vDispatchedPathRequests.size() )
+					{
+						break;
+					}
+
+					const uint16_t index = m_vDispatchedPathRequests[cursor];
+					PathRequest& request = m_pPathRequests[index];
+					if( request.cancelled.load( std::memory_order_acquire ) )
+					{
+						continue;
+					}
+
+					const float* s = reinterpret_cast<const float*>( &request.start );
+					const float* e = reinterpret_cast<const float*>( &request.end );
+
+					dtPolyRef start_ref = 0;
+					dtPolyRef end_ref = 0;
+					lane.query->findNearestPoly( s, PATH_POLY_EXTENTS, &m_PathFilter, &start_ref, nullptr );
+					lane.query->findNearestPoly( e, PATH_POLY_EXTENTS, &m_PathFilter, &end_ref, nullptr );
+					budget--;
+
+					if( !start_ref || !end_ref || dtStatusFailed( lane.query->initSlicedFindPath( start_ref, end_ref, s, e, &m_PathFilter ) ) )
+					{
+						request.status.store( PathRequestStatus::FAILED, std::memory_order_release );
+						continue;
+					}
+
+					lane.request = index;
+				}
+
+				int iterations = 0;
+				const dtStatus status = lane.query->updateSlicedFindPath( budget, &iterations );
+				budget -= std::max( iterations, 1 );
+				if( dtStatusInProgress( status ) )
 				{
-					if( p[j] == RC_MESH_NULL_IDX ) break;
-					if( p[nvp + j] & 0x8000 ) continue;
-					const int nj = ( j + 1 >= nvp || p[j + 1] == RC_MESH_NULL_IDX ) ? 0 : j + 1;
-					const int vi[2] = { p[j], p[nj] };
+					continue;
+				}
 
-					const unsigned short* t0 = &mesh.verts[p[j] * 3];
-					Vec3 v0 = orig + Vec3{ t0[0] * cs, ( t0[1] + 1 ) * ch + 0.1f, t0[2] * cs };
-					const unsigned short* t1 = &mesh.verts[p[nj] * 3];
-					Vec3 v1 = orig + Vec3{ t1[0] * cs, ( t1[1] + 1 ) * ch + 0.1f, t1[2] * cs };
+				PathRequest& request = m_pPathRequests[lane.request];
+				lane.request = -1;
+
+				int num_polys = 0;
+				const dtStatus final_status = dtStatusFailed( status ) ? status :
+					lane.query->finalizeSlicedFindPath( lane.polys, &num_polys, MAX_PATH_POLYS );
+				if( dtStatusFailed( final_status ) || num_polys == 0 )
+				{
+					request.status.store( PathRequestStatus::FAILED, std::memory_order_release );
+					continue;
+				}
 
-					DebugDraw::Line( v0, v1, Colours::Green );
+				// end wasn't reachable, path goes to the closest point on the last polygon instead
+				const bool partial = dtStatusDetail( final_status, DT_PARTIAL_RESULT );
+				float end[3] = { request.end.x, request.end.y, request.end.z };
+				if( partial )
+				{
+					lane.query->closestPointOnPoly( lane.polys[num_polys - 1], reinterpret_cast<const float*>( &request.end ), end, nullptr );
 				}
+
+				lane.query->findStraightPath( reinterpret_cast<const float*>( &request.start ), end, lane.polys, num_polys,
+					reinterpret_cast<float*>( request.corners ), nullptr, nullptr, &request.num_corners, (int)NavMeshSystem::MAX_PATH_CORNERS );
+
+				request.status.store( partial ? PathRequestStatus::PARTIAL : PathRequestStatus::SUCCEEDED, std::memory_order_release );
 			}
+		}
 
-			for( int i = 0; i < mesh.npolys; ++i )
+		// Builds the tiles in the given (inclusive) range on the job system and swaps them into the nav mesh,
+		// returns how many tiles ended up with polygons
+		int BuildTiles( int min_tx, int min_ty, int max_tx, int max_ty )
+		{
+			NavMeshInput input;
+			GatherInput( min_tx, min_ty, max_tx, max_ty, input );
+
+			struct TileResult
 			{
-				const unsigned short* p = &mesh.polys[i * nvp * 2];
-				for( int j = 0; j < nvp; ++j )
+				int tx, ty;
+				unsigned char* data;
+				int data_size;
+			};
+
+			const int tiles_x = max_tx - min_tx + 1;
+			const int num_tiles = tiles_x * ( max_ty - min_ty + 1 );
+			std::vector<TileResult> results( num_tiles );
+
+			JobCounter counter;
+			JobSystem::Dispatch( (uint32_t)num_tiles, 1, [this, &input, &results, min_tx, min_ty, tiles_x]( JobDispatchArgs args )
+			{
+				TileResult& result = results[args.jobIndex];
+				result.tx = min_tx + (int)args.jobIndex % tiles_x;
+				result.ty = min_ty + (int)args.jobIndex / tiles_x;
+				result.data = BuildTileData( input, result.tx, result.ty, &result.data_size );
+			}, &counter );
+			JobSystem::Wait( counter );
+
+			// dtNavMesh isn't thread safe, tiles get swapped in on this thread
+			int num_built = 0;
+			for( const TileResult& result : results )
+			{
+				const dtTileRef old_tile = m_NavMesh->getTileRefAt( result.tx, result.ty, 0 );
+				if( old_tile )
+				{
+					m_NavMesh->removeTile( old_tile, nullptr, nullptr );
+				}
+
+				if( !result.data )
+				{
+					continue;
+				}
+
+				if( dtStatusFailed( m_NavMesh->addTile( result.data, result.data_size, DT_TILE_FREE_DATA, 0, nullptr ) ) )
+				{
+					BAT_WARN( "Could not add nav mesh tile (%i, %i)", result.tx, result.ty );
+					dtFree( result.data );
+					continue;
+				}
+
+				num_built++;
+			}
+
+			return num_built;
+		}
+
+		// Bakes every tile, taking tiles whose input hash matches from the cache file. If any tile had to be
+		// rebuilt the cache is rewritten first, either way tiles are added straight from the mapped cache
+		// without copying. Returns how many tiles ended up with polygons.
+		int BuildTilesCached( const std::string& filename, int* num_cached )
+		{
+			NavMeshInput input;
+			GatherInput( 0, 0, m_iTilesX - 1, m_iTilesY - 1, input );
+
+			const int num_tiles = m_iTilesX * m_iTilesY;
+			std::vector<CachedTile> tiles( num_tiles );
+
+			MappedFile cache( filename.c_str() );
+			const NavMeshCacheTile* cache_tiles = GetCacheTiles( cache );
+
+			std::atomic<int> num_rebuilt = 0;
+			JobCounter counter;
+			JobSystem::Dispatch( (uint32_t)num_tiles, 1, [&]( JobDispatchArgs args )
+			{
+				const int tx = (int)args.jobIndex % m_iTilesX;
+				const int ty = (int)args.jobIndex / m_iTilesX;
+				CachedTile& tile = tiles[args.jobIndex];
+				tile.input_hash = HashTileInput( input, tx, ty );
+
+				if( cache_tiles && cache_tiles[args.jobIndex].input_hash == tile.input_hash )
+				{
+					const NavMeshCacheTile& cache_tile = cache_tiles[args.jobIndex];
+					tile.data = cache_tile.size ? reinterpret_cast<unsigned char*>( cache.Data() + cache_tile.offset ) : nullptr;
+					tile.data_size = (int)cache_tile.size;
+					tile.built = false;
+					return;
+				}
+
+				tile.data = BuildTileData( input, tx, ty, &tile.data_size );
+				tile.built = true;
+				num_rebuilt.fetch_add( 1, std::memory_order_relaxed );
+			}, &counter );
+			JobSystem::Wait( counter );
+
+			*num_cached = num_tiles - num_rebuilt.load();
+
+			// the cache is written before any tile is added, Detour writes links into tile data
+			if( num_rebuilt.load() > 0 )
+			{
+				const std::string temp_filename = filename + ".tmp";
+				if( WriteCache( temp_filename, tiles.data(), num_tiles ) )
+				{
+					// can't replace a file that's still mapped
+					cache.Close();
+
+					std::error_code ec;
+					std::filesystem::rename( temp_filename, filename, ec );
+					if( !ec )
+					{
+						cache = MappedFile( filename.c_str() );
+					}
+					cache_tiles = GetCacheTiles( cache );
+					if( !cache_tiles )
+					{
+						BAT_WARN( "Could not reload nav mesh cache '%s', building every tile", filename );
+						for( CachedTile& tile : tiles )
+						{
+							if( tile.built )
+							{
+								dtFree( tile.data );
+							}
+						}
+						*num_cached = 0;
+						return BuildTiles( 0, 0, m_iTilesX - 1, m_iTilesY - 1 );
+					}
+
+					for( int i = 0; i < num_tiles; i++ )
+					{
+						CachedTile& tile = tiles[i];
+						if( tile.built )
+						{
+							dtFree( tile.data );
+						}
+						tile.data = cache_tiles[i].size ? reinterpret_cast<unsigned char*>( cache.Data() + cache_tiles[i].offset ) : nullptr;
+						tile.data_size = (int)cache_tiles[i].size;
+						tile.built = false;
+					}
+				}
+				else
+				{
+					BAT_WARN( "Could not write nav mesh cache '%s'", filename );
+				}
+			}
+
+			int num_built = 0;
+			for( int i = 0; i < num_tiles; i++ )
+			{
+				const CachedTile& tile = tiles[i];
+				if( !tile.data )
+				{
+					continue;
+				}
+
+				// mapped tiles belong to the cache and must not be freed by Detour
+				const int flags = tile.built ? DT_TILE_FREE_DATA : 0;
+				if( dtStatusFailed( m_NavMesh->addTile( tile.data, tile.data_size, flags, 0, nullptr ) ) )
+				{
+					BAT_WARN( "Could not add nav mesh tile (%i, %i)", i % m_iTilesX, i / m_iTilesX );
+					if( tile.built )
+					{
+						dtFree( tile.data );
+					}
+					continue;
+				}
+
+				num_built++;
+			}
+
+			m_Cache = std::move( cache );
+
+			return num_built;
+		}
+
+		NavMeshCacheHeader MakeCacheHeader() const
+		{
+			NavMeshCacheHeader header = {};
+			header.magic = NAVMESH_CACHE_MAGIC;
+			header.version = NAVMESH_CACHE_VERSION;
+			header.config_hash = m_iConfigHash;
+			header.params = *m_NavMesh->getParams();
+			header.bounds_mins[0] = m_Bounds.mins.x;
+			header.bounds_mins[1] = m_Bounds.mins.y;
+			header.bounds_mins[2] = m_Bounds.mins.z;
+			header.bounds_maxs[0] = m_Bounds.maxs.x;
+			header.bounds_maxs[1] = m_Bounds.maxs.y;
+			header.bounds_maxs[2] = m_Bounds.maxs.z;
+			header.tiles_x = m_iTilesX;
+			header.tiles_y = m_iTilesY;
+			header.detour_version = DT_NAVMESH_VERSION;
+
+			return header;
+		}
+
+		// Returns the cache's tile table, nullptr if the cache is missing, corrupt or was built for a different grid
+		const NavMeshCacheTile* GetCacheTiles( const MappedFile& cache ) const
+		{
+			const size_t num_tiles = (size_t)m_iTilesX * m_iTilesY;
+			const size_t table_end = sizeof( NavMeshCacheHeader ) + num_tiles * sizeof( NavMeshCacheTile );
+			if( !cache.IsOpen() || cache.Size() < table_end )
+			{
+				return nullptr;
+			}
+
+			const NavMeshCacheHeader header = MakeCacheHeader();
+			if( memcmp( cache.Data(), &header, sizeof( header ) ) != 0 )
+			{
+				return nullptr;
+			}
+
+			const auto* tiles = reinterpret_cast<const NavMeshCacheTile*>( cache.Data() + sizeof( NavMeshCacheHeader ) );
+			for( size_t i = 0; i < num_tiles; i++ )
+			{
+				if( tiles[i].offset % NAVMESH_CACHE_ALIGNMENT != 0 || tiles[i].offset + tiles[i].size > cache.Size() )
+				{
+					return nullptr;
+				}
+			}
+
+			return tiles;
+		}
+
+		bool WriteCache( const std::string& filename, const CachedTile* tiles, int num_tiles ) const
+		{
+			if( !filesystem )
+			{
+				return false;
+			}
+
+			const NavMeshCacheHeader header = MakeCacheHeader();
+			std::vector<NavMeshCacheTile> table( num_tiles );
+			uint64_t offset = sizeof( NavMeshCacheHeader ) + num_tiles * sizeof( NavMeshCacheTile );
+			for( int i = 0; i < num_tiles; i++ )
+			{
+				offset = ( offset + NAVMESH_CACHE_ALIGNMENT - 1 ) & ~(uint64_t)( NAVMESH_CACHE_ALIGNMENT - 1 );
+				table[i].input_hash = tiles[i].input_hash;
+				table[i].offset = offset;
+				table[i].size = tiles[i].data ? (uint32_t)tiles[i].data_size : 0;
+				table[i].padding = 0;
+				offset += table[i].size;
+			}
+
+			const FileHandle_t file = filesystem->Open( filename.c_str(), "wb" );
+			if( file == FileSystem::INVALID_HANDLE )
+			{
+				return false;
+			}
+
+			bool ok = filesystem->Write( file, reinterpret_cast<const char*>( &header ), sizeof( header ) ) == sizeof( header );
+			ok &= filesystem->Write( file, reinterpret_cast<const char*>( table.data() ), table.size() * sizeof( NavMeshCacheTile ) ) == table.size() * sizeof( NavMeshCacheTile );
+
+			const char padding[NAVMESH_CACHE_ALIGNMENT] = {};
+			uint64_t written = sizeof( NavMeshCacheHeader ) + num_tiles * sizeof( NavMeshCacheTile );
+			for( int i = 0; i < num_tiles && ok; i++ )
+			{
+				if( !table[i].size )
+				{
+					continue;
+				}
+
+				ok &= filesystem->Write( file, padding, (size_t)( table[i].offset - written ) ) == table[i].offset - written;
+				ok &= filesystem->Write( file, reinterpret_cast<const char*>( tiles[i].data ), table[i].size ) == table[i].size;
+				written = table[i].offset + table[i].size;
+			}
+
+			filesystem->Close( file );
+			return ok;
+		}
+
+		// Triangles are hashed individually and summed, so the order models were gathered in doesn't matter
+		uint64_t HashTileInput( const NavMeshInput& input, int tx, int ty ) const
+		{
+			const std::vector<int>& tile_tris = input.GetTileTris( tx, ty );
+
+			uint64_t sum = 0;
+			for( int tri_index : tile_tris )
+			{
+				float tri[10];
+				for( int i = 0; i < 3; i++ )
+				{
+					const float* v = &input.verts[input.tris[tri_index * 3 + i] * 3];
+					tri[i * 3 + 0] = v[0];
+					tri[i * 3 + 1] = v[1];
+					tri[i * 3 + 2] = v[2];
+				}
+				tri[9] = (float)input.areas[tri_index];
+
+				sum += MixHash( HashBytes( tri, sizeof( tri ) ) );
+			}
+
+			const uint64_t key[5] = { m_iConfigHash, (uint64_t)tx, (uint64_t)ty, (uint64_t)tile_tris.size(), sum };
+			return HashBytes( key, sizeof( key ) );
+		}
+
+		// Collects world space triangles from every model that overlaps the tiles (and their borders).
+		// Transforms are lazily cached, so this has to run on the main thread.
+		void GatherInput( int min_tx, int min_ty, int max_tx, int max_ty, NavMeshInput& input ) const
+		{
+			input.min_tx = min_tx;
+			input.min_ty = min_ty;
+			input.max_tx = max_tx;
+			input.max_ty = max_ty;
+			input.tile_tris.resize( ( max_tx - min_tx + 1 ) * ( max_ty - min_ty + 1 ) );
+
+			const float tile_world_size = m_Config.tileSize * m_Config.cs;
+			const float border_world_size = m_Config.borderSize * m_Config.cs;
+			const AABB bounds(
+				{ m_Bounds.mins.x + min_tx * tile_world_size - border_world_size, m_Bounds.mins.y, m_Bounds.mins.z + min_ty * tile_world_size - border_world_size },
+				{ m_Bounds.mins.x + ( max_tx + 1 ) * tile_world_size + border_world_size, m_Bounds.maxs.y, m_Bounds.mins.z + ( max_ty + 1 ) * tile_world_size + border_world_size }
+			);
+
+			std::vector<Entity> models;
+			if( spatial_index )
+			{
+				spatial_index->QueryAABB( SpatialCategory::MODEL, bounds, models );
+			}
+			else
+			{
+				for( auto [e, model, t] : world.View<ModelComponent, TransformComponent>() )
+				{
+					models.push_back( e );
+				}
+			}
+
+			for( Entity e : models )
+			{
+				const Mat3x4& transform = e.Get<TransformComponent>().LocalToWorldMatrix();
+				for( auto& mesh : e.Get<ModelComponent>().GetMeshes() )
 				{
-					if( p[j] == RC_MESH_NULL_IDX ) break;
-					if( ( p[nvp + j] & 0x8000 ) == 0 ) continue;
-					const int nj = ( j + 1 >= nvp || p[j + 1] == RC_MESH_NULL_IDX ) ? 0 : j + 1;
+					const auto* orig_verts = mesh->GetVertexData();
+					const auto* orig_tris = mesh->GetIndexData();
+					const int nv = (int)mesh->GetVertexCount();
+					const int nt = (int)mesh->GetIndexCount() / 3;
+					const int base_vert = (int)input.verts.size() / 3;
 
-					Colour col = Colours::Blue;
-					if( ( p[nvp + j] & 0xf ) != 0xf )
+					input.verts.reserve( input.verts.size() + nv * 3 );
+					for( int i = 0; i < nv; i++ )
 					{
-						col = Colours::White;
+						const Vec3 vert = transform * orig_verts[i];
+						input.verts.push_back( vert.x );
+						input.verts.push_back( vert.y );
+						input.verts.push_back( vert.z );
 					}
 
-					const unsigned short* t0 = &mesh.verts[p[j] * 3];
-					Vec3 v0 = orig + Vec3{ t0[0] * cs, ( t0[1] + 1 ) * ch + 0.1f, t0[2] * cs };
-					const unsigned short* t1 = &mesh.verts[p[nj] * 3];
-					Vec3 v1 = orig + Vec3{ t1[0] * cs, ( t1[1] + 1 ) * ch + 0.1f, t1[2] * cs };
+					for( int i = 0; i < nt; i++ )
+					{
+						const int a = base_vert + (int)orig_tris[i * 3 + 0];
+						const int b = base_vert + (int)orig_tris[i * 3 + 1];
+						const int c = base_vert + (int)orig_tris[i * 3 + 2];
+						const float* va = &input.verts[a * 3];
+						const float* vb = &input.verts[b * 3];
+						const float* vc = &input.verts[c * 3];
+
+						const float tri_min_x = std::min( { va[0], vb[0], vc[0] } );
+						const float tri_max_x = std::max( { va[0], vb[0], vc[0] } );
+						const float tri_min_z = std::min( { va[2], vb[2], vc[2] } );
+						const float tri_max_z = std::max( { va[2], vb[2], vc[2] } );
+						if( tri_max_x < bounds.mins.x || tri_min_x > bounds.maxs.x ||
+							tri_max_z < bounds.mins.z || tri_min_z > bounds.maxs.z )
+						{
+							continue;
+						}
+
+						// every tile whose bordered bounds the triangle touches
+						const int tri_min_tx = std::max( min_tx, (int)floorf( ( tri_min_x - border_world_size - m_Bounds.mins.x ) / tile_world_size ) );
+						const int tri_min_ty = std::max( min_ty, (int)floorf( ( tri_min_z - border_world_size - m_Bounds.mins.z ) / tile_world_size ) );
+						const int tri_max_tx = std::min( max_tx, (int)floorf( ( tri_max_x + border_world_size - m_Bounds.mins.x ) / tile_world_size ) );
+						const int tri_max_ty = std::min( max_ty, (int)floorf( ( tri_max_z + border_world_size - m_Bounds.mins.z ) / tile_world_size ) );
 
-					DebugDraw::Line( v0, v1, col );
+						const int tri_index = (int)input.tris.size() / 3;
+						input.tris.push_back( a );
+						input.tris.push_back( b );
+						input.tris.push_back( c );
+
+						for( int ty = tri_min_ty; ty <= tri_max_ty; ty++ )
+						{
+							for( int tx = tri_min_tx; tx <= tri_max_tx; tx++ )
+							{
+								input.tile_tris[( ty - min_ty ) * ( max_tx - min_tx + 1 ) + ( tx - min_tx )].push_back( tri_index );
+							}
+						}
+					}
 				}
 			}
+
+			BuildContext ctx;
+			input.areas.resize( input.tris.size() / 3 );
+			rcMarkWalkableTriangles( &ctx, m_Config.walkableSlopeAngle,
+				input.verts.data(), (int)input.verts.size() / 3,
+				input.tris.data(), (int)input.areas.size(), input.areas.data() );
+		}
+
+		// Runs the Recast pipeline for a single tile, safe to call from any thread.
+		// Returns the Detour tile data or nullptr if the tile has nothing walkable.
+		unsigned char* BuildTileData( const NavMeshInput& input, int tx, int ty, int* data_size ) const
+		{
+			const std::vector<int>& tile_tris = input.GetTileTris( tx, ty );
+			if( tile_tris.empty() )
+			{
+				return nullptr;
+			}
+
+			BuildContext ctx;
+
+			rcConfig cfg = m_Config;
+			const float tile_world_size = cfg.tileSize * cfg.cs;
+			const float border_world_size = cfg.borderSize * cfg.cs;
+			cfg.bmin[0] = m_Bounds.mins.x + tx * tile_world_size - border_world_size;
+			cfg.bmin[1] = m_Bounds.mins.y;
+			cfg.bmin[2] = m_Bounds.mins.z + ty * tile_world_size - border_world_size;
+			cfg.bmax[0] = m_Bounds.mins.x + ( tx + 1 ) * tile_world_size + border_world_size;
+			cfg.bmax[1] = m_Bounds.maxs.y;
+			cfg.bmax[2] = m_Bounds.mins.z + ( ty + 1 ) * tile_world_size + border_world_size;
+
+			rcHeightfieldAuto solid = rcHeightfieldMake();
+			if( !rcCreateHeightfield( &ctx, *solid, cfg.width, cfg.height, cfg.bmin, cfg.bmax, cfg.cs, cfg.ch ) )
+			{
+				BAT_ERROR( "Could not create solid heightfield for tile (%i, %i)", tx, ty );
+				return nullptr;
+			}
+
+			std::vector<int> tris;
+			std::vector<unsigned char> areas;
+			tris.reserve( tile_tris.size() * 3 );
+			areas.reserve( tile_tris.size() );
+			for( int tri_index : tile_tris )
+			{
+				tris.push_back( input.tris[tri_index * 3 + 0] );
+				tris.push_back( input.tris[tri_index * 3 + 1] );
+				tris.push_back( input.tris[tri_index * 3 + 2] );
+				areas.push_back( input.areas[tri_index] );
+			}
+
+			if( !rcRasterizeTriangles( &ctx, input.verts.data(), (int)input.verts.size() / 3, tris.data(), areas.data(), (int)areas.size(), *solid, cfg.walkableClimb ) )
+			{
+				BAT_ERROR( "Could not rasterize triangles for tile (%i, %i)", tx, ty );
+				return nullptr;
+			}
+
+			rcFilterLowHangingWalkableObstacles( &ctx, cfg.walkableClimb, *solid );
+			rcFilterLedgeSpans( &ctx, cfg.walkableHeight, cfg.walkableClimb, *solid );
+			rcFilterWalkableLowHeightSpans( &ctx, cfg.walkableHeight, *solid );
+
+			rcCompactHeightfieldAuto chf = rcCompactHeightfieldMake();
+			if( !rcBuildCompactHeightfield( &ctx, cfg.walkableHeight, cfg.walkableClimb, *solid, *chf ) )
+			{
+				BAT_ERROR( "Could not build compact data for tile (%i, %i)", tx, ty );
+				return nullptr;
+			}
+			solid.reset();
+
+			if( !rcErodeWalkableArea( &ctx, cfg.walkableRadius, *chf ) )
+			{
+				BAT_ERROR( "Could not erode tile (%i, %i)", tx, ty );
+				return nullptr;
+			}
+
+			if( !rcBuildDistanceField( &ctx, *chf ) )
+			{
+				BAT_ERROR( "Could not build distance field for tile (%i, %i)", tx, ty );
+				return nullptr;
+			}
+
+			if( !rcBuildRegions( &ctx, *chf, cfg.borderSize, cfg.minRegionArea, cfg.mergeRegionArea ) )
+			{
+				BAT_ERROR( "Could not build watershed regions for tile (%i, %i)", tx, ty );
+				return nullptr;
+			}
+
+			rcContourSetAuto cset = rcContourSetMake();
+			if( !rcBuildContours( &ctx, *chf, cfg.maxSimplificationError, cfg.maxEdgeLen, *cset ) )
+			{
+				BAT_ERROR( "Could not create contours for tile (%i, %i)", tx, ty );
+				return nullptr;
+			}
+
+			if( cset->nconts == 0 )
+			{
+				return nullptr;
+			}
+
+			rcPolyMeshAuto pmesh = rcPolyMeshMake();
+			if( !rcBuildPolyMesh( &ctx, *cset, cfg.maxVertsPerPoly, *pmesh ) )
+			{
+				BAT_ERROR( "Could not triangulate contours for tile (%i, %i)", tx, ty );
+				return nullptr;
+			}
+
+			rcPolyMeshDetailAuto dmesh = rcPolyMeshDetailMake();
+			if( !rcBuildPolyMeshDetail( &ctx, *pmesh, *chf, cfg.detailSampleDist, cfg.detailSampleMaxError, *dmesh ) )
+			{
+				BAT_ERROR( "Could not build detail mesh for tile (%i, %i)", tx, ty );
+				return nullptr;
+			}
+
+			if( pmesh->npolys == 0 )
+			{
+				return nullptr;
+			}
+
+			for( int i = 0; i < pmesh->npolys; i++ )
+			{
+				if( pmesh->areas[i] == RC_WALKABLE_AREA )
+				{
+					pmesh->flags[i] = 1; // TODO: Update to proper flag
+				}
+			}
+
+			dtNavMeshCreateParams params = {};
+			params.verts = pmesh->verts;
+			params.vertCount = pmesh->nverts;
+			params.polys = pmesh->polys;
+			params.polyFlags = pmesh->flags;
+			params.polyAreas = pmesh->areas;
+			params.polyCount = pmesh->npolys;
+			params.nvp = pmesh->nvp;
+			params.detailMeshes = dmesh->meshes;
+			params.detailVerts = dmesh->verts;
+			params.detailVertsCount = dmesh->nverts;
+			params.detailTris = dmesh->tris;
+			params.detailTriCount = dmesh->ntris;
+			params.offMeshConCount = 0;
+			params.userId = 0;
+			params.tileX = tx;
+			params.tileY = ty;
+			params.tileLayer = 0;
+			rcVcopy( params.bmin, pmesh->bmin );
+			rcVcopy( params.bmax, pmesh->bmax );
+			params.walkableHeight = AGENT_HEIGHT;
+			params.walkableRadius = AGENT_RADIUS;
+			params.walkableClimb = AGENT_MAX_CLIMB;
+			params.cs = cfg.cs;
+			params.ch = cfg.ch;
+			params.buildBvTree = true;
+
+			unsigned char* navmesh_data;
+			if( !dtCreateNavMeshData( &params, &navmesh_data, data_size ) )
+			{
+				BAT_ERROR( "Could not build nav mesh data for tile (%i, %i)", tx, ty );
+				return nullptr;
+			}
+
+			return navmesh_data;
 		}
 	private:
-		rcPolyMeshAuto m_PolyMesh;
-		rcPolyMeshDetailAuto m_PolyMeshDetail;
+		// base config, each tile fills in its own bounds
+		rcConfig m_Config = {};
+		uint64_t m_iConfigHash = 0;
+		AABB m_Bounds;
+		int m_iTilesX = 0;
+		int m_iTilesY = 0;
+		// tiles loaded from the cache point into this, has to outlive the nav mesh
+		MappedFile m_Cache;
 		dtNavMeshAuto m_NavMesh;
+		// used by the synchronous queries
 		dtNavMeshQueryAuto m_Query;
+
+		// async path requests, the mutex guards the free/pending/cancelled lists
+		dtQueryFilter m_PathFilter;
+		std::unique_ptr<PathRequest[]> m_pPathRequests;
+		std::vector<uint16_t> m_vFreePathRequests;
+		std::vector<uint16_t> m_vPendingPathRequests;
+		std::vector<uint16_t> m_vCancelledPathRequests;
+		mutable std::mutex m_PathRequestMutex;
+		// snapshot of the pending list lanes pull from during an update
+		std::vector<uint16_t> m_vDispatchedPathRequests;
+		std::atomic<size_t> m_iDispatchCursor = 0;
+		std::vector<PathLane> m_vPathLanes;
+		std::vector<dtNavMeshQueryAuto> m_vThreadQueries;
 	};
 
 	NavMeshSystem::NavMeshSystem()
@@ -377,19 +1317,72 @@ namespace Bat
 	{
 	}
 
-	NavMeshHandle_t NavMeshSystem::Bake()
+	NavMeshHandle_t NavMeshSystem::Bake( const std::string& cache_filename )
 	{
 		auto handle = (NavMeshHandle_t)m_NavMeshes.size();
-		m_NavMeshes.emplace_back();
+		m_NavMeshes.push_back( std::make_unique<NavMesh>( cache_filename ) );
 		return handle;
 	}
 
+	void NavMeshSystem::RebuildTiles( NavMeshHandle_t navmesh, const AABB& bounds )
+	{
+		m_NavMeshes[navmesh]->RebuildTiles( bounds );
+	}
+
+	void NavMeshSystem::Update( EntityManager& world, float dt )
+	{
+		for( auto& navmesh : m_NavMeshes )
+		{
+			navmesh->UpdatePathRequests( m_iPathIterationBudget );
+		}
+	}
+
+	void NavMeshSystem::SetPathIterationBudget( int iterations )
+	{
+		m_iPathIterationBudget = iterations;
+	}
+
+	PathRequestHandle_t NavMeshSystem::RequestPath( NavMeshHandle_t navmesh, const Vec3& start, const Vec3& end )
+	{
+		return m_NavMeshes[navmesh]->RequestPath( start, end );
+	}
+
+	PathRequestStatus NavMeshSystem::GetPathStatus( NavMeshHandle_t navmesh, PathRequestHandle_t request ) const
+	{
+		return m_NavMeshes[navmesh]->GetPathStatus( request );
+	}
+
+	const Vec3* NavMeshSystem::GetPathCorners( NavMeshHandle_t navmesh, PathRequestHandle_t request, size_t* count ) const
+	{
+		return m_NavMeshes[navmesh]->GetPathCorners( request, count );
+	}
+
+	void NavMeshSystem::ReleasePathRequest( NavMeshHandle_t navmesh, PathRequestHandle_t request )
+	{
+		m_NavMeshes[navmesh]->ReleasePathRequest( request );
+	}
+
+	bool NavMeshSystem::FindNearestPoint( NavMeshHandle_t navmesh, const Vec3& pos, Vec3* point_out, NavPolyRef_t* poly_out ) const
+	{
+		return m_NavMeshes[navmesh]->FindNearestPoint( pos, point_out, poly_out );
+	}
+
+	Vec3 NavMeshSystem::MoveAlongSurface( NavMeshHandle_t navmesh, NavPolyRef_t* poly, const Vec3& start, const Vec3& end ) const
+	{
+		return m_NavMeshes[navmesh]->MoveAlongSurface( poly, start, end );
+	}
+
+	bool NavMeshSystem::IsLineWalkable( NavMeshHandle_t navmesh, NavPolyRef_t poly, const Vec3& start, const Vec3& end ) const
+	{
+		return m_NavMeshes[navmesh]->IsLineWalkable( poly, start, end );
+	}
+
 	std::vector<Vec3> NavMeshSystem::GetPath( NavMeshHandle_t navmesh, const Vec3& start, const Vec3& end ) const
 	{
-		return m_NavMeshes[navmesh].GetPath( start, end );
+		return m_NavMeshes[navmesh]->GetPath( start, end );
 	}
 	void NavMeshSystem::Draw( NavMeshHandle_t navmesh ) const
 	{
-		m_NavMeshes[navmesh].Draw();
+		m_NavMeshes[navmesh]->Draw();
 	}
 }
@@ -1,23 +1,77 @@
 #pragma once
 
+#include <memory>
+#include <string>
 #include "Graphics/Mesh.h"
 
 namespace Bat
 {
+	class EntityManager;
+
 	using NavMeshHandle_t = size_t;
+	// Index of the request in the low 16 bits, generation in the high 16 bits so stale handles can be detected
+	using PathRequestHandle_t = uint32_t;
+	static constexpr PathRequestHandle_t INVALID_PATH_REQUEST = UINT32_MAX;
+	// Polygon on a navmesh, 0 for none. Polygons become invalid when their tile is rebuilt.
+	using NavPolyRef_t = uint32_t;
+
+	enum class PathRequestStatus
+	{
+		INVALID, // handle is stale or was never valid
+		PENDING,
+		SUCCEEDED,
+		PARTIAL, // couldn't reach the end, path leads to the closest reachable point
+		FAILED
+	};
 
 	class NavMesh;
 
 	class NavMeshSystem
 	{
 	public:
+		// Maximum number of path requests in flight per navmesh
+		static constexpr size_t MAX_PATH_REQUESTS = 4096;
+		// Corners stored for each path result
+		static constexpr size_t MAX_PATH_CORNERS = 64;
+
 		NavMeshSystem();
 		~NavMeshSystem();
-		NavMeshHandle_t Bake();
+		// Builds a tiled nav mesh covering every model in the scene, tiles are built in parallel on the job system.
+		// If a cache file is given, tiles whose input geometry hasn't changed are memory mapped from it instead of
+		// being rebuilt, and the cache is rewritten whenever a tile had to be rebuilt.
+		NavMeshHandle_t Bake( const std::string& cache_filename = "" );
+		// Rebuilds the tiles of a baked nav mesh that overlap bounds, call after geometry inside them has changed.
+		// Path requests that were in progress are restarted.
+		void RebuildTiles( NavMeshHandle_t navmesh, const AABB& bounds );
+
+		// Advances queued path requests on the job system, every navmesh gets at most the iteration budget per call
+		void Update( EntityManager& world, float dt );
+		// Number of A* iterations spread across the job system threads per update
+		void SetPathIterationBudget( int iterations );
+
+		// Queues a path request, thread safe. Returns INVALID_PATH_REQUEST if too many requests are in flight.
+		PathRequestHandle_t RequestPath( NavMeshHandle_t navmesh, const Vec3& start, const Vec3& end );
+		PathRequestStatus GetPathStatus( NavMeshHandle_t navmesh, PathRequestHandle_t request ) const;
+		// Corners of a finished path, valid until the request is released
+		const Vec3* GetPathCorners( NavMeshHandle_t navmesh, PathRequestHandle_t request, size_t* count ) const;
+		// Frees the request's result, pending requests get cancelled. The handle can't be used afterwards.
+		void ReleasePathRequest( NavMeshHandle_t navmesh, PathRequestHandle_t request );
+
+		// Surface queries, safe to call from any job system thread
+
+		// Closest point on the navmesh to pos, returns false if there's no polygon nearby
+		bool FindNearestPoint( NavMeshHandle_t navmesh, const Vec3& pos, Vec3* point_out, NavPolyRef_t* poly_out ) const;
+		// Moves from start towards end without leaving the navmesh and returns where it ended up. poly is the polygon
+		// start is on (looked up if 0 or invalid) and is updated to the polygon of the result.
+		Vec3 MoveAlongSurface( NavMeshHandle_t navmesh, NavPolyRef_t* poly, const Vec3& start, const Vec3& end ) const;
+		// Whether the straight line from start (on poly) to end stays on the navmesh
+		bool IsLineWalkable( NavMeshHandle_t navmesh, NavPolyRef_t poly, const Vec3& start, const Vec3& end ) const;
 
+		// Finds a path immediately on the calling thread
 		std::vector<Vec3> GetPath( NavMeshHandle_t navmesh, const Vec3& start, const Vec3& end ) const;
 		void Draw( NavMeshHandle_t navmesh ) const;
 	private:
-		std::vector<NavMesh> m_NavMeshes;
+		std::vector<std::unique_ptr<NavMesh>> m_NavMeshes;
+		int m_iPathIterationBudget = 8192;
 	};
-}
\ No newline at end of file
+}
@@ -14,4 +14,12 @@ namespace Bat
 
 		return new_pose;
 	}
-}
\ No newline at end of file
+
+	void AnimationClip::Sample( float timestamp, SoASkeletonPose& pose ) const
+	{
+		for( const AnimationChannel& channel : channels )
+		{
+			pose.Set( channel.node_index, channel.GetSample( timestamp ) );
+		}
+	}
+}
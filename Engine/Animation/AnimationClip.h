@@ -15,5 +15,7 @@ namespace Bat
 
 		// Returns bone space transforms for each node in the skeleton at the given timestamp
 		SkeletonPose GetSample( float timestamp, const SkeletonPose& bind_pose ) const;
+		// Overwrites the animated bones in pose with their transforms at the given timestamp, other bones are left untouched
+		void Sample( float timestamp, SoASkeletonPose& pose ) const;
 	};
 }
\ No newline at end of file
@@ -13,9 +13,16 @@ namespace Bat
 		BAT_COMPONENT( ANIMATION );
 
 		SkeletonPose bind_pose;
-		SkeletonPose current_pose;
+		// skinning matrices for the current pose, one for each entry in bones
+		std::vector<Mat4> matrix_palette;
 		std::vector<AnimationState> states;
 		std::vector<BoneData> bones;
 		std::vector<AnimationClip> clips;
+
+		// scratch poses for the animation system, sized to the skeleton on first update
+		SoASkeletonPose soa_bind_pose;
+		SoASkeletonPose soa_sample_pose;
+		SoASkeletonPose soa_blended_pose;
+		std::vector<BoneTransform> model_pose;
 	};
 }
\ No newline at end of file
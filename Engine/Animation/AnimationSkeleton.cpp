@@ -54,6 +54,28 @@ namespace Bat
 			out[i] = Mat4( bones[i].inverse_bind_transform * bone_transform );
 		}
 	}
+	void SkeletonPose::ToModelSpace( const SkeletonPose& pose, BoneTransform* out )
+	{
+		if( pose.bones.empty() )
+		{
+			return;
+		}
+
+		out[0] = pose.bones[0].transform;
+		for( size_t i = 1; i < pose.bones.size(); i++ )
+		{
+			int parent_index = pose.bones[i].parent_index;
+			out[i] = pose.bones[i].transform * out[parent_index];
+		}
+	}
+	void SkeletonPose::ToMatrixPalette( const BoneTransform* model_transforms, const std::vector<BoneData>& bones, Mat4* out )
+	{
+		for( size_t i = 0; i < bones.size(); i++ )
+		{
+			Mat3x4 bone_transform = BoneTransform::ToMatrix( model_transforms[bones[i].index] );
+			out[i] = Mat4( bones[i].inverse_bind_transform * bone_transform );
+		}
+	}
 	SkeletonPose SkeletonPose::Blend( const SkeletonPose* poses, const float* weights, int num_poses, const SkeletonPose& bind_pose )
 	{
 		ASSERT( num_poses >= 1, "Can't blend 0 poses" );
@@ -125,4 +147,151 @@ namespace Bat
 
 		return blended;
 	}
-}
\ No newline at end of file
+
+	void SoASkeletonPose::Resize( size_t num_bones )
+	{
+		m_iNumBones = num_bones;
+		m_iPaddedNumBones = ( num_bones + 3 ) & ~(size_t)3;
+		// padding bones are identity so they never produce NaNs when normalized
+		m_Data.assign( NUM_COMPONENTS * m_iPaddedNumBones, 0.0f );
+		std::fill_n( GetComponent( RW ), m_iPaddedNumBones, 1.0f );
+	}
+
+	BoneTransform SoASkeletonPose::Get( size_t bone ) const
+	{
+		BoneTransform transform;
+		transform.translation = { GetComponent( TX )[bone], GetComponent( TY )[bone], GetComponent( TZ )[bone] };
+		transform.rotation = { GetComponent( RX )[bone], GetComponent( RY )[bone], GetComponent( RZ )[bone], GetComponent( RW )[bone] };
+		return transform;
+	}
+
+	void SoASkeletonPose::Set( size_t bone, const BoneTransform& transform )
+	{
+		GetComponent( TX )[bone] = transform.translation.x;
+		GetComponent( TY )[bone] = transform.translation.y;
+		GetComponent( TZ )[bone] = transform.translation.z;
+		GetComponent( RX )[bone] = transform.rotation.x;
+		GetComponent( RY )[bone] = transform.rotation.y;
+		GetComponent( RZ )[bone] = transform.rotation.z;
+		GetComponent( RW )[bone] = transform.rotation.w;
+	}
+
+	void SoASkeletonPose::CopyFrom( const SoASkeletonPose& pose )
+	{
+		ASSERT( pose.m_iNumBones == m_iNumBones, "Poses size mismatch" );
+		std::copy( pose.m_Data.begin(), pose.m_Data.end(), m_Data.begin() );
+	}
+
+	void SoASkeletonPose::CopyFrom( const SkeletonPose& pose )
+	{
+		ASSERT( pose.bones.size() == m_iNumBones, "Poses size mismatch" );
+		for( size_t i = 0; i < m_iNumBones; i++ )
+		{
+			Set( i, pose.bones[i].transform );
+		}
+	}
+
+	void SoASkeletonPose::CopyTo( SkeletonPose& pose ) const
+	{
+		ASSERT( pose.bones.size() == m_iNumBones, "Poses size mismatch" );
+		for( size_t i = 0; i < m_iNumBones; i++ )
+		{
+			pose.bones[i].transform = Get( i );
+		}
+	}
+
+	static DirectX::XMVECTOR LoadBones( const float* pSrc )
+	{
+		return DirectX::XMLoadFloat4( reinterpret_cast<const DirectX::XMFLOAT4*>( pSrc ) );
+	}
+
+	static void StoreBones( float* pDst, DirectX::FXMVECTOR v )
+	{
+		DirectX::XMStoreFloat4( reinterpret_cast<DirectX::XMFLOAT4*>( pDst ), v );
+	}
+
+	void SoASkeletonPose::Scale( SoASkeletonPose& out, const SoASkeletonPose& pose, float weight )
+	{
+		using namespace DirectX;
+		ASSERT( pose.m_iNumBones == out.m_iNumBones, "Poses size mismatch" );
+
+		const XMVECTOR w = XMVectorReplicate( weight );
+		const size_t count = NUM_COMPONENTS * out.m_iPaddedNumBones;
+		for( size_t i = 0; i < count; i += 4 )
+		{
+			StoreBones( &out.m_Data[i], XMVectorMultiply( LoadBones( &pose.m_Data[i] ), w ) );
+		}
+	}
+
+	void SoASkeletonPose::AddWeighted( SoASkeletonPose& out, const SoASkeletonPose& pose, float weight )
+	{
+		using namespace DirectX;
+		ASSERT( pose.m_iNumBones == out.m_iNumBones, "Poses size mismatch" );
+
+		const XMVECTOR w = XMVectorReplicate( weight );
+		const XMVECTOR neg_w = XMVectorReplicate( -weight );
+
+		for( size_t i = 0; i < out.m_iPaddedNumBones; i += 4 )
+		{
+			for( int c = TX; c <= TZ; c++ )
+			{
+				float* pOut = out.GetComponent( (Component)c ) + i;
+				const float* pIn = pose.GetComponent( (Component)c ) + i;
+				StoreBones( pOut, XMVectorMultiplyAdd( LoadBones( pIn ), w, LoadBones( pOut ) ) );
+			}
+
+			const XMVECTOR ox = LoadBones( out.GetComponent( RX ) + i );
+			const XMVECTOR oy = LoadBones( out.GetComponent( RY ) + i );
+			const XMVECTOR oz = LoadBones( out.GetComponent( RZ ) + i );
+			const XMVECTOR ow = LoadBones( out.GetComponent( RW ) + i );
+			const XMVECTOR px = LoadBones( pose.GetComponent( RX ) + i );
+			const XMVECTOR py = LoadBones( pose.GetComponent( RY ) + i );
+			const XMVECTOR pz = LoadBones( pose.GetComponent( RZ ) + i );
+			const XMVECTOR pw = LoadBones( pose.GetComponent( RW ) + i );
+
+			// take the shortest path, same as BoneTransform::operator+ but for 4 bones at once
+			XMVECTOR dot = XMVectorMultiply( ox, px );
+			dot = XMVectorMultiplyAdd( oy, py, dot );
+			dot = XMVectorMultiplyAdd( oz, pz, dot );
+			dot = XMVectorMultiplyAdd( ow, pw, dot );
+			const XMVECTOR signed_w = XMVectorSelect( neg_w, w, XMVectorGreater( dot, XMVectorZero() ) );
+
+			StoreBones( out.GetComponent( RX ) + i, XMVectorMultiplyAdd( px, signed_w, ox ) );
+			StoreBones( out.GetComponent( RY ) + i, XMVectorMultiplyAdd( py, signed_w, oy ) );
+			StoreBones( out.GetComponent( RZ ) + i, XMVectorMultiplyAdd( pz, signed_w, oz ) );
+			StoreBones( out.GetComponent( RW ) + i, XMVectorMultiplyAdd( pw, signed_w, ow ) );
+		}
+	}
+
+	void SoASkeletonPose::NormalizeRotations( SoASkeletonPose& pose )
+	{
+		using namespace DirectX;
+
+		for( size_t i = 0; i < pose.m_iPaddedNumBones; i += 4 )
+		{
+			float* pX = pose.GetComponent( RX ) + i;
+			float* pY = pose.GetComponent( RY ) + i;
+			float* pZ = pose.GetComponent( RZ ) + i;
+			float* pW = pose.GetComponent( RW ) + i;
+
+			const XMVECTOR x = LoadBones( pX );
+			const XMVECTOR y = LoadBones( pY );
+			const XMVECTOR z = LoadBones( pZ );
+			const XMVECTOR w = LoadBones( pW );
+
+			XMVECTOR length_sq = XMVectorMultiply( x, x );
+			length_sq = XMVectorMultiplyAdd( y, y, length_sq );
+			length_sq = XMVectorMultiplyAdd( z, z, length_sq );
+			length_sq = XMVectorMultiplyAdd( w, w, length_sq );
+
+			// leave degenerate rotations alone rather than turning them into NaNs
+			const XMVECTOR valid = XMVectorGreater( length_sq, XMVectorReplicate( 1e-12f ) );
+			const XMVECTOR inv_length = XMVectorSelect( XMVectorSplatOne(), XMVectorReciprocalSqrt( length_sq ), valid );
+
+			StoreBones( pX, XMVectorMultiply( x, inv_length ) );
+			StoreBones( pY, XMVectorMultiply( y, inv_length ) );
+			StoreBones( pZ, XMVectorMultiply( z, inv_length ) );
+			StoreBones( pW, XMVectorMultiply( w, inv_length ) );
+		}
+	}
+}
@@ -43,8 +43,49 @@ namespace Bat
 	
 		// Converts a given pose from local space to model space
 		static SkeletonPose ToModelSpace( SkeletonPose pose );
+		// Writes the model space transform of every bone in a local space pose to out, which must have room for pose.bones.size()
+		static void ToModelSpace( const SkeletonPose& pose, BoneTransform* out );
 		// Converts a given model-space pose to a matrix palette for use in skinning
 		static void ToMatrixPalette( const SkeletonPose& model_pose, const std::vector<BoneData>& bones, Mat4* out );
+		static void ToMatrixPalette( const BoneTransform* model_transforms, const std::vector<BoneData>& bones, Mat4* out );
 		static SkeletonPose Blend( const SkeletonPose* poses, const float* weights, int num_poses, const SkeletonPose& bind_pose );
 	};
-}
\ No newline at end of file
+
+	// Structure of arrays version of SkeletonPose used by the animation system for sampling and blending.
+	// Translations and rotations live in separate per-component arrays, padded to a multiple of 4 bones
+	// so blending can work on 4 bones at a time. Storage is allocated once in Resize() and reused every frame.
+	class SoASkeletonPose
+	{
+	public:
+		void Resize( size_t num_bones );
+		size_t GetNumBones() const { return m_iNumBones; }
+
+		BoneTransform Get( size_t bone ) const;
+		void Set( size_t bone, const BoneTransform& transform );
+
+		void CopyFrom( const SoASkeletonPose& pose );
+		void CopyFrom( const SkeletonPose& pose );
+		// Writes the bone transforms into an existing pose with the same number of bones
+		void CopyTo( SkeletonPose& pose ) const;
+
+		// out = pose * weight
+		static void Scale( SoASkeletonPose& out, const SoASkeletonPose& pose, float weight );
+		// out += pose * weight, rotations are flipped onto the same hemisphere as out before being added
+		static void AddWeighted( SoASkeletonPose& out, const SoASkeletonPose& pose, float weight );
+		static void NormalizeRotations( SoASkeletonPose& pose );
+	private:
+		enum Component
+		{
+			TX, TY, TZ,
+			RX, RY, RZ, RW,
+			NUM_COMPONENTS
+		};
+
+		float* GetComponent( Component c ) { return m_Data.data() + c * m_iPaddedNumBones; }
+		const float* GetComponent( Component c ) const { return m_Data.data() + c * m_iPaddedNumBones; }
+	private:
+		std::vector<float> m_Data;
+		size_t m_iNumBones = 0;
+		size_t m_iPaddedNumBones = 0;
+	};
+}
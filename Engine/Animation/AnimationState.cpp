@@ -21,6 +21,10 @@ namespace Bat
 	{
 		return m_pClip->GetSample( m_flTimestamp, bind_pose );
 	}
+	void AnimationState::Sample( SoASkeletonPose& pose ) const
+	{
+		m_pClip->Sample( m_flTimestamp, pose );
+	}
 	void AnimationState::DoImGuiMenu()
 	{
 		if( ImGui::TreeNode( m_pClip->name.c_str() ) )
@@ -31,6 +31,8 @@ namespace Bat
 
 		void Update( float dt );
 		SkeletonPose GetSample( const SkeletonPose& bind_pose ) const;
+		// See AnimationClip::Sample
+		void Sample( SoASkeletonPose& pose ) const;
 
 		void DoImGuiMenu();
 	private:
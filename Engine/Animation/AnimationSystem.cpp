@@ -9,63 +9,107 @@
 
 namespace Bat
 {
-	void AnimationSystem::Update( EntityManager& world, float dt )
+	static void UpdatePose( AnimationComponent& anim, float dt )
 	{
-		for( Entity ent : world )
+		const size_t num_bones = anim.bind_pose.bones.size();
+		if( anim.soa_bind_pose.GetNumBones() != num_bones )
 		{
-			if( ent.Has<AnimationComponent>() )
+			anim.soa_bind_pose.Resize( num_bones );
+			anim.soa_bind_pose.CopyFrom( anim.bind_pose );
+			anim.soa_sample_pose.Resize( num_bones );
+			anim.soa_blended_pose.Resize( num_bones );
+		}
+
+		float accumulated_weight = 0.0f;
+		for( AnimationState& state : anim.states )
+		{
+			state.Update( dt );
+			accumulated_weight += state.GetWeight();
+		}
+		const float weight_factor = ( accumulated_weight > 1.0f ) ? 1.0f / accumulated_weight : 1.0f;
+
+		// poses are accumulated straight into the blended pose instead of sampling every state up front
+		bool has_pose = false;
+		for( const AnimationState& state : anim.states )
+		{
+			if( Math::CloseEnough( state.GetWeight(), 0.0f ) )
 			{
-				ASSERT( !ent.Has<PhysicsComponent>(), "Physics components interferes with animation component" );
+				continue;
+			}
 
-				auto& anim = ent.Get<AnimationComponent>();
-				auto& t = ent.Get<TransformComponent>();
+			anim.soa_sample_pose.CopyFrom( anim.soa_bind_pose );
+			state.Sample( anim.soa_sample_pose );
 
-				SkeletonPose poses[8];
-				float weights[8];
+			const float weight = state.GetWeight() * weight_factor;
+			if( !has_pose )
+			{
+				SoASkeletonPose::Scale( anim.soa_blended_pose, anim.soa_sample_pose, weight );
+				has_pose = true;
+			}
+			else
+			{
+				SoASkeletonPose::AddWeighted( anim.soa_blended_pose, anim.soa_sample_pose, weight );
+			}
+		}
 
-				ASSERT( anim.states.size() < 8, "Can only have 8 active animation states at a time" );
+		if( !has_pose )
+		{
+			anim.soa_blended_pose.CopyFrom( anim.soa_bind_pose );
+		}
+		else
+		{
+			if( accumulated_weight < 1.0f )
+			{
+				SoASkeletonPose::AddWeighted( anim.soa_blended_pose, anim.soa_bind_pose, 1.0f - accumulated_weight );
+			}
+			SoASkeletonPose::NormalizeRotations( anim.soa_blended_pose );
+		}
 
-				if( anim.states.empty() )
-				{
-					anim.current_pose = anim.bind_pose;
-				}
-				else
-				{
-					int num_poses = 0;
-					for( size_t i = 0; i < anim.states.size(); i++ )
-					{
-						AnimationState& state = anim.states[i];
-						
-						state.Update( dt );
+	}
 
-						if( Math::CloseEnough( state.GetWeight(), 0.0f ) )
-						{
-							continue;
-						}
+	// Builds the skinning matrices straight from the SoA arrays of the blended pose
+	static void BuildMatrixPalette( AnimationComponent& anim )
+	{
+		const std::vector<BoneNode>& bones = anim.bind_pose.bones;
+		const size_t num_bones = bones.size();
+		anim.model_pose.resize( num_bones );
 
-						poses[num_poses] = state.GetSample( anim.bind_pose );
-						weights[num_poses] = state.GetWeight();
-						num_poses++;
-					}
+		for( size_t i = 0; i < num_bones; i++ )
+		{
+			const BoneTransform local = anim.soa_blended_pose.Get( i );
+			anim.model_pose[i] = ( i == 0 ) ? local : local * anim.model_pose[bones[i].parent_index];
+		}
 
-					if( num_poses > 0 )
-					{
-						SkeletonPose blended = SkeletonPose::Blend( poses, weights, num_poses, anim.bind_pose );
-						anim.current_pose = std::move( blended );
-					}
-					else
-					{
-						anim.current_pose = anim.bind_pose;
-					}
-				}
+		ASSERT( anim.bones.size() <= MAX_BONES, "Too many bones!" );
+		anim.matrix_palette.resize( anim.bones.size() );
+		SkeletonPose::ToMatrixPalette( anim.model_pose.data(), anim.bones, anim.matrix_palette.data() );
+	}
 
-				for( BoneNode& node : anim.current_pose.bones )
-				{
-					auto& transform = node.entity.Get<TransformComponent>();
-					transform.SetPosition( node.transform.translation )
-						.SetRotation( Math::QuaternionToEulerDeg( node.transform.rotation ) );
-				}
+	void AnimationSystem::Update( EntityManager& world, float dt )
+	{
+		// each character only touches its own component, so characters can be done in parallel
+		world.View<AnimationComponent>().ParallelForEach( [dt]( Entity ent, AnimationComponent& anim )
+		{
+			ASSERT( anim.states.size() < 8, "Can only have 8 active animation states at a time" );
+
+			UpdatePose( anim, dt );
+			BuildMatrixPalette( anim );
+		}, 4 );
+	}
+
+	void AnimationSystem::ApplyPoses( EntityManager& world )
+	{
+		// bones are the character's own scene nodes, so characters don't mark anything dirty for each other.
+		// bone transforms only get their local matrix set, the hierarchy system works out the world transforms
+		world.View<AnimationComponent>().ParallelForEach( []( Entity ent, AnimationComponent& anim )
+		{
+			ASSERT( !ent.Has<PhysicsComponent>(), "Physics components interferes with animation component" );
+
+			std::vector<BoneNode>& bones = anim.bind_pose.bones;
+			for( size_t i = 0; i < bones.size(); i++ )
+			{
+				bones[i].entity.Get<TransformComponent>().SetLocalMatrix( BoneTransform::ToMatrix( anim.soa_blended_pose.Get( i ) ) );
 			}
-		}
+		}, 4 );
 	}
-}
\ No newline at end of file
+}
@@ -7,6 +7,10 @@ namespace Bat
 	class AnimationSystem
 	{
 	public:
+		// Samples and blends every character's animations and builds their skinning matrices,
+		// only touches animation components
 		void Update( EntityManager& world, float dt );
+		// Writes the poses from the last Update into the bone transforms
+		void ApplyPoses( EntityManager& world );
 	};
 }
\ No newline at end of file
@@ -6,7 +6,9 @@
 #include "Core/CoreEntityComponents.h"
 #include "Core/EngineSystems.h"
 #include "Core/Entity.h"
+#include "Core/EntityCommandBuffer.h"
 #include "Core/Globals.h"
 #include "Core/Log.h"
 #include "Core/ResourceManager.h"
-#include "Core/Scene.h"
\ No newline at end of file
+#include "Core/Scene.h"
+#include "Core/SystemScheduler.h"
\ No newline at end of file
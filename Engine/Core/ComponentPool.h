@@ -0,0 +1,171 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "Util/BatAssert.h"
+#include "Util/ChunkedAllocator.h"
+
+namespace Bat
+{
+	// Sparse set of type-erased components.
+	// Components are packed contiguously in the dense array, so iterating a pool is O(number of components)
+	// regardless of how big the entity index space is. The sparse array maps entity index -> dense index and
+	// is paged, so entity indices that never had this component don't cost anything beyond their page.
+	//
+	// Component addresses are stable until a component of the same type is removed, since removal
+	// moves the last component into the hole to keep the dense array packed.
+	class ComponentPool
+	{
+	public:
+		using DestroyFunc_t = void(*)( void* pComponent );
+		using MoveFunc_t = void(*)( void* pDst, void* pSrc );
+
+		static constexpr uint32_t INVALID_INDEX = UINT32_MAX;
+
+		ComponentPool( size_t component_size, DestroyFunc_t destroy_func, MoveFunc_t move_func )
+			:
+			m_Components( component_size, 0 ),
+			m_pDestroyFunc( destroy_func ),
+			m_pMoveFunc( move_func )
+		{}
+		~ComponentPool()
+		{
+			Clear();
+		}
+
+		ComponentPool( const ComponentPool& ) = delete;
+		ComponentPool& operator=( const ComponentPool& ) = delete;
+
+		bool Has( uint32_t entity_index ) const
+		{
+			return GetDenseIndex( entity_index ) != INVALID_INDEX;
+		}
+
+		// Returns the component for the given entity, entity must have the component
+		void* Get( uint32_t entity_index )
+		{
+			const uint32_t dense_index = GetDenseIndex( entity_index );
+			ASSERT( dense_index != INVALID_INDEX, "Tried to get component we don't have" );
+			return m_Components.Get( dense_index );
+		}
+		// Returns the component for the given entity, or nullptr if it doesn't have one
+		void* TryGet( uint32_t entity_index )
+		{
+			const uint32_t dense_index = GetDenseIndex( entity_index );
+			if( dense_index == INVALID_INDEX )
+			{
+				return nullptr;
+			}
+			return m_Components.Get( dense_index );
+		}
+
+		// Reserves a slot for the entity's component and returns its uninitialized memory.
+		// The caller is responsible for constructing the component in-place.
+		void* Insert( uint32_t entity_index )
+		{
+			uint32_t& sparse = EnsureSparse( entity_index );
+			ASSERT( sparse == INVALID_INDEX, "Added same component twice" );
+
+			const uint32_t dense_index = (uint32_t)m_DenseEntities.size();
+			m_Components.EnsureCapacity( dense_index + 1 );
+			m_DenseEntities.push_back( entity_index );
+			sparse = dense_index;
+
+			return m_Components.Get( dense_index );
+		}
+
+		// Destroys the entity's component, last component in the pool is moved into its slot
+		void Remove( uint32_t entity_index )
+		{
+			uint32_t& sparse = SparseRef( entity_index );
+			const uint32_t dense_index = sparse;
+			ASSERT( dense_index != INVALID_INDEX, "Removing non-existent component" );
+
+			void* pComponent = m_Components.Get( dense_index );
+			m_pDestroyFunc( pComponent );
+
+			const uint32_t last_index = (uint32_t)m_DenseEntities.size() - 1;
+			if( dense_index != last_index )
+			{
+				void* pLast = m_Components.Get( last_index );
+				m_pMoveFunc( pComponent, pLast );
+				m_pDestroyFunc( pLast );
+
+				const uint32_t moved_entity = m_DenseEntities[last_index];
+				m_DenseEntities[dense_index] = moved_entity;
+				SparseRef( moved_entity ) = dense_index;
+			}
+
+			m_DenseEntities.pop_back();
+			sparse = INVALID_INDEX;
+			m_iNumRemovals++;
+		}
+
+		// Destroys every component in the pool
+		void Clear()
+		{
+			for( uint32_t i = 0; i < (uint32_t)m_DenseEntities.size(); i++ )
+			{
+				m_pDestroyFunc( m_Components.Get( i ) );
+				SparseRef( m_DenseEntities[i] ) = INVALID_INDEX;
+			}
+			m_DenseEntities.clear();
+			m_iNumRemovals++;
+		}
+
+		// Number of components in the pool
+		size_t Size() const { return m_DenseEntities.size(); }
+		// Changes whenever components are removed, pointers into the pool taken before a change may be invalid
+		uint32_t GetNumRemovals() const { return m_iNumRemovals; }
+		// Entity index that owns the component at the given dense index
+		uint32_t GetEntityIndex( size_t dense_index ) const { return m_DenseEntities[dense_index]; }
+		// Component at the given dense index, in [0, Size())
+		void* GetDense( size_t dense_index ) { return m_Components.Get( dense_index ); }
+		// Packed list of entity indices that own a component in this pool
+		const std::vector<uint32_t>& GetEntities() const { return m_DenseEntities; }
+	private:
+		static constexpr uint32_t PAGE_SIZE = 4096;
+
+		uint32_t GetDenseIndex( uint32_t entity_index ) const
+		{
+			const size_t page = entity_index / PAGE_SIZE;
+			if( page >= m_SparsePages.size() || !m_SparsePages[page] )
+			{
+				return INVALID_INDEX;
+			}
+			return m_SparsePages[page][entity_index % PAGE_SIZE];
+		}
+
+		// Entity's sparse entry, page must already exist
+		uint32_t& SparseRef( uint32_t entity_index )
+		{
+			return m_SparsePages[entity_index / PAGE_SIZE][entity_index % PAGE_SIZE];
+		}
+
+		uint32_t& EnsureSparse( uint32_t entity_index )
+		{
+			const size_t page = entity_index / PAGE_SIZE;
+			if( page >= m_SparsePages.size() )
+			{
+				m_SparsePages.resize( page + 1 );
+			}
+			if( !m_SparsePages[page] )
+			{
+				m_SparsePages[page] = std::make_unique<uint32_t[]>( PAGE_SIZE );
+				std::fill_n( m_SparsePages[page].get(), PAGE_SIZE, INVALID_INDEX );
+			}
+			return m_SparsePages[page][entity_index % PAGE_SIZE];
+		}
+	private:
+		std::vector<std::unique_ptr<uint32_t[]>> m_SparsePages;
+		std::vector<uint32_t> m_DenseEntities;
+		ChunkedAllocator<1024> m_Components;
+		uint32_t m_iNumRemovals = 0;
+
+		DestroyFunc_t m_pDestroyFunc = nullptr;
+		MoveFunc_t m_pMoveFunc = nullptr;
+	};
+}
@@ -2,6 +2,9 @@
 #include "CoreEntityComponents.h"
 
 #include "Scene.h"
+#include "Util/JobSystem.h"
+#include "Util/Bits.h"
+#include "Globals.h"
 
 namespace Bat
 {
@@ -16,6 +19,8 @@ namespace Bat
 		BAT_COMPONENT_MEMBER( m_vecLocalRotation );
 	BAT_COMPONENT_END();
 
+	HierarchySystem* hierarchy_system = nullptr;
+
 	TransformComponent::TransformComponent( SceneNode* node )
 		:
 		m_pNode( node )
@@ -27,6 +32,7 @@ namespace Bat
 		{
 			CalculateCache();
 		}
+		DecomposeWorld();
 		return m_vecPosition;
 	}
 
@@ -37,9 +43,13 @@ namespace Bat
 
 	TransformComponent& TransformComponent::SetPosition( const Vec3& pos )
 	{
-		if( !IsDirty( HierarchyCache::POS ) && m_vecPosition == pos )
+		if( !IsDirty( HierarchyCache::POS ) )
 		{
-			return *this;
+			DecomposeWorld();
+			if( m_vecPosition == pos )
+			{
+				return *this;
+			}
 		}
 
 		MarkSelfAndChildrenDirty( HierarchyCache::POS );
@@ -48,6 +58,9 @@ namespace Bat
 		m_vecPosition = pos;
 		m_matLocalToWorld.SetTranslation( pos );
 
+		DecomposeLocal();
+		m_bLocalMatrixDirty = true;
+
 		SceneNode* parent = m_pNode->GetParent();
 		if( !parent )
 		{
@@ -70,6 +83,7 @@ namespace Bat
 		{
 			CalculateCache();
 		}
+		DecomposeWorld();
 		return m_vecRotation;
 	}
 
@@ -80,6 +94,7 @@ namespace Bat
 
 	TransformComponent& TransformComponent::SetRotation( const Vec3& rot )
 	{
+		DecomposeWorld();
 		if( !IsDirty( HierarchyCache::ROT ) && m_vecRotation == rot )
 		{
 			return *this;
@@ -92,6 +107,9 @@ namespace Bat
 		m_matLocalToWorld = Mat3x4::Scale( m_flScale ) * Mat3x4::RotateDeg( m_vecRotation );
 		m_matLocalToWorld.SetTranslation( m_vecPosition );
 
+		DecomposeLocal();
+		m_bLocalMatrixDirty = true;
+
 		SceneNode* parent = m_pNode->GetParent();
 		if( !parent )
 		{
@@ -115,6 +133,7 @@ namespace Bat
 		{
 			CalculateCache();
 		}
+		DecomposeWorld();
 		return m_flScale;
 	}
 
@@ -125,6 +144,7 @@ namespace Bat
 
 	TransformComponent& TransformComponent::SetLocalPosition( const Vec3& pos )
 	{
+		DecomposeLocal();
 		if( m_vecLocalPosition == pos )
 		{
 			return *this;
@@ -132,12 +152,14 @@ namespace Bat
 
 		MarkSelfAndChildrenDirty( HierarchyCache::POS );
 		m_vecLocalPosition = pos;
+		m_bLocalMatrixDirty = true;
 
 		return *this;
 	}
 
 	TransformComponent& TransformComponent::SetScale( float scale )
 	{
+		DecomposeWorld();
 		if( !IsDirty( HierarchyCache::SCALE ) && m_flScale == scale )
 		{
 			return *this;
@@ -150,6 +172,9 @@ namespace Bat
 		m_matLocalToWorld = Mat3x4::Scale( m_flScale ) * Mat3x4::RotateDeg( m_vecRotation );
 		m_matLocalToWorld.SetTranslation( m_vecPosition );
 
+		DecomposeLocal();
+		m_bLocalMatrixDirty = true;
+
 		SceneNode* parent = m_pNode->GetParent();
 		if( !parent )
 		{
@@ -169,6 +194,7 @@ namespace Bat
 
 	const Vec3& TransformComponent::GetLocalPosition() const
 	{
+		DecomposeLocal();
 		return m_vecLocalPosition;
 	}
 
@@ -179,12 +205,14 @@ namespace Bat
 
 	TransformComponent& TransformComponent::SetLocalRotation( const Vec3& rot )
 	{
+		DecomposeLocal();
 		if( m_vecLocalRotation == rot )
 		{
 			return *this;
 		}
 
 		m_vecLocalRotation = rot;
+		m_bLocalMatrixDirty = true;
 		MarkSelfAndChildrenDirty( HierarchyCache::ROT );
 
 		return *this;
@@ -192,17 +220,20 @@ namespace Bat
 
 	const Vec3& TransformComponent::GetLocalRotation() const
 	{
+		DecomposeLocal();
 		return m_vecLocalRotation;
 	}
 
 	TransformComponent& TransformComponent::SetLocalScale( float uniform_scale )
 	{
+		DecomposeLocal();
 		if( m_flLocalScale == uniform_scale )
 		{
 			return *this;
 		}
 
 		m_flLocalScale = uniform_scale;
+		m_bLocalMatrixDirty = true;
 		MarkSelfAndChildrenDirty( HierarchyCache::SCALE );
 
 		return *this;
@@ -210,13 +241,28 @@ namespace Bat
 
 	float TransformComponent::GetLocalScale() const
 	{
+		DecomposeLocal();
 		return m_flLocalScale;
 	}
 
 	void TransformComponent::SetLocalMatrix( const Mat3x4& local_matrix )
 	{
 		MarkSelfAndChildrenDirty( HierarchyCache::ALL );
-		local_matrix.DecomposeDeg( &m_vecLocalPosition, &m_vecLocalRotation, &m_flLocalScale );
+		m_matLocal = local_matrix;
+		m_bLocalMatrixDirty = false;
+		m_bLocalDecomposed = false;
+	}
+
+	const Mat3x4& TransformComponent::GetLocalMatrix() const
+	{
+		if( m_bLocalMatrixDirty )
+		{
+			m_matLocal = Mat3x4::Scale( m_flLocalScale ) *
+				Mat3x4::RotateDeg( m_vecLocalRotation ) *
+				Mat3x4::Translate( m_vecLocalPosition );
+			m_bLocalMatrixDirty = false;
+		}
+		return m_matLocal;
 	}
 
 	const Mat3x4& TransformComponent::LocalToWorldMatrix() const
@@ -234,14 +280,31 @@ namespace Bat
 	}
 
 	void TransformComponent::MarkSelfAndChildrenDirty( HierarchyCache cache_type )
+	{
+		// the hierarchy flags the rest of the subtree itself when it updates this entry
+		if( hierarchy_system && m_iHierarchyIndex != INVALID_HIERARCHY_INDEX )
+		{
+			hierarchy_system->MarkDirty( m_iHierarchyIndex );
+		}
+
+		MarkSubtreeDirty( cache_type );
+	}
+
+	void TransformComponent::MarkSubtreeDirty( HierarchyCache cache_type )
 	{
 		ASSERT( m_pNode, "No associated scene node" );
 
+		// if we're already dirty then so is everything below us, no need to walk the subtree again
+		if( ( m_Dirty & cache_type ) == cache_type )
+		{
+			return;
+		}
+
 		m_Dirty |= cache_type;
 		for( SceneNode& child_node : *m_pNode )
 		{
 			Entity child = child_node.Get();
-			child.Get<TransformComponent>().MarkSelfAndChildrenDirty( cache_type );
+			child.Get<TransformComponent>().MarkSubtreeDirty( cache_type );
 		}
 	}
 
@@ -257,41 +320,76 @@ namespace Bat
 
 	void TransformComponent::CalculateCache() const
 	{
-		ClearDirty( HierarchyCache::ALL );
+		const Mat3x4* parent_to_world = nullptr;
 
-		Entity ent = m_pNode->Get();
-		auto& t = ent.Get<TransformComponent>();
+		SceneNode* parent = m_pNode->GetParent();
+		if( parent )
+		{
+			Entity parent_ent = parent->Get();
+			// make sure the parent's cache is up to date first
+			parent_to_world = &parent_ent.Get<TransformComponent>().LocalToWorldMatrix();
+		}
 
-		Mat3x4 local = Mat3x4::Scale( m_flLocalScale ) *
-			Mat3x4::RotateDeg( m_vecLocalRotation ) *
-			Mat3x4::Translate( m_vecLocalPosition );
+		UpdateWorldCache( parent_to_world );
+	}
 
-		SceneNode* parent = m_pNode->GetParent();
-		if( !parent )
+	void TransformComponent::UpdateWorldCache( const Mat3x4* parent_to_world ) const
+	{
+		ClearDirty( HierarchyCache::ALL );
+
+		const Mat3x4& local = GetLocalMatrix();
+		if( !parent_to_world )
 		{
-			m_vecPosition = m_vecLocalPosition;
-			m_vecRotation = m_vecLocalRotation;
-			m_flScale = m_flLocalScale;
 			m_matLocalToWorld = local;
+			m_bWorldDecomposed = m_bLocalDecomposed;
+			if( m_bLocalDecomposed )
+			{
+				m_vecPosition = m_vecLocalPosition;
+				m_vecRotation = m_vecLocalRotation;
+				m_flScale = m_flLocalScale;
+			}
 		}
 		else
 		{
-			Entity parent_ent = parent->Get();
-			auto& parent_transform = parent_ent.Get<TransformComponent>();
+			// position/rotation/scale are extracted on demand, most transforms only ever need the matrix
+			m_matLocalToWorld = *parent_to_world * local;
+			m_bWorldDecomposed = false;
+		}
+	}
+
+	void TransformComponent::DecomposeLocal() const
+	{
+		if( !m_bLocalDecomposed )
+		{
+			m_matLocal.DecomposeDeg( &m_vecLocalPosition, &m_vecLocalRotation, &m_flLocalScale );
+			m_bLocalDecomposed = true;
+		}
+	}
 
-			m_matLocalToWorld = parent_transform.LocalToWorldMatrix() * local;
+	void TransformComponent::DecomposeWorld() const
+	{
+		if( !m_bWorldDecomposed )
+		{
 			m_matLocalToWorld.DecomposeDeg( &m_vecPosition, &m_vecRotation, &m_flScale );
+			m_bWorldDecomposed = true;
 		}
 	}
 
 	HierarchySystem::HierarchySystem()
 	{
+		ASSERT( !hierarchy_system, "Only one hierarchy system can exist at a time" );
+		hierarchy_system = this;
+
 		EventDispatcher::AddGlobalEventListener<SceneNodeAddedEvent>( *this );
+		EventDispatcher::AddGlobalEventListener<SceneNodeRemovedEvent>( *this );
 	}
 
 	HierarchySystem::~HierarchySystem()
 	{
 		EventDispatcher::RemoveGlobalEventListener<SceneNodeAddedEvent>( *this );
+		EventDispatcher::RemoveGlobalEventListener<SceneNodeRemovedEvent>( *this );
+
+		hierarchy_system = nullptr;
 	}
 
 	void HierarchySystem::OnEvent( const SceneNodeAddedEvent& e )
@@ -300,5 +398,236 @@ namespace Bat
 		auto& t = node.Ensure<TransformComponent>( nullptr );
 		t.m_pNode = e.node;
 		t.MarkSelfAndChildrenDirty( HierarchyCache::ALL );
+
+		// entity may already have an entry as a root, it needs to move under its new parent
+		m_bStructureDirty = true;
+	}
+
+	void HierarchySystem::OnEvent( const SceneNodeRemovedEvent& e )
+	{
+		m_bStructureDirty = true;
+	}
+
+	void HierarchySystem::Update( EntityManager& world, float dt )
+	{
+		m_MovedEntities.clear();
+
+		// transforms can also be added/removed without going through the scene graph
+		if( m_bStructureDirty || world.GetComponentCount<TransformComponent>() != m_iNumTransforms )
+		{
+			Rebuild( world );
+		}
+		else if( world.GetComponentRemovals<TransformComponent>() != m_iPoolRemovals && !GatherTransforms( world ) )
+		{
+			// entity was destroyed without leaving the scene graph
+			Rebuild( world );
+		}
+
+		for( size_t level = 0; level + 1 < m_LevelStarts.size(); level++ )
+		{
+			const size_t start = m_LevelStarts[level];
+			const size_t end = m_LevelStarts[level + 1];
+
+			const size_t num_dirty = CountDirty( start, end );
+			if( num_dirty == 0 )
+			{
+				continue;
+			}
+
+			if( num_dirty < PARALLEL_LEVEL_SIZE )
+			{
+				UpdateRange( start, end );
+			}
+			else
+			{
+				const uint32_t num_groups = (uint32_t)( ( end - start + PARALLEL_LEVEL_SIZE - 1 ) / PARALLEL_LEVEL_SIZE );
+
+				JobCounter counter;
+				JobSystem::Dispatch( num_groups, 1, [this, start, end]( JobDispatchArgs args )
+				{
+					const size_t group_start = start + args.jobIndex * PARALLEL_LEVEL_SIZE;
+					UpdateRange( group_start, std::min( group_start + PARALLEL_LEVEL_SIZE, end ) );
+				}, &counter );
+				// next level reads this one
+				JobSystem::Wait( counter );
+			}
+		}
+
+		// every entry that was visited moved, including transforms that were moved directly or
+		// recalculated on demand since the last update
+		for( size_t word = 0; word < m_iNumDirtyWords; word++ )
+		{
+			uint64_t bits = m_pDirtyBits[word].load( std::memory_order_relaxed );
+			if( !bits )
+			{
+				continue;
+			}
+
+			m_pDirtyBits[word].store( 0, std::memory_order_relaxed );
+			while( bits )
+			{
+				const size_t i = word * 64 + CountTrailingZeros( bits );
+				bits &= bits - 1;
+				m_MovedEntities.push_back( m_Entries[i].entity );
+			}
+		}
+	}
+
+	uint64_t HierarchySystem::GetDirtyBits( size_t word, size_t start, size_t end ) const
+	{
+		uint64_t bits = m_pDirtyBits[word].load( std::memory_order_relaxed );
+
+		const size_t word_start = word * 64;
+		if( start > word_start )
+		{
+			bits &= ~0ull << ( start - word_start );
+		}
+		if( end < word_start + 64 )
+		{
+			bits &= ~0ull >> ( word_start + 64 - end );
+		}
+
+		return bits;
+	}
+
+	size_t HierarchySystem::CountDirty( size_t start, size_t end ) const
+	{
+		size_t count = 0;
+		for( size_t word = start / 64; word * 64 < end; word++ )
+		{
+			count += PopCount( GetDirtyBits( word, start, end ) );
+		}
+		return count;
+	}
+
+	void HierarchySystem::UpdateRange( size_t start, size_t end )
+	{
+		for( size_t word = start / 64; word * 64 < end; word++ )
+		{
+			uint64_t bits = GetDirtyBits( word, start, end );
+			while( bits )
+			{
+				UpdateEntry( word * 64 + CountTrailingZeros( bits ) );
+				bits &= bits - 1;
+			}
+		}
+	}
+
+	void HierarchySystem::UpdateEntry( size_t index )
+	{
+		const HierarchyEntry& entry = m_Entries[index];
+		const TransformComponent* t = m_pTransforms[index];
+
+		// transforms that were set in world space or recalculated on demand are already up to date
+		if( t->IsDirty( HierarchyCache::ALL ) )
+		{
+			t->UpdateWorldCache( entry.parent >= 0 ? &m_WorldMatrices[entry.parent] : nullptr );
+		}
+		m_WorldMatrices[index] = t->m_matLocalToWorld;
+
+		// children are contiguous in the next level, so this only touches a word or two
+		const size_t children_start = entry.first_child;
+		const size_t children_end = children_start + entry.num_children;
+		for( size_t word = children_start / 64; word * 64 < children_end; word++ )
+		{
+			const size_t word_start = word * 64;
+			uint64_t mask = ~0ull;
+			if( children_start > word_start )
+			{
+				mask &= ~0ull << ( children_start - word_start );
+			}
+			if( children_end < word_start + 64 )
+			{
+				mask &= ~0ull >> ( word_start + 64 - children_end );
+			}
+			m_pDirtyBits[word].fetch_or( mask, std::memory_order_relaxed );
+		}
+	}
+
+	bool HierarchySystem::GatherTransforms( EntityManager& world )
+	{
+		for( size_t i = 0; i < m_Entries.size(); i++ )
+		{
+			// index may have been recycled by another entity since the rebuild
+			Entity e( world, m_Entries[i].entity );
+			if( world.IsStale( e ) || !world.HasComponent<TransformComponent>( e ) )
+			{
+				return false;
+			}
+			m_pTransforms[i] = &world.GetComponent<TransformComponent>( e );
+		}
+
+		m_iPoolRemovals = world.GetComponentRemovals<TransformComponent>();
+		return true;
+	}
+
+	void HierarchySystem::Rebuild( EntityManager& world )
+	{
+		m_Entries.clear();
+		m_LevelStarts.clear();
+
+		// roots first, then breadth first through the scene graph so every level ends up contiguous
+		for( auto [e, t] : world.View<TransformComponent>() )
+		{
+			// transforms that don't make it into the new hierarchy shouldn't flag an old entry
+			t.m_iHierarchyIndex = TransformComponent::INVALID_HIERARCHY_INDEX;
+			if( !t.m_pNode || !t.m_pNode->GetParent() )
+			{
+				m_Entries.push_back( { e.GetId(), -1, 0, 0 } );
+			}
+		}
+
+		size_t level_start = 0;
+		while( level_start < m_Entries.size() )
+		{
+			m_LevelStarts.push_back( level_start );
+
+			const size_t level_end = m_Entries.size();
+			for( size_t i = level_start; i < level_end; i++ )
+			{
+				Entity ent( world, m_Entries[i].entity );
+				SceneNode* node = ent.Get<TransformComponent>().m_pNode;
+				m_Entries[i].first_child = (uint32_t)m_Entries.size();
+				if( !node )
+				{
+					continue;
+				}
+
+				for( SceneNode& child : *node )
+				{
+					Entity child_ent = child.Get();
+					if( !world.IsStale( child_ent ) && child_ent.Has<TransformComponent>() )
+					{
+						m_Entries.push_back( { child_ent.GetId(), (int32_t)i, 0, 0 } );
+					}
+				}
+				m_Entries[i].num_children = (uint32_t)m_Entries.size() - m_Entries[i].first_child;
+			}
+
+			level_start = level_end;
+		}
+		m_LevelStarts.push_back( m_Entries.size() );
+
+		m_WorldMatrices.resize( m_Entries.size() );
+		m_pTransforms.resize( m_Entries.size() );
+		for( size_t i = 0; i < m_Entries.size(); i++ )
+		{
+			auto& t = Entity( world, m_Entries[i].entity ).Get<TransformComponent>();
+			t.m_iHierarchyIndex = (uint32_t)i;
+			m_pTransforms[i] = &t;
+		}
+
+		// world matrices are in the new order now, so every entry has to be recalculated
+		m_iNumDirtyWords = ( m_Entries.size() + 63 ) / 64;
+		m_pDirtyBits = std::make_unique<std::atomic<uint64_t>[]>( m_iNumDirtyWords );
+		for( size_t word = 0; word < m_iNumDirtyWords; word++ )
+		{
+			const size_t remaining = m_Entries.size() - word * 64;
+			m_pDirtyBits[word].store( remaining >= 64 ? ~0ull : ( 1ull << remaining ) - 1, std::memory_order_relaxed );
+		}
+
+		m_iNumTransforms = world.GetComponentCount<TransformComponent>();
+		m_iPoolRemovals = world.GetComponentRemovals<TransformComponent>();
+		m_bStructureDirty = false;
 	}
-}
\ No newline at end of file
+}
@@ -60,26 +60,50 @@ namespace Bat
 		TransformComponent& SetLocalScale( float uniform_scale );
 		float GetLocalScale() const;
 
+		// Sets the local transform without going through euler angles, the local position/rotation/scale
+		// are only extracted again if something asks for them
 		void SetLocalMatrix( const Mat3x4& local_matrix );
+		const Mat3x4& GetLocalMatrix() const;
 		const Mat3x4& LocalToWorldMatrix() const;
 		Mat3x4 WorldToLocalMatrix() const;
 	private:
 		bool IsDirty( HierarchyCache cache_type ) const;
 		void MarkSelfAndChildrenDirty( HierarchyCache cache_type );
+		void MarkSubtreeDirty( HierarchyCache cache_type );
 		void ClearDirty( HierarchyCache cache_type ) const;
 		void CalculateCache() const;
+		// Recalculates the world space cache, parent's cache must already be up to date
+		void UpdateWorldCache( const Mat3x4* parent_to_world ) const;
+		void DecomposeLocal() const;
+		void DecomposeWorld() const;
 	private:
+		static constexpr uint32_t INVALID_HIERARCHY_INDEX = UINT32_MAX;
+
 		SceneNode* m_pNode = nullptr;
-		Vec3 m_vecLocalPosition = { 0.0f, 0.0f, 0.0f };
-		float m_flLocalScale = 1.0f;
-		Vec3 m_vecLocalRotation = { 0.0f, 0.0f, 0.0f };
+		mutable Vec3 m_vecLocalPosition = { 0.0f, 0.0f, 0.0f };
+		mutable float m_flLocalScale = 1.0f;
+		mutable Vec3 m_vecLocalRotation = { 0.0f, 0.0f, 0.0f };
+		mutable Mat3x4 m_matLocal = Mat3x4::Identity();
+		// local position/rotation/scale are out of date with m_matLocal
+		mutable bool m_bLocalDecomposed = true;
+		// m_matLocal is out of date with the local position/rotation/scale
+		mutable bool m_bLocalMatrixDirty = false;
 		mutable HierarchyCache m_Dirty = HierarchyCache::ALL;
 		mutable Vec3 m_vecPosition = { 0.0f, 0.0f, 0.0f };
 		mutable Vec3 m_vecRotation = { 0.0f, 0.0f, 0.0f };
 		mutable float m_flScale = 1.0f;
 		mutable Mat3x4 m_matLocalToWorld = Mat3x4::Identity();
+		// world position/rotation/scale haven't been extracted from m_matLocalToWorld yet
+		mutable bool m_bWorldDecomposed = true;
+		// entry in the HierarchySystem, assigned when it rebuilds
+		uint32_t m_iHierarchyIndex = INVALID_HIERARCHY_INDEX;
 	};
 
+	// Keeps every transform in a flat array sorted by depth in the scene graph (parents always come before their children),
+	// and once per frame recalculates the world space transforms of everything that is dirty, one depth level at a time.
+	// Transforms flag their entry in a bitset when they change, and an updated entry flags its children (which are
+	// contiguous in the next level), so only the dirty parts of each level are visited.
+	// Big levels are split across the job system, transforms within a level only depend on the previous level.
 	class HierarchySystem
 	{
 	public:
@@ -90,6 +114,54 @@ namespace Bat
 		HierarchySystem( HierarchySystem&& ) = delete;
 		HierarchySystem& operator=( HierarchySystem&& ) = delete;
 
+		void Update( EntityManager& world, float dt );
+
 		void OnEvent( const SceneNodeAddedEvent& e );
+		void OnEvent( const SceneNodeRemovedEvent& e );
+
+		// Entities whose world transform changed since the previous update, including ones that were
+		// recalculated on demand outside of it. Valid until the next update.
+		const std::vector<Entity::Id>& GetMovedEntities() const { return m_MovedEntities; }
+
+		// Flags the entry for the next update, thread safe
+		void MarkDirty( uint32_t index )
+		{
+			m_pDirtyBits[index / 64].fetch_or( 1ull << ( index % 64 ), std::memory_order_relaxed );
+		}
+	private:
+		void Rebuild( EntityManager& world );
+		// Returns false if an entry's entity or transform has gone away
+		bool GatherTransforms( EntityManager& world );
+		void UpdateRange( size_t start, size_t end );
+		void UpdateEntry( size_t index );
+		size_t CountDirty( size_t start, size_t end ) const;
+		// Dirty bits in the given word that fall inside [start, end)
+		uint64_t GetDirtyBits( size_t word, size_t start, size_t end ) const;
+	private:
+		static constexpr size_t PARALLEL_LEVEL_SIZE = 256;
+
+		struct HierarchyEntry
+		{
+			Entity::Id entity;
+			// index of the parent's entry, -1 for roots
+			int32_t parent;
+			// children are contiguous in the next level
+			uint32_t first_child;
+			uint32_t num_children;
+		};
+
+		// depth sorted, entries for depth d are in [m_LevelStarts[d], m_LevelStarts[d + 1])
+		std::vector<HierarchyEntry> m_Entries;
+		std::vector<size_t> m_LevelStarts;
+		// world matrix of each entry, children read their parent's from here
+		std::vector<Mat3x4> m_WorldMatrices;
+		// transform of each entry, only gathered again when the pool has moved components around
+		std::vector<TransformComponent*> m_pTransforms;
+		std::unique_ptr<std::atomic<uint64_t>[]> m_pDirtyBits;
+		size_t m_iNumDirtyWords = 0;
+		std::vector<Entity::Id> m_MovedEntities;
+		size_t m_iNumTransforms = 0;
+		uint32_t m_iPoolRemovals = 0;
+		bool m_bStructureDirty = true;
 	};
 }
\ No newline at end of file
@@ -1,6 +1,8 @@
 #include "PCH.h"
 #include "Entity.h"
 
+#include "Util/Bits.h"
+
 namespace Bat
 {
 	EntityManager world;
@@ -18,15 +20,43 @@ namespace Bat
 	BAT_REFLECT_BEGIN( EntityManager );
 	BAT_REFLECT_END();
 
+	static ComponentPool::DestroyFunc_t GetComponentDestroyFunc( ComponentId id )
+	{
+		switch( id )
+		{
+#define GET_DESTROY_FUNC( component ) case ComponentId::component: return &Detail::DestroyComponent<ComponentId::component>;
+			BAT_COMPONENT_LIST( GET_DESTROY_FUNC )
+#undef GET_DESTROY_FUNC
+		default:
+			ASSERT( false, "Unhandled component type" );
+			return nullptr;
+		}
+	}
+
+	static ComponentPool::MoveFunc_t GetComponentMoveFunc( ComponentId id )
+	{
+		switch( id )
+		{
+#define GET_MOVE_FUNC( component ) case ComponentId::component: return &Detail::MoveComponent<ComponentId::component>;
+			BAT_COMPONENT_LIST( GET_MOVE_FUNC )
+#undef GET_MOVE_FUNC
+		default:
+			ASSERT( false, "Unhandled component type" );
+			return nullptr;
+		}
+	}
+
 	EntityManager::EntityManager()
 	{
 		m_EntityVersions.resize( INITIAL_ENTITIES );
 		m_EntityComponentMasks.resize( INITIAL_ENTITIES );
+		m_AliveBits.resize( ( INITIAL_ENTITIES + 63 ) / 64 );
 
 		for( int i = (int)ComponentId::INVALID + 1; i < (int)ComponentId::LAST; i++ )
 		{
-			TypeDescriptor component_desc = GetComponentTypeDescriptor( (ComponentId)i );
-			m_pComponentAllocators[i] = std::make_unique<ComponentAllocator>( component_desc.size );
+			const ComponentId id = (ComponentId)i;
+			TypeDescriptor component_desc = GetComponentTypeDescriptor( id );
+			m_pComponentPools[i] = std::make_unique<ComponentPool>( component_desc.size, GetComponentDestroyFunc( id ), GetComponentMoveFunc( id ) );
 		}
 	}
 
@@ -46,52 +76,59 @@ namespace Bat
 			version = m_EntityVersions[idx];
 		}
 
+		m_AliveBits[idx / 64] |= ( 1ull << ( idx % 64 ) );
+
 		Entity::Id id( idx, version );
 		Entity entity( *this, id );
 
-		DispatchEvent<EntityCreatedEvent>( entity );
+		if( m_bDeferEvents )
+		{
+			QueueCall( [this, entity]()
+			{
+				Entity e = entity;
+				if( !IsStale( e ) )
+				{
+					DispatchEvent<EntityCreatedEvent>( e );
+				}
+			} );
+		}
+		else
+		{
+			DispatchEvent<EntityCreatedEvent>( entity );
+		}
 
 		return entity;
 	}
 
 	void EntityManager::DestroyEntity( Entity entity )
 	{
+		ASSERT( !IsStale( entity ), "Tried to destroy an entity that was already destroyed" );
+
 		DispatchEvent<EntityDestroyedEvent>( entity );
 
-		const size_t entity_idx = entity.GetId().GetIndex();
+		const uint32_t entity_idx = entity.GetId().GetIndex();
 
 		for( auto i = (int)ComponentId::INVALID + 1; i < (int)ComponentId::LAST; i++ )
 		{
 			if( m_EntityComponentMasks[entity_idx].test( i ) )
 			{
-				auto& allocator = m_pComponentAllocators[i];
-				void* pComponent = allocator->Get( entity_idx );
-				switch( (ComponentId)i )
-				{
-#define DESTROY_COMPONENT( component ) case ComponentId::component: Detail::DestroyComponent<ComponentId::component>( pComponent ); break;
-					BAT_COMPONENT_LIST( DESTROY_COMPONENT )
-#undef DESTROY_COMPONENT
-				default:
-					ASSERT( false, "Unhandled component type" );
-				}
+				m_pComponentPools[i]->Remove( entity_idx );
 			}
 		}
 
 		m_EntityComponentMasks[entity_idx].reset();
 		m_EntityVersions[entity_idx]++; // update version so all other entities get invalidated
-	}
 
-	bool EntityManager::IsStale( Entity e )
-	{
-		return e.GetId().GetVersion() != m_EntityVersions[e.GetId().GetIndex()];
+		m_AliveBits[entity_idx / 64] &= ~( 1ull << ( entity_idx % 64 ) );
+		m_FreeList.push_back( entity_idx );
 	}
 
 	void* EntityManager::GetComponent( Entity entity, ComponentId id )
 	{
-		const size_t entity_idx = entity.GetId().GetIndex();
-		auto& allocator = GetComponentAllocator( id );
+		const uint32_t entity_idx = entity.GetId().GetIndex();
+		auto& pool = GetComponentPool( id );
 
-		return allocator.Get( entity_idx );
+		return pool.TryGet( entity_idx );
 	}
 
 	std::vector<ComponentId> EntityManager::GetComponentsList( Entity entity )
@@ -117,24 +154,50 @@ namespace Bat
 		{
 			m_EntityVersions.resize( capacity );
 			m_EntityComponentMasks.resize( capacity );
-
-			for( int i = (int)ComponentId::INVALID + 1; i < (int)ComponentId::LAST; i++ )
-			{
-				auto& allocator = m_pComponentAllocators[i];
-				allocator->EnsureCapacity( capacity );
-			}
 		}
+		if( m_AliveBits.size() * 64 < capacity )
+		{
+			m_AliveBits.resize( ( capacity + 63 ) / 64 );
+		}
+	}
+
+	ComponentPool& EntityManager::GetComponentPool( ComponentId id )
+	{
+		const size_t component_idx = (size_t)id;
+		ASSERT( m_pComponentPools[component_idx], "Tried to get non-existent component pool" );
+		return *m_pComponentPools[component_idx].get();
 	}
-	EntityManager::ComponentAllocator& EntityManager::GetComponentAllocator( ComponentId id )
+
+	const ComponentPool& EntityManager::GetComponentPool( ComponentId id ) const
 	{
 		const size_t component_idx = (size_t)id;
-		ASSERT( m_pComponentAllocators[component_idx], "Tried to get non-existent component allocator" );
-		return *m_pComponentAllocators[component_idx].get();
+		ASSERT( m_pComponentPools[component_idx], "Tried to get non-existent component pool" );
+		return *m_pComponentPools[component_idx].get();
 	}
 
-	void EntityManager::SortFreeList()
+	uint32_t EntityManager::FindNextAlive( uint32_t index ) const
 	{
-		std::sort( m_FreeList.begin(), m_FreeList.end() );
+		if( index >= m_iEntityHead )
+		{
+			return m_iEntityHead;
+		}
+
+		size_t word_idx = index / 64;
+		// mask off the bits below the starting index in the first word
+		uint64_t word = m_AliveBits[word_idx] & ( ~0ull << ( index % 64 ) );
+
+		const size_t num_words = ( (size_t)m_iEntityHead + 63 ) / 64;
+		while( !word )
+		{
+			word_idx++;
+			if( word_idx >= num_words )
+			{
+				return m_iEntityHead;
+			}
+			word = m_AliveBits[word_idx];
+		}
+
+		return (uint32_t)( word_idx * 64 ) + CountTrailingZeros( word );
 	}
 
 	TypeDescriptor GetComponentTypeDescriptor( ComponentId id )
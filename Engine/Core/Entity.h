@@ -8,7 +8,7 @@
 
 #include "Events/Event.h"
 #include "Events/EntityEvents.h"
-#include "Util/ChunkedAllocator.h"
+#include "ComponentPool.h"
 #include "Util/Reflect.h"
 
 namespace Bat
@@ -23,6 +23,7 @@ namespace Bat
 	_(PARTICLE_EMITTER)     \
 	_(CHARACTER_CONTROLLER) \
 	_(BEHAVIOUR_TREE)       \
+	_(CROWD_AGENT)          \
 
 	enum class ComponentId
 	{
@@ -44,6 +45,8 @@ namespace Bat
 	TypeDescriptor Bat::GetComponentTypeDescriptor<classname::GetId()>() { return classname::Reflect(); } \
 	template <> \
 	void Bat::Detail::DestroyComponent<classname::GetId()>( void* pComponent ) { reinterpret_cast<classname*>( pComponent )->~classname(); } \
+	template <> \
+	void Bat::Detail::MoveComponent<classname::GetId()>( void* pDst, void* pSrc ) { new( pDst ) classname( std::move( *reinterpret_cast<classname*>( pSrc ) ) ); } \
 	BAT_REFLECT_BEGIN( classname );
 
 #define BAT_COMPONENT_MEMBER( membername ) \
@@ -61,9 +64,13 @@ namespace Bat
 	{
 		template <ComponentId Id>
 		void DestroyComponent( void* pComponent );
+		template <ComponentId Id>
+		void MoveComponent( void* pDst, void* pSrc );
 	}
 
 	class EntityManager;
+	template <typename... Cs>
+	class EntityView;
 
 	class Entity
 	{
@@ -139,6 +146,13 @@ namespace Bat
 		Entity CreateEntity();
 		void DestroyEntity( Entity entity );
 
+		// While set, entity created and component added events are queued and dispatched on the next
+		// EventDispatcher::FlushQueuedEvents() instead of right away, e.g. while a scene is loading. They are dropped
+		// if the entity/component is gone by then. Removed/destroyed events stay synchronous, listeners need the
+		// component while it still exists.
+		void SetDeferEvents( bool defer ) { m_bDeferEvents = defer; }
+		bool IsDeferringEvents() const { return m_bDeferEvents; }
+
 		inline bool IsStale( Entity e );
 
 		template <typename C, typename... Args>
@@ -154,24 +168,35 @@ namespace Bat
 		bool HasComponent( Entity entity );
 		std::vector<ComponentId> GetComponentsList( Entity entity );
 
+		// Number of entities that currently have the given component
+		template <typename C>
+		size_t GetComponentCount() const;
+		// Changes whenever a component of the given type is removed, references to components of that type
+		// taken before a change may no longer be valid
+		template <typename C>
+		uint32_t GetComponentRemovals() const;
+		// Calls func( Entity, C& ) for every entity that has the component, only touches the packed component storage
+		template <typename C, typename Func>
+		void ForEachComponent( Func&& func );
+
+		// Iterates over every entity that has all of the given components, see EntityView
+		template <typename... Cs>
+		EntityView<Cs...> View();
+
+		// Iterates over every alive entity, liveness is tracked with a bitset so
+		// iterating doesn't need to allocate or sort anything
 		class Iterator
 		{
 		public:
 			Iterator( EntityManager* manager, uint32_t index )
 				:
 				m_pManager( manager ),
-				m_iIndex( index )
-			{
-				manager->SortFreeList();
-			}
+				m_iIndex( manager->FindNextAlive( index ) )
+			{}
 
 			Iterator& operator++()
 			{
-				m_iIndex++;
-				while( m_iIndex < m_pManager->m_iEntityHead && !IsValid() )
-				{
-					m_iIndex++;
-				}
+				m_iIndex = m_pManager->FindNextAlive( m_iIndex + 1 );
 				return *this;
 			}
 			bool operator==( const Iterator& rhs ) const
@@ -186,64 +211,83 @@ namespace Bat
 			{
 				return Entity( *m_pManager, Entity::Id( m_iIndex, m_pManager->m_EntityVersions[m_iIndex] ) );
 			}
-		private:
-			bool IsValid()
-			{
-				const std::vector<uint32_t>& free_list = m_pManager->m_FreeList;
-				if( m_iFreeIndex < free_list.size() && m_iIndex == free_list[m_iFreeIndex] )
-				{
-					m_iFreeIndex++;
-					return false;
-				}
-				return true;
-			}
 		private:
 			friend class EntityManager;
 
 			EntityManager* m_pManager = nullptr;
 			uint32_t m_iIndex = 0;
-			size_t m_iFreeIndex = 0;
 		};
 
 		Iterator begin() { return Iterator( this, 0 ); }
 		Iterator end() { return Iterator( this, m_iEntityHead ); }
 
+		// Number of alive entities
+		size_t GetEntityCount() const { return m_iEntityHead - m_FreeList.size(); }
+
 		void EnsureEntityCapacity( uint32_t index );
 	private:
-		using ComponentAllocator = ChunkedAllocator<8192>;
+		template <typename... Cs>
+		friend class EntityView;
 
-		ComponentAllocator& GetComponentAllocator( ComponentId id );
+		ComponentPool& GetComponentPool( ComponentId id );
+		const ComponentPool& GetComponentPool( ComponentId id ) const;
+		template <typename C>
+		ComponentPool& GetComponentPool();
 		template <typename C>
-		ComponentAllocator& GetComponentAllocator();
+		const ComponentPool& GetComponentPool() const;
 
-		void SortFreeList();
+		// Returns the first alive entity index >= index, or m_iEntityHead if there are none
+		uint32_t FindNextAlive( uint32_t index ) const;
 	private:
 		static constexpr size_t MAX_COMPONENTS = 100;
 		static constexpr size_t INITIAL_ENTITIES = 1000;
 
 		std::vector<uint32_t> m_EntityVersions;
 		std::vector<uint32_t> m_FreeList;
+		std::vector<uint64_t> m_AliveBits;
 		uint32_t m_iEntityHead = 0;
 
 		using ComponentMask = std::bitset<MAX_COMPONENTS>;
 		std::vector<ComponentMask> m_EntityComponentMasks;
-		std::array<std::unique_ptr<ComponentAllocator>, MAX_COMPONENTS> m_pComponentAllocators;
+		std::array<std::unique_ptr<ComponentPool>, MAX_COMPONENTS> m_pComponentPools;
+
+		bool m_bDeferEvents = false;
 	};
 
+	inline bool EntityManager::IsStale( Entity e )
+	{
+		return e.GetId().GetVersion() != m_EntityVersions[e.GetId().GetIndex()];
+	}
+
 	template<typename C, typename... Args>
 	inline C& EntityManager::AddComponent( Entity entity, Args&&... args )
 	{
 		const size_t component_idx = C::GetIndex();
 		const size_t entity_idx = entity.GetId().GetIndex();
 		ASSERT( !m_EntityComponentMasks[entity_idx].test( component_idx ), "Added same component twice" );
-		ComponentAllocator& allocator = GetComponentAllocator<C>();
+		ComponentPool& pool = GetComponentPool<C>();
 
-		void* pAlloc = allocator.Get( entity_idx );
+		void* pAlloc = pool.Insert( (uint32_t)entity_idx );
 		C* pComponent = new( pAlloc ) C{ std::forward<Args>( args )... };
 
 		m_EntityComponentMasks[entity_idx].set( component_idx );
 
-		DispatchEvent<ComponentAddedEvent<C>>( entity, *pComponent );
+		if( m_bDeferEvents )
+		{
+			// the component can move around in its pool until then, look it up again
+			QueueCall( [this, entity]()
+			{
+				Entity e = entity;
+				if( !IsStale( e ) && HasComponent<C>( e ) )
+				{
+					DispatchEvent<ComponentAddedEvent<C>>( e, GetComponent<C>( e ) );
+				}
+			} );
+		}
+		else
+		{
+			DispatchEvent<ComponentAddedEvent<C>>( entity, *pComponent );
+		}
 
 		return *pComponent;
 	}
@@ -254,11 +298,11 @@ namespace Bat
 		const size_t component_idx = C::GetIndex();
 		const size_t entity_idx = entity.GetId().GetIndex();
 		ASSERT( m_EntityComponentMasks[entity_idx].test( component_idx ), "Removing non-existent component" );
-		ComponentAllocator& allocator = GetComponentAllocator<C>();
+		ComponentPool& pool = GetComponentPool<C>();
 
-		C* pComponent = reinterpret_cast<C*>( allocator.Get( entity_idx ) );
+		C* pComponent = reinterpret_cast<C*>( pool.Get( (uint32_t)entity_idx ) );
 		DispatchEvent<ComponentRemovedEvent<C>>( entity, *pComponent );
-		pComponent->~C();
+		pool.Remove( (uint32_t)entity_idx );
 
 		m_EntityComponentMasks[entity_idx].reset( component_idx ); // clear component mask
 	}
@@ -267,10 +311,10 @@ namespace Bat
 	inline C& EntityManager::GetComponent( Entity entity )
 	{
 		ASSERT( HasComponent<C>( entity ), "Tried to get component we don't have" );
-		const size_t entity_idx = entity.GetId().GetIndex();
-		ComponentAllocator& allocator = GetComponentAllocator<C>();
+		const uint32_t entity_idx = entity.GetId().GetIndex();
+		ComponentPool& pool = GetComponentPool<C>();
 
-		C* pComponent = reinterpret_cast<C*>( allocator.Get( entity_idx ) );
+		C* pComponent = reinterpret_cast<C*>( pool.Get( entity_idx ) );
 		return *pComponent;
 	}
 
@@ -278,10 +322,10 @@ namespace Bat
 	inline const C& EntityManager::GetComponent( Entity entity ) const
 	{
 		ASSERT( HasComponent<C>( entity ), "Tried to get component we don't have" );
-		const size_t entity_idx = entity.GetId().GetIndex();
-		ComponentAllocator& allocator = GetComponentAllocator<C>();
+		const uint32_t entity_idx = entity.GetId().GetIndex();
+		ComponentPool& pool = const_cast<EntityManager*>( this )->GetComponentPool<C>();
 
-		const C* pComponent = reinterpret_cast<const C*>( allocator.Get( entity_idx ) );
+		const C* pComponent = reinterpret_cast<const C*>( pool.Get( entity_idx ) );
 		return *pComponent;
 	}
 
@@ -294,10 +338,41 @@ namespace Bat
 	}
 
 	template<typename C>
-	inline EntityManager::ComponentAllocator& EntityManager::GetComponentAllocator()
+	inline size_t EntityManager::GetComponentCount() const
+	{
+		return GetComponentPool<C>().Size();
+	}
+
+	template<typename C>
+	inline uint32_t EntityManager::GetComponentRemovals() const
+	{
+		return GetComponentPool<C>().GetNumRemovals();
+	}
+
+	template<typename C, typename Func>
+	inline void EntityManager::ForEachComponent( Func&& func )
+	{
+		ComponentPool& pool = GetComponentPool<C>();
+		for( size_t i = 0; i < pool.Size(); i++ )
+		{
+			const uint32_t entity_idx = pool.GetEntityIndex( i );
+			Entity entity( *this, Entity::Id( entity_idx, m_EntityVersions[entity_idx] ) );
+			func( entity, *reinterpret_cast<C*>( pool.GetDense( i ) ) );
+		}
+	}
+
+	template<typename C>
+	inline ComponentPool& EntityManager::GetComponentPool()
 	{
 		const ComponentId component_id = C::GetId();
-		return GetComponentAllocator( component_id );
+		return GetComponentPool( component_id );
+	}
+
+	template<typename C>
+	inline const ComponentPool& EntityManager::GetComponentPool() const
+	{
+		const ComponentId component_id = C::GetId();
+		return GetComponentPool( component_id );
 	}
 
 	template<typename C, typename ...Args>
@@ -341,4 +416,6 @@ namespace Bat
 	}
 
 	extern EntityManager world;
-}
\ No newline at end of file
+}
+
+#include "EntityView.h"
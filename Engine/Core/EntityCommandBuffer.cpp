@@ -0,0 +1,240 @@
+#include "PCH.h"
+#include "EntityCommandBuffer.h"
+
+#include "Util/JobSystem.h"
+
+namespace Bat
+{
+	EntityCommandBuffer::EntityCommandBuffer( uint32_t buffer_index )
+		:
+		m_iBufferIndex( buffer_index )
+	{}
+
+	EntityCommandBuffer::~EntityCommandBuffer()
+	{
+		Reset();
+	}
+
+	Entity EntityCommandBuffer::CreateEntity()
+	{
+		ASSERT( m_iNumCreated <= DEFERRED_INDEX_MASK, "Too many entities created in one command buffer" );
+
+		const uint32_t deferred_index = (m_iBufferIndex << DEFERRED_INDEX_BITS) | m_iNumCreated;
+		m_iNumCreated++;
+
+		Entity entity( world, Entity::Id( deferred_index, DEFERRED_VERSION ) );
+		Record( CommandType::CREATE, entity );
+		return entity;
+	}
+
+	void EntityCommandBuffer::DestroyEntity( Entity entity )
+	{
+		Record( CommandType::DESTROY, entity );
+	}
+
+	void EntityCommandBuffer::Playback( EntityManager& world )
+	{
+		// placeholders are resolved by buffer index, so put ourselves in our slot
+		std::vector<EntityCommandBuffer*> buffers( m_iBufferIndex + 1, nullptr );
+		buffers[m_iBufferIndex] = this;
+
+		PlaybackBuffers( world, buffers );
+	}
+
+	void EntityCommandBuffer::Reset()
+	{
+		for( const Command& cmd : m_Commands )
+		{
+			if( cmd.pDestroy )
+			{
+				cmd.pDestroy( cmd.pData );
+			}
+		}
+
+		m_Commands.clear();
+		m_CreatedEntities.clear();
+		m_iNumCreated = 0;
+		m_iSortKey = 0;
+		// keep the blocks around for the next frame
+		m_iBlock = 0;
+		m_iBlockOffset = 0;
+	}
+
+	void* EntityCommandBuffer::AllocData( size_t size, size_t alignment )
+	{
+		ASSERT( size + alignment <= BLOCK_SIZE, "Command data too large" );
+
+		while( true )
+		{
+			if( m_iBlock == m_Blocks.size() )
+			{
+				m_Blocks.emplace_back( std::make_unique<char[]>( BLOCK_SIZE ) );
+			}
+
+			char* pBlock = m_Blocks[m_iBlock].get();
+			const uintptr_t start = reinterpret_cast<uintptr_t>( pBlock + m_iBlockOffset );
+			const uintptr_t aligned = (start + alignment - 1) & ~(uintptr_t)(alignment - 1);
+			const size_t offset = m_iBlockOffset + (size_t)(aligned - start);
+			if( offset + size <= BLOCK_SIZE )
+			{
+				m_iBlockOffset = offset + size;
+				return pBlock + offset;
+			}
+
+			// doesn't fit, move on to the next block
+			m_iBlock++;
+			m_iBlockOffset = 0;
+		}
+	}
+
+	void EntityCommandBuffer::Record( CommandType type, Entity entity, void* pData, ExecuteFunc_t execute, DestroyFunc_t destroy )
+	{
+		Command cmd;
+		cmd.type = type;
+		cmd.sort_key = m_iSortKey;
+		cmd.buffer_index = m_iBufferIndex;
+		cmd.entity = entity.GetId();
+		cmd.pData = pData;
+		cmd.pExecute = execute;
+		cmd.pDestroy = destroy;
+		m_Commands.push_back( cmd );
+	}
+
+	void EntityCommandBuffer::PlaybackBuffers( EntityManager& world, const std::vector<EntityCommandBuffer*>& buffers )
+	{
+		// gather in buffer order so the stable sort breaks sort key ties by buffer, then record order
+		std::vector<const Command*> creates;
+		std::vector<const Command*> commands;
+		for( EntityCommandBuffer* buffer : buffers )
+		{
+			if( !buffer )
+			{
+				continue;
+			}
+
+			buffer->m_CreatedEntities.resize( buffer->m_iNumCreated );
+			for( const Command& cmd : buffer->m_Commands )
+			{
+				if( cmd.type == CommandType::CREATE )
+				{
+					creates.push_back( &cmd );
+				}
+				else
+				{
+					commands.push_back( &cmd );
+				}
+			}
+		}
+
+		auto sort_key_less = []( const Command* a, const Command* b )
+		{
+			return a->sort_key < b->sort_key;
+		};
+		std::stable_sort( creates.begin(), creates.end(), sort_key_less );
+		std::stable_sort( commands.begin(), commands.end(), sort_key_less );
+
+		// ties between buffers would be broken by thread index, which depends on how jobs got scheduled
+		auto check_deterministic = []( const std::vector<const Command*>& sorted )
+		{
+			for( size_t i = 1; i < sorted.size(); i++ )
+			{
+				ASSERT( sorted[i - 1]->sort_key != sorted[i]->sort_key || sorted[i - 1]->buffer_index == sorted[i]->buffer_index,
+					"Commands with sort key %u were recorded on different threads, playback order isn't deterministic", sorted[i]->sort_key );
+			}
+		};
+		check_deterministic( creates );
+		check_deterministic( commands );
+
+		// creates go first so every placeholder entity is resolved by the time other commands reference it
+		for( const Command* cmd : creates )
+		{
+			const uint32_t buffer_index = cmd->entity.GetIndex() >> DEFERRED_INDEX_BITS;
+			const uint32_t created_index = cmd->entity.GetIndex() & DEFERRED_INDEX_MASK;
+			buffers[buffer_index]->m_CreatedEntities[created_index] = world.CreateEntity();
+		}
+
+		for( const Command* cmd : commands )
+		{
+			Execute( world, *cmd, buffers );
+		}
+
+		for( EntityCommandBuffer* buffer : buffers )
+		{
+			if( buffer )
+			{
+				buffer->Reset();
+			}
+		}
+	}
+
+	Entity EntityCommandBuffer::Resolve( EntityManager& world, Entity::Id id, const std::vector<EntityCommandBuffer*>& buffers )
+	{
+		if( id.GetVersion() != DEFERRED_VERSION )
+		{
+			return Entity( world, id );
+		}
+
+		const uint32_t buffer_index = id.GetIndex() >> DEFERRED_INDEX_BITS;
+		const uint32_t created_index = id.GetIndex() & DEFERRED_INDEX_MASK;
+		ASSERT( buffer_index < buffers.size() && buffers[buffer_index], "Placeholder entity from another command buffer" );
+		return buffers[buffer_index]->m_CreatedEntities[created_index];
+	}
+
+	void EntityCommandBuffer::Execute( EntityManager& world, const Command& cmd, const std::vector<EntityCommandBuffer*>& buffers )
+	{
+		Entity entity = Resolve( world, cmd.entity, buffers );
+
+		// an earlier command already destroyed this entity, nothing left to do
+		if( world.IsStale( entity ) )
+		{
+			return;
+		}
+
+		switch( cmd.type )
+		{
+		case CommandType::DESTROY:
+			world.DestroyEntity( entity );
+			break;
+		case CommandType::ADD_COMPONENT:
+		case CommandType::REMOVE_COMPONENT:
+			cmd.pExecute( world, entity, cmd.pData );
+			break;
+		default:
+			ASSERT( false, "Unhandled command type" );
+		}
+	}
+
+	EntityCommandQueue::EntityCommandQueue()
+	{
+		const uint32_t num_threads = JobSystem::GetThreadCount();
+		ASSERT( num_threads > 0, "Job system must be initialized before creating a command queue" );
+
+		m_pBuffers.reserve( num_threads );
+		for( uint32_t i = 0; i < num_threads; i++ )
+		{
+			m_pBuffers.emplace_back( std::make_unique<EntityCommandBuffer>( i ) );
+		}
+	}
+
+	EntityCommandBuffer& EntityCommandQueue::GetThreadBuffer( uint32_t sort_key )
+	{
+		const uint32_t thread_index = JobSystem::GetThreadIndex();
+		ASSERT( thread_index < m_pBuffers.size(), "Command buffers can only be recorded from job system threads" );
+
+		EntityCommandBuffer& buffer = *m_pBuffers[thread_index];
+		buffer.SetSortKey( sort_key );
+		return buffer;
+	}
+
+	void EntityCommandQueue::Playback( EntityManager& world )
+	{
+		std::vector<EntityCommandBuffer*> buffers;
+		buffers.reserve( m_pBuffers.size() );
+		for( auto& pBuffer : m_pBuffers )
+		{
+			buffers.push_back( pBuffer.get() );
+		}
+
+		EntityCommandBuffer::PlaybackBuffers( world, buffers );
+	}
+}
@@ -0,0 +1,148 @@
+#pragma once
+
+#include <memory>
+#include <vector>
+
+#include "Entity.h"
+
+namespace Bat
+{
+	// Records structural changes (create/destroy entities, add/remove components) so they can be
+	// applied later at a sync point, instead of mutating the EntityManager while systems are running on other threads.
+	// A single buffer must only be recorded into from one thread at a time, see EntityCommandQueue for the per-thread version.
+	//
+	// Entities returned by CreateEntity() are placeholders until the buffer is played back,
+	// they can only be used for recording further commands into the same buffer/queue.
+	class EntityCommandBuffer
+	{
+	public:
+		EntityCommandBuffer( uint32_t buffer_index = 0 );
+		~EntityCommandBuffer();
+		EntityCommandBuffer( const EntityCommandBuffer& ) = delete;
+		EntityCommandBuffer& operator=( const EntityCommandBuffer& ) = delete;
+
+		// Commands recorded after this will be played back in ascending sort key order.
+		// Use something deterministic, like the index of the entity being processed, to get
+		// the same playback order no matter which threads recorded the commands.
+		void SetSortKey( uint32_t sort_key ) { m_iSortKey = sort_key; }
+
+		Entity CreateEntity();
+		void DestroyEntity( Entity entity );
+		template <typename C, typename... Args>
+		void AddComponent( Entity entity, Args&&... args );
+		template <typename C>
+		void RemoveComponent( Entity entity );
+
+		bool IsEmpty() const { return m_Commands.empty(); }
+
+		// Applies all recorded commands to the world and clears the buffer. Must be called from the main thread.
+		void Playback( EntityManager& world );
+		// Throws away all recorded commands
+		void Reset();
+
+		// Whether the entity is a placeholder created by a command buffer that hasn't been played back yet
+		static bool IsDeferred( Entity entity ) { return entity.GetId().GetVersion() == DEFERRED_VERSION; }
+	private:
+		friend class EntityCommandQueue;
+
+		static constexpr uint32_t DEFERRED_VERSION = UINT32_MAX;
+		static constexpr uint32_t DEFERRED_INDEX_BITS = 20;
+		static constexpr uint32_t DEFERRED_INDEX_MASK = (1u << DEFERRED_INDEX_BITS) - 1;
+		static constexpr size_t BLOCK_SIZE = 16 * 1024;
+
+		enum class CommandType
+		{
+			CREATE,
+			DESTROY,
+			ADD_COMPONENT,
+			REMOVE_COMPONENT
+		};
+
+		using ExecuteFunc_t = void(*)( EntityManager& world, Entity entity, void* pData );
+		using DestroyFunc_t = void(*)( void* pData );
+
+		struct Command
+		{
+			CommandType type;
+			uint32_t sort_key;
+			uint32_t buffer_index;
+			Entity::Id entity;
+			void* pData;
+			ExecuteFunc_t pExecute;
+			DestroyFunc_t pDestroy;
+		};
+
+		// Allocates storage for command data, the storage never moves until Reset()
+		void* AllocData( size_t size, size_t alignment );
+		void Record( CommandType type, Entity entity, void* pData = nullptr, ExecuteFunc_t execute = nullptr, DestroyFunc_t destroy = nullptr );
+
+		// Plays back and resets the given buffers, a buffer's position in the list must match its buffer index
+		static void PlaybackBuffers( EntityManager& world, const std::vector<EntityCommandBuffer*>& buffers );
+		// Runs a single non-CREATE command
+		static void Execute( EntityManager& world, const Command& cmd, const std::vector<EntityCommandBuffer*>& buffers );
+		static Entity Resolve( EntityManager& world, Entity::Id id, const std::vector<EntityCommandBuffer*>& buffers );
+	private:
+		std::vector<Command> m_Commands;
+		std::vector<std::unique_ptr<char[]>> m_Blocks;
+		size_t m_iBlock = 0;
+		size_t m_iBlockOffset = 0;
+
+		std::vector<Entity> m_CreatedEntities;
+		uint32_t m_iNumCreated = 0;
+		uint32_t m_iBufferIndex = 0;
+		uint32_t m_iSortKey = 0;
+	};
+
+	// One command buffer per job system thread, so systems running in parallel can record
+	// structural changes without locking. Playback merges all buffers by sort key.
+	class EntityCommandQueue
+	{
+	public:
+		// Job system must already be initialized
+		EntityCommandQueue();
+
+		// Command buffer owned by the calling thread, with its sort key set for the commands recorded next.
+		// Must be called from a job system thread. Which thread runs a job isn't deterministic, so the key has to
+		// come from what is being recorded for (e.g. the entity's index), and no two threads may record with the same key.
+		EntityCommandBuffer& GetThreadBuffer( uint32_t sort_key );
+
+		// Applies every buffer's commands to the world and clears them. Must be called from the main thread
+		// while no jobs are recording. Entity creates run first, then the remaining commands,
+		// each ordered by (sort key, record order).
+		void Playback( EntityManager& world );
+	private:
+		std::vector<std::unique_ptr<EntityCommandBuffer>> m_pBuffers;
+	};
+
+	template <typename C, typename... Args>
+	inline void EntityCommandBuffer::AddComponent( Entity entity, Args&&... args )
+	{
+		void* pData = AllocData( sizeof( C ), alignof( C ) );
+		new( pData ) C{ std::forward<Args>( args )... };
+
+		Record( CommandType::ADD_COMPONENT, entity, pData,
+			[]( EntityManager& world, Entity e, void* pComponent )
+			{
+				world.AddComponent<C>( e, std::move( *reinterpret_cast<C*>( pComponent ) ) );
+			},
+			[]( void* pComponent )
+			{
+				reinterpret_cast<C*>( pComponent )->~C();
+			}
+		);
+	}
+
+	template <typename C>
+	inline void EntityCommandBuffer::RemoveComponent( Entity entity )
+	{
+		Record( CommandType::REMOVE_COMPONENT, entity, nullptr,
+			[]( EntityManager& world, Entity e, void* )
+			{
+				if( world.HasComponent<C>( e ) )
+				{
+					world.RemoveComponent<C>( e );
+				}
+			}
+		);
+	}
+}
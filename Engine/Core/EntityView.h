@@ -0,0 +1,155 @@
+#pragma once
+
+#include <tuple>
+
+#include "Entity.h"
+#include "Util/JobSystem.h"
+
+namespace Bat
+{
+	// Iterates every entity that has all of the given components, e.g.
+	//	for( auto [e, t, model] : world.View<TransformComponent, ModelComponent>() ) { ... }
+	// The smallest of the component pools drives the iteration, and each candidate is filtered
+	// with a single mask test, so the cost scales with the rarest component rather than the world size.
+	// Entities must not gain/lose any of the viewed components while a view is being iterated.
+	template <typename... Cs>
+	class EntityView
+	{
+		static_assert( sizeof...(Cs) > 0, "View needs at least one component" );
+	public:
+		EntityView( EntityManager& manager )
+			:
+			m_pManager( &manager ),
+			m_Pools{ &manager.GetComponentPool<Cs>()... }
+		{
+			(m_Mask.set( Cs::GetIndex() ), ...);
+
+			m_pDriver = m_Pools[0];
+			for( ComponentPool* pool : m_Pools )
+			{
+				if( pool->Size() < m_pDriver->Size() )
+				{
+					m_pDriver = pool;
+				}
+			}
+		}
+
+		class Iterator
+		{
+		public:
+			Iterator( const EntityView* view, size_t dense_index )
+				:
+				m_pView( view ),
+				m_iDenseIndex( dense_index )
+			{
+				SkipInvalid();
+			}
+
+			Iterator& operator++()
+			{
+				m_iDenseIndex++;
+				SkipInvalid();
+				return *this;
+			}
+			bool operator==( const Iterator& rhs ) const
+			{
+				return m_iDenseIndex == rhs.m_iDenseIndex;
+			}
+			bool operator!=( const Iterator& rhs ) const
+			{
+				return !(*this == rhs);
+			}
+			std::tuple<Entity, Cs&...> operator*() const
+			{
+				return m_pView->Fetch( m_pView->m_pDriver->GetEntityIndex( m_iDenseIndex ) );
+			}
+		private:
+			void SkipInvalid()
+			{
+				const size_t size = m_pView->m_pDriver->Size();
+				while( m_iDenseIndex < size && !m_pView->Matches( m_pView->m_pDriver->GetEntityIndex( m_iDenseIndex ) ) )
+				{
+					m_iDenseIndex++;
+				}
+			}
+		private:
+			const EntityView* m_pView = nullptr;
+			size_t m_iDenseIndex = 0;
+		};
+
+		Iterator begin() const { return Iterator( this, 0 ); }
+		Iterator end() const { return Iterator( this, m_pDriver->Size() ); }
+
+		// Upper bound on the number of entities this view will visit
+		size_t SizeHint() const { return m_pDriver->Size(); }
+
+		// Calls func( Entity, Cs&... ) for every matching entity
+		template <typename Func>
+		void ForEach( Func&& func ) const
+		{
+			const size_t size = m_pDriver->Size();
+			for( size_t i = 0; i < size; i++ )
+			{
+				const uint32_t entity_idx = m_pDriver->GetEntityIndex( i );
+				if( Matches( entity_idx ) )
+				{
+					std::apply( func, Fetch( entity_idx ) );
+				}
+			}
+		}
+
+		// Calls func( Entity, Cs&... ) for every matching entity, spread across the job system.
+		// Blocks until every entity has been visited. func must be safe to call concurrently for different entities.
+		template <typename Func>
+		void ParallelForEach( Func&& func, uint32_t group_size = 64 ) const
+		{
+			const uint32_t size = (uint32_t)m_pDriver->Size();
+			if( size == 0 )
+			{
+				return;
+			}
+
+			const EntityView* view = this;
+			auto* pFunc = &func;
+
+			JobCounter counter;
+			JobSystem::Dispatch( size, group_size, [view, pFunc]( JobDispatchArgs args )
+			{
+				const uint32_t entity_idx = view->m_pDriver->GetEntityIndex( args.jobIndex );
+				if( view->Matches( entity_idx ) )
+				{
+					std::apply( *pFunc, view->Fetch( entity_idx ) );
+				}
+			}, &counter );
+			JobSystem::Wait( counter );
+		}
+	private:
+		bool Matches( uint32_t entity_idx ) const
+		{
+			return (m_pManager->m_EntityComponentMasks[entity_idx] & m_Mask) == m_Mask;
+		}
+
+		std::tuple<Entity, Cs&...> Fetch( uint32_t entity_idx ) const
+		{
+			Entity entity( *m_pManager, Entity::Id( entity_idx, m_pManager->m_EntityVersions[entity_idx] ) );
+			return FetchImpl( entity, entity_idx, std::index_sequence_for<Cs...>{} );
+		}
+
+		template <size_t... Is>
+		std::tuple<Entity, Cs&...> FetchImpl( Entity entity, uint32_t entity_idx, std::index_sequence<Is...> ) const
+		{
+			return std::tuple<Entity, Cs&...>( entity, *reinterpret_cast<Cs*>( m_Pools[Is]->Get( entity_idx ) )... );
+		}
+	private:
+		EntityManager* m_pManager = nullptr;
+		std::array<ComponentPool*, sizeof...(Cs)> m_Pools;
+		ComponentPool* m_pDriver = nullptr;
+		EntityManager::ComponentMask m_Mask;
+	};
+
+	template <typename... Cs>
+	inline EntityView<Cs...> EntityManager::View()
+	{
+		return EntityView<Cs...>( *this );
+	}
+}
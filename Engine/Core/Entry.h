@@ -6,6 +6,7 @@
 #include "Globals.h"
 #include "Networking/Networking.h"
 #include "Util/JobSystem.h"
+#include "Util/FrameAllocator.h"
 #include "ResourceManager.h"
 #include "Platform/Window.h"
 #include "Graphics/Renderer.h"
@@ -31,6 +32,7 @@ int WINAPI WinMain(
 		BAT_INIT_SYSTEM( Logger );
 		BAT_INIT_SYSTEM( Networking );
 		BAT_INIT_SYSTEM( JobSystem );
+		BAT_INIT_SYSTEM( FrameAllocator );
 		BAT_INIT_SYSTEM( Physics );
 		BAT_INIT_SYSTEM( COMInitialize );
 #ifdef _DEBUG
@@ -56,6 +58,7 @@ int WINAPI WinMain(
 			g_pGlobals->elapsed_time += dt;
 
 			BAT_SERVICE_SYSTEMS( dt );
+			EventDispatcher::FlushQueuedEvents();
 
 			app->OnUpdate( dt );
 
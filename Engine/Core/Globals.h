@@ -4,6 +4,8 @@ namespace Bat
 {
 	class IGPUDevice;
 	class FileSystem;
+	class SpatialIndexSystem;
+	class HierarchySystem;
 
 	struct GlobalValues
 	{
@@ -15,4 +17,8 @@ namespace Bat
 
 	extern IGPUDevice* gpu;
 	extern FileSystem* filesystem;
+	// set while a SpatialIndexSystem exists
+	extern SpatialIndexSystem* spatial_index;
+	// set while a HierarchySystem exists
+	extern HierarchySystem* hierarchy_system;
 }
@@ -12,13 +12,17 @@ namespace Bat
 {
 	template<typename T>
 	using ResourceMap = std::unordered_map<std::string, Resource<T>>;
+	// Shaders are looked up every draw, so they are keyed by a hash of the filename and macros rather than a string
+	// that would need building (and allocating) for every lookup
 	template<typename T>
-	using UniqueResourceMap = std::unordered_map<std::string, std::unique_ptr<T>>;
+	using ShaderMap = std::unordered_map<uint64_t, std::unique_ptr<T>>;
 
 	static ResourceMap<Texture>             g_mapTextures;
 	static ResourceMap<Mesh>                g_mapMeshes;
-	static UniqueResourceMap<IVertexShader> g_mapVShaders;
-	static UniqueResourceMap<IPixelShader>  g_mapPShaders;
+	static ShaderMap<IVertexShader>         g_mapVShaders;
+	static ShaderMap<IPixelShader>          g_mapPShaders;
+	// shaders are requested from async loads and render passes recording on job threads
+	static std::mutex                       g_ShaderMutex;
 
 	Resource<Texture> ResourceManager::GetTexture( const std::string& filename )
 	{
@@ -57,25 +61,37 @@ namespace Bat
 		return std::async( &ResourceManager::GetMesh, filename );
 	}
 
-	static std::string GetShaderHashName( const std::string& filename, const ShaderMacro* macros, size_t num_macros )
+	static void HashShaderString( uint64_t& hash, const char* str )
 	{
-		std::string name = filename;
+		// FNV-1a, the terminator is hashed too so neighbouring strings can't run into each other
+		do
+		{
+			hash ^= (uint8_t)*str;
+			hash *= 1099511628211ull;
+		} while( *str++ );
+	}
+
+	static uint64_t GetShaderHash( const char* filename, const ShaderMacro* macros, size_t num_macros )
+	{
+		uint64_t hash = 14695981039346656037ull;
+		HashShaderString( hash, filename );
 		for( size_t i = 0; i < num_macros; i++ )
 		{
-			name += macros[i].name;
-			name += macros[i].value;
+			HashShaderString( hash, macros[i].name );
+			HashShaderString( hash, macros[i].value ? macros[i].value : "" );
 		}
-		return name;
+		return hash;
 	}
 	
-	IVertexShader* ResourceManager::GetVertexShader( const std::string& filename, const ShaderMacro* macros, size_t num_macros )
+	IVertexShader* ResourceManager::GetVertexShader( const char* filename, const ShaderMacro* macros, size_t num_macros )
 	{
-		std::string name = GetShaderHashName( filename, macros, num_macros );
-		auto it = g_mapVShaders.find( name );
+		const uint64_t hash = GetShaderHash( filename, macros, num_macros );
+		std::lock_guard<std::mutex> lock( g_ShaderMutex );
+		auto it = g_mapVShaders.find( hash );
 		if( it == g_mapVShaders.end() )
 		{
 			auto pResource = gpu->CreateVertexShader( filename, macros, num_macros );
-			g_mapVShaders[name] = std::unique_ptr<IVertexShader>( pResource );
+			g_mapVShaders[hash] = std::unique_ptr<IVertexShader>( pResource );
 			return pResource;
 		}
 
@@ -84,17 +100,18 @@ namespace Bat
 
 	Future<IVertexShader*> ResourceManager::GetVertexShaderAsync( const std::string& filename, const ShaderMacro* macros, size_t num_macros )
 	{
-		return std::async( &ResourceManager::GetVertexShader, filename, macros, num_macros );
+		return std::async( [filename, macros, num_macros]() { return GetVertexShader( filename.c_str(), macros, num_macros ); } );
 	}
 
-	IPixelShader* ResourceManager::GetPixelShader( const std::string& filename, const ShaderMacro* macros, size_t num_macros )
+	IPixelShader* ResourceManager::GetPixelShader( const char* filename, const ShaderMacro* macros, size_t num_macros )
 	{
-		std::string name = GetShaderHashName( filename, macros, num_macros );
-		auto it = g_mapPShaders.find( name );
+		const uint64_t hash = GetShaderHash( filename, macros, num_macros );
+		std::lock_guard<std::mutex> lock( g_ShaderMutex );
+		auto it = g_mapPShaders.find( hash );
 		if( it == g_mapPShaders.end() )
 		{
 			auto pResource = gpu->CreatePixelShader( filename, macros, num_macros );
-			g_mapPShaders[name] = std::unique_ptr<IPixelShader>( pResource );
+			g_mapPShaders[hash] = std::unique_ptr<IPixelShader>( pResource );
 			return pResource;
 		}
 
@@ -103,7 +120,7 @@ namespace Bat
 
 	Future<IPixelShader*> ResourceManager::GetPixelShaderAsync( const std::string& filename, const ShaderMacro* macros, size_t num_macros )
 	{
-		return std::async( &ResourceManager::GetPixelShader, filename, macros, num_macros );
+		return std::async( [filename, macros, num_macros]() { return GetPixelShader( filename.c_str(), macros, num_macros ); } );
 	}
 
 	template <typename T>
@@ -25,9 +25,9 @@ namespace Bat
 		static FutureResource<Texture> GetTextureAsync( const std::string& filename );
 		static Resource<Mesh>          GetMesh( const std::string& filename );
 		static FutureResource<Mesh>    GetMeshAsync( const std::string& filename );
-		static IVertexShader*          GetVertexShader( const std::string& filename, const ShaderMacro* macros = nullptr, size_t num_macros = 0 );
+		static IVertexShader*          GetVertexShader( const char* filename, const ShaderMacro* macros = nullptr, size_t num_macros = 0 );
 		static Future<IVertexShader*>  GetVertexShaderAsync( const std::string& filename, const ShaderMacro* macros = nullptr, size_t num_macros = 0 );
-		static IPixelShader*           GetPixelShader( const std::string& filename, const ShaderMacro* macros = nullptr, size_t num_macros = 0 );
+		static IPixelShader*           GetPixelShader( const char* filename, const ShaderMacro* macros = nullptr, size_t num_macros = 0 );
 		static Future<IPixelShader*>   GetPixelShaderAsync( const std::string& filename, const ShaderMacro* macros = nullptr, size_t num_macros = 0 );
 
 		static void CleanUp();
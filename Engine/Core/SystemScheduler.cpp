@@ -0,0 +1,255 @@
+#include "PCH.h"
+#include "SystemScheduler.h"
+
+#include "Util/JobSystem.h"
+
+namespace Bat
+{
+	bool SystemAccess::ConflictsWith( const SystemAccess& other ) const
+	{
+		if( m_bExclusive || other.m_bExclusive )
+		{
+			return true;
+		}
+
+		return ( m_Writes & ( other.m_Reads | other.m_Writes ) ).any() ||
+			( other.m_Writes & m_Reads ).any();
+	}
+
+	struct SystemScheduler::SystemEntry
+	{
+		std::string name;
+		SystemAccess access;
+		SystemFunc_t func;
+
+		// systems that have to wait for this one
+		std::vector<size_t> dependents;
+		// systems this one has to wait for
+		std::vector<size_t> dependencies;
+		std::atomic<uint32_t> pending_dependencies = 0;
+	};
+
+	SystemScheduler::SystemScheduler() = default;
+	SystemScheduler::~SystemScheduler() = default;
+
+	void SystemScheduler::AddSystem( std::string name, const SystemAccess& access, SystemFunc_t func )
+	{
+		auto entry = std::make_unique<SystemEntry>();
+		entry->name = std::move( name );
+		entry->access = access;
+		entry->func = std::move( func );
+		m_Systems.emplace_back( std::move( entry ) );
+
+		m_bGraphDirty = true;
+	}
+
+	void SystemScheduler::BuildGraph()
+	{
+		const size_t num_systems = m_Systems.size();
+		for( auto& system : m_Systems )
+		{
+			system->dependents.clear();
+			system->dependencies.clear();
+		}
+
+		// a system depends on every earlier system it conflicts with
+		for( size_t i = 0; i < num_systems; i++ )
+		{
+			for( size_t j = i + 1; j < num_systems; j++ )
+			{
+				if( m_Systems[i]->access.ConflictsWith( m_Systems[j]->access ) )
+				{
+					m_Systems[i]->dependents.push_back( j );
+					m_Systems[j]->dependencies.push_back( i );
+				}
+			}
+		}
+
+		m_Timings.resize( num_systems );
+		for( size_t i = 0; i < num_systems; i++ )
+		{
+			m_Timings[i].name = m_Systems[i]->name;
+		}
+
+		m_bGraphDirty = false;
+	}
+
+	void SystemScheduler::Run( EntityManager& world, float dt )
+	{
+		if( m_bGraphDirty )
+		{
+			BuildGraph();
+		}
+
+		m_pWorld = &world;
+		m_flDeltaTime = dt;
+		m_StartTime = std::chrono::steady_clock::now();
+		m_iRemaining = (uint32_t)m_Systems.size();
+
+		for( auto& system : m_Systems )
+		{
+			system->pending_dependencies = (uint32_t)system->dependencies.size();
+		}
+
+		for( size_t i = 0; i < m_Systems.size(); i++ )
+		{
+			if( m_Systems[i]->dependencies.empty() )
+			{
+				ScheduleSystem( i );
+			}
+		}
+
+		while( m_iRemaining.load( std::memory_order_acquire ) > 0 )
+		{
+			size_t ready = SIZE_MAX;
+			{
+				std::lock_guard<std::mutex> lock( m_MainThreadMutex );
+				if( !m_MainThreadReady.empty() )
+				{
+					ready = m_MainThreadReady.back();
+					m_MainThreadReady.pop_back();
+				}
+			}
+
+			if( ready != SIZE_MAX )
+			{
+				RunSystem( ready );
+			}
+			else if( !JobSystem::TryRunJob() )
+			{
+				std::this_thread::yield();
+			}
+		}
+		// make sure the jobs that ran the last systems have fully retired before touching their state again
+		JobSystem::Wait( m_WorkerCounter );
+
+		// sync point, apply everything the systems deferred
+		m_CommandQueue.Playback( world );
+
+		m_flFrameTime = std::chrono::duration<float, std::milli>( std::chrono::steady_clock::now() - m_StartTime ).count();
+		CalculateCriticalPath();
+	}
+
+	void SystemScheduler::ScheduleSystem( size_t index )
+	{
+		if( m_Systems[index]->access.IsMainThread() )
+		{
+			std::lock_guard<std::mutex> lock( m_MainThreadMutex );
+			m_MainThreadReady.push_back( index );
+		}
+		else
+		{
+			JobSystem::Execute( [this, index]() { RunSystem( index ); }, &m_WorkerCounter );
+		}
+	}
+
+	void SystemScheduler::RunSystem( size_t index )
+	{
+		SystemEntry& system = *m_Systems[index];
+
+		const auto start = std::chrono::steady_clock::now();
+		system.func( *m_pWorld, m_flDeltaTime );
+		const auto end = std::chrono::steady_clock::now();
+
+		SystemTiming& timing = m_Timings[index];
+		timing.start = std::chrono::duration<float, std::milli>( start - m_StartTime ).count();
+		timing.duration = std::chrono::duration<float, std::milli>( end - start ).count();
+		timing.thread_index = JobSystem::GetThreadIndex();
+
+		OnSystemFinished( index );
+	}
+
+	void SystemScheduler::OnSystemFinished( size_t index )
+	{
+		for( size_t dependent : m_Systems[index]->dependents )
+		{
+			if( m_Systems[dependent]->pending_dependencies.fetch_sub( 1, std::memory_order_acq_rel ) == 1 )
+			{
+				ScheduleSystem( dependent );
+			}
+		}
+
+		m_iRemaining.fetch_sub( 1, std::memory_order_acq_rel );
+	}
+
+	void SystemScheduler::CalculateCriticalPath()
+	{
+		if( m_Timings.empty() )
+		{
+			return;
+		}
+
+		auto end_time = [this]( size_t index )
+		{
+			return m_Timings[index].start + m_Timings[index].duration;
+		};
+
+		size_t current = 0;
+		for( size_t i = 0; i < m_Timings.size(); i++ )
+		{
+			m_Timings[i].critical_path = false;
+			if( end_time( i ) > end_time( current ) )
+			{
+				current = i;
+			}
+		}
+
+		// walk backwards from the system that finished last, following whichever dependency held it up the longest
+		while( true )
+		{
+			m_Timings[current].critical_path = true;
+
+			const auto& dependencies = m_Systems[current]->dependencies;
+			if( dependencies.empty() )
+			{
+				break;
+			}
+
+			size_t latest = dependencies[0];
+			for( size_t dependency : dependencies )
+			{
+				if( end_time( dependency ) > end_time( latest ) )
+				{
+					latest = dependency;
+				}
+			}
+			current = latest;
+		}
+	}
+
+	std::string SystemScheduler::GetTimingReport() const
+	{
+		float system_time = 0.0f;
+		for( const SystemTiming& timing : m_Timings )
+		{
+			system_time += timing.duration;
+		}
+
+		std::string report = Format( "Systems: %.3fms, %.3fms of system time (%.2fx overlap)\n",
+			m_flFrameTime, system_time, ( m_flFrameTime > 0.0f ) ? system_time / m_flFrameTime : 0.0f );
+		for( size_t i = 0; i < m_Timings.size(); i++ )
+		{
+			const SystemTiming& timing = m_Timings[i];
+			report += Format( "%c %-24s start %7.3fms  took %7.3fms  thread %u",
+				timing.critical_path ? '*' : ' ',
+				timing.name,
+				timing.start,
+				timing.duration,
+				timing.thread_index );
+
+			// systems that were running at the same time as this one
+			std::string overlaps;
+			for( size_t j = 0; j < m_Timings.size(); j++ )
+			{
+				const SystemTiming& other = m_Timings[j];
+				if( j != i && timing.start < other.start + other.duration && other.start < timing.start + timing.duration )
+				{
+					overlaps += overlaps.empty() ? "  alongside " : ", ";
+					overlaps += other.name;
+				}
+			}
+			report += overlaps + "\n";
+		}
+		return report;
+	}
+}
@@ -0,0 +1,127 @@
+#pragma once
+
+#include <atomic>
+#include <bitset>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "Entity.h"
+#include "EntityCommandBuffer.h"
+
+namespace Bat
+{
+	// Which components a system touches, used to figure out which systems can run at the same time
+	class SystemAccess
+	{
+	public:
+		template <typename... Cs>
+		SystemAccess& Reads()
+		{
+			(m_Reads.set( Cs::GetIndex() ), ...);
+			return *this;
+		}
+		template <typename... Cs>
+		SystemAccess& Writes()
+		{
+			(m_Writes.set( Cs::GetIndex() ), ...);
+			return *this;
+		}
+		// System touches state outside of the ECS (e.g. physics scene, global RNG), it won't overlap with any other system
+		SystemAccess& Exclusive()
+		{
+			m_bExclusive = true;
+			return *this;
+		}
+		// System must run on the thread that calls SystemScheduler::Run (e.g. it dispatches events or creates GPU resources)
+		SystemAccess& MainThread()
+		{
+			m_bMainThread = true;
+			return *this;
+		}
+
+		bool ConflictsWith( const SystemAccess& other ) const;
+		bool IsMainThread() const { return m_bMainThread; }
+	private:
+		using ComponentSet = std::bitset<(size_t)ComponentId::LAST>;
+
+		ComponentSet m_Reads;
+		ComponentSet m_Writes;
+		bool m_bExclusive = false;
+		bool m_bMainThread = false;
+	};
+
+	// Runs systems every frame, systems that don't conflict (see SystemAccess) run concurrently on the job system.
+	// Systems conflicting with each other keep the order they were added in.
+	// Systems running on worker threads must record structural changes into GetCommandQueue(),
+	// the queue is played back once every system has finished.
+	class SystemScheduler
+	{
+	public:
+		using SystemFunc_t = std::function<void( EntityManager& world, float dt )>;
+
+		struct SystemTiming
+		{
+			std::string name;
+			// times are in milliseconds, relative to the start of Run()
+			float start = 0.0f;
+			float duration = 0.0f;
+			uint32_t thread_index = 0;
+			bool critical_path = false;
+		};
+
+		SystemScheduler();
+		~SystemScheduler();
+		SystemScheduler( const SystemScheduler& ) = delete;
+		SystemScheduler& operator=( const SystemScheduler& ) = delete;
+
+		void AddSystem( std::string name, const SystemAccess& access, SystemFunc_t func );
+		// Convenience for systems with an Update( EntityManager&, float ) function
+		template <typename System>
+		void AddSystem( std::string name, const SystemAccess& access, System& system )
+		{
+			AddSystem( std::move( name ), access, [&system]( EntityManager& world, float dt ) { system.Update( world, dt ); } );
+		}
+
+		// Runs every system once, blocks until they have all finished and the command queue has been played back
+		void Run( EntityManager& world, float dt );
+
+		EntityCommandQueue& GetCommandQueue() { return m_CommandQueue; }
+
+		// Timings from the last Run(), in the order systems were added
+		const std::vector<SystemTiming>& GetTimings() const { return m_Timings; }
+		// Total time the last Run() took in milliseconds, including command playback
+		float GetFrameTime() const { return m_flFrameTime; }
+		// Human readable timing report of the last Run(), critical path systems are marked with '*' and each
+		// system lists the systems that ran alongside it
+		std::string GetTimingReport() const;
+	private:
+		struct SystemEntry;
+
+		void BuildGraph();
+		void ScheduleSystem( size_t index );
+		void RunSystem( size_t index );
+		void OnSystemFinished( size_t index );
+		void CalculateCriticalPath();
+	private:
+		std::vector<std::unique_ptr<SystemEntry>> m_Systems;
+		std::vector<SystemTiming> m_Timings;
+		bool m_bGraphDirty = true;
+
+		EntityCommandQueue m_CommandQueue;
+
+		// per-Run state
+		EntityManager* m_pWorld = nullptr;
+		float m_flDeltaTime = 0.0f;
+		std::chrono::steady_clock::time_point m_StartTime;
+		float m_flFrameTime = 0.0f;
+		JobCounter m_WorkerCounter;
+		std::atomic<uint32_t> m_iRemaining = 0;
+		// main thread systems that are ready to run, filled in by whichever thread finished their last dependency
+		std::mutex m_MainThreadMutex;
+		std::vector<size_t> m_MainThreadReady;
+	};
+}
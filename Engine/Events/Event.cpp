@@ -3,5 +3,267 @@
 
 namespace Bat
 {
-	std::unordered_map<std::type_index, std::vector<EventDispatcher::EventListener>> EventDispatcher::m_GlobalCallbacks;
-}
\ No newline at end of file
+	EventDispatcher::ListenerRegistry EventDispatcher::m_GlobalListeners;
+
+	namespace Detail
+	{
+		size_t NextEventTypeId()
+		{
+			static std::atomic<size_t> next_id = 0;
+			const size_t id = next_id.fetch_add( 1, std::memory_order_relaxed );
+			ASSERT( id < EventDispatcher::MAX_EVENT_TYPES, "Too many event types, increase MAX_EVENT_TYPES" );
+			return id;
+		}
+	}
+
+	void EventDispatcher::ListenerRegistry::Add( size_t type, EventListener listener )
+	{
+		std::lock_guard<std::mutex> lock( m_Mutex );
+		Slot& slot = m_Slots[type];
+
+		auto pNewListeners = slot.pListeners ? std::make_shared<ListenerList>( *slot.pListeners ) : std::make_shared<ListenerList>();
+		pNewListeners->emplace_back( std::move( listener ) );
+
+		std::atomic_store( &slot.pListeners, std::shared_ptr<const ListenerList>( std::move( pNewListeners ) ) );
+		slot.num_listeners.fetch_add( 1, std::memory_order_release );
+	}
+
+	bool EventDispatcher::ListenerRegistry::Remove( size_t type, const void* address )
+	{
+		std::lock_guard<std::mutex> lock( m_Mutex );
+		Slot& slot = m_Slots[type];
+		if( !slot.pListeners )
+		{
+			return false;
+		}
+
+		const ListenerList& listeners = *slot.pListeners;
+		for( size_t i = 0; i < listeners.size(); i++ )
+		{
+			if( listeners[i].address == address )
+			{
+				auto pNewListeners = std::make_shared<ListenerList>( listeners );
+				pNewListeners->erase( pNewListeners->begin() + i );
+
+				slot.num_listeners.fetch_sub( 1, std::memory_order_release );
+				std::atomic_store( &slot.pListeners, std::shared_ptr<const ListenerList>( std::move( pNewListeners ) ) );
+				return true;
+			}
+		}
+
+		return false;
+	}
+
+	bool EventDispatcher::ListenerRegistry::Contains( size_t type, const void* address ) const
+	{
+		const auto pListeners = std::atomic_load( &m_Slots[type].pListeners );
+		if( !pListeners )
+		{
+			return false;
+		}
+
+		for( const EventListener& listener : *pListeners )
+		{
+			if( listener.address == address )
+			{
+				return true;
+			}
+		}
+
+		return false;
+	}
+
+	void EventDispatcher::ListenerRegistry::Dispatch( size_t type, const void* pEvent ) const
+	{
+		// holding on to the list keeps it alive even if a listener adds/removes listeners while we iterate
+		const auto pListeners = std::atomic_load( &m_Slots[type].pListeners );
+		if( !pListeners )
+		{
+			return;
+		}
+
+		for( const EventListener& listener : *pListeners )
+		{
+			listener.callback( pEvent );
+		}
+	}
+
+	struct EventDispatcher::ThreadEventQueue
+	{
+		struct QueuedEvent
+		{
+			// nullptr for global events
+			EventDispatcher* pDispatcher;
+			void* pData;
+			QueuedEventFuncs funcs;
+			// set when the dispatcher is destroyed before the event was flushed
+			bool discarded;
+		};
+
+		struct Buffer
+		{
+			std::vector<QueuedEvent> events;
+			std::vector<std::unique_ptr<char[]>> blocks;
+			size_t block = 0;
+			size_t block_offset = 0;
+
+			void* Alloc( size_t size, size_t alignment )
+			{
+				ASSERT( size + alignment <= BLOCK_SIZE, "Event too large to be queued" );
+
+				while( true )
+				{
+					if( block == blocks.size() )
+					{
+						blocks.emplace_back( std::make_unique<char[]>( BLOCK_SIZE ) );
+					}
+
+					char* pBlock = blocks[block].get();
+					const uintptr_t start = reinterpret_cast<uintptr_t>( pBlock + block_offset );
+					const uintptr_t aligned = (start + alignment - 1) & ~(uintptr_t)(alignment - 1);
+					const size_t offset = block_offset + (size_t)(aligned - start);
+					if( offset + size <= BLOCK_SIZE )
+					{
+						block_offset = offset + size;
+						return pBlock + offset;
+					}
+
+					block++;
+					block_offset = 0;
+				}
+			}
+
+			void Reset()
+			{
+				for( const QueuedEvent& e : events )
+				{
+					e.funcs.destroy( e.pData );
+				}
+				events.clear();
+				// keep the blocks around for the next frame
+				block = 0;
+				block_offset = 0;
+			}
+		};
+
+		static constexpr size_t BLOCK_SIZE = 16 * 1024;
+
+		// held for the whole flush of this queue, dispatchers take it before discarding their events so they can't
+		// go away mid dispatch. Recursive since a listener can destroy a dispatcher while its events are flushed.
+		std::recursive_mutex flush_mutex;
+		std::mutex mutex;
+		// threads queue into buffers[current] while the other one is being flushed
+		Buffer buffers[2];
+		int current = 0;
+	};
+
+	struct EventDispatcher::EventQueueRegistry
+	{
+		std::mutex mutex;
+		// queues are never freed so events queued by threads that have since exited still get flushed
+		std::vector<std::unique_ptr<ThreadEventQueue>> queues;
+	};
+
+	EventDispatcher::EventQueueRegistry& EventDispatcher::GetQueueRegistry()
+	{
+		// intentionally leaked, dispatchers with static storage duration can still be destroyed after this
+		static EventQueueRegistry* pRegistry = new EventQueueRegistry;
+		return *pRegistry;
+	}
+
+	void EventDispatcher::PushQueuedEvent( EventDispatcher* pDispatcher, void* pEvent, size_t size, size_t alignment, const QueuedEventFuncs& funcs )
+	{
+		thread_local ThreadEventQueue* pQueue = nullptr;
+		if( !pQueue )
+		{
+			EventQueueRegistry& registry = GetQueueRegistry();
+			std::lock_guard<std::mutex> lock( registry.mutex );
+			pQueue = registry.queues.emplace_back( std::make_unique<ThreadEventQueue>() ).get();
+		}
+
+		// only contended while this queue is being flushed
+		std::lock_guard<std::mutex> lock( pQueue->mutex );
+		ThreadEventQueue::Buffer& buffer = pQueue->buffers[pQueue->current];
+
+		void* pData = buffer.Alloc( size, alignment );
+		funcs.move( pData, pEvent );
+
+		ThreadEventQueue::QueuedEvent e;
+		e.pDispatcher = pDispatcher;
+		e.pData = pData;
+		e.funcs = funcs;
+		e.discarded = false;
+		buffer.events.push_back( e );
+	}
+
+	void EventDispatcher::FlushQueuedEvents()
+	{
+		std::vector<ThreadEventQueue*> queues;
+		{
+			EventQueueRegistry& registry = GetQueueRegistry();
+			std::lock_guard<std::mutex> lock( registry.mutex );
+			queues.reserve( registry.queues.size() );
+			for( auto& pQueue : registry.queues )
+			{
+				queues.push_back( pQueue.get() );
+			}
+		}
+
+		for( ThreadEventQueue* pQueue : queues )
+		{
+			std::lock_guard<std::recursive_mutex> flush_lock( pQueue->flush_mutex );
+
+			ThreadEventQueue::Buffer* pBuffer;
+			{
+				std::lock_guard<std::mutex> lock( pQueue->mutex );
+				pBuffer = &pQueue->buffers[pQueue->current];
+				pQueue->current ^= 1;
+			}
+
+			// not holding the lock, listeners are free to queue more events
+			for( const ThreadEventQueue::QueuedEvent& e : pBuffer->events )
+			{
+				if( !e.discarded )
+				{
+					e.funcs.dispatch( e.pDispatcher, e.pData );
+				}
+			}
+
+			std::lock_guard<std::mutex> lock( pQueue->mutex );
+			pBuffer->Reset();
+		}
+	}
+
+	EventDispatcher::~EventDispatcher()
+	{
+		// make sure queued events don't get dispatched to a dead dispatcher
+		std::vector<ThreadEventQueue*> queues;
+		{
+			// not held while waiting on flushes, a listener being flushed may need it to queue an event
+			EventQueueRegistry& registry = GetQueueRegistry();
+			std::lock_guard<std::mutex> registry_lock( registry.mutex );
+			queues.reserve( registry.queues.size() );
+			for( auto& pQueue : registry.queues )
+			{
+				queues.push_back( pQueue.get() );
+			}
+		}
+
+		for( ThreadEventQueue* pQueue : queues )
+		{
+			// waits for a flush on another thread that may be dispatching to us right now
+			std::lock_guard<std::recursive_mutex> flush_lock( pQueue->flush_mutex );
+			std::lock_guard<std::mutex> lock( pQueue->mutex );
+			for( ThreadEventQueue::Buffer& buffer : pQueue->buffers )
+			{
+				for( ThreadEventQueue::QueuedEvent& e : buffer.events )
+				{
+					if( e.pDispatcher == this )
+					{
+						e.discarded = true;
+					}
+				}
+			}
+		}
+	}
+}
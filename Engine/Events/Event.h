@@ -1,174 +1,246 @@
 #pragma once
 
-#include <functional>
-#include <typeindex>
-#include <unordered_map>
 #include <array>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <type_traits>
 #include <vector>
 #include "Util/BatAssert.h"
+#include "Util/Delegate.h"
 
-// TODO: Make this thread safe so we can listen for events on other threads
 namespace Bat
 {
-	// erases event type and does a conversion back when called
+	namespace Detail
+	{
+		size_t NextEventTypeId();
+	}
+
+	// Dense id for an event type, ids are handed out on first use starting from 0
 	template <typename Event>
-	struct EventCallbackWrapper
+	size_t GetEventTypeId()
 	{
-		explicit EventCallbackWrapper(std::function<void(const Event&)> callback)
-			:
-			callback(callback)
-		{}
-		void operator()(const void* event)
-		{
-			callback(*(static_cast<const Event*>(event)));
-		}
-		std::function<void(const Event&)> callback;
-	};
+		static const size_t id = Detail::NextEventTypeId();
+		return id;
+	}
 
+	// Listeners can be added/removed and events dispatched from any thread.
+	// Dispatching never copies listeners, it takes a reference to the current listener list, so listeners
+	// added or removed during a dispatch (e.g. from inside a callback) only take effect for the next dispatch.
 	class EventDispatcher
 	{
 	public:
+		static constexpr size_t MAX_EVENT_TYPES = 256;
+
+		EventDispatcher() = default;
+		~EventDispatcher();
+		EventDispatcher( const EventDispatcher& ) = delete;
+		EventDispatcher& operator=( const EventDispatcher& ) = delete;
+
 		// for classes that want to be able to both listen/unlisten
 		template <typename Event, typename Listener>
 		void AddEventListener( Listener& listener )
 		{
-			void (Listener::*listen_func)(const Event&) = &Listener::OnEvent;
 			ASSERT( !IsListeningForEvent<Event>( listener ), "Attempted to listen to same event multiple times" );
-			auto wrapper = EventCallbackWrapper<Event>(std::bind(listen_func, &listener, std::placeholders::_1));
-			m_Callbacks[std::type_index(typeid(Event))].emplace_back( &listener, wrapper );
+			m_Listeners.Add( GetEventTypeId<Event>(), MakeListener<Event>( listener ) );
 		}
 		template <typename Event, typename Listener>
 		bool RemoveEventListener( Listener& listener )
 		{
-			auto& listeners = m_Callbacks[std::type_index(typeid(Event))];
-
-			for( size_t i = 0; i < listeners.size(); i++ )
-			{
-				if( listeners[i].address == &listener )
-				{
-					listeners.erase( listeners.begin() + i );
-					return true;
-				}
-			}
-
-			return false;
+			return m_Listeners.Remove( GetEventTypeId<Event>(), &listener );
 		}
 		template <typename Event, typename Listener>
-		bool IsListeningForEvent( Listener& listener )
+		bool IsListeningForEvent( Listener& listener ) const
 		{
-			auto& listeners = m_Callbacks[std::type_index(typeid(Event))];
-
-			for( size_t i = 0; i < listeners.size(); i++ )
-			{
-				if( listeners[i].address == &listener )
-				{
-					return true;
-				}
-			}
-
-			return false;
+			return m_Listeners.Contains( GetEventTypeId<Event>(), &listener );
 		}
 
 		// for classes that want to be able to both listen/unlisten
 		template <typename Event, typename Listener>
 		static void AddGlobalEventListener( Listener& listener )
 		{
-			void (Listener:: * listen_func)(const Event&) = &Listener::OnEvent;
 			ASSERT( !IsListeningForGlobalEvent<Event>( listener ), "Attempted to listen to same event multiple times" );
-			auto wrapper = EventCallbackWrapper<Event>( std::bind( listen_func, &listener, std::placeholders::_1 ) );
-			m_GlobalCallbacks[std::type_index( typeid(Event) )].emplace_back( &listener, wrapper );
+			m_GlobalListeners.Add( GetEventTypeId<Event>(), MakeListener<Event>( listener ) );
 		}
 		template <typename Event, typename Listener>
 		static bool RemoveGlobalEventListener( Listener& listener )
 		{
-			auto& listeners = m_GlobalCallbacks[std::type_index( typeid(Event) )];
-
-			for( size_t i = 0; i < listeners.size(); i++ )
-			{
-				if( listeners[i].address == &listener )
-				{
-					listeners.erase( listeners.begin() + i );
-					return true;
-				}
-			}
-
-			return false;
+			return m_GlobalListeners.Remove( GetEventTypeId<Event>(), &listener );
 		}
 		template <typename Event, typename Listener>
-		static bool IsListeningForGlobalEvent( Listener & listener )
+		static bool IsListeningForGlobalEvent( Listener& listener )
 		{
-			auto& listeners = m_GlobalCallbacks[std::type_index( typeid(Event) )];
-
-			for( size_t i = 0; i < listeners.size(); i++ )
-			{
-				if( listeners[i].address == &listener )
-				{
-					return true;
-				}
-			}
-
-			return false;
+			return m_GlobalListeners.Contains( GetEventTypeId<Event>(), &listener );
 		}
-		
+
 		// for quick and dirty callbacks that dont need to be able to be removed
-		template <typename Event, typename Listener>
-		void OnEventDispatched( Listener& listener )
+		template <typename Event, typename Callback>
+		void OnEventDispatched( Callback&& callback )
 		{
-			EventCallbackWrapper<Event> wrapper( listener );
-			m_Callbacks[std::type_index(typeid(Event))].emplace_back( nullptr, wrapper );
+			m_Listeners.Add( GetEventTypeId<Event>(), MakeCallbackListener<Event>( std::forward<Callback>( callback ) ) );
 		}
-		template <typename Event, typename Listener>
-		static void OnGlobalEventDispatched( Listener& listener )
+		template <typename Event, typename Callback>
+		static void OnGlobalEventDispatched( Callback&& callback )
 		{
-			EventCallbackWrapper<Event> wrapper( listener );
-			m_GlobalCallbacks[std::type_index( typeid(Event) )].emplace_back( nullptr, wrapper );
+			m_GlobalListeners.Add( GetEventTypeId<Event>(), MakeCallbackListener<Event>( std::forward<Callback>( callback ) ) );
 		}
 
 		template <typename Event, typename... Args>
 		static void DispatchGlobalEvent( Args&& ... args )
 		{
-			const auto& listeners = m_GlobalCallbacks[std::type_index( typeid(Event) )];
-			if( listeners.empty() )
+			const size_t type = GetEventTypeId<Event>();
+			if( !m_GlobalListeners.HasListeners( type ) )
 			{
 				return;
 			}
 
-			Event e = Event{ std::forward<Args>( args )... };
-			for( auto listener : listeners )
-			{
-				listener.callback( &e );
-			}
+			const Event e = Event{ std::forward<Args>( args )... };
+			m_GlobalListeners.Dispatch( type, &e );
+		}
+		// Same as DispatchGlobalEvent, but the event is stored in the calling thread's queue and
+		// only dispatched on the next FlushQueuedEvents(). The event must not reference anything that won't outlive the frame.
+		template <typename Event, typename... Args>
+		static void QueueGlobalEvent( Args&&... args )
+		{
+			QueueEventImpl<Event>( nullptr, std::forward<Args>( args )... );
 		}
+
+		// Dispatches every queued event, thread by thread in the order they were queued.
+		// Called once per frame by the engine. Events queued while flushing are dispatched on the next flush.
+		// A dispatcher destroyed on another thread while its events are being flushed waits for the flush to finish.
+		static void FlushQueuedEvents();
 	protected:
 		template <typename Event, typename... Args>
 		void DispatchEvent( Args&&... args )
 		{
-			const auto& listeners = m_Callbacks[std::type_index(typeid(Event))];
-			if( listeners.empty() )
+			const size_t type = GetEventTypeId<Event>();
+			if( !m_Listeners.HasListeners( type ) )
 			{
 				return;
 			}
 
-			Event e = Event{ std::forward<Args>( args )... };
-			for( auto listener : listeners )
+			const Event e = Event{ std::forward<Args>( args )... };
+			m_Listeners.Dispatch( type, &e );
+		}
+		// Deferred version of DispatchEvent, see QueueGlobalEvent
+		template <typename Event, typename... Args>
+		void QueueEvent( Args&&... args )
+		{
+			QueueEventImpl<Event>( this, std::forward<Args>( args )... );
+		}
+		// Calls func on the next FlushQueuedEvents() in order with the queued events, for events that can only be
+		// built once they are dispatched. Not called if this dispatcher is destroyed first.
+		template <typename Func>
+		void QueueCall( Func&& func )
+		{
+			using F = std::decay_t<Func>;
+			F f( std::forward<Func>( func ) );
+
+			QueuedEventFuncs funcs;
+			funcs.move = []( void* pDst, void* pSrc )
 			{
-				listener.callback( &e );
-			}
+				new( pDst ) F( std::move( *static_cast<F*>( pSrc ) ) );
+			};
+			funcs.dispatch = []( EventDispatcher* pDispatcher, const void* pFunc )
+			{
+				( *static_cast<const F*>( pFunc ) )();
+			};
+			funcs.destroy = []( void* pFunc )
+			{
+				static_cast<F*>( pFunc )->~F();
+			};
+			PushQueuedEvent( this, &f, sizeof( F ), alignof( F ), funcs );
 		}
 	private:
+		using Callback_t = Delegate<void( const void* pEvent )>;
+
 		struct EventListener
 		{
-			EventListener( void* pAddress, std::function<void( const void* )> cb )
-				:
-				address( pAddress ),
-				callback( cb )
-			{}
-
+			// address of the listener object, used to remove it again, nullptr for callbacks
 			void* address;
-			std::function<void( const void* )> callback;
+			Callback_t callback;
+		};
+		using ListenerList = std::vector<EventListener>;
+
+		// Per event type listener lists. Lists are never modified after being published, adding or removing
+		// a listener swaps in a new list so dispatches in flight keep iterating the old one.
+		class ListenerRegistry
+		{
+		public:
+			bool HasListeners( size_t type ) const
+			{
+				return m_Slots[type].num_listeners.load( std::memory_order_acquire ) > 0;
+			}
+			void Add( size_t type, EventListener listener );
+			bool Remove( size_t type, const void* address );
+			bool Contains( size_t type, const void* address ) const;
+			void Dispatch( size_t type, const void* pEvent ) const;
+		private:
+			struct Slot
+			{
+				std::shared_ptr<const ListenerList> pListeners;
+				std::atomic<uint32_t> num_listeners = 0;
+			};
+
+			std::array<Slot, MAX_EVENT_TYPES> m_Slots;
+			// serializes writers, readers never lock
+			std::mutex m_Mutex;
+		};
+
+		struct QueuedEventFuncs
+		{
+			void(*move)( void* pDst, void* pSrc );
+			void(*dispatch)( EventDispatcher* pDispatcher, const void* pEvent );
+			void(*destroy)( void* pEvent );
 		};
 
-		std::unordered_map<std::type_index, std::vector<EventListener>> m_Callbacks{ 20 };
-		static std::unordered_map<std::type_index, std::vector<EventListener>> m_GlobalCallbacks;
+		template <typename Event, typename Listener>
+		static EventListener MakeListener( Listener& listener )
+		{
+			Listener* pListener = &listener;
+			return EventListener{ pListener, [pListener]( const void* pEvent )
+			{
+				pListener->OnEvent( *static_cast<const Event*>( pEvent ) );
+			} };
+		}
+		// callback has to be small enough to fit in a Delegate, see Delegate.h
+		template <typename Event, typename Callback>
+		static EventListener MakeCallbackListener( Callback&& callback )
+		{
+			return EventListener{ nullptr, [callback = std::forward<Callback>( callback )]( const void* pEvent )
+			{
+				callback( *static_cast<const Event*>( pEvent ) );
+			} };
+		}
+
+		template <typename Event, typename... Args>
+		static void QueueEventImpl( EventDispatcher* pDispatcher, Args&&... args )
+		{
+			Event e = Event{ std::forward<Args>( args )... };
+
+			QueuedEventFuncs funcs;
+			funcs.move = []( void* pDst, void* pSrc )
+			{
+				new( pDst ) Event( std::move( *static_cast<Event*>( pSrc ) ) );
+			};
+			funcs.dispatch = []( EventDispatcher* pDispatcher, const void* pEvent )
+			{
+				ListenerRegistry& listeners = pDispatcher ? pDispatcher->m_Listeners : m_GlobalListeners;
+				listeners.Dispatch( GetEventTypeId<Event>(), pEvent );
+			};
+			funcs.destroy = []( void* pEvent )
+			{
+				static_cast<Event*>( pEvent )->~Event();
+			};
+			PushQueuedEvent( pDispatcher, &e, sizeof( Event ), alignof( Event ), funcs );
+		}
+		struct ThreadEventQueue;
+		struct EventQueueRegistry;
+		static EventQueueRegistry& GetQueueRegistry();
+		// Moves the event into the calling thread's queue
+		static void PushQueuedEvent( EventDispatcher* pDispatcher, void* pEvent, size_t size, size_t alignment, const QueuedEventFuncs& funcs );
+	private:
+		ListenerRegistry m_Listeners;
+		static ListenerRegistry m_GlobalListeners;
 	};
-}
\ No newline at end of file
+}
@@ -7,6 +7,39 @@
 namespace Bat
 {
 	void ColourPipeline::Render( IGPUContext* pContext, const Mesh& mesh, const Camera& camera, const Mat4& world_transform )
+	{
+		IVertexShader* pVertexShader = BindShaders( pContext, camera, world_transform );
+
+		mesh.Bind( pContext, pVertexShader );
+
+		if( mesh.GetIndexCount() == 0 )
+		{
+			pContext->Draw( mesh.GetVertexCount() );
+		}
+		else
+		{
+			pContext->DrawIndexed( mesh.GetIndexCount() );
+		}
+	}
+
+	void ColourPipeline::Render( IGPUContext* pContext,
+		IVertexBuffer* pPositions,
+		IVertexBuffer* pColours,
+		size_t vertex_count,
+		PrimitiveTopology topology,
+		const Camera& camera,
+		const Mat4& world_transform )
+	{
+		IVertexShader* pVertexShader = BindShaders( pContext, camera, world_transform );
+
+		pContext->SetPrimitiveTopology( topology );
+		pContext->SetVertexBuffer( pPositions, pVertexShader->GetVertexAttributeSlot( VertexAttribute::Position, 0 ) );
+		pContext->SetVertexBuffer( pColours, pVertexShader->GetVertexAttributeSlot( VertexAttribute::Colour, 0 ) );
+
+		pContext->Draw( vertex_count );
+	}
+
+	IVertexShader* ColourPipeline::BindShaders( IGPUContext* pContext, const Camera& camera, const Mat4& world_transform )
 	{
 		IVertexShader* pVertexShader = ResourceManager::GetVertexShader( "../Engine/Graphics/Shaders/ColourVS.hlsl" );
 		IPixelShader* pPixelShader = ResourceManager::GetPixelShader( "../Engine/Graphics/Shaders/ColourPS.hlsl" );
@@ -22,15 +55,6 @@ namespace Bat
 		pContext->SetVertexShader( pVertexShader );
 		pContext->SetPixelShader( pPixelShader );
 
-		mesh.Bind( pContext, pVertexShader );
-
-		if( mesh.GetIndexCount() == 0 )
-		{
-			pContext->Draw( mesh.GetVertexCount() );
-		}
-		else
-		{
-			pContext->DrawIndexed( mesh.GetIndexCount() );
-		}
+		return pVertexShader;
 	}
 }
\ No newline at end of file
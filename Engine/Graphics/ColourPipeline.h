@@ -11,6 +11,16 @@ namespace Bat
 	{
 	public:
 		void Render( IGPUContext* pContext, const Mesh& mesh, const Camera& camera, const Mat4& world_transform );
+		// Draws the first vertex_count vertices of separate position (Vec3) and colour (Vec4) buffers
+		void Render( IGPUContext* pContext,
+			IVertexBuffer* pPositions,
+			IVertexBuffer* pColours,
+			size_t vertex_count,
+			PrimitiveTopology topology,
+			const Camera& camera,
+			const Mat4& world_transform );
+	private:
+		IVertexShader* BindShaders( IGPUContext* pContext, const Camera& camera, const Mat4& world_transform );
 	private:
 		struct CB_ColourPipelineMatrix
 		{
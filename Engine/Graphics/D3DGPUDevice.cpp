@@ -108,7 +108,18 @@ inline bool operator==( const D3D11_RASTERIZER_DESC& a, const D3D11_RASTERIZER_D
 #endif
 
 // Only use within GPUContext class. Does all the error checking in debug builds.
-#define DXGI_CONTEXT_CALL( fn ) DXGI_CALL( m_pDevice, fn )
+// Deferred contexts are used from job threads and the info queue is shared by the whole device, so they skip the check.
+// Anything they cause gets reported by the immediate context once their command list is executed.
+#define DXGI_CONTEXT_CALL( fn ) do { \
+		if( m_bDeferred ) \
+		{ \
+			fn; \
+		} \
+		else \
+		{ \
+			DXGI_CALL( m_pDevice, fn ); \
+		} \
+	} while( false )
 // Only use within GPUDevice class. Does all the error checking in debug builds.
 #define DXGI_DEVICE_CALL( fn ) DXGI_CALL( this, fn )
 
@@ -241,6 +252,7 @@ namespace Bat
 		ShaderMacro m_Macros[MAX_SHADER_MACROS];
 		size_t m_iNumMacros;
 		std::atomic_bool m_bDirty = true;
+		std::mutex m_ReloadMutex;
 		Microsoft::WRL::ComPtr<ID3D11PixelShader> m_pShader;
 
 #ifdef _DEBUG
@@ -276,6 +288,7 @@ namespace Bat
 		ShaderMacro m_Macros[MAX_SHADER_MACROS];
 		size_t m_iNumMacros;
 		std::atomic_bool m_bDirty = true;
+		std::mutex m_ReloadMutex;
 		Microsoft::WRL::ComPtr<ID3D11VertexShader> m_pShader;
 
 #ifdef _DEBUG
@@ -287,7 +300,7 @@ namespace Bat
 	{
 		friend class D3DGPUDevice;
 	public:
-		D3DGPUContext( D3DGPUDevice* pDevice );
+		D3DGPUContext( D3DGPUDevice* pDevice, bool deferred = false );
 
 		// Called once device context is initialized by device
 		void Init();
@@ -356,6 +369,7 @@ namespace Bat
 		virtual void ClearRenderTarget( IRenderTarget* pRT, float r, float g, float b, float a, size_t array_index = 0, size_t mip_index = 0 ) override;
 		virtual void ClearDepthStencil( IDepthStencil* pDepthStencil, int clearflag, float depth, uint8_t stencil, size_t index = 0 ) override;
 		virtual void Resolve( IRenderTarget* pDst, IRenderTarget* pSrc ) override;
+		virtual void CopyDepthStencil( IDepthStencil* pDst, size_t dst_index, IDepthStencil* pSrc, size_t src_index ) override;
 
 		virtual void UpdateTexturePixels( ITexture* pTexture, const void* pPixels, size_t pitch ) override;
 		virtual void BindTexture( ITexture* pTexture, size_t slot ) override;
@@ -392,21 +406,54 @@ namespace Bat
 		virtual void BeginEvent( const std::string& name ) override;
 		virtual void EndEvent() override;
 
+		virtual bool IsDeferred() const override { return m_bDeferred; }
+		virtual void InheritState( IGPUContext* pContext ) override;
+		virtual IGPUCommandList* FinishCommandList() override;
+		virtual void ExecuteCommandList( IGPUCommandList* pCommandList ) override;
+
 		virtual void* GetImpl() override { return m_pDeviceContext.Get(); }
 	private:
+		// Sets tracked state back to what D3D has for a fresh context
+		void ResetState();
 		void BindViewports();
 		void BindRenderTarget();
 		void BindDepthStencilState();
 		void BindRasterizerState();
 	private:
 		D3DGPUDevice* m_pDevice = nullptr;
+		bool m_bDeferred = false;
 
 		Microsoft::WRL::ComPtr<ID3D11DeviceContext> m_pDeviceContext;
 		Microsoft::WRL::ComPtr<ID3DUserDefinedAnnotation> m_pAnnotation;
-		std::vector<std::vector<IRenderTarget*>> m_RenderTargetStack;
+		// Stack entries are fixed size so pushing and popping reuses the stack's storage instead of allocating every frame
+		struct RenderTargetSet
+		{
+			IRenderTarget* targets[D3D11_SIMULTANEOUS_RENDER_TARGET_COUNT];
+			size_t count = 0;
+
+			void Assign( IRenderTarget* const* pRTs, size_t num_rts )
+			{
+				ASSERT( num_rts <= D3D11_SIMULTANEOUS_RENDER_TARGET_COUNT, "Too many render targets" );
+				std::copy( pRTs, pRTs + num_rts, targets );
+				count = num_rts;
+			}
+		};
+		struct ViewportSet
+		{
+			Viewport viewports[D3D11_VIEWPORT_AND_SCISSORRECT_OBJECT_COUNT_PER_PIPELINE];
+			size_t count = 0;
+
+			void Assign( const Viewport* pViewports, size_t num_viewports )
+			{
+				ASSERT( num_viewports <= D3D11_VIEWPORT_AND_SCISSORRECT_OBJECT_COUNT_PER_PIPELINE, "Too many viewports" );
+				std::copy( pViewports, pViewports + num_viewports, viewports );
+				count = num_viewports;
+			}
+		};
+		std::vector<RenderTargetSet> m_RenderTargetStack;
 		size_t m_iRenderTargetArrayIndex = 0;
 		size_t m_iRenderTargetMipIndex = 0;
-		std::vector<std::vector<Viewport>> m_ViewportStack;
+		std::vector<ViewportSet> m_ViewportStack;
 		class D3DDepthStencil* m_pDepthStencil = nullptr;
 		size_t m_iDepthStencilIndex = 0;
 		D3DPixelShader* m_pPixelShader = nullptr;
@@ -470,6 +517,7 @@ namespace Bat
 		virtual void ResizeBuffers( size_t width, size_t height ) override;
 
 		virtual IGPUContext* GetContext() override { return &m_GPUContext; };
+		virtual IGPUContext* CreateDeferredContext() override;
 
 		virtual void* GetImpl() override { return m_pDevice.Get(); }
 
@@ -502,6 +550,8 @@ namespace Bat
 		Microsoft::WRL::ComPtr<ID3D11BlendState>         m_pBlendEnabledState;
 		Microsoft::WRL::ComPtr<ID3D11BlendState>         m_pBlendDisabledState;
 
+		// state objects are looked up/created by every context, including deferred ones on job threads
+		std::mutex m_StateMutex;
 		std::unordered_map<D3D11_DEPTH_STENCIL_DESC, Microsoft::WRL::ComPtr<ID3D11DepthStencilState>>  m_pDepthStencilStates;
 		std::unordered_map<D3D11_RASTERIZER_DESC, Microsoft::WRL::ComPtr<ID3D11RasterizerState>>  m_pRasterizerStates;
 
@@ -610,6 +660,7 @@ namespace Bat
 		virtual TexFormat GetFormat() const override { return m_Format; }
 		virtual size_t GetArraySize() const override { return m_iArraySize; }
 
+		ID3D11Texture2D* GetResource() const { return m_pDepthStencilBuffer.Get(); }
 		ID3D11DepthStencilView* GetDepthStencilView( size_t index ) { return m_pDepthStencilView[index].Get(); }
 		const ID3D11DepthStencilView* GetDepthStencilView( size_t index ) const { return m_pDepthStencilView[index].Get(); }
 		ID3D11ShaderResourceView* GetShaderResourceView() { return m_pDepthShaderResourceView.Get(); }
@@ -635,14 +686,68 @@ namespace Bat
 		Microsoft::WRL::ComPtr<ID3D11SamplerState> m_pSamplerState = nullptr;
 	};
 
-	D3DGPUContext::D3DGPUContext( D3DGPUDevice* pDevice )
+	class D3DCommandList : public IGPUCommandList
+	{
+	public:
+		// Parallel passes finish a command list every frame, their memory is recycled instead of going back to the heap
+		static void* operator new( size_t size );
+		static void operator delete( void* ptr );
+
+		ID3D11CommandList* GetCommandList() const { return m_pCommandList.Get(); }
+		ID3D11CommandList** GetAddressOf() { return &m_pCommandList; }
+	private:
+		Microsoft::WRL::ComPtr<ID3D11CommandList> m_pCommandList;
+	};
+
+	static std::mutex g_CommandListMutex;
+	static std::vector<void*> g_FreeCommandLists;
+
+	void* D3DCommandList::operator new( size_t size )
+	{
+		ASSERT( size == sizeof( D3DCommandList ), "Unexpected command list size" );
+
+		std::lock_guard<std::mutex> lock( g_CommandListMutex );
+		if( g_FreeCommandLists.empty() )
+		{
+			return ::operator new( size );
+		}
+
+		void* ptr = g_FreeCommandLists.back();
+		g_FreeCommandLists.pop_back();
+		return ptr;
+	}
+
+	void D3DCommandList::operator delete( void* ptr )
+	{
+		std::lock_guard<std::mutex> lock( g_CommandListMutex );
+		g_FreeCommandLists.push_back( ptr );
+	}
+
+	D3DGPUContext::D3DGPUContext( D3DGPUDevice* pDevice, bool deferred )
 		:
-		m_pDevice( pDevice )
+		m_pDevice( pDevice ),
+		m_bDeferred( deferred )
 	{}
 
 	void D3DGPUContext::Init()
 	{
+		ResetState();
+
+		m_pDeviceContext.As( &m_pAnnotation );
+	}
+
+	void D3DGPUContext::ResetState()
+	{
+		m_RenderTargetStack.clear();
+		m_iRenderTargetArrayIndex = 0;
+		m_iRenderTargetMipIndex = 0;
+		m_ViewportStack.clear();
 		m_ViewportStack.emplace_back();
+		m_pDepthStencil = nullptr;
+		m_iDepthStencilIndex = 0;
+		m_pPixelShader = nullptr;
+		m_pVertexShader = nullptr;
+		m_bBlendingEnabled = false;
 
 		m_CurrentDepthStencilState.DepthEnable = TRUE;
 		m_CurrentDepthStencilState.DepthWriteMask = D3D11_DEPTH_WRITE_MASK::D3D11_DEPTH_WRITE_MASK_ALL;
@@ -669,8 +774,6 @@ namespace Bat
 		m_CurrentRasterizerState.MultisampleEnable = true;
 		m_CurrentRasterizerState.ScissorEnable = false;
 		m_CurrentRasterizerState.SlopeScaledDepthBias = 0.0f;
-
-		m_pDeviceContext.As( &m_pAnnotation );
 	}
 
 	IGPUDevice* D3DGPUContext::GetDevice()
@@ -745,7 +848,7 @@ namespace Bat
 			return 0;
 		}
 
-		return m_ViewportStack.back().size();
+		return m_ViewportStack.back().count;
 	}
 
 	const Viewport& D3DGPUContext::GetViewport(size_t slot) const
@@ -757,31 +860,31 @@ namespace Bat
 			return null_vp;
 		}
 
-		return m_ViewportStack.back()[slot];
+		return m_ViewportStack.back().viewports[slot];
 	}
 
 	void D3DGPUContext::SetViewport( const Viewport& viewport )
 	{
-		m_ViewportStack.back() = { viewport };
+		m_ViewportStack.back().Assign( &viewport, 1 );
 
 		BindViewports();
 	}
 
 	void D3DGPUContext::SetViewports( const std::vector<Viewport>& viewports )
 	{
-		m_ViewportStack.back() = viewports;
+		m_ViewportStack.back().Assign( viewports.data(), viewports.size() );
 		BindViewports();
 	}
 
 	void D3DGPUContext::PushViewport( const Viewport& viewport )
 	{
-		m_ViewportStack.push_back( { viewport } );
+		m_ViewportStack.emplace_back().Assign( &viewport, 1 );
 		BindViewports();
 	}
 
 	void D3DGPUContext::PushViewports( const std::vector<Viewport>& viewports )
 	{
-		m_ViewportStack.push_back( viewports );
+		m_ViewportStack.emplace_back().Assign( viewports.data(), viewports.size() );
 		BindViewports();
 	}
 
@@ -963,7 +1066,7 @@ namespace Bat
 			return 0;
 		}
 
-		return m_RenderTargetStack.back().size();
+		return m_RenderTargetStack.back().count;
 	}
 
 	IRenderTarget* D3DGPUContext::GetRenderTarget(size_t slot) const
@@ -973,7 +1076,7 @@ namespace Bat
 			return nullptr;
 		}
 
-		return m_RenderTargetStack.back()[slot];
+		return m_RenderTargetStack.back().targets[slot];
 	}
 
 	void D3DGPUContext::SetRenderTarget( IRenderTarget* pRT, size_t array_index, size_t mip_index )
@@ -982,12 +1085,9 @@ namespace Bat
 		m_iRenderTargetMipIndex = mip_index;
 		if( m_RenderTargetStack.empty() )
 		{
-			m_RenderTargetStack.push_back( { pRT } );
-		}
-		else
-		{
-			m_RenderTargetStack.back() = { pRT };
+			m_RenderTargetStack.emplace_back();
 		}
+		m_RenderTargetStack.back().Assign( &pRT, 1 );
 
 		BindRenderTarget();
 	}
@@ -996,31 +1096,28 @@ namespace Bat
 	{
 		if( m_RenderTargetStack.empty() )
 		{
-			m_RenderTargetStack.push_back( pRT );
-		}
-		else
-		{
-			m_RenderTargetStack.back() = pRT;
+			m_RenderTargetStack.emplace_back();
 		}
+		m_RenderTargetStack.back().Assign( pRT.data(), pRT.size() );
 
 		BindRenderTarget();
 	}
 
 	void D3DGPUContext::PushRenderTarget()
 	{
-		m_RenderTargetStack.push_back( {} );
+		m_RenderTargetStack.emplace_back();
 		BindRenderTarget();
 	}
 
 	void D3DGPUContext::PushRenderTarget( IRenderTarget* pRT )
 	{
-		m_RenderTargetStack.push_back( { pRT } );
+		m_RenderTargetStack.emplace_back().Assign( &pRT, 1 );
 		BindRenderTarget();
 	}
 
 	void D3DGPUContext::PushRenderTargets( const std::vector<IRenderTarget*>& pRTs )
 	{
-		m_RenderTargetStack.push_back( pRTs );
+		m_RenderTargetStack.emplace_back().Assign( pRTs.data(), pRTs.size() );
 	}
 
 	void D3DGPUContext::PopRenderTarget()
@@ -1033,7 +1130,7 @@ namespace Bat
 	{
 		if( !m_RenderTargetStack.empty() )
 		{
-			m_RenderTargetStack.back() = {};
+			m_RenderTargetStack.back().count = 0;
 		}
 		BindRenderTarget();
 	}
@@ -1093,6 +1190,17 @@ namespace Bat
 		m_pDeviceContext->ResolveSubresource( pDstResource, 0, pSrcResource, 0, format );
 	}
 
+	void D3DGPUContext::CopyDepthStencil( IDepthStencil* pDst, size_t dst_index, IDepthStencil* pSrc, size_t src_index )
+	{
+		ASSERT( pDst->GetFormat() == pSrc->GetFormat(), "Cannot copy to a depth stencil of a different type" );
+		ASSERT( pDst->GetWidth() == pSrc->GetWidth() && pDst->GetHeight() == pSrc->GetHeight(), "Cannot copy to a depth stencil of a different size" );
+
+		ID3D11Resource* pDstResource = static_cast<D3DDepthStencil*>( pDst )->GetResource();
+		ID3D11Resource* pSrcResource = static_cast<D3DDepthStencil*>( pSrc )->GetResource();
+		DXGI_CONTEXT_CALL( m_pDeviceContext->CopySubresourceRegion( pDstResource, D3D11CalcSubresource( 0, (UINT)dst_index, 1 ), 0, 0, 0,
+			pSrcResource, D3D11CalcSubresource( 0, (UINT)src_index, 1 ), nullptr ) );
+	}
+
 	void D3DGPUContext::ClearRenderTarget( IRenderTarget* pRT, float r, float g, float b, float a, size_t array_index, size_t mip_index )
 	{
 		if( !pRT )
@@ -1331,16 +1439,111 @@ namespace Bat
 		}
 	}
 
+	template <typename T, size_t N>
+	static void ReleaseAll( T* (&objects)[N] )
+	{
+		for( T* pObject : objects )
+		{
+			if( pObject )
+			{
+				pObject->Release();
+			}
+		}
+	}
+
+	void D3DGPUContext::InheritState( IGPUContext* pContext )
+	{
+		const D3DGPUContext* pSource = static_cast<const D3DGPUContext*>( pContext );
+
+		m_RenderTargetStack.clear();
+		if( !pSource->m_RenderTargetStack.empty() )
+		{
+			m_RenderTargetStack.push_back( pSource->m_RenderTargetStack.back() );
+		}
+		m_iRenderTargetArrayIndex = pSource->m_iRenderTargetArrayIndex;
+		m_iRenderTargetMipIndex = pSource->m_iRenderTargetMipIndex;
+		// inherited viewports become the bottom of the stack
+		m_ViewportStack.clear();
+		m_ViewportStack.push_back( pSource->m_ViewportStack.back() );
+		m_pDepthStencil = pSource->m_pDepthStencil;
+		m_iDepthStencilIndex = pSource->m_iDepthStencilIndex;
+		m_CurrentDepthStencilState = pSource->m_CurrentDepthStencilState;
+		m_CurrentRasterizerState = pSource->m_CurrentRasterizerState;
+
+		BindViewports();
+		BindRenderTarget();
+		BindDepthStencilState();
+		BindRasterizerState();
+		SetBlendingEnabled( pSource->m_bBlendingEnabled );
+		SetPixelShader( pSource->m_pPixelShader );
+		SetVertexShader( pSource->m_pVertexShader );
+
+		// Topology and resource bindings aren't tracked, so copy them from the D3D context directly
+		ID3D11DeviceContext* pSourceContext = pSource->m_pDeviceContext.Get();
+
+		D3D11_PRIMITIVE_TOPOLOGY topology;
+		pSourceContext->IAGetPrimitiveTopology( &topology );
+		DXGI_CONTEXT_CALL( m_pDeviceContext->IASetPrimitiveTopology( topology ) );
+
+		ID3D11ShaderResourceView* srvs[D3D11_COMMONSHADER_INPUT_RESOURCE_SLOT_COUNT];
+		pSourceContext->PSGetShaderResources( 0, D3D11_COMMONSHADER_INPUT_RESOURCE_SLOT_COUNT, srvs );
+		DXGI_CONTEXT_CALL( m_pDeviceContext->PSSetShaderResources( 0, D3D11_COMMONSHADER_INPUT_RESOURCE_SLOT_COUNT, srvs ) );
+		ReleaseAll( srvs );
+
+		pSourceContext->VSGetShaderResources( 0, D3D11_COMMONSHADER_INPUT_RESOURCE_SLOT_COUNT, srvs );
+		DXGI_CONTEXT_CALL( m_pDeviceContext->VSSetShaderResources( 0, D3D11_COMMONSHADER_INPUT_RESOURCE_SLOT_COUNT, srvs ) );
+		ReleaseAll( srvs );
+
+		ID3D11SamplerState* samplers[D3D11_COMMONSHADER_SAMPLER_SLOT_COUNT];
+		pSourceContext->PSGetSamplers( 0, D3D11_COMMONSHADER_SAMPLER_SLOT_COUNT, samplers );
+		DXGI_CONTEXT_CALL( m_pDeviceContext->PSSetSamplers( 0, D3D11_COMMONSHADER_SAMPLER_SLOT_COUNT, samplers ) );
+		ReleaseAll( samplers );
+
+		pSourceContext->VSGetSamplers( 0, D3D11_COMMONSHADER_SAMPLER_SLOT_COUNT, samplers );
+		DXGI_CONTEXT_CALL( m_pDeviceContext->VSSetSamplers( 0, D3D11_COMMONSHADER_SAMPLER_SLOT_COUNT, samplers ) );
+		ReleaseAll( samplers );
+
+		ID3D11Buffer* cbufs[D3D11_COMMONSHADER_CONSTANT_BUFFER_API_SLOT_COUNT];
+		pSourceContext->PSGetConstantBuffers( 0, D3D11_COMMONSHADER_CONSTANT_BUFFER_API_SLOT_COUNT, cbufs );
+		DXGI_CONTEXT_CALL( m_pDeviceContext->PSSetConstantBuffers( 0, D3D11_COMMONSHADER_CONSTANT_BUFFER_API_SLOT_COUNT, cbufs ) );
+		ReleaseAll( cbufs );
+
+		pSourceContext->VSGetConstantBuffers( 0, D3D11_COMMONSHADER_CONSTANT_BUFFER_API_SLOT_COUNT, cbufs );
+		DXGI_CONTEXT_CALL( m_pDeviceContext->VSSetConstantBuffers( 0, D3D11_COMMONSHADER_CONSTANT_BUFFER_API_SLOT_COUNT, cbufs ) );
+		ReleaseAll( cbufs );
+	}
+
+	IGPUCommandList* D3DGPUContext::FinishCommandList()
+	{
+		ASSERT( m_bDeferred, "Only deferred contexts can record command lists" );
+
+		auto pCommandList = new D3DCommandList();
+		COM_THROW_IF_FAILED( m_pDeviceContext->FinishCommandList( FALSE, pCommandList->GetAddressOf() ) );
+
+		// D3D resets a deferred context once its command list is finished
+		ResetState();
+
+		return pCommandList;
+	}
+
+	void D3DGPUContext::ExecuteCommandList( IGPUCommandList* pCommandList )
+	{
+		ASSERT( !m_bDeferred, "Command lists can only be executed on the immediate context" );
+
+		// restore our state afterwards so the tracked state stays valid
+		auto pD3DCommandList = static_cast<D3DCommandList*>( pCommandList );
+		DXGI_CONTEXT_CALL( m_pDeviceContext->ExecuteCommandList( pD3DCommandList->GetCommandList(), TRUE ) );
+	}
+
 	void D3DGPUContext::BindViewports()
 	{
-		size_t count = m_ViewportStack.back().size();
+		size_t count = m_ViewportStack.back().count;
 
-		std::vector<D3D11_VIEWPORT> d3d11vps;
-		d3d11vps.resize( count );
+		D3D11_VIEWPORT d3d11vps[D3D11_VIEWPORT_AND_SCISSORRECT_OBJECT_COUNT_PER_PIPELINE];
 
 		for( size_t i = 0; i < count; i++ )
 		{
-			const Viewport& vp = m_ViewportStack.back()[i];
+			const Viewport& vp = m_ViewportStack.back().viewports[i];
 			d3d11vps[i].Width = vp.width;
 			d3d11vps[i].Height = vp.height;
 			d3d11vps[i].MinDepth = vp.min_depth;
@@ -1349,34 +1552,33 @@ namespace Bat
 			d3d11vps[i].TopLeftY = vp.top_left.y;
 		}
 
-		DXGI_CONTEXT_CALL( m_pDeviceContext->RSSetViewports( (UINT)count, d3d11vps.data() ) );
+		DXGI_CONTEXT_CALL( m_pDeviceContext->RSSetViewports( (UINT)count, d3d11vps ) );
 	}
 
 	void D3DGPUContext::BindRenderTarget()
 	{
-		size_t count = m_RenderTargetStack.empty() ? 0 : m_RenderTargetStack.back().size();
+		size_t count = m_RenderTargetStack.empty() ? 0 : m_RenderTargetStack.back().count;
 
 		ID3D11DepthStencilView* pDSV = m_pDepthStencil ? m_pDepthStencil->GetDepthStencilView( m_iDepthStencilIndex ) : nullptr;
 
 		if( count )
 		{
-			std::vector<ID3D11RenderTargetView*> d3d11rts;
-			d3d11rts.reserve( count );
+			ID3D11RenderTargetView* d3d11rts[D3D11_SIMULTANEOUS_RENDER_TARGET_COUNT];
 
 			for( size_t i = 0; i < count; i++ )
 			{
-				const IRenderTarget* rt = m_RenderTargetStack.back()[i];
+				const IRenderTarget* rt = m_RenderTargetStack.back().targets[i];
 				if( rt )
 				{
-					d3d11rts.push_back( static_cast<const D3DRenderTarget*>(rt)->GetRenderTargetView( m_iRenderTargetArrayIndex, m_iRenderTargetMipIndex ) );
+					d3d11rts[i] = static_cast<const D3DRenderTarget*>(rt)->GetRenderTargetView( m_iRenderTargetArrayIndex, m_iRenderTargetMipIndex );
 				}
 				else
 				{
-					d3d11rts.push_back( nullptr );
+					d3d11rts[i] = nullptr;
 				}
 			}
 
-			DXGI_CONTEXT_CALL( m_pDeviceContext->OMSetRenderTargets( (UINT)count, d3d11rts.data(), pDSV ) );
+			DXGI_CONTEXT_CALL( m_pDeviceContext->OMSetRenderTargets( (UINT)count, d3d11rts, pDSV ) );
 		}
 		else
 		{
@@ -1644,6 +1846,15 @@ namespace Bat
 #endif
 	}
 
+	IGPUContext* D3DGPUDevice::CreateDeferredContext()
+	{
+		auto pContext = new D3DGPUContext( this, true );
+		COM_THROW_IF_FAILED( m_pDevice->CreateDeferredContext( 0, &pContext->m_pDeviceContext ) );
+		pContext->Init();
+
+		return pContext;
+	}
+
 	const DeviceInfo& D3DGPUDevice::GetDeviceInfo() const
 	{
 		return m_DeviceInfo;
@@ -1855,6 +2066,7 @@ namespace Bat
 
 	ID3D11DepthStencilState* D3DGPUDevice::GetDepthStencilState( const D3D11_DEPTH_STENCIL_DESC& state )
 	{
+		std::lock_guard<std::mutex> lock( m_StateMutex );
 		auto it = m_pDepthStencilStates.find( state );
 		if( it == m_pDepthStencilStates.end() )
 		{
@@ -1866,13 +2078,19 @@ namespace Bat
 
 	ID3D11DepthStencilState* D3DGPUDevice::AddDepthStencilState( const D3D11_DEPTH_STENCIL_DESC& state )
 	{
+		std::lock_guard<std::mutex> lock( m_StateMutex );
 		auto& depth_stencil_state = m_pDepthStencilStates[state];
-		COM_THROW_IF_FAILED( m_pDevice->CreateDepthStencilState( &state, &depth_stencil_state ) );
+		// another context may have added it since this one looked it up
+		if( !depth_stencil_state )
+		{
+			COM_THROW_IF_FAILED( m_pDevice->CreateDepthStencilState( &state, &depth_stencil_state ) );
+		}
 		return depth_stencil_state.Get();
 	}
 
 	ID3D11RasterizerState* D3DGPUDevice::GetRasterizerState( const D3D11_RASTERIZER_DESC& state )
 	{
+		std::lock_guard<std::mutex> lock( m_StateMutex );
 		auto it = m_pRasterizerStates.find( state );
 		if( it == m_pRasterizerStates.end() )
 		{
@@ -1884,8 +2102,12 @@ namespace Bat
 
 	ID3D11RasterizerState* D3DGPUDevice::AddRasterizerState( const D3D11_RASTERIZER_DESC& state )
 	{
+		std::lock_guard<std::mutex> lock( m_StateMutex );
 		auto& rasterizer_state = m_pRasterizerStates[state];
-		COM_THROW_IF_FAILED( m_pDevice->CreateRasterizerState( &state, &rasterizer_state ) );
+		if( !rasterizer_state )
+		{
+			COM_THROW_IF_FAILED( m_pDevice->CreateRasterizerState( &state, &rasterizer_state ) );
+		}
 		return rasterizer_state.Get();
 	}
 
@@ -1942,9 +2164,14 @@ namespace Bat
 	{
 		if( IsDirty() )
 		{
-			LoadFromFile( pDevice, m_szName, false );
+			// contexts on several threads can hit a dirty shader at the same time
+			std::lock_guard<std::mutex> lock( m_ReloadMutex );
+			if( IsDirty() )
+			{
+				LoadFromFile( pDevice, m_szName, false );
 
-			SetDirty( false );
+				SetDirty( false );
+			}
 		}
 
 		return m_pShader.Get();
@@ -2045,9 +2272,14 @@ namespace Bat
 	{
 		if( IsDirty() )
 		{
-			LoadFromFile( pDevice, m_szName, false );
+			// contexts on several threads can hit a dirty shader at the same time
+			std::lock_guard<std::mutex> lock( m_ReloadMutex );
+			if( IsDirty() )
+			{
+				LoadFromFile( pDevice, m_szName, false );
 
-			SetDirty( false );
+				SetDirty( false );
+			}
 		}
 
 		return m_pShader.Get();
@@ -6,6 +6,8 @@
 #include "ShaderManager.h"
 #include "ColourPipeline.h"
 #include "SpriteFont.h"
+#include "VertexBuffer.h"
+#include "Util/FrameAllocator.h"
 
 namespace Bat
 {
@@ -20,20 +22,13 @@ namespace Bat
 
 	struct DebugText
 	{
-		std::string str;
+		// lives in the frame allocator
+		const char* str;
 		Vei2 pos;
 		Colour col;
 	};
 	static std::vector<DebugText> g_DebugTexts;
 
-	struct DebugBox
-	{
-		Vec3 a;
-		Vec3 b;
-		Colour col;
-	};
-	static std::vector<DebugBox> g_DebugBoxes;
-
 	struct DebugLine
 	{
 		Vec3 a;
@@ -41,6 +36,13 @@ namespace Bat
 		Colour col;
 	};
 	static std::vector<DebugLine> g_DebugLines;
+	// persistent, only recreated when a frame has more lines than ever before
+	static VertexBuffer<Vec3> g_LinePositions;
+	static VertexBuffer<Vec4> g_LineColours;
+	static size_t g_iLineVertexCapacity = 0;
+
+	// render graph passes record on job threads, anything can be queued from them
+	static std::mutex g_DebugMutex;
 
 	static void InitDebugDrawState( IGPUContext* pContext )
 	{
@@ -86,54 +88,33 @@ namespace Bat
 		auto pPipeline = ShaderManager::GetPipeline<ColourPipeline>();
 		pPipeline->Render( pContext, builder.Build(), Camera::ScreenOrtho(), Mat4::Identity() );
 	}
-	static void DrawBox( const Camera& camera, const DebugBox& box )
+	static void DrawLines( const Camera& camera, const std::vector<DebugLine>& lines )
 	{
-		AABB aabb( box.a, box.b );
-		Vec3 box_points[8];
-		aabb.GetPoints( box_points );
-		Vec4 colour = box.col.AsVector();
-
-		const size_t vertex_count = 8;
-		const size_t index_count = 8 * 3;
-		MeshBuilder builder( vertex_count, index_count, PrimitiveTopology::LINELIST );
-		for( int i = 0; i < 8; i++ )
+		const size_t vertex_count = lines.size() * 2;
+		if( vertex_count > g_iLineVertexCapacity )
 		{
-			builder.Position( box_points[i] );
-			builder.Colour( colour );
+			g_iLineVertexCapacity = std::max( vertex_count, g_iLineVertexCapacity * 2 );
+			g_LinePositions.Reset( nullptr, g_iLineVertexCapacity );
+			g_LineColours.Reset( nullptr, g_iLineVertexCapacity );
 		}
 
-		builder.Line( 0, 1 );
-		builder.Line( 1, 2 );
-		builder.Line( 2, 3 );
-		builder.Line( 3, 0 );
-		builder.Line( 4, 5 );
-		builder.Line( 5, 6 );
-		builder.Line( 6, 7 );
-		builder.Line( 7, 4 );
-		builder.Line( 4, 2 );
-		builder.Line( 5, 1 );
-		builder.Line( 6, 0 );
-		builder.Line( 7, 3 );
-
+		// written straight into the mapped buffers
 		IGPUContext* pContext = gpu->GetContext();
-		auto pPipeline = ShaderManager::GetPipeline<ColourPipeline>();
-		pPipeline->Render( pContext, builder.Build(), camera, Mat4::Identity() );
-	}
-	static void DrawLines( const Camera& camera, const std::vector<DebugLine>& lines )
-	{
-		const size_t vertex_count = lines.size() * 2;
-		const size_t index_count = 0;
-		MeshBuilder builder( vertex_count, index_count, PrimitiveTopology::LINELIST );
-		for( const DebugLine& line : lines  )
+		Vec3* pPositions = g_LinePositions.Lock( pContext );
+		Vec4* pColours = g_LineColours.Lock( pContext );
+		for( size_t i = 0; i < lines.size(); i++ )
 		{
-			Vec4 col = line.col.AsVector();
-			builder.Position( line.a ); builder.Colour( col );
-			builder.Position( line.b ); builder.Colour( col );
+			const Vec4 col = lines[i].col.AsVector();
+			pPositions[i * 2 + 0] = lines[i].a;
+			pPositions[i * 2 + 1] = lines[i].b;
+			pColours[i * 2 + 0] = col;
+			pColours[i * 2 + 1] = col;
 		}
+		g_LineColours.Unlock( pContext );
+		g_LinePositions.Unlock( pContext );
 
-		IGPUContext* pContext = gpu->GetContext();
 		auto pPipeline = ShaderManager::GetPipeline<ColourPipeline>();
-		pPipeline->Render( pContext, builder.Build(), camera, Mat4::Identity() );
+		pPipeline->Render( pContext, g_LinePositions, g_LineColours, vertex_count, PrimitiveTopology::LINELIST, camera, Mat4::Identity() );
 	}
 
 	void DebugDraw::Rectangle( const Vei2& a, const Vei2& b, const Colour& col, float thickness )
@@ -143,15 +124,26 @@ namespace Bat
 		rect.b = b;
 		rect.col = col;
 		rect.thickness = thickness;
+
+		std::lock_guard<std::mutex> lock( g_DebugMutex );
 		g_DebugRects.push_back( rect );
 	}
 	void DebugDraw::Box( const Vec3& a, const Vec3& b, const Colour& col )
 	{
-		DebugBox box;
-		box.a = a;
-		box.b = b;
-		box.col = col;
-		g_DebugBoxes.push_back( box );
+		// boxes are drawn as part of the line batch rather than as a mesh each
+		AABB aabb( a, b );
+		Vec3 box_points[8];
+		aabb.GetPoints( box_points );
+
+		static constexpr int edges[12][2] = {
+			{ 0, 1 }, { 1, 2 }, { 2, 3 }, { 3, 0 },
+			{ 4, 5 }, { 5, 6 }, { 6, 7 }, { 7, 4 },
+			{ 4, 2 }, { 5, 1 }, { 6, 0 }, { 7, 3 }
+		};
+		for( const auto& edge : edges )
+		{
+			Line( box_points[edge[0]], box_points[edge[1]], col );
+		}
 	}
 	void DebugDraw::Line( const Vec3& a, const Vec3& b, const Colour& col )
 	{
@@ -159,18 +151,24 @@ namespace Bat
 		line.a = a;
 		line.b = b;
 		line.col = col;
+
+		std::lock_guard<std::mutex> lock( g_DebugMutex );
 		g_DebugLines.push_back( line );
 	}
 	void DebugDraw::Text( const std::string& str, const Vei2& pos, const Colour& col )
 	{
 		DebugText text;
-		text.str = str;
+		text.str = FrameAllocator::CopyString( str.c_str() );
 		text.pos = pos;
 		text.col = col;
-		g_DebugTexts.push_back( std::move( text ) );
+
+		std::lock_guard<std::mutex> lock( g_DebugMutex );
+		g_DebugTexts.push_back( text );
 	}
 	void DebugDraw::Flush( const Camera& camera )
 	{
+		std::lock_guard<std::mutex> lock( g_DebugMutex );
+
 		IGPUContext* pContext = gpu->GetContext();
 		pContext->BeginEvent( "debug_draw" );
 
@@ -182,12 +180,6 @@ namespace Bat
 		}
 		g_DebugRects.clear();
 
-		for( const DebugBox& box : g_DebugBoxes )
-		{
-			DrawBox( camera, box );
-		}
-		g_DebugBoxes.clear();
-
 		if( !g_DebugLines.empty() )
 		{
 			DrawLines( camera, g_DebugLines );
@@ -204,7 +196,7 @@ namespace Bat
 				Vec2 pos = { (float)text.pos.x, (float)text.pos.y };
 
 				wchar_t wstr[256];
-				Bat::StringToWide( text.str.c_str(), wstr, sizeof( wstr ) );
+				Bat::StringToWide( text.str, wstr, sizeof( wstr ) );
 				font.DrawString( &batch, wstr, pos, text.col.AsVector() );
 			}
 			batch.End();
@@ -0,0 +1,1396 @@
+#include "PCH.h"
+#include "HeadlessGPUDevice.h"
+
+#include "IGPUDevice.h"
+
+namespace Bat
+{
+	const char* GPUCommandTypeToString( GPUCommandType type )
+	{
+		switch( type )
+		{
+		case GPUCommandType::SET_TOPOLOGY:            return "SetTopology";
+		case GPUCommandType::SET_VIEWPORTS:           return "SetViewports";
+		case GPUCommandType::SET_DEPTH_STENCIL:       return "SetDepthStencil";
+		case GPUCommandType::SET_DEPTH_STENCIL_STATE: return "SetDepthStencilState";
+		case GPUCommandType::SET_RASTERIZER_STATE:    return "SetRasterizerState";
+		case GPUCommandType::SET_BLEND_STATE:         return "SetBlendState";
+		case GPUCommandType::SET_RENDER_TARGETS:      return "SetRenderTargets";
+		case GPUCommandType::CLEAR_RENDER_TARGET:     return "ClearRenderTarget";
+		case GPUCommandType::CLEAR_DEPTH_STENCIL:     return "ClearDepthStencil";
+		case GPUCommandType::RESOLVE:                 return "Resolve";
+		case GPUCommandType::COPY_DEPTH_STENCIL:      return "CopyDepthStencil";
+		case GPUCommandType::UPDATE_TEXTURE:          return "UpdateTexture";
+		case GPUCommandType::BIND_TEXTURE:            return "BindTexture";
+		case GPUCommandType::UNBIND_TEXTURE:          return "UnbindTexture";
+		case GPUCommandType::UPDATE_BUFFER:           return "UpdateBuffer";
+		case GPUCommandType::LOCK_BUFFER:             return "LockBuffer";
+		case GPUCommandType::SET_PIXEL_SHADER:        return "SetPixelShader";
+		case GPUCommandType::SET_VERTEX_SHADER:       return "SetVertexShader";
+		case GPUCommandType::SET_VERTEX_BUFFER:       return "SetVertexBuffer";
+		case GPUCommandType::SET_INDEX_BUFFER:        return "SetIndexBuffer";
+		case GPUCommandType::SET_CONSTANT_BUFFER:     return "SetConstantBuffer";
+		case GPUCommandType::SET_SAMPLER:             return "SetSampler";
+		case GPUCommandType::DRAW:                    return "Draw";
+		case GPUCommandType::DRAW_INSTANCED:          return "DrawInstanced";
+		case GPUCommandType::DRAW_INDEXED:            return "DrawIndexed";
+		case GPUCommandType::DRAW_INSTANCED_INDEXED:  return "DrawInstancedIndexed";
+		case GPUCommandType::BEGIN_EVENT:             return "BeginEvent";
+		case GPUCommandType::END_EVENT:               return "EndEvent";
+		}
+
+		ASSERT( false, "Unhandled command type" );
+		return "";
+	}
+
+	static bool IsStateChange( GPUCommandType type )
+	{
+		switch( type )
+		{
+		case GPUCommandType::SET_TOPOLOGY:
+		case GPUCommandType::SET_VIEWPORTS:
+		case GPUCommandType::SET_DEPTH_STENCIL:
+		case GPUCommandType::SET_DEPTH_STENCIL_STATE:
+		case GPUCommandType::SET_RASTERIZER_STATE:
+		case GPUCommandType::SET_BLEND_STATE:
+		case GPUCommandType::SET_RENDER_TARGETS:
+		case GPUCommandType::BIND_TEXTURE:
+		case GPUCommandType::UNBIND_TEXTURE:
+		case GPUCommandType::SET_PIXEL_SHADER:
+		case GPUCommandType::SET_VERTEX_SHADER:
+		case GPUCommandType::SET_VERTEX_BUFFER:
+		case GPUCommandType::SET_INDEX_BUFFER:
+		case GPUCommandType::SET_CONSTANT_BUFFER:
+		case GPUCommandType::SET_SAMPLER:
+			return true;
+		default:
+			return false;
+		}
+	}
+
+	static bool IsDraw( GPUCommandType type )
+	{
+		return type == GPUCommandType::DRAW ||
+			type == GPUCommandType::DRAW_INSTANCED ||
+			type == GPUCommandType::DRAW_INDEXED ||
+			type == GPUCommandType::DRAW_INSTANCED_INDEXED;
+	}
+
+	void GPUCommandLog::Record( GPUCommandType type, const void* resource, size_t count, size_t slot, bool redundant )
+	{
+		GPUCommand cmd;
+		cmd.type = type;
+		cmd.redundant = redundant;
+		cmd.slot = (uint16_t)slot;
+		cmd.count = (uint32_t)count;
+		cmd.resource = resource;
+		m_Commands.push_back( cmd );
+	}
+
+	void GPUCommandLog::RecordBeginEvent( const std::string& name )
+	{
+		Record( GPUCommandType::BEGIN_EVENT, nullptr, 0, AddEventName( name ) );
+		m_EventTimes.push_back( std::chrono::steady_clock::now() );
+	}
+
+	void GPUCommandLog::RecordEndEvent()
+	{
+		Record( GPUCommandType::END_EVENT );
+		m_EventTimes.push_back( std::chrono::steady_clock::now() );
+	}
+
+	void GPUCommandLog::Append( const GPUCommandLog& log )
+	{
+		m_Commands.reserve( m_Commands.size() + log.m_Commands.size() );
+		m_EventTimes.insert( m_EventTimes.end(), log.m_EventTimes.begin(), log.m_EventTimes.end() );
+		for( GPUCommand cmd : log.m_Commands )
+		{
+			// event names are indices into the log they were recorded in
+			if( cmd.type == GPUCommandType::BEGIN_EVENT )
+			{
+				cmd.slot = AddEventName( log.GetEventName( cmd.slot ) );
+			}
+			m_Commands.push_back( cmd );
+		}
+	}
+
+	void GPUCommandLog::Clear()
+	{
+		// keep the event names around, they are usually the same every frame
+		m_Commands.clear();
+		m_EventTimes.clear();
+	}
+
+	uint16_t GPUCommandLog::AddEventName( const std::string& name )
+	{
+		auto it = m_EventNameIndices.find( name );
+		if( it == m_EventNameIndices.end() )
+		{
+			it = m_EventNameIndices.emplace( name, (uint16_t)m_EventNames.size() ).first;
+			m_EventNames.push_back( name );
+		}
+
+		return it->second;
+	}
+
+	// Calls func( pass_name, first_command, end_command ) for every top level event, commands outside
+	// of any event are grouped into passes named "<none>"
+	template <typename Func>
+	static void ForEachPass( const GPUCommandLog& log, Func&& func )
+	{
+		static const std::string no_pass = "<none>";
+
+		const std::vector<GPUCommand>& commands = log.GetCommands();
+		const std::string* pass_name = &no_pass;
+		size_t pass_start = 0;
+		size_t depth = 0;
+		for( size_t i = 0; i < commands.size(); i++ )
+		{
+			const GPUCommand& cmd = commands[i];
+			if( cmd.type == GPUCommandType::BEGIN_EVENT )
+			{
+				if( depth == 0 )
+				{
+					if( i != pass_start )
+					{
+						func( *pass_name, pass_start, i );
+					}
+					pass_name = &log.GetEventName( cmd.slot );
+					pass_start = i;
+				}
+				depth++;
+			}
+			else if( cmd.type == GPUCommandType::END_EVENT && depth > 0 )
+			{
+				depth--;
+				if( depth == 0 )
+				{
+					func( *pass_name, pass_start, i + 1 );
+					pass_name = &no_pass;
+					pass_start = i + 1;
+				}
+			}
+		}
+
+		if( pass_start != commands.size() )
+		{
+			func( *pass_name, pass_start, commands.size() );
+		}
+	}
+
+	std::vector<GPUPassStats> GPUCommandLog::GetPassStats() const
+	{
+		std::vector<GPUPassStats> passes;
+		// passes are visited in command order, so event times can be consumed as they are reached
+		size_t event_index = 0;
+		ForEachPass( *this, [&]( const std::string& name, size_t start, size_t end )
+		{
+			GPUPassStats stats;
+			stats.name = name;
+			stats.commands = end - start;
+
+			const size_t first_event = event_index;
+			for( size_t i = start; i < end; i++ )
+			{
+				const GPUCommand& cmd = m_Commands[i];
+				if( cmd.type == GPUCommandType::BEGIN_EVENT || cmd.type == GPUCommandType::END_EVENT )
+				{
+					event_index++;
+				}
+				else if( IsDraw( cmd.type ) )
+				{
+					stats.draws++;
+					stats.vertices += cmd.count;
+				}
+				else if( IsStateChange( cmd.type ) )
+				{
+					if( cmd.redundant )
+					{
+						stats.redundant_state_changes++;
+					}
+					else
+					{
+						stats.state_changes++;
+					}
+
+					if( cmd.type == GPUCommandType::BIND_TEXTURE )
+					{
+						stats.texture_binds++;
+					}
+				}
+				else if( cmd.type == GPUCommandType::UPDATE_BUFFER ||
+					cmd.type == GPUCommandType::UPDATE_TEXTURE ||
+					cmd.type == GPUCommandType::LOCK_BUFFER )
+				{
+					stats.buffer_uploads++;
+					stats.bytes_uploaded += cmd.count;
+				}
+			}
+
+			const bool is_event = ( m_Commands[start].type == GPUCommandType::BEGIN_EVENT && m_Commands[end - 1].type == GPUCommandType::END_EVENT );
+			if( is_event && event_index <= m_EventTimes.size() )
+			{
+				const std::chrono::duration<float, std::milli> duration = m_EventTimes[event_index - 1] - m_EventTimes[first_event];
+				stats.cpu_ms = duration.count();
+			}
+			passes.push_back( std::move( stats ) );
+		} );
+
+		return passes;
+	}
+
+	std::string GPUCommandLog::GetReport() const
+	{
+		std::string report = Format( "%-24s %8s %10s %8s %10s %8s %10s %8s\n",
+			"pass", "draws", "vertices", "states", "redundant", "uploads", "bytes", "ms" );
+
+		GPUPassStats total;
+		for( const GPUPassStats& pass : GetPassStats() )
+		{
+			report += Format( "%-24s %8zu %10zu %8zu %10zu %8zu %10zu %8.3f\n",
+				pass.name,
+				pass.draws,
+				pass.vertices,
+				pass.state_changes,
+				pass.redundant_state_changes,
+				pass.buffer_uploads,
+				pass.bytes_uploaded,
+				pass.cpu_ms );
+
+			total.draws += pass.draws;
+			total.vertices += pass.vertices;
+			total.state_changes += pass.state_changes;
+			total.redundant_state_changes += pass.redundant_state_changes;
+			total.buffer_uploads += pass.buffer_uploads;
+			total.bytes_uploaded += pass.bytes_uploaded;
+			total.cpu_ms += pass.cpu_ms;
+		}
+
+		report += Format( "%-24s %8zu %10zu %8zu %10zu %8zu %10zu %8.3f\n",
+			"total",
+			total.draws,
+			total.vertices,
+			total.state_changes,
+			total.redundant_state_changes,
+			total.buffer_uploads,
+			total.bytes_uploaded,
+			total.cpu_ms );
+
+		return report;
+	}
+
+	std::string GPUCommandLog::Diff( const GPUCommandLog& before, const GPUCommandLog& after )
+	{
+		struct PassRange
+		{
+			std::string name;
+			size_t start;
+			size_t end;
+		};
+		auto gather = []( const GPUCommandLog& log )
+		{
+			std::vector<PassRange> ranges;
+			ForEachPass( log, [&]( const std::string& name, size_t start, size_t end )
+			{
+				ranges.push_back( { name, start, end } );
+			} );
+			return ranges;
+		};
+
+		const std::vector<PassRange> before_passes = gather( before );
+		const std::vector<PassRange> after_passes = gather( after );
+		const std::vector<GPUPassStats> before_stats = before.GetPassStats();
+		const std::vector<GPUPassStats> after_stats = after.GetPassStats();
+
+		std::string diff;
+		if( before_passes.size() != after_passes.size() )
+		{
+			diff += Format( "pass count changed: %zu -> %zu\n", before_passes.size(), after_passes.size() );
+		}
+
+		const size_t num_passes = std::min( before_passes.size(), after_passes.size() );
+		for( size_t p = 0; p < num_passes; p++ )
+		{
+			const PassRange& b = before_passes[p];
+			const PassRange& a = after_passes[p];
+			const GPUPassStats& bs = before_stats[p];
+			const GPUPassStats& as = after_stats[p];
+
+			if( b.name != a.name )
+			{
+				diff += Format( "pass %zu renamed: '%s' -> '%s'\n", p, b.name, a.name );
+			}
+
+			if( bs.draws != as.draws )
+			{
+				diff += Format( "%s: draws %zu -> %zu\n", a.name, bs.draws, as.draws );
+			}
+			if( bs.state_changes != as.state_changes )
+			{
+				diff += Format( "%s: state changes %zu -> %zu\n", a.name, bs.state_changes, as.state_changes );
+			}
+			if( bs.redundant_state_changes != as.redundant_state_changes )
+			{
+				diff += Format( "%s: redundant state changes %zu -> %zu\n", a.name, bs.redundant_state_changes, as.redundant_state_changes );
+			}
+			if( bs.buffer_uploads != as.buffer_uploads || bs.bytes_uploaded != as.bytes_uploaded )
+			{
+				diff += Format( "%s: uploads %zu (%zu bytes) -> %zu (%zu bytes)\n", a.name,
+					bs.buffer_uploads, bs.bytes_uploaded, as.buffer_uploads, as.bytes_uploaded );
+			}
+
+			// same counters can still hide a reordering, so also report the first command that differs
+			const size_t b_count = b.end - b.start;
+			const size_t a_count = a.end - a.start;
+			for( size_t i = 0; i < std::max( b_count, a_count ); i++ )
+			{
+				if( i >= b_count || i >= a_count )
+				{
+					diff += Format( "%s: command count %zu -> %zu\n", a.name, b_count, a_count );
+					break;
+				}
+
+				const GPUCommand& bc = before.GetCommands()[b.start + i];
+				const GPUCommand& ac = after.GetCommands()[a.start + i];
+				if( bc.type != ac.type || bc.count != ac.count || bc.slot != ac.slot || bc.redundant != ac.redundant )
+				{
+					diff += Format( "%s: command %zu differs: %s(slot %u, count %u)%s -> %s(slot %u, count %u)%s\n", a.name, i,
+						GPUCommandTypeToString( bc.type ), (unsigned)bc.slot, (unsigned)bc.count, bc.redundant ? " redundant" : "",
+						GPUCommandTypeToString( ac.type ), (unsigned)ac.slot, (unsigned)ac.count, ac.redundant ? " redundant" : "" );
+					break;
+				}
+			}
+		}
+
+		return diff;
+	}
+
+	class HeadlessTexture : public ITexture
+	{
+	public:
+		HeadlessTexture( size_t width, size_t height, TexFormat format )
+			:
+			m_iWidth( width ),
+			m_iHeight( height ),
+			m_Format( format )
+		{}
+
+		virtual size_t GetWidth() const override { return m_iWidth; }
+		virtual size_t GetHeight() const override { return m_iHeight; }
+		virtual TexFormat GetFormat() const override { return m_Format; }
+		virtual bool IsTranslucent() const override { return false; }
+		virtual void* GetImpl() override { return nullptr; }
+	private:
+		size_t m_iWidth;
+		size_t m_iHeight;
+		TexFormat m_Format;
+	};
+
+	class HeadlessRenderTarget : public IRenderTarget
+	{
+	public:
+		HeadlessRenderTarget( size_t width, size_t height, TexFormat format )
+			:
+			m_Texture( width, height, format )
+		{}
+
+		virtual size_t GetWidth() const override { return m_Texture.GetWidth(); }
+		virtual size_t GetHeight() const override { return m_Texture.GetHeight(); }
+		virtual TexFormat GetFormat() const override { return m_Texture.GetFormat(); }
+		virtual ITexture* AsTexture() const override { return const_cast<HeadlessTexture*>( &m_Texture ); }
+
+		void Resize( size_t width, size_t height ) { m_Texture = HeadlessTexture( width, height, m_Texture.GetFormat() ); }
+	private:
+		HeadlessTexture m_Texture;
+	};
+
+	class HeadlessDepthStencil : public IDepthStencil
+	{
+	public:
+		HeadlessDepthStencil( size_t width, size_t height, TexFormat format, size_t array_size )
+			:
+			m_iWidth( width ),
+			m_iHeight( height ),
+			m_Format( format ),
+			m_iArraySize( array_size )
+		{}
+
+		virtual size_t GetWidth() const override { return m_iWidth; }
+		virtual size_t GetHeight() const override { return m_iHeight; }
+		virtual TexFormat GetFormat() const override { return m_Format; }
+		virtual size_t GetArraySize() const override { return m_iArraySize; }
+	private:
+		size_t m_iWidth;
+		size_t m_iHeight;
+		TexFormat m_Format;
+		size_t m_iArraySize;
+	};
+
+	// Buffers keep a CPU copy so Lock() has somewhere to write to
+	class HeadlessVertexBuffer : public IVertexBuffer
+	{
+	public:
+		HeadlessVertexBuffer( size_t elem_size, size_t size )
+			:
+			m_iElementSize( elem_size ),
+			m_iVertexCount( size ),
+			m_Data( elem_size * size )
+		{}
+
+		virtual size_t GetVertexCount() const override { return m_iVertexCount; }
+		virtual size_t GetElementSize() const override { return m_iElementSize; }
+
+		char* GetData() { return m_Data.data(); }
+	private:
+		size_t m_iElementSize;
+		size_t m_iVertexCount;
+		std::vector<char> m_Data;
+	};
+
+	class HeadlessIndexBuffer : public IIndexBuffer
+	{
+	public:
+		HeadlessIndexBuffer( size_t elem_size, size_t size )
+			:
+			m_iElementSize( elem_size ),
+			m_iIndexCount( size ),
+			m_Data( elem_size * size )
+		{}
+
+		virtual size_t GetIndexCount() const override { return m_iIndexCount; }
+		virtual size_t GetElementSize() const override { return m_iElementSize; }
+
+		char* GetData() { return m_Data.data(); }
+	private:
+		size_t m_iElementSize;
+		size_t m_iIndexCount;
+		std::vector<char> m_Data;
+	};
+
+	class HeadlessConstantBuffer : public IConstantBuffer
+	{
+	public:
+		HeadlessConstantBuffer( size_t size )
+			:
+			m_Data( size )
+		{}
+
+		virtual size_t GetSize() const override { return m_Data.size(); }
+
+		char* GetData() { return m_Data.data(); }
+	private:
+		std::vector<char> m_Data;
+	};
+
+	class HeadlessPixelShader : public IPixelShader
+	{
+	public:
+		HeadlessPixelShader( std::string name )
+			:
+			m_szName( std::move( name ) )
+		{}
+
+		virtual std::string GetName() const override { return m_szName; }
+	private:
+		std::string m_szName;
+	};
+
+	// Shaders aren't compiled, so there is no input signature to reflect. Every attribute is reported
+	// as used once, each in its own slot, which makes meshes bind every vertex stream they have.
+	class HeadlessVertexShader : public IVertexShader
+	{
+	public:
+		HeadlessVertexShader( std::string name )
+			:
+			m_szName( std::move( name ) )
+		{}
+
+		virtual std::string GetName() const override { return m_szName; }
+		virtual int GetVertexAttributeCount( VertexAttribute attribute ) const override
+		{
+			return ( attribute > VertexAttribute::VertexId ) ? 1 : 0;
+		}
+		virtual int GetVertexAttributeSlot( VertexAttribute attribute, int index ) const override
+		{
+			if( attribute <= VertexAttribute::VertexId || index != 0 )
+			{
+				return -1;
+			}
+			return (int)attribute - (int)VertexAttribute::Position;
+		}
+	private:
+		std::string m_szName;
+	};
+
+	class HeadlessSampler : public ISampler
+	{
+	};
+
+	class HeadlessCommandList : public IGPUCommandList
+	{
+	public:
+		HeadlessCommandList( GPUCommandLog log )
+			:
+			m_Log( std::move( log ) )
+		{}
+
+		const GPUCommandLog& GetLog() const { return m_Log; }
+	private:
+		GPUCommandLog m_Log;
+	};
+
+	static bool operator==( const Viewport& lhs, const Viewport& rhs )
+	{
+		return lhs.width == rhs.width &&
+			lhs.height == rhs.height &&
+			lhs.min_depth == rhs.min_depth &&
+			lhs.max_depth == rhs.max_depth &&
+			lhs.top_left.x == rhs.top_left.x &&
+			lhs.top_left.y == rhs.top_left.y;
+	}
+
+	static bool operator==( const StencilOpDesc& lhs, const StencilOpDesc& rhs )
+	{
+		return lhs.fail_op == rhs.fail_op &&
+			lhs.depth_fail_op == rhs.depth_fail_op &&
+			lhs.pass_op == rhs.pass_op &&
+			lhs.func == rhs.func;
+	}
+
+	class HeadlessGPUDevice;
+
+	class HeadlessGPUContext : public IGPUContext
+	{
+	public:
+		HeadlessGPUContext( HeadlessGPUDevice* pDevice, bool deferred = false );
+
+		GPUCommandLog& GetLog() { return m_Log; }
+
+		virtual IGPUDevice* GetDevice() override;
+		virtual const IGPUDevice* GetDevice() const override;
+
+		virtual void SetPrimitiveTopology( PrimitiveTopology topology ) override;
+		virtual PrimitiveTopology GetPrimitiveTopology() const override { return m_Topology; }
+
+		virtual size_t GetViewportCount() const override;
+		virtual const Viewport& GetViewport( size_t slot = 0 ) const override;
+		virtual void SetViewport( const Viewport& viewport ) override;
+		virtual void SetViewports( const std::vector<Viewport>& viewport ) override;
+		virtual void PushViewport( const Viewport& viewport ) override;
+		virtual void PushViewports( const std::vector<Viewport>& viewport ) override;
+		virtual void PopViewport() override;
+
+		virtual void SetDepthStencil( IDepthStencil* pDepthStencil, size_t index = 0 ) override;
+		virtual IDepthStencil* GetDepthStencil() const override { return m_pDepthStencil; }
+		virtual bool IsDepthEnabled() const override { return m_bDepthEnabled; }
+		virtual void SetDepthEnabled( bool enabled ) override;
+		virtual bool IsDepthWriteEnabled() const override { return m_bDepthWriteEnabled; }
+		virtual void SetDepthWriteEnabled( bool enabled ) override;
+		virtual ComparisonFunc GetDepthComparisonFunc() const override { return m_DepthFunc; }
+		virtual void SetDepthComparisonFunc( ComparisonFunc func ) override;
+		virtual bool IsStencilEnabled() const override { return m_bStencilEnabled; }
+		virtual void SetStencilEnabled( bool enabled ) override;
+		virtual uint8_t GetStencilReadMask() const override { return m_iStencilReadMask; }
+		virtual void SetStencilReadMask( uint8_t mask ) override;
+		virtual uint8_t GetStencilWriteMask() const override { return m_iStencilWriteMask; }
+		virtual void SetStencilWriteMask( uint8_t mask ) override;
+		virtual StencilOpDesc GetStencilFrontFaceOp() const override { return m_StencilFrontOp; }
+		virtual void SetStencilFrontFaceOp( const StencilOpDesc& desc ) override;
+		virtual StencilOpDesc GetStencilBackFaceOp() const override { return m_StencilBackOp; }
+		virtual void SetStencilBackFaceOp( const StencilOpDesc& desc ) override;
+
+		virtual CullMode GetCullMode() const override { return m_CullMode; }
+		virtual void SetCullMode( CullMode mode ) override;
+		virtual bool GetDepthClipEnabled() const override { return m_bDepthClipEnabled; }
+		virtual void SetDepthClipEnabled( bool enabled ) override;
+
+		virtual bool IsBlendingEnabled() const override { return m_bBlendingEnabled; }
+		virtual void SetBlendingEnabled( bool enabled ) override;
+
+		virtual size_t GetRenderTargetCount() const override;
+		virtual IRenderTarget* GetRenderTarget( size_t slot = 0 ) const override;
+		virtual void SetRenderTarget( IRenderTarget* pRT, size_t array_index = 0, size_t mip_index = 0 ) override;
+		virtual void SetRenderTargets( const std::vector<IRenderTarget*>& pRTs ) override;
+		virtual void PushRenderTarget() override;
+		virtual void PushRenderTarget( IRenderTarget* pRT ) override;
+		virtual void PushRenderTargets( const std::vector<IRenderTarget*>& pRTs ) override;
+		virtual void PopRenderTarget() override;
+		virtual void UnbindRenderTargets() override;
+		virtual void ClearRenderTargetStack() override;
+
+		virtual void SetRenderTargetAndViewport( IRenderTarget* pRT ) override;
+		virtual void PushRenderTargetAndViewport( IRenderTarget* pRT ) override;
+		virtual void PopRenderTargetAndViewport() override;
+
+		virtual void ClearRenderTarget( IRenderTarget* pRT, float r, float g, float b, float a, size_t array_index = 0, size_t mip_index = 0 ) override;
+		virtual void ClearDepthStencil( IDepthStencil* pDepthStencil, int clearflag, float depth, uint8_t stencil, size_t index = 0 ) override;
+		virtual void Resolve( IRenderTarget* pDst, IRenderTarget* pSrc ) override;
+		virtual void CopyDepthStencil( IDepthStencil* pDst, size_t dst_index, IDepthStencil* pSrc, size_t src_index ) override;
+
+		virtual void UpdateTexturePixels( ITexture* pTexture, const void* pPixels, size_t pitch ) override;
+		virtual void BindTexture( ITexture* pTexture, size_t slot ) override;
+		virtual void BindTexture( IRenderTarget* pRT, size_t slot ) override;
+		virtual void BindTexture( IDepthStencil* pDepthStencil, size_t slot ) override;
+		virtual void UnbindTextureSlot( size_t slot ) override;
+
+		virtual void UpdateBuffer( IVertexBuffer* pBuffer, const void* pData, size_t count = 0, size_t offset = 0 ) override;
+		virtual void* Lock( IVertexBuffer* pBuffer ) override;
+		virtual void Unlock( IVertexBuffer* pBuffer ) override {}
+		virtual void UpdateBuffer( IIndexBuffer* pBuffer, const void* pData, size_t count = 0, size_t offset = 0 ) override;
+		virtual void* Lock( IIndexBuffer* pBuffer ) override;
+		virtual void Unlock( IIndexBuffer* pBuffer ) override {}
+		virtual void UpdateBuffer( IConstantBuffer* pBuffer, const void* pData, size_t count = 0, size_t offset = 0 ) override;
+		virtual void* Lock( IConstantBuffer* pBuffer ) override;
+		virtual void Unlock( IConstantBuffer* pBuffer ) override {}
+
+		virtual IPixelShader* GetPixelShader() const override { return m_pPixelShader; }
+		virtual void SetPixelShader( IPixelShader* pShader ) override;
+		virtual IVertexShader* GetVertexShader() const override { return m_pVertexShader; }
+		virtual void SetVertexShader( IVertexShader* pShader ) override;
+
+		virtual void SetVertexBuffer( IVertexBuffer* pBuffer, size_t slot = 0 ) override;
+		virtual void SetIndexBuffer( IIndexBuffer* pBuffer ) override;
+		virtual void SetConstantBuffer( ShaderType shader, IConstantBuffer* pBuffer, size_t slot ) override;
+
+		virtual void SetSampler( ShaderType shader, ISampler* pSampler, size_t slot ) override;
+
+		virtual void Draw( size_t vertex_count ) override;
+		virtual void DrawInstanced( size_t vertex_count, size_t instance_count ) override;
+		virtual void DrawIndexed( size_t index_count ) override;
+		virtual void DrawInstancedIndexed( size_t index_count, size_t instance_count ) override;
+
+		virtual void BeginEvent( const std::string& name ) override;
+		virtual void EndEvent() override;
+
+		virtual bool IsDeferred() const override { return m_bDeferred; }
+		virtual void InheritState( IGPUContext* pContext ) override;
+		virtual IGPUCommandList* FinishCommandList() override;
+		virtual void ExecuteCommandList( IGPUCommandList* pCommandList ) override;
+
+		virtual void* GetImpl() override { return &m_Log; }
+	private:
+		void ResetState();
+		template <typename T>
+		void SetState( GPUCommandType type, T& state, const T& value, size_t count = 0 )
+		{
+			const bool redundant = ( state == value );
+			state = value;
+			m_Log.Record( type, nullptr, count, 0, redundant );
+		}
+		template <typename T>
+		void SetBinding( GPUCommandType type, std::vector<const void*>& bindings, size_t slot, const T* pResource )
+		{
+			if( bindings.size() <= slot )
+			{
+				bindings.resize( slot + 1, nullptr );
+			}
+
+			const bool redundant = ( bindings[slot] == pResource );
+			bindings[slot] = pResource;
+			m_Log.Record( type, pResource, 0, slot, redundant );
+		}
+		void RecordRenderTargets();
+		// CPU copy of a buffer's contents, buffers created by another device get a shadow copy
+		template <typename Headless, typename T>
+		char* GetBufferData( T* pBuffer, size_t size );
+		static Viewport FullViewport( IRenderTarget* pRT );
+		static size_t ShaderBindingIndex( ShaderType shader, size_t slot ) { return (size_t)shader * MAX_SLOTS_PER_SHADER + slot; }
+	private:
+		static constexpr size_t MAX_SLOTS_PER_SHADER = 32;
+
+		HeadlessGPUDevice* m_pDevice;
+		GPUCommandLog m_Log;
+
+		bool m_bDeferred;
+
+		PrimitiveTopology m_Topology;
+		std::vector<std::vector<Viewport>> m_ViewportStack;
+		std::vector<std::vector<IRenderTarget*>> m_RenderTargetStack;
+		IDepthStencil* m_pDepthStencil;
+		size_t m_iDepthStencilIndex;
+
+		bool m_bDepthEnabled;
+		bool m_bDepthWriteEnabled;
+		ComparisonFunc m_DepthFunc;
+		bool m_bStencilEnabled;
+		uint8_t m_iStencilReadMask;
+		uint8_t m_iStencilWriteMask;
+		StencilOpDesc m_StencilFrontOp;
+		StencilOpDesc m_StencilBackOp;
+		CullMode m_CullMode;
+		bool m_bDepthClipEnabled;
+		bool m_bBlendingEnabled;
+
+		IPixelShader* m_pPixelShader;
+		IVertexShader* m_pVertexShader;
+		const IIndexBuffer* m_pIndexBuffer;
+		std::vector<const void*> m_VertexBuffers;
+		std::vector<const void*> m_Textures;
+		std::vector<const void*> m_ConstantBuffers;
+		std::vector<const void*> m_Samplers;
+
+		// Buffers that weren't created by a headless device, e.g. pipeline constant buffers that were created
+		// before a headless device was swapped in to benchmark a scene. Uploads to them are still recorded.
+		std::unordered_map<const void*, std::vector<char>> m_ShadowBuffers;
+	};
+
+	class HeadlessGPUDevice : public IGPUDevice
+	{
+	public:
+		HeadlessGPUDevice( size_t width, size_t height )
+			:
+			m_Backbuffer( width, height, TEX_FORMAT_R8G8B8A8_UNORM ),
+			m_Context( this )
+		{
+			m_DeviceInfo.name = "Headless";
+			m_DeviceInfo.memory = 0;
+		}
+
+		virtual const DeviceInfo& GetDeviceInfo() const override { return m_DeviceInfo; }
+
+		virtual IPixelShader* CreatePixelShader( const std::string& filename, const ShaderMacro* macros, size_t num_macros ) override
+		{
+			return new HeadlessPixelShader( filename );
+		}
+		virtual IVertexShader* CreateVertexShader( const std::string& filename, const ShaderMacro* macros, size_t num_macros ) override
+		{
+			return new HeadlessVertexShader( filename );
+		}
+
+		virtual IVertexBuffer* CreateVertexBuffer( const void* data, size_t elem_size, size_t size ) override
+		{
+			auto pBuffer = new HeadlessVertexBuffer( elem_size, size );
+			if( data )
+			{
+				std::memcpy( pBuffer->GetData(), data, elem_size * size );
+			}
+			return pBuffer;
+		}
+		virtual IIndexBuffer* CreateIndexBuffer( const void* data, size_t elem_size, size_t size ) override
+		{
+			ASSERT( elem_size == 2 || elem_size == 4, "Invalid index buffer element size" );
+
+			auto pBuffer = new HeadlessIndexBuffer( elem_size, size );
+			if( data )
+			{
+				std::memcpy( pBuffer->GetData(), data, elem_size * size );
+			}
+			return pBuffer;
+		}
+		virtual IConstantBuffer* CreateConstantBuffer( const void* data, size_t size ) override
+		{
+			auto pBuffer = new HeadlessConstantBuffer( size );
+			if( data )
+			{
+				std::memcpy( pBuffer->GetData(), data, size );
+			}
+			return pBuffer;
+		}
+
+		// Nothing is decoded, file/memory textures are 1x1 placeholders
+		virtual ITexture* CreateTexture( const std::string& filename, TexFlags flags = TexFlags::NONE ) override
+		{
+			return new HeadlessTexture( 1, 1, TEX_FORMAT_R8G8B8A8_UNORM );
+		}
+		virtual ITexture* CreateTexture( const char* pData, size_t size, TexFlags flags = TexFlags::NONE ) override
+		{
+			return new HeadlessTexture( 1, 1, TEX_FORMAT_R8G8B8A8_UNORM );
+		}
+		virtual ITexture* CreateTexture( const void* pPixels,
+			size_t pitch,
+			size_t width,
+			size_t height,
+			TexFormat format,
+			GPUResourceUsage usage = GPUResourceUsage::DEFAULT,
+			TexFlags flags = TexFlags::NONE ) override
+		{
+			return new HeadlessTexture( width, height, format );
+		}
+
+		virtual IDepthStencil* CreateDepthStencil( size_t width,
+			size_t height,
+			TexFormat format,
+			size_t array_size = 1,
+			MsaaQuality ms_quality = MsaaQuality::NONE,
+			size_t ms_samples = 1,
+			TexFlags flags = TexFlags::NONE ) override
+		{
+			return new HeadlessDepthStencil( width, height, format, array_size );
+		}
+
+		virtual IRenderTarget* CreateRenderTarget( size_t width,
+			size_t height,
+			TexFormat format,
+			MsaaQuality ms_quality = MsaaQuality::NONE,
+			size_t ms_samples = 1,
+			TexFlags flags = TexFlags::NONE ) override
+		{
+			return new HeadlessRenderTarget( width, height, format );
+		}
+		virtual IRenderTarget* CreateCubemapRenderTarget( size_t width,
+			size_t height,
+			TexFormat format,
+			size_t mip_levels = 1,
+			TexFlags flags = TexFlags::NONE ) override
+		{
+			return new HeadlessRenderTarget( width, height, format );
+		}
+
+		virtual IRenderTarget* GetBackbuffer() override { return &m_Backbuffer; }
+		virtual const IRenderTarget* GetBackbuffer() const override { return &m_Backbuffer; }
+
+		virtual ISampler* CreateSampler( const SamplerDesc& sampler_desc ) override
+		{
+			return new HeadlessSampler;
+		}
+
+		virtual void SwapBuffers() override {}
+
+		virtual void ResizeBuffers( size_t width, size_t height ) override
+		{
+			m_Context.ClearRenderTargetStack();
+			m_Backbuffer.Resize( width, height );
+		}
+
+		virtual IGPUContext* GetContext() override { return &m_Context; }
+		virtual IGPUContext* CreateDeferredContext() override { return new HeadlessGPUContext( this, true ); }
+
+		// The command log is the closest thing to an underlying implementation we have
+		virtual void* GetImpl() override { return &m_Context.GetLog(); }
+	private:
+		DeviceInfo m_DeviceInfo;
+		HeadlessRenderTarget m_Backbuffer;
+		HeadlessGPUContext m_Context;
+	};
+
+	HeadlessGPUContext::HeadlessGPUContext( HeadlessGPUDevice* pDevice, bool deferred )
+		:
+		m_pDevice( pDevice ),
+		m_bDeferred( deferred )
+	{
+		ResetState();
+	}
+
+	void HeadlessGPUContext::ResetState()
+	{
+		m_Topology = PrimitiveTopology::INVALID;
+		// bottom of the stack is the null viewport, same as the D3D context
+		m_ViewportStack.clear();
+		m_ViewportStack.push_back( {} );
+		m_RenderTargetStack.clear();
+		m_pDepthStencil = nullptr;
+		m_iDepthStencilIndex = 0;
+
+		// defaults match D3D11's default depth stencil/rasterizer state
+		m_bDepthEnabled = true;
+		m_bDepthWriteEnabled = true;
+		m_DepthFunc = ComparisonFunc::LESS;
+		m_bStencilEnabled = false;
+		m_iStencilReadMask = 0xFF;
+		m_iStencilWriteMask = 0xFF;
+		m_StencilFrontOp = { StencilOp::KEEP, StencilOp::KEEP, StencilOp::KEEP, ComparisonFunc::ALWAYS };
+		m_StencilBackOp = { StencilOp::KEEP, StencilOp::KEEP, StencilOp::KEEP, ComparisonFunc::ALWAYS };
+		m_CullMode = CullMode::BACK;
+		m_bDepthClipEnabled = true;
+		m_bBlendingEnabled = false;
+
+		m_pPixelShader = nullptr;
+		m_pVertexShader = nullptr;
+		m_pIndexBuffer = nullptr;
+		m_VertexBuffers.clear();
+		m_Textures.clear();
+		m_ConstantBuffers.clear();
+		m_Samplers.clear();
+	}
+
+	IGPUDevice* HeadlessGPUContext::GetDevice()
+	{
+		return m_pDevice;
+	}
+
+	const IGPUDevice* HeadlessGPUContext::GetDevice() const
+	{
+		return m_pDevice;
+	}
+
+	void HeadlessGPUContext::SetPrimitiveTopology( PrimitiveTopology topology )
+	{
+		SetState( GPUCommandType::SET_TOPOLOGY, m_Topology, topology, (size_t)topology );
+	}
+
+	size_t HeadlessGPUContext::GetViewportCount() const
+	{
+		return m_ViewportStack.back().size();
+	}
+
+	const Viewport& HeadlessGPUContext::GetViewport( size_t slot ) const
+	{
+		static Viewport null_vp;
+
+		if( slot >= m_ViewportStack.back().size() )
+		{
+			return null_vp;
+		}
+
+		return m_ViewportStack.back()[slot];
+	}
+
+	void HeadlessGPUContext::SetViewport( const Viewport& viewport )
+	{
+		SetViewports( { viewport } );
+	}
+
+	void HeadlessGPUContext::SetViewports( const std::vector<Viewport>& viewports )
+	{
+		SetState( GPUCommandType::SET_VIEWPORTS, m_ViewportStack.back(), viewports, viewports.size() );
+	}
+
+	void HeadlessGPUContext::PushViewport( const Viewport& viewport )
+	{
+		PushViewports( { viewport } );
+	}
+
+	void HeadlessGPUContext::PushViewports( const std::vector<Viewport>& viewports )
+	{
+		const bool redundant = ( m_ViewportStack.back() == viewports );
+		m_ViewportStack.push_back( viewports );
+		m_Log.Record( GPUCommandType::SET_VIEWPORTS, nullptr, viewports.size(), 0, redundant );
+	}
+
+	void HeadlessGPUContext::PopViewport()
+	{
+		bool redundant = true;
+		// Don't pop off null viewport
+		if( m_ViewportStack.size() > 1 )
+		{
+			redundant = ( m_ViewportStack[m_ViewportStack.size() - 2] == m_ViewportStack.back() );
+			m_ViewportStack.pop_back();
+		}
+		m_Log.Record( GPUCommandType::SET_VIEWPORTS, nullptr, m_ViewportStack.back().size(), 0, redundant );
+	}
+
+	void HeadlessGPUContext::SetDepthStencil( IDepthStencil* pDepthStencil, size_t index )
+	{
+		const bool redundant = ( m_pDepthStencil == pDepthStencil && m_iDepthStencilIndex == index );
+		m_pDepthStencil = pDepthStencil;
+		m_iDepthStencilIndex = index;
+		m_Log.Record( GPUCommandType::SET_DEPTH_STENCIL, pDepthStencil, 0, index, redundant );
+	}
+
+	void HeadlessGPUContext::SetDepthEnabled( bool enabled )
+	{
+		SetState( GPUCommandType::SET_DEPTH_STENCIL_STATE, m_bDepthEnabled, enabled, enabled );
+	}
+
+	void HeadlessGPUContext::SetDepthWriteEnabled( bool enabled )
+	{
+		SetState( GPUCommandType::SET_DEPTH_STENCIL_STATE, m_bDepthWriteEnabled, enabled, enabled );
+	}
+
+	void HeadlessGPUContext::SetDepthComparisonFunc( ComparisonFunc func )
+	{
+		SetState( GPUCommandType::SET_DEPTH_STENCIL_STATE, m_DepthFunc, func, (size_t)func );
+	}
+
+	void HeadlessGPUContext::SetStencilEnabled( bool enabled )
+	{
+		SetState( GPUCommandType::SET_DEPTH_STENCIL_STATE, m_bStencilEnabled, enabled, enabled );
+	}
+
+	void HeadlessGPUContext::SetStencilReadMask( uint8_t mask )
+	{
+		SetState( GPUCommandType::SET_DEPTH_STENCIL_STATE, m_iStencilReadMask, mask, mask );
+	}
+
+	void HeadlessGPUContext::SetStencilWriteMask( uint8_t mask )
+	{
+		SetState( GPUCommandType::SET_DEPTH_STENCIL_STATE, m_iStencilWriteMask, mask, mask );
+	}
+
+	void HeadlessGPUContext::SetStencilFrontFaceOp( const StencilOpDesc& desc )
+	{
+		SetState( GPUCommandType::SET_DEPTH_STENCIL_STATE, m_StencilFrontOp, desc );
+	}
+
+	void HeadlessGPUContext::SetStencilBackFaceOp( const StencilOpDesc& desc )
+	{
+		SetState( GPUCommandType::SET_DEPTH_STENCIL_STATE, m_StencilBackOp, desc );
+	}
+
+	void HeadlessGPUContext::SetCullMode( CullMode mode )
+	{
+		SetState( GPUCommandType::SET_RASTERIZER_STATE, m_CullMode, mode, (size_t)mode );
+	}
+
+	void HeadlessGPUContext::SetDepthClipEnabled( bool enabled )
+	{
+		SetState( GPUCommandType::SET_RASTERIZER_STATE, m_bDepthClipEnabled, enabled, enabled );
+	}
+
+	void HeadlessGPUContext::SetBlendingEnabled( bool enabled )
+	{
+		SetState( GPUCommandType::SET_BLEND_STATE, m_bBlendingEnabled, enabled, enabled );
+	}
+
+	size_t HeadlessGPUContext::GetRenderTargetCount() const
+	{
+		if( m_RenderTargetStack.empty() )
+		{
+			return 0;
+		}
+
+		return m_RenderTargetStack.back().size();
+	}
+
+	IRenderTarget* HeadlessGPUContext::GetRenderTarget( size_t slot ) const
+	{
+		if( m_RenderTargetStack.empty() || slot >= m_RenderTargetStack.back().size() )
+		{
+			return nullptr;
+		}
+
+		return m_RenderTargetStack.back()[slot];
+	}
+
+	void HeadlessGPUContext::SetRenderTarget( IRenderTarget* pRT, size_t array_index, size_t mip_index )
+	{
+		SetRenderTargets( { pRT } );
+	}
+
+	void HeadlessGPUContext::SetRenderTargets( const std::vector<IRenderTarget*>& pRTs )
+	{
+		if( m_RenderTargetStack.empty() )
+		{
+			m_RenderTargetStack.push_back( pRTs );
+		}
+		else
+		{
+			m_RenderTargetStack.back() = pRTs;
+		}
+
+		RecordRenderTargets();
+	}
+
+	void HeadlessGPUContext::PushRenderTarget()
+	{
+		m_RenderTargetStack.push_back( {} );
+		RecordRenderTargets();
+	}
+
+	void HeadlessGPUContext::PushRenderTarget( IRenderTarget* pRT )
+	{
+		m_RenderTargetStack.push_back( { pRT } );
+		RecordRenderTargets();
+	}
+
+	void HeadlessGPUContext::PushRenderTargets( const std::vector<IRenderTarget*>& pRTs )
+	{
+		m_RenderTargetStack.push_back( pRTs );
+		RecordRenderTargets();
+	}
+
+	void HeadlessGPUContext::PopRenderTarget()
+	{
+		m_RenderTargetStack.pop_back();
+		RecordRenderTargets();
+	}
+
+	void HeadlessGPUContext::UnbindRenderTargets()
+	{
+		if( !m_RenderTargetStack.empty() )
+		{
+			m_RenderTargetStack.back() = {};
+		}
+		RecordRenderTargets();
+	}
+
+	void HeadlessGPUContext::ClearRenderTargetStack()
+	{
+		m_RenderTargetStack.clear();
+		RecordRenderTargets();
+	}
+
+	void HeadlessGPUContext::RecordRenderTargets()
+	{
+		const size_t count = GetRenderTargetCount();
+		m_Log.Record( GPUCommandType::SET_RENDER_TARGETS, count ? m_RenderTargetStack.back()[0] : nullptr, count );
+	}
+
+	template <typename Headless, typename T>
+	char* HeadlessGPUContext::GetBufferData( T* pBuffer, size_t size )
+	{
+		if( Headless* pHeadless = dynamic_cast<Headless*>( pBuffer ) )
+		{
+			return pHeadless->GetData();
+		}
+
+		std::vector<char>& shadow = m_ShadowBuffers[pBuffer];
+		shadow.resize( size );
+		return shadow.data();
+	}
+
+	Viewport HeadlessGPUContext::FullViewport( IRenderTarget* pRT )
+	{
+		Viewport vp;
+		vp.top_left = { 0.0f, 0.0f };
+		vp.width = (float)pRT->GetWidth();
+		vp.height = (float)pRT->GetHeight();
+		vp.min_depth = 0.0f;
+		vp.max_depth = 1.0f;
+		return vp;
+	}
+
+	void HeadlessGPUContext::SetRenderTargetAndViewport( IRenderTarget* pRT )
+	{
+		SetRenderTarget( pRT );
+		SetViewport( FullViewport( pRT ) );
+	}
+
+	void HeadlessGPUContext::PushRenderTargetAndViewport( IRenderTarget* pRT )
+	{
+		PushRenderTarget( pRT );
+		PushViewport( FullViewport( pRT ) );
+	}
+
+	void HeadlessGPUContext::PopRenderTargetAndViewport()
+	{
+		PopRenderTarget();
+		PopViewport();
+	}
+
+	void HeadlessGPUContext::ClearRenderTarget( IRenderTarget* pRT, float r, float g, float b, float a, size_t array_index, size_t mip_index )
+	{
+		m_Log.Record( GPUCommandType::CLEAR_RENDER_TARGET, pRT, 0, array_index );
+	}
+
+	void HeadlessGPUContext::ClearDepthStencil( IDepthStencil* pDepthStencil, int clearflag, float depth, uint8_t stencil, size_t index )
+	{
+		m_Log.Record( GPUCommandType::CLEAR_DEPTH_STENCIL, pDepthStencil, (size_t)clearflag, index );
+	}
+
+	void HeadlessGPUContext::Resolve( IRenderTarget* pDst, IRenderTarget* pSrc )
+	{
+		ASSERT( pDst->GetFormat() == pSrc->GetFormat(), "Cannot resolve to a render-target of a different type" );
+		m_Log.Record( GPUCommandType::RESOLVE, pDst );
+	}
+
+	void HeadlessGPUContext::CopyDepthStencil( IDepthStencil* pDst, size_t dst_index, IDepthStencil* pSrc, size_t src_index )
+	{
+		ASSERT( pDst->GetFormat() == pSrc->GetFormat(), "Cannot copy to a depth stencil of a different type" );
+		m_Log.Record( GPUCommandType::COPY_DEPTH_STENCIL, pDst, 0, dst_index );
+	}
+
+	void HeadlessGPUContext::UpdateTexturePixels( ITexture* pTexture, const void* pPixels, size_t pitch )
+	{
+		m_Log.Record( GPUCommandType::UPDATE_TEXTURE, pTexture, pitch * pTexture->GetHeight() );
+	}
+
+	void HeadlessGPUContext::BindTexture( ITexture* pTexture, size_t slot )
+	{
+		SetBinding( GPUCommandType::BIND_TEXTURE, m_Textures, slot, pTexture );
+	}
+
+	void HeadlessGPUContext::BindTexture( IRenderTarget* pRT, size_t slot )
+	{
+		SetBinding( GPUCommandType::BIND_TEXTURE, m_Textures, slot, pRT->AsTexture() );
+	}
+
+	void HeadlessGPUContext::BindTexture( IDepthStencil* pDepthStencil, size_t slot )
+	{
+		SetBinding( GPUCommandType::BIND_TEXTURE, m_Textures, slot, pDepthStencil );
+	}
+
+	void HeadlessGPUContext::UnbindTextureSlot( size_t slot )
+	{
+		SetBinding<void>( GPUCommandType::UNBIND_TEXTURE, m_Textures, slot, nullptr );
+	}
+
+	void HeadlessGPUContext::UpdateBuffer( IVertexBuffer* pBuffer, const void* pData, size_t count, size_t offset )
+	{
+		const size_t elem_size = pBuffer->GetElementSize();
+		if( count == 0 )
+		{
+			count = pBuffer->GetVertexCount() - offset;
+		}
+
+		char* pDst = GetBufferData<HeadlessVertexBuffer>( pBuffer, pBuffer->GetVertexCount() * elem_size );
+		std::memcpy( pDst + offset * elem_size, pData, count * elem_size );
+		m_Log.Record( GPUCommandType::UPDATE_BUFFER, pBuffer, count * elem_size );
+	}
+
+	void* HeadlessGPUContext::Lock( IVertexBuffer* pBuffer )
+	{
+		const size_t size = pBuffer->GetVertexCount() * pBuffer->GetElementSize();
+		m_Log.Record( GPUCommandType::LOCK_BUFFER, pBuffer, size );
+		return GetBufferData<HeadlessVertexBuffer>( pBuffer, size );
+	}
+
+	void HeadlessGPUContext::UpdateBuffer( IIndexBuffer* pBuffer, const void* pData, size_t count, size_t offset )
+	{
+		const size_t elem_size = pBuffer->GetElementSize();
+		if( count == 0 )
+		{
+			count = pBuffer->GetIndexCount() - offset;
+		}
+
+		char* pDst = GetBufferData<HeadlessIndexBuffer>( pBuffer, pBuffer->GetIndexCount() * elem_size );
+		std::memcpy( pDst + offset * elem_size, pData, count * elem_size );
+		m_Log.Record( GPUCommandType::UPDATE_BUFFER, pBuffer, count * elem_size );
+	}
+
+	void* HeadlessGPUContext::Lock( IIndexBuffer* pBuffer )
+	{
+		const size_t size = pBuffer->GetIndexCount() * pBuffer->GetElementSize();
+		m_Log.Record( GPUCommandType::LOCK_BUFFER, pBuffer, size );
+		return GetBufferData<HeadlessIndexBuffer>( pBuffer, size );
+	}
+
+	void HeadlessGPUContext::UpdateBuffer( IConstantBuffer* pBuffer, const void* pData, size_t count, size_t offset )
+	{
+		if( count == 0 )
+		{
+			count = pBuffer->GetSize() - offset;
+		}
+
+		std::memcpy( GetBufferData<HeadlessConstantBuffer>( pBuffer, pBuffer->GetSize() ) + offset, pData, count );
+		m_Log.Record( GPUCommandType::UPDATE_BUFFER, pBuffer, count );
+	}
+
+	void* HeadlessGPUContext::Lock( IConstantBuffer* pBuffer )
+	{
+		m_Log.Record( GPUCommandType::LOCK_BUFFER, pBuffer, pBuffer->GetSize() );
+		return GetBufferData<HeadlessConstantBuffer>( pBuffer, pBuffer->GetSize() );
+	}
+
+	void HeadlessGPUContext::SetPixelShader( IPixelShader* pShader )
+	{
+		const bool redundant = ( m_pPixelShader == pShader );
+		m_pPixelShader = pShader;
+		m_Log.Record( GPUCommandType::SET_PIXEL_SHADER, pShader, 0, 0, redundant );
+	}
+
+	void HeadlessGPUContext::SetVertexShader( IVertexShader* pShader )
+	{
+		const bool redundant = ( m_pVertexShader == pShader );
+		m_pVertexShader = pShader;
+		m_Log.Record( GPUCommandType::SET_VERTEX_SHADER, pShader, 0, 0, redundant );
+	}
+
+	void HeadlessGPUContext::SetVertexBuffer( IVertexBuffer* pBuffer, size_t slot )
+	{
+		SetBinding( GPUCommandType::SET_VERTEX_BUFFER, m_VertexBuffers, slot, pBuffer );
+	}
+
+	void HeadlessGPUContext::SetIndexBuffer( IIndexBuffer* pBuffer )
+	{
+		const bool redundant = ( m_pIndexBuffer == pBuffer );
+		m_pIndexBuffer = pBuffer;
+		m_Log.Record( GPUCommandType::SET_INDEX_BUFFER, pBuffer, 0, 0, redundant );
+	}
+
+	void HeadlessGPUContext::SetConstantBuffer( ShaderType shader, IConstantBuffer* pBuffer, size_t slot )
+	{
+		SetBinding( GPUCommandType::SET_CONSTANT_BUFFER, m_ConstantBuffers, ShaderBindingIndex( shader, slot ), pBuffer );
+	}
+
+	void HeadlessGPUContext::SetSampler( ShaderType shader, ISampler* pSampler, size_t slot )
+	{
+		SetBinding( GPUCommandType::SET_SAMPLER, m_Samplers, ShaderBindingIndex( shader, slot ), pSampler );
+	}
+
+	void HeadlessGPUContext::Draw( size_t vertex_count )
+	{
+		m_Log.Record( GPUCommandType::DRAW, nullptr, vertex_count );
+	}
+
+	void HeadlessGPUContext::DrawInstanced( size_t vertex_count, size_t instance_count )
+	{
+		m_Log.Record( GPUCommandType::DRAW_INSTANCED, nullptr, vertex_count * instance_count, instance_count );
+	}
+
+	void HeadlessGPUContext::DrawIndexed( size_t index_count )
+	{
+		m_Log.Record( GPUCommandType::DRAW_INDEXED, m_pIndexBuffer, index_count );
+	}
+
+	void HeadlessGPUContext::DrawInstancedIndexed( size_t index_count, size_t instance_count )
+	{
+		m_Log.Record( GPUCommandType::DRAW_INSTANCED_INDEXED, m_pIndexBuffer, index_count * instance_count, instance_count );
+	}
+
+	void HeadlessGPUContext::BeginEvent( const std::string& name )
+	{
+		m_Log.RecordBeginEvent( name );
+	}
+
+	void HeadlessGPUContext::EndEvent()
+	{
+		m_Log.RecordEndEvent();
+	}
+
+	void HeadlessGPUContext::InheritState( IGPUContext* pContext )
+	{
+		const HeadlessGPUContext* pSource = static_cast<const HeadlessGPUContext*>( pContext );
+
+		m_Topology = pSource->m_Topology;
+		// inherited viewports become the bottom of the stack
+		m_ViewportStack.clear();
+		m_ViewportStack.push_back( pSource->m_ViewportStack.back() );
+		m_RenderTargetStack.clear();
+		if( !pSource->m_RenderTargetStack.empty() )
+		{
+			m_RenderTargetStack.push_back( pSource->m_RenderTargetStack.back() );
+		}
+		m_pDepthStencil = pSource->m_pDepthStencil;
+		m_iDepthStencilIndex = pSource->m_iDepthStencilIndex;
+
+		m_bDepthEnabled = pSource->m_bDepthEnabled;
+		m_bDepthWriteEnabled = pSource->m_bDepthWriteEnabled;
+		m_DepthFunc = pSource->m_DepthFunc;
+		m_bStencilEnabled = pSource->m_bStencilEnabled;
+		m_iStencilReadMask = pSource->m_iStencilReadMask;
+		m_iStencilWriteMask = pSource->m_iStencilWriteMask;
+		m_StencilFrontOp = pSource->m_StencilFrontOp;
+		m_StencilBackOp = pSource->m_StencilBackOp;
+		m_CullMode = pSource->m_CullMode;
+		m_bDepthClipEnabled = pSource->m_bDepthClipEnabled;
+		m_bBlendingEnabled = pSource->m_bBlendingEnabled;
+
+		m_pPixelShader = pSource->m_pPixelShader;
+		m_pVertexShader = pSource->m_pVertexShader;
+		m_pIndexBuffer = pSource->m_pIndexBuffer;
+		m_VertexBuffers = pSource->m_VertexBuffers;
+		m_Textures = pSource->m_Textures;
+		m_ConstantBuffers = pSource->m_ConstantBuffers;
+		m_Samplers = pSource->m_Samplers;
+	}
+
+	IGPUCommandList* HeadlessGPUContext::FinishCommandList()
+	{
+		ASSERT( m_bDeferred, "Only deferred contexts can record command lists" );
+
+		auto pCommandList = new HeadlessCommandList( std::move( m_Log ) );
+		m_Log = GPUCommandLog();
+		ResetState();
+
+		return pCommandList;
+	}
+
+	void HeadlessGPUContext::ExecuteCommandList( IGPUCommandList* pCommandList )
+	{
+		ASSERT( !m_bDeferred, "Command lists can only be executed on the immediate context" );
+
+		// commands are inlined so a frame recorded in parallel produces the same passes as a serial one
+		m_Log.Append( static_cast<HeadlessCommandList*>( pCommandList )->GetLog() );
+	}
+
+	IGPUDevice* CreateHeadlessGPUDevice( size_t width, size_t height )
+	{
+		return new HeadlessGPUDevice( width, height );
+	}
+
+	GPUCommandLog& GetHeadlessCommandLog( IGPUDevice* pDevice )
+	{
+		return *static_cast<GPUCommandLog*>( pDevice->GetImpl() );
+	}
+}
@@ -0,0 +1,116 @@
+#pragma once
+
+#include <cstdint>
+#include <chrono>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace Bat
+{
+	class IGPUDevice;
+
+	enum class GPUCommandType : uint8_t
+	{
+		SET_TOPOLOGY,
+		SET_VIEWPORTS,
+		SET_DEPTH_STENCIL,
+		SET_DEPTH_STENCIL_STATE,
+		SET_RASTERIZER_STATE,
+		SET_BLEND_STATE,
+		SET_RENDER_TARGETS,
+		CLEAR_RENDER_TARGET,
+		CLEAR_DEPTH_STENCIL,
+		RESOLVE,
+		COPY_DEPTH_STENCIL,
+		UPDATE_TEXTURE,
+		BIND_TEXTURE,
+		UNBIND_TEXTURE,
+		UPDATE_BUFFER,
+		LOCK_BUFFER,
+		SET_PIXEL_SHADER,
+		SET_VERTEX_SHADER,
+		SET_VERTEX_BUFFER,
+		SET_INDEX_BUFFER,
+		SET_CONSTANT_BUFFER,
+		SET_SAMPLER,
+		DRAW,
+		DRAW_INSTANCED,
+		DRAW_INDEXED,
+		DRAW_INSTANCED_INDEXED,
+		BEGIN_EVENT,
+		END_EVENT,
+
+		COUNT
+	};
+
+	const char* GPUCommandTypeToString( GPUCommandType type );
+
+	// A single recorded IGPUContext call
+	struct GPUCommand
+	{
+		GPUCommandType type;
+		// set when the call didn't change any state (e.g. binding the shader that is already bound)
+		bool redundant;
+		// binding slot, or event name index for BEGIN_EVENT
+		uint16_t slot;
+		// vertex/index count for draws, bytes for uploads, state value for state changes
+		uint32_t count;
+		// resource the command operates on, nullptr if none
+		const void* resource;
+	};
+
+	struct GPUPassStats
+	{
+		std::string name;
+		size_t draws = 0;
+		size_t vertices = 0;
+		size_t state_changes = 0;
+		size_t redundant_state_changes = 0;
+		size_t buffer_uploads = 0;
+		size_t bytes_uploaded = 0;
+		size_t texture_binds = 0;
+		size_t commands = 0;
+		// CPU time between the pass's BeginEvent and EndEvent, 0 for commands outside of any event
+		float cpu_ms = 0.0f;
+	};
+
+	// Everything recorded by a headless device's context. Commands are grouped into passes by
+	// their outermost BeginEvent/EndEvent, RenderGraph emits one of those per render pass.
+	class GPUCommandLog
+	{
+	public:
+		void Record( GPUCommandType type, const void* resource = nullptr, size_t count = 0, size_t slot = 0, bool redundant = false );
+		void RecordBeginEvent( const std::string& name );
+		void RecordEndEvent();
+		// Appends every command of another log, e.g. one recorded by a deferred context
+		void Append( const GPUCommandLog& log );
+		void Clear();
+
+		const std::vector<GPUCommand>& GetCommands() const { return m_Commands; }
+		const std::string& GetEventName( size_t index ) const { return m_EventNames[index]; }
+
+		std::vector<GPUPassStats> GetPassStats() const;
+		// Human readable per pass summary
+		std::string GetReport() const;
+
+		// Compares two logs pass by pass and returns a description of every pass whose counters or command
+		// sequence changed, or an empty string if they match. Resource addresses are ignored, so logs
+		// from different runs can be compared.
+		static std::string Diff( const GPUCommandLog& before, const GPUCommandLog& after );
+	private:
+		uint16_t AddEventName( const std::string& name );
+	private:
+		std::vector<GPUCommand> m_Commands;
+		// when each BEGIN_EVENT/END_EVENT command was recorded, in command order
+		std::vector<std::chrono::steady_clock::time_point> m_EventTimes;
+		std::vector<std::string> m_EventNames;
+		std::unordered_map<std::string, uint16_t> m_EventNameIndices;
+	};
+
+	// Creates a device that doesn't talk to a GPU at all, it only tracks state and records every context call.
+	// Used to measure/regression test the CPU side of rendering on machines without a GPU.
+	IGPUDevice* CreateHeadlessGPUDevice( size_t width, size_t height );
+	// Command log of a device created with CreateHeadlessGPUDevice
+	GPUCommandLog& GetHeadlessCommandLog( IGPUDevice* pDevice );
+}
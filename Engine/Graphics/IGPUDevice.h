@@ -18,6 +18,7 @@ namespace Bat
 	class IVertexShader;
 	class IDepthStencil;
 	class ISampler;
+	class IGPUCommandList;
 
 	static constexpr size_t MAX_SHADER_MACROS = 16;
 	struct ShaderMacro
@@ -97,6 +98,9 @@ namespace Bat
 
 		// Gets immediate context
 		virtual IGPUContext* GetContext() = 0;
+		// Creates a context that records commands into a command list instead of submitting them.
+		// Each deferred context may only be used by one thread at a time. Returns nullptr if not supported.
+		virtual IGPUContext* CreateDeferredContext() = 0;
 
 		// Gets pointer to underlying implementation
 		// e.g. for D3D11 device this returns the ID3D11Device*
@@ -185,6 +189,8 @@ namespace Bat
 		// See ClearFlag enum for list of valid flags (can be ORed together)
 		virtual void ClearDepthStencil( IDepthStencil* pDepthStencil, int clearflag, float depth, uint8_t stencil, size_t index = 0 ) = 0;
 		virtual void Resolve( IRenderTarget* pDst, IRenderTarget* pSrc ) = 0;
+		// Copies one array slice of a depth stencil into a slice of another (or the same) one with the same size and format
+		virtual void CopyDepthStencil( IDepthStencil* pDst, size_t dst_index, IDepthStencil* pSrc, size_t src_index ) = 0;
 
 		virtual void UpdateTexturePixels( ITexture* pTexture, const void* pPixels, size_t pitch ) = 0;
 		virtual void BindTexture( ITexture* pTexture, size_t slot ) = 0;
@@ -234,6 +240,18 @@ namespace Bat
 		virtual void BeginEvent( const std::string& name ) = 0;
 		virtual void EndEvent() = 0;
 
+		virtual bool IsDeferred() const = 0;
+		// Copies the pipeline state of another context (render targets, viewports, depth/rasterizer/blend state,
+		// shaders and bound textures/samplers/constant buffers of every stage) so recording starts from where that context is.
+		// Must be called on the thread that owns pContext.
+		virtual void InheritState( IGPUContext* pContext ) = 0;
+		// Deferred contexts only. Ends recording and returns everything recorded since the last call,
+		// the context is reset to default state afterwards. Caller owns the returned command list.
+		virtual IGPUCommandList* FinishCommandList() = 0;
+		// Immediate context only. Submits a command list recorded by a deferred context,
+		// the state of this context is the same after the call as before it.
+		virtual void ExecuteCommandList( IGPUCommandList* pCommandList ) = 0;
+
 		// Gets pointer to underlying implementation
 		// e.g. for D3D11 device this returns the ID3D11DeviceContext*
 		virtual void* GetImpl() = 0;
@@ -325,4 +343,10 @@ namespace Bat
 	public:
 		virtual ~ISampler() = default;
 	};
+
+	class IGPUCommandList
+	{
+	public:
+		virtual ~IGPUCommandList() = default;
+	};
 }
\ No newline at end of file
@@ -48,9 +48,8 @@ namespace Bat
 
 	void BaseRenderPass::Traverse()
 	{
-		for( Entity e : world )
+		for( auto [e, t] : world.View<TransformComponent>() )
 		{
-			auto& t = e.Get<TransformComponent>();
 			Visit( t.LocalToWorldMatrix(), e );
 		}
 	}
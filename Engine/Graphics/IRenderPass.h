@@ -23,7 +23,14 @@ namespace Bat
 		virtual const std::vector<RenderNode>& GetNodes() const = 0;
 		virtual NodeType GetNodeType( const std::string& name ) const = 0;
 		virtual NodeDataType GetNodeDataType( const std::string& name ) const = 0;
+		// Called on the immediate context in graph order, right before the pass is executed or starts recording.
+		// Passes recorded in parallel don't leak state to later passes, so anything later passes rely on
+		// (e.g. textures they sample) has to be bound here instead of in Execute.
+		virtual void Prepare( IGPUContext* pContext, Camera& camera, SceneNode& scene, RenderData& data ) = 0;
 		virtual void Execute( IGPUContext* pContext, Camera& camera, SceneNode& scene, RenderData& data ) = 0;
+		// Whether Execute can record into a deferred context on a job thread while other passes are being recorded.
+		// Execute must then only read shared data (components, pipelines, etc.), per-frame writes belong in Prepare.
+		virtual bool CanRecordInParallel() const = 0;
 	};
 
 	class BaseRenderPass : public IRenderPass
@@ -33,6 +40,8 @@ namespace Bat
 		virtual const std::vector<RenderNode>& GetNodes() const override;
 		virtual NodeType GetNodeType( const std::string& name ) const override;
 		virtual NodeDataType GetNodeDataType( const std::string& name ) const override;
+		virtual void Prepare( IGPUContext* pContext, Camera& camera, SceneNode& scene, RenderData& data ) override {}
+		virtual bool CanRecordInParallel() const override { return false; }
 
 		virtual void Visit( const Mat3x4& transform, Entity e ) {};
 	protected:
@@ -0,0 +1,334 @@
+#include "PCH.h"
+#include "LightClusters.h"
+
+#include <cstring>
+
+#include "Core/CoreEntityComponents.h"
+#include "Core/Globals.h"
+#include "Util/AABBTree.h"
+#include "Util/JobSystem.h"
+#include "Camera.h"
+#include "Light.h"
+#include "ShaderManager.h"
+#include "SpatialIndex.h"
+
+namespace Bat
+{
+	// Bounding sphere of the region a light can reach, directional lights have none
+	static Vec4 GetLightBounds( const LightComponent& light, const Vec3& position, const Vec3& direction )
+	{
+		const float range = light.GetRange();
+		if( light.GetType() == LightType::SPOT )
+		{
+			// sphere through the apex and the edge of the cone's cap, only smaller than the full range for narrow cones
+			const float cos_angle = cosf( light.GetSpotlightAngle() );
+			if( cos_angle > 0.5f )
+			{
+				const float radius = range / ( 2.0f * cos_angle );
+				const Vec3 centre = position + direction * radius;
+				return { centre.x, centre.y, centre.z, radius };
+			}
+		}
+
+		return { position.x, position.y, position.z, range };
+	}
+
+	void LightClusters::Build( const Camera& camera )
+	{
+		m_Lights.clear();
+		m_LightTransforms.clear();
+		m_ViewSpheres.clear();
+		m_bUploaded = false;
+
+		// only lights whose range reaches into the view can affect anything we draw
+		std::vector<Entity>& candidates = m_Candidates;
+		candidates.clear();
+		if( spatial_index )
+		{
+			spatial_index->QueryFrustum( SpatialCategory::LIGHT, camera.GetFrustum(), candidates );
+		}
+		else
+		{
+			for( auto [e, light, t] : world.View<LightComponent, TransformComponent>() )
+			{
+				candidates.push_back( e );
+			}
+		}
+
+		// directional lights go first, they aren't binned and every pixel shades them
+		for( Entity e : candidates )
+		{
+			const auto& light = e.Get<LightComponent>();
+			if( light.IsEnabled() && light.GetType() == LightType::DIRECTIONAL && m_Lights.size() < MAX_LIGHTS )
+			{
+				m_Lights.push_back( e );
+				m_LightTransforms.push_back( Mat4( e.Get<TransformComponent>().LocalToWorldMatrix() ) );
+			}
+		}
+		m_iNumGlobalLights = m_Lights.size();
+
+		const Mat4& view = camera.GetViewMatrix();
+		for( Entity e : candidates )
+		{
+			const auto& light = e.Get<LightComponent>();
+			if( !light.IsEnabled() || light.GetType() == LightType::DIRECTIONAL )
+			{
+				continue;
+			}
+
+			if( m_Lights.size() == MAX_LIGHTS )
+			{
+				BAT_WARN( "Too many lights in view, only %i will be shaded", (int)MAX_LIGHTS );
+				break;
+			}
+
+			const auto& t = e.Get<TransformComponent>();
+			const Mat4 transform = Mat4( t.LocalToWorldMatrix() );
+			const Vec3 direction = Mat4::TransformNormal( Mat4::RotateDeg( t.GetRotation() ), { 0.0f, 0.0f, 1.0f } );
+			const Vec4 bounds = GetLightBounds( light, transform.GetTranslation(), direction );
+			const Vec3 view_centre = Mat4::Transform( view, { bounds.x, bounds.y, bounds.z } );
+
+			m_Lights.push_back( e );
+			m_LightTransforms.push_back( transform );
+			m_ViewSpheres.push_back( { view_centre.x, view_centre.y, view_centre.z, bounds.w } );
+		}
+
+		Assign( camera, m_ViewSpheres );
+	}
+
+	void LightClusters::Assign( const Camera& camera, const std::vector<Vec4>& view_spheres )
+	{
+		ASSERT( view_spheres.size() <= UINT16_MAX, "Too many lights to cluster" );
+
+		UpdateClusterBounds( camera );
+
+		const Mat4& view = camera.GetViewMatrix();
+		m_ViewDepthPlane = { view.m[2][0], view.m[2][1], view.m[2][2], view.m[2][3] };
+
+		m_ClusterBins.resize( (size_t)NUM_CLUSTERS * MAX_LIGHTS_PER_CLUSTER );
+		m_ClusterBinCounts.resize( NUM_CLUSTERS );
+		m_ClusterGrid.resize( NUM_CLUSTERS );
+		m_LightIndices.resize( MAX_LIGHT_INDICES );
+
+		// every job owns the bins of one depth slice, so they never write to the same cluster
+		JobCounter counter;
+		JobSystem::Dispatch( CLUSTERS_Z, 1, [this, &view_spheres]( JobDispatchArgs args )
+		{
+			AssignSlice( args.jobIndex, view_spheres );
+		}, &counter );
+		JobSystem::Wait( counter );
+
+		// compact the bins into one index list
+		uint32_t offset = 0;
+		m_iNumDropped = 0;
+		for( uint32_t cluster = 0; cluster < NUM_CLUSTERS; cluster++ )
+		{
+			uint32_t count = m_ClusterBinCounts[cluster];
+			if( count > MAX_LIGHTS_PER_CLUSTER )
+			{
+				m_iNumDropped += count - MAX_LIGHTS_PER_CLUSTER;
+				count = MAX_LIGHTS_PER_CLUSTER;
+			}
+			if( offset + count > MAX_LIGHT_INDICES )
+			{
+				m_iNumDropped += offset + count - MAX_LIGHT_INDICES;
+				count = MAX_LIGHT_INDICES - offset;
+			}
+
+			std::memcpy( &m_LightIndices[offset], &m_ClusterBins[(size_t)cluster * MAX_LIGHTS_PER_CLUSTER], count * sizeof( uint16_t ) );
+			m_ClusterGrid[cluster] = { offset, count };
+			offset += count;
+		}
+	}
+
+	void LightClusters::AssignSlice( uint32_t slice, const std::vector<Vec4>& view_spheres )
+	{
+		const float z0 = m_SliceDepths[slice];
+		const float z1 = m_SliceDepths[slice + 1];
+		const uint32_t first_cluster = slice * CLUSTERS_X * CLUSTERS_Y;
+
+		std::fill_n( &m_ClusterBinCounts[first_cluster], CLUSTERS_X * CLUSTERS_Y, 0 );
+
+		for( size_t i = 0; i < view_spheres.size(); i++ )
+		{
+			const Vec4& sphere = view_spheres[i];
+			const Vec3 centre = { sphere.x, sphere.y, sphere.z };
+			const float radius = sphere.w;
+
+			if( centre.z + radius < z0 || centre.z - radius > z1 )
+			{
+				continue;
+			}
+
+			// Range of x/z and y/z slopes covered by the part of the sphere's bounding box inside this slice,
+			// gives the tiles it can touch without testing all of them
+			const float near_z = std::max( z0, centre.z - radius );
+			const float far_z = std::min( z1, centre.z + radius );
+			const float min_x = centre.x - radius;
+			const float max_x = centre.x + radius;
+			const float min_y = centre.y - radius;
+			const float max_y = centre.y + radius;
+			const float min_slope_x = min_x / ( min_x < 0.0f ? near_z : far_z );
+			const float max_slope_x = max_x / ( max_x > 0.0f ? near_z : far_z );
+			const float min_slope_y = min_y / ( min_y < 0.0f ? near_z : far_z );
+			const float max_slope_y = max_y / ( max_y > 0.0f ? near_z : far_z );
+
+			if( max_slope_x < -m_flTanHalfFovX || min_slope_x > m_flTanHalfFovX ||
+				max_slope_y < -m_flTanHalfFovY || min_slope_y > m_flTanHalfFovY )
+			{
+				continue;
+			}
+
+			// tiles are padded by one on each side so rounding never loses a tile the exact test would accept,
+			// y tiles go top to bottom like pixels do
+			auto to_tile = []( float t, uint32_t num_tiles )
+			{
+				return (int)std::clamp( std::floor( t * num_tiles ), -1.0f, (float)num_tiles );
+			};
+			const int tx0 = std::max( to_tile( ( min_slope_x / m_flTanHalfFovX + 1.0f ) * 0.5f, CLUSTERS_X ) - 1, 0 );
+			const int tx1 = std::min( to_tile( ( max_slope_x / m_flTanHalfFovX + 1.0f ) * 0.5f, CLUSTERS_X ) + 1, (int)CLUSTERS_X - 1 );
+			const int ty0 = std::max( to_tile( ( 1.0f - max_slope_y / m_flTanHalfFovY ) * 0.5f, CLUSTERS_Y ) - 1, 0 );
+			const int ty1 = std::min( to_tile( ( 1.0f - min_slope_y / m_flTanHalfFovY ) * 0.5f, CLUSTERS_Y ) + 1, (int)CLUSTERS_Y - 1 );
+
+			for( int ty = ty0; ty <= ty1; ty++ )
+			{
+				for( int tx = tx0; tx <= tx1; tx++ )
+				{
+					const uint32_t cluster = first_cluster + ty * CLUSTERS_X + tx;
+					if( !AABBTree::SphereOverlaps( m_ClusterBounds[cluster], centre, radius ) )
+					{
+						continue;
+					}
+
+					const uint32_t count = m_ClusterBinCounts[cluster]++;
+					if( count < MAX_LIGHTS_PER_CLUSTER )
+					{
+						m_ClusterBins[(size_t)cluster * MAX_LIGHTS_PER_CLUSTER + count] = (uint16_t)i;
+					}
+				}
+			}
+		}
+	}
+
+	void LightClusters::UpdateClusterBounds( const Camera& camera )
+	{
+		if( camera.GetFOV() == m_flFOV && camera.GetAspectRatio() == m_flAspectRatio &&
+			camera.GetNear() == m_flNear && camera.GetFar() == m_flFar )
+		{
+			return;
+		}
+
+		m_flFOV = camera.GetFOV();
+		m_flAspectRatio = camera.GetAspectRatio();
+		m_flNear = camera.GetNear();
+		m_flFar = camera.GetFar();
+
+		m_flTanHalfFovY = tanf( Math::DegToRad( m_flFOV ) * 0.5f );
+		m_flTanHalfFovX = m_flTanHalfFovY * m_flAspectRatio;
+
+		const float log_depth_range = logf( m_flFar / m_flNear );
+		m_flDepthScale = CLUSTERS_Z / log_depth_range;
+		m_flDepthBias = -(float)CLUSTERS_Z * logf( m_flNear ) / log_depth_range;
+
+		m_SliceDepths.resize( CLUSTERS_Z + 1 );
+		for( uint32_t slice = 0; slice <= CLUSTERS_Z; slice++ )
+		{
+			m_SliceDepths[slice] = m_flNear * powf( m_flFar / m_flNear, (float)slice / CLUSTERS_Z );
+		}
+
+		m_ClusterBounds.resize( NUM_CLUSTERS );
+		for( uint32_t slice = 0; slice < CLUSTERS_Z; slice++ )
+		{
+			const float z0 = m_SliceDepths[slice];
+			const float z1 = m_SliceDepths[slice + 1];
+			for( uint32_t ty = 0; ty < CLUSTERS_Y; ty++ )
+			{
+				const float slope_y1 = ( 1.0f - 2.0f * ty / CLUSTERS_Y ) * m_flTanHalfFovY;
+				const float slope_y0 = ( 1.0f - 2.0f * ( ty + 1 ) / CLUSTERS_Y ) * m_flTanHalfFovY;
+				for( uint32_t tx = 0; tx < CLUSTERS_X; tx++ )
+				{
+					const float slope_x0 = ( 2.0f * tx / CLUSTERS_X - 1.0f ) * m_flTanHalfFovX;
+					const float slope_x1 = ( 2.0f * ( tx + 1 ) / CLUSTERS_X - 1.0f ) * m_flTanHalfFovX;
+
+					AABB& bounds = m_ClusterBounds[( slice * CLUSTERS_Y + ty ) * CLUSTERS_X + tx];
+					bounds.mins = { std::min( slope_x0 * z0, slope_x0 * z1 ), std::min( slope_y0 * z0, slope_y0 * z1 ), z0 };
+					bounds.maxs = { std::max( slope_x1 * z0, slope_x1 * z1 ), std::max( slope_y1 * z0, slope_y1 * z1 ), z1 };
+				}
+			}
+		}
+	}
+
+	float LightClusters::GetSlice( float view_z ) const
+	{
+		return logf( view_z ) * m_flDepthScale + m_flDepthBias;
+	}
+
+	uint32_t LightClusters::GetClusterIndex( const Vec3& view_pos ) const
+	{
+		const float ndc_x = view_pos.x / ( view_pos.z * m_flTanHalfFovX );
+		const float ndc_y = view_pos.y / ( view_pos.z * m_flTanHalfFovY );
+
+		const uint32_t tx = (uint32_t)std::clamp( ( ndc_x + 1.0f ) * 0.5f * CLUSTERS_X, 0.0f, CLUSTERS_X - 1.0f );
+		const uint32_t ty = (uint32_t)std::clamp( ( 1.0f - ndc_y ) * 0.5f * CLUSTERS_Y, 0.0f, CLUSTERS_Y - 1.0f );
+		const uint32_t slice = (uint32_t)std::clamp( GetSlice( view_pos.z ), 0.0f, CLUSTERS_Z - 1.0f );
+
+		return ( slice * CLUSTERS_Y + ty ) * CLUSTERS_X + tx;
+	}
+
+	void LightClusters::Upload( IGPUContext* pContext )
+	{
+		if( m_bUploaded )
+		{
+			return;
+		}
+		ASSERT( m_ClusterGrid.size() == NUM_CLUSTERS, "Light clusters uploaded before being built" );
+		m_bUploaded = true;
+
+		if( !m_pLightParams )
+		{
+			m_pLightParams.reset( gpu->CreateConstantBuffer( nullptr, sizeof( ShaderLightParams ) ) );
+			m_pClusterGrid.reset( gpu->CreateTexture( m_ClusterGrid.data(), CLUSTERS_X * CLUSTERS_Y * sizeof( ClusterRange ),
+				CLUSTERS_X * CLUSTERS_Y, CLUSTERS_Z, TEX_FORMAT_R32G32_UINT, GPUResourceUsage::DYNAMIC, TexFlags::NO_GEN_MIPS ) );
+			m_pLightIndices.reset( gpu->CreateTexture( m_LightIndices.data(), LIGHT_INDICES_WIDTH * sizeof( uint16_t ),
+				LIGHT_INDICES_WIDTH, MAX_LIGHT_INDICES / LIGHT_INDICES_WIDTH, TEX_FORMAT_R16_UINT, GPUResourceUsage::DYNAMIC, TexFlags::NO_GEN_MIPS ) );
+		}
+
+		// Filled in here rather than in Build, shadow maps are assigned by the shadow pass after the clusters are built
+		auto params = reinterpret_cast<ShaderLightParams*>( pContext->Lock( m_pLightParams.get() ) );
+		params->NumGlobalLights = (uint32_t)m_iNumGlobalLights;
+		params->NumLights = (uint32_t)m_Lights.size();
+		params->ClusterDepthScale = m_flDepthScale;
+		params->ClusterDepthBias = m_flDepthBias;
+		params->ViewDepthPlane = m_ViewDepthPlane;
+		for( size_t i = 0; i < m_Lights.size(); i++ )
+		{
+			const auto& l = m_Lights[i].Get<LightComponent>();
+			const auto& t = m_Lights[i].Get<TransformComponent>();
+
+			Mat4 rot = Mat4::RotateDeg( t.GetRotation() );
+
+			ShaderLight& light = params->Lights[i];
+			light.Position = m_LightTransforms[i].GetTranslation();
+			light.ShadowIndex = (int)l.GetShadowIndex();
+			light.Direction = Mat4::TransformNormal( rot, { 0.0f, 0.0f, 1.0f } );
+			light.SpotlightAngle = l.GetSpotlightAngle();
+			light.Colour = l.GetColour();
+			light.Range = l.GetRange();
+			light.Intensity = l.GetIntensity();
+			light.Type = (int)l.GetType();
+		}
+		pContext->Unlock( m_pLightParams.get() );
+
+		pContext->UpdateTexturePixels( m_pClusterGrid.get(), m_ClusterGrid.data(), CLUSTERS_X * CLUSTERS_Y * sizeof( ClusterRange ) );
+		pContext->UpdateTexturePixels( m_pLightIndices.get(), m_LightIndices.data(), LIGHT_INDICES_WIDTH * sizeof( uint16_t ) );
+	}
+
+	void LightClusters::Bind( IGPUContext* pContext ) const
+	{
+		ASSERT( m_pLightParams, "Light clusters bound before being uploaded" );
+
+		pContext->SetConstantBuffer( ShaderType::PIXEL, m_pLightParams.get(), PS_CBUF_SLOT_1 );
+		pContext->BindTexture( m_pClusterGrid.get(), PS_TEX_LIGHT_GRID );
+		pContext->BindTexture( m_pLightIndices.get(), PS_TEX_LIGHT_INDICES );
+	}
+}
@@ -0,0 +1,103 @@
+#pragma once
+
+#include <memory>
+#include <vector>
+#include "Core/Entity.h"
+#include "IGPUDevice.h"
+#include "ShaderBuffers.h"
+
+namespace Bat
+{
+	class Camera;
+
+	// Clustered forward light assignment. The view frustum is split into screen space tiles and exponentially spaced
+	// depth slices, every point/spot light is binned into the clusters its bounds touch so a pixel only shades the
+	// lights of its own cluster. Directional lights reach everything and are kept out of the clusters.
+	// Built once per frame by the render graph, binning runs on the job system with one depth slice per job.
+	class LightClusters
+	{
+	public:
+		// Must match the defines in CommonPS.hlsli
+		static constexpr uint32_t CLUSTERS_X = 16;
+		static constexpr uint32_t CLUSTERS_Y = 9;
+		static constexpr uint32_t CLUSTERS_Z = 24;
+		static constexpr uint32_t NUM_CLUSTERS = CLUSTERS_X * CLUSTERS_Y * CLUSTERS_Z;
+		// Lights past this in a single cluster are dropped
+		static constexpr uint32_t MAX_LIGHTS_PER_CLUSTER = 128;
+		// Light index list shared by every cluster, uploaded as a LIGHT_INDICES_WIDTH wide texture
+		static constexpr uint32_t LIGHT_INDICES_WIDTH = 1024;
+		static constexpr uint32_t MAX_LIGHT_INDICES = LIGHT_INDICES_WIDTH * 64;
+
+		// Gathers every enabled light that can affect the camera's view and bins them into clusters
+		void Build( const Camera& camera );
+		// Bins bounding spheres given in the camera's view space (centre in xyz, radius in w) into clusters.
+		// Build calls this with its point/spot lights, it can also be called directly to test the assignment without a scene.
+		void Assign( const Camera& camera, const std::vector<Vec4>& view_spheres );
+
+		// Uploads the light parameters and cluster lists. Does nothing if they have been uploaded since the last Build.
+		// Has to be called on the immediate context after shadow maps have been assigned for the frame.
+		void Upload( IGPUContext* pContext );
+		// Binds what Upload uploaded for LitGenericPS
+		void Bind( IGPUContext* pContext ) const;
+
+		// Lights that were gathered by Build, directional lights come first
+		const std::vector<Entity>& GetLights() const { return m_Lights; }
+		const std::vector<Mat4>& GetLightTransforms() const { return m_LightTransforms; }
+		size_t GetNumGlobalLights() const { return m_iNumGlobalLights; }
+
+		// Cluster a view space position falls into, matches the lookup in LitGenericPS
+		uint32_t GetClusterIndex( const Vec3& view_pos ) const;
+		// View space bounds of a cluster
+		const AABB& GetClusterBounds( uint32_t cluster ) const { return m_ClusterBounds[cluster]; }
+		// Indices into the spheres passed to Assign of the lights touching a cluster, in ascending order
+		const uint16_t* GetClusterLights( uint32_t cluster ) const { return &m_LightIndices[m_ClusterGrid[cluster].offset]; }
+		size_t GetClusterLightCount( uint32_t cluster ) const { return m_ClusterGrid[cluster].count; }
+		// Number of light/cluster pairs that didn't fit in the last Assign
+		size_t GetNumDroppedLights() const { return m_iNumDropped; }
+	private:
+		void UpdateClusterBounds( const Camera& camera );
+		void AssignSlice( uint32_t slice, const std::vector<Vec4>& view_spheres );
+		float GetSlice( float view_z ) const;
+	private:
+		struct ClusterRange
+		{
+			uint32_t offset;
+			uint32_t count;
+		};
+
+		// lights
+		std::vector<Entity> m_Candidates;
+		std::vector<Entity> m_Lights;
+		std::vector<Mat4> m_LightTransforms;
+		std::vector<Vec4> m_ViewSpheres;
+		size_t m_iNumGlobalLights = 0;
+		// view space plane the clusters are sliced along, view z = dot( pos, xyz ) + w
+		Vec4 m_ViewDepthPlane = { 0.0f, 0.0f, 1.0f, 0.0f };
+
+		// cluster geometry, only rebuilt when the projection changes
+		float m_flFOV = 0.0f;
+		float m_flAspectRatio = 0.0f;
+		float m_flNear = 0.0f;
+		float m_flFar = 0.0f;
+		float m_flTanHalfFovX = 0.0f;
+		float m_flTanHalfFovY = 0.0f;
+		// slice = log( view z ) * scale + bias
+		float m_flDepthScale = 0.0f;
+		float m_flDepthBias = 0.0f;
+		std::vector<float> m_SliceDepths;
+		std::vector<AABB> m_ClusterBounds;
+
+		// per cluster bins written by the slice jobs, then compacted into the index list
+		std::vector<uint16_t> m_ClusterBins;
+		std::vector<uint32_t> m_ClusterBinCounts;
+		std::vector<ClusterRange> m_ClusterGrid;
+		std::vector<uint16_t> m_LightIndices;
+		size_t m_iNumDropped = 0;
+
+		// gpu resources, created on first upload
+		bool m_bUploaded = false;
+		std::unique_ptr<IConstantBuffer> m_pLightParams;
+		std::unique_ptr<ITexture> m_pClusterGrid;
+		std::unique_ptr<ITexture> m_pLightIndices;
+	};
+}
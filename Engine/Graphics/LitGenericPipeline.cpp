@@ -19,8 +19,7 @@ namespace Bat
 		const Mesh& mesh,
 		const Camera& camera,
 		const Mat4& world_transform,
-		const std::vector<Entity>& light_ents,
-		const std::vector<Mat4>& light_transforms,
+		const LightClusters* pLights,
 		const PbrGlobalMaps& maps )
 	{
 		ShaderMacro macros[MAX_SHADER_MACROS];
@@ -36,7 +35,7 @@ namespace Bat
 
 		mesh.Bind( pContext, pVertexShader );
 		BindMaterial( pContext, mesh.GetMaterial() );
-		BindLights( pContext, light_ents, light_transforms );
+		BindLights( pContext, pLights );
 
 		if( maps.irradiance_map )
 		{
@@ -58,8 +57,7 @@ namespace Bat
 		const Mesh& mesh,
 		const std::vector<LitGenericInstanceData>& instances,
 		const Camera& camera,
-		const std::vector<Entity>& light_ents,
-		const std::vector<Mat4>& light_transforms,
+		const LightClusters* pLights,
 		const PbrGlobalMaps& maps )
 	{
 		ShaderMacro macros[MAX_SHADER_MACROS];
@@ -75,10 +73,21 @@ namespace Bat
 
 		mesh.Bind( pContext, pVertexShader );
 		BindMaterial( pContext, mesh.GetMaterial() );
-		BindLights( pContext, light_ents, light_transforms );
+		BindLights( pContext, pLights );
 		BindInstances( pContext, pVertexShader, instances );
 
-		pContext->BindTexture( maps.irradiance_map, PS_TEX_SLOT_5 );
+		if( maps.irradiance_map )
+		{
+			pContext->BindTexture( maps.irradiance_map, PS_TEX_SLOT_5 );
+		}
+		if( maps.prefilter_map )
+		{
+			pContext->BindTexture( maps.prefilter_map, PS_TEX_SLOT_6 );
+		}
+		if( maps.brdf_integration_map )
+		{
+			pContext->BindTexture( maps.brdf_integration_map, PS_TEX_SLOT_7 );
+		}
 
 		pContext->DrawInstancedIndexed( mesh.GetIndexCount(), instances.size() );
 	}
@@ -129,42 +138,18 @@ namespace Bat
 		}
 	}
 
-	void LitGenericPipeline::BindLights( IGPUContext* pContext, const std::vector<Entity>& light_ents, const std::vector<Mat4>& light_transforms )
+	void LitGenericPipeline::BindLights( IGPUContext* pContext, const LightClusters* pLights )
 	{
-		CB_LitGenericPipelineLights lights;
-		size_t j = 0;
-		for( size_t i = 0; i < light_ents.size(); i++ )
+		if( pLights )
 		{
-			if( j == MAX_LIGHTS )
-			{
-				break;
-			}
-
-			const auto& l = light_ents[i].Get<LightComponent>();
-			const auto& t = light_ents[i].Get<TransformComponent>();
-
-			if( !l.IsEnabled() )
-			{
-				continue;
-			}
-
-			Mat4 rot = Mat4::RotateDeg( t.GetRotation() );
-
-			lights.lights[j].Position = light_transforms[i].GetTranslation();
-			lights.lights[j].ShadowIndex = (int)l.GetShadowIndex();
-			lights.lights[j].Direction = Mat4::TransformNormal( rot, { 0.0f, 0.0f, 1.0f } );
-			lights.lights[j].SpotlightAngle = l.GetSpotlightAngle();
-			lights.lights[j].Colour = l.GetColour();
-			lights.lights[j].Range = l.GetRange();
-			lights.lights[j].Intensity = l.GetIntensity();
-			lights.lights[j].Type = (int)l.GetType();
-
-			j++;
+			pLights->Bind( pContext );
+		}
+		else
+		{
+			pContext->SetConstantBuffer( ShaderType::PIXEL, m_cbufNoLights, PS_CBUF_SLOT_1 );
 		}
-		lights.num_lights = (uint32_t)j;
-		m_cbufLightParams.Update( pContext, lights );
-		pContext->SetConstantBuffer( ShaderType::PIXEL, m_cbufLightParams, PS_CBUF_SLOT_1 );
 	}
+
 	void LitGenericPipeline::BindInstances( IGPUContext* pContext, IVertexShader* pVertexShader, const std::vector<LitGenericInstanceData>& instances )
 	{
 		if( !m_vbufInstanceData )
@@ -6,6 +6,7 @@
 #include "ShaderBuffers.h"
 #include "Light.h"
 #include "Material.h"
+#include "LightClusters.h"
 
 namespace Bat
 {
@@ -28,23 +29,22 @@ namespace Bat
 			const Mesh& mesh,
 			const Camera& camera,
 			const Mat4& world_transform,
-			const std::vector<Entity>& light_ents,
-			const std::vector<Mat4>& light_transforms,
+			const LightClusters* pLights,
 			const PbrGlobalMaps& maps );
 
 		void RenderInstanced( IGPUContext* pContext,
 			const Mesh& mesh,
 			const std::vector<LitGenericInstanceData>& instances,
 			const Camera& camera,
-			const std::vector<Entity>& light_ents,
-			const std::vector<Mat4>& light_transforms,
+			const LightClusters* pLights,
 			const PbrGlobalMaps& maps );
 	private:
 		void BindTransforms( IGPUContext* pContext,
 			const Camera& camera,
 			const Mat4& world_transform );
 		void BindMaterial( IGPUContext* pContext, const Material& material );
-		void BindLights( IGPUContext* pContext, const std::vector<Entity>& light_ents, const std::vector<Mat4>& light_transforms );
+		// Binds the frame's clustered lights, or no lights at all if pLights is null
+		void BindLights( IGPUContext* pContext, const LightClusters* pLights );
 		void BindInstances( IGPUContext* pContext, IVertexShader* pVertexShader, const std::vector<LitGenericInstanceData>& instances );
 	private:
 		struct CB_LitGenericPipelineMatrix
@@ -57,17 +57,11 @@ namespace Bat
 		{
 			ShaderMaterial mat;
 		};
-
-		struct CB_LitGenericPipelineLights
-		{
-			uint32_t    num_lights;
-			float       _pad0[3];
-			ShaderLight lights[MAX_LIGHTS];
-		};
 	private:
 		ConstantBuffer<CB_LitGenericPipelineMatrix>   m_cbufTransform;
 		ConstantBuffer<CB_LitGenericPipelineMaterial> m_cbufMaterial;
-		ConstantBuffer<CB_LitGenericPipelineLights>    m_cbufLightParams;
+		// all zeroes, bound when drawing without lights
+		ConstantBuffer<ShaderLightParams> m_cbufNoLights = ShaderLightParams{};
 		VertexBuffer<LitGenericInstanceData> m_vbufInstanceData;
 	};
 }
\ No newline at end of file
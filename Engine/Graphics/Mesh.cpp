@@ -6,6 +6,35 @@
 
 namespace Bat
 {
+	static std::mutex g_MeshIdMutex;
+	static std::vector<uint32_t> g_FreeMeshIds;
+	static uint32_t g_iNextMeshId = 0;
+
+	Mesh::MeshId::MeshId()
+	{
+		std::lock_guard<std::mutex> lock( g_MeshIdMutex );
+		if( !g_FreeMeshIds.empty() )
+		{
+			m_iId = g_FreeMeshIds.back();
+			g_FreeMeshIds.pop_back();
+		}
+		else
+		{
+			m_iId = g_iNextMeshId++;
+		}
+	}
+
+	Mesh::MeshId::MeshId( const MeshId& )
+		:
+		MeshId()
+	{}
+
+	Mesh::MeshId::~MeshId()
+	{
+		std::lock_guard<std::mutex> lock( g_MeshIdMutex );
+		g_FreeMeshIds.push_back( m_iId );
+	}
+
 	Mesh::Mesh( const MeshParameters& params, const std::vector<unsigned int>& indices, const Material& material )
 		:
 		m_Material( material )
@@ -61,8 +61,26 @@ namespace Bat
 		void AddRenderFlag( RenderFlags flag ) { m_RenderFlags |= flag; }
 		void RemoveRenderFlag( RenderFlags flag ) { m_RenderFlags &= ~flag; }
 
+		// Unique among live meshes, ids of destroyed meshes are reused so they stay small
+		uint32_t GetId() const { return m_Id.Get(); }
+
 		void DoImGuiMenu();
 	private:
+		// Copies get an id of their own rather than sharing the original's
+		class MeshId
+		{
+		public:
+			MeshId();
+			MeshId( const MeshId& );
+			MeshId& operator=( const MeshId& ) { return *this; }
+			~MeshId();
+
+			uint32_t Get() const { return m_iId; }
+		private:
+			uint32_t m_iId;
+		};
+
+		MeshId m_Id;
 		VertexBuffer<Vec3> m_bufPosition;
 		VertexBuffer<Vec4> m_bufColour;
 		VertexBuffer<Vec3> m_bufNormal;
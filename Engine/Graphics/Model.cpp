@@ -45,6 +45,7 @@ namespace Bat
 			}
 
 			ImGui::CheckboxFlags( "Draw BBox", (unsigned int*)&m_RenderFlags, (unsigned int)RenderFlags::DRAW_BBOX );
+			ImGui::CheckboxFlags( "Static", (unsigned int*)&m_RenderFlags, (unsigned int)RenderFlags::STATIC );
 
 			ImGui::TreePop();
 		}
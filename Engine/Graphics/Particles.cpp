@@ -8,12 +8,18 @@ namespace Bat
 	BAT_COMPONENT_BEGIN( ParticleEmitterComponent );
 	BAT_COMPONENT_END();
 
-	static Particle CreateParticle( const Vec3& pos, const ParticleEmitterComponent& emitter )
+	static float GetRandomFloat( std::mt19937& rng, float min, float max )
+	{
+		std::uniform_real_distribution<float> dist( min, max );
+		return dist( rng );
+	}
+
+	static Particle CreateParticle( const Vec3& pos, const ParticleEmitterComponent& emitter, std::mt19937& rng )
 	{
 		Vec3 rand_vel = {
-			Math::GetRandomFloat( -emitter.rand_velocity_range.x, emitter.rand_velocity_range.x ),
-			Math::GetRandomFloat( -emitter.rand_velocity_range.y, emitter.rand_velocity_range.y ),
-			Math::GetRandomFloat( -emitter.rand_velocity_range.z, emitter.rand_velocity_range.z )
+			GetRandomFloat( rng, -emitter.rand_velocity_range.x, emitter.rand_velocity_range.x ),
+			GetRandomFloat( rng, -emitter.rand_velocity_range.y, emitter.rand_velocity_range.y ),
+			GetRandomFloat( rng, -emitter.rand_velocity_range.z, emitter.rand_velocity_range.z )
 		};
 
 		Particle new_particle;
@@ -21,33 +27,38 @@ namespace Bat
 		new_particle.velocity = emitter.normal + rand_vel;
 		new_particle.age = 0.0f;
 		new_particle.colour = emitter.gradient.Get( 0.0f ).AsVector();
-		new_particle.rot_velocity = Math::GetRandomFloat( -emitter.rand_rot_velocity_range, emitter.rand_rot_velocity_range );
+		new_particle.rot_velocity = GetRandomFloat( rng, -emitter.rand_rot_velocity_range, emitter.rand_rot_velocity_range );
 		return new_particle;
 	}
 
-	void ParticleSystem::Update( EntityManager& world, float dt )
+	void ParticleSystem::Update( EntityManager& world, float dt, EntityCommandQueue& commands )
 	{
-		for( Entity e : world )
+		for( auto [e, emitter, t] : world.View<ParticleEmitterComponent, TransformComponent>() )
 		{
-			if( !e.Has<ParticleEmitterComponent>() )
+			// only reads the world matrix, which the hierarchy has already brought up to date
+			const Vec3 emitter_pos = t.LocalToWorldMatrix().GetTranslation();
+
+			emitter.particles.resize( MAX_PARTICLES );
+
+			emitter.age += dt;
+			const bool emitting = ( emitter.duration <= 0.0f || emitter.age < emitter.duration );
+			if( !emitting && emitter.num_particles == 0 )
 			{
+				// can't remove anything while iterating the view
+				commands.GetThreadBuffer( e.GetId().GetIndex() ).RemoveComponent<ParticleEmitterComponent>( e );
 				continue;
 			}
 
-			auto& t = e.Get<TransformComponent>();
-
-			Vec3 emitter_pos = t.GetPosition();
-
-			auto& emitter = e.Get<ParticleEmitterComponent>();
-			emitter.particles.resize( MAX_PARTICLES );
-
-			emitter.timer += dt;
-			float creation_interval = 1.0f / emitter.particles_per_sec;
 			int particles_to_create = 0;
-			while( emitter.timer >= creation_interval )
+			if( emitting )
 			{
-				particles_to_create++;
-				emitter.timer -= creation_interval;
+				emitter.timer += dt;
+				float creation_interval = 1.0f / emitter.particles_per_sec;
+				while( emitter.timer >= creation_interval )
+				{
+					particles_to_create++;
+					emitter.timer -= creation_interval;
+				}
 			}
 
 			for( int i = 0; i < emitter.num_particles; i++ )
@@ -62,7 +73,7 @@ namespace Bat
 				{
 					if( particles_to_create )
 					{
-						p = CreateParticle( emitter_pos, emitter );
+						p = CreateParticle( emitter_pos, emitter, m_Rng );
 						particles_to_create--;
 					}
 					else
@@ -81,7 +92,7 @@ namespace Bat
 					return;
 				}
 
-				emitter.particles[emitter.num_particles] = CreateParticle( emitter_pos, emitter );
+				emitter.particles[emitter.num_particles] = CreateParticle( emitter_pos, emitter, m_Rng );
 				emitter.num_particles++;
 			}
 		}
@@ -1,7 +1,10 @@
 #pragma once
 
+#include <random>
+
 #include "Core/ResourceManager.h"
 #include "Core/Entity.h"
+#include "Core/EntityCommandBuffer.h"
 #include "Colour.h"
 
 namespace Bat
@@ -45,11 +48,19 @@ namespace Bat
 		float rand_rot_velocity_range = 5.0f;
 		Vec3 normal = { 0.0f, 1.0f, 0.0f }; // The direction to emit particles to (velocity is relative to size of this)
 		float timer = 0.0f;
+
+		// Seconds to emit for, 0 emits forever. The component is removed once it's done and its last particle has died.
+		float duration = 0.0f;
+		float age = 0.0f;
 	};
 
 	class ParticleSystem
 	{
 	public:
-		void Update( EntityManager& world, float dt );
+		// Finished emitters are removed through the command queue, they are gone after it's played back
+		void Update( EntityManager& world, float dt, EntityCommandQueue& commands );
+	private:
+		// own generator so the system doesn't share the global one with whatever else is running
+		std::mt19937 m_Rng;
 	};
 }
\ No newline at end of file
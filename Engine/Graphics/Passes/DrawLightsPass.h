@@ -56,13 +56,11 @@ namespace Bat
 
 						auto pPipeline = ShaderManager::GetPipeline<LitGenericPipeline>();
 
-						std::vector<Entity> empty;
-						std::vector<Mat4> empty2;
 						PbrGlobalMaps pbr_maps;
 						pbr_maps.irradiance_map = nullptr;
 						pbr_maps.prefilter_map = nullptr;
 						pbr_maps.brdf_integration_map = nullptr;
-						pPipeline->Render( m_pContext, *sphere_mesh, *m_pCamera, w, empty, empty2, pbr_maps );
+						pPipeline->Render( m_pContext, *sphere_mesh, *m_pCamera, w, nullptr, pbr_maps );
 					}
 				}
 			}
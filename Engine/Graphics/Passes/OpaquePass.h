@@ -12,6 +12,7 @@
 #include "../ShaderManager.h"
 #include "../LitGenericPipeline.h"
 #include "../DebugDraw.h"
+#include "Util/RadixSort.h"
 
 namespace Bat
 {
@@ -25,6 +26,8 @@ namespace Bat
 			AddRenderNode( "prefilter", NodeType::INPUT, NodeDataType::TEXTURE );
 			AddRenderNode( "brdf", NodeType::INPUT, NodeDataType::TEXTURE );
 		}
+
+		virtual bool CanRecordInParallel() const override { return true; }
 	private:
 		virtual void PreRender( IGPUContext* pContext, Camera& camera, RenderData& data ) override
 		{
@@ -41,19 +44,19 @@ namespace Bat
 			m_PbrMaps.brdf_integration_map = data.GetTexture( "brdf" );
 		}
 
-		virtual void Render( const Mat3x4& transform, Entity e ) override
+		virtual void Render( const Mat3x4& transform, Entity e, bool fully_visible ) override
 		{
 			IGPUContext* pContext = SceneRenderPass::GetContext();
 			Camera* pCamera = SceneRenderPass::GetCamera();
-			LightList light_list = SceneRenderPass::GetLights();
+			const LightClusters* pLights = SceneRenderPass::GetLights();
 
 			if( e.Has<AnimationComponent>() )
 			{
 				auto& anim = e.Get<AnimationComponent>();
 
+				// palette is built by the animation system
 				Mat4* cbuf = m_cbufBones.Lock( pContext )->bone_transforms;
-
-				GetMatrixPalette( cbuf, anim.bones, anim.current_pose );
+				std::copy( anim.matrix_palette.begin(), anim.matrix_palette.end(), cbuf );
 
 				m_cbufBones.Unlock( pContext );
 
@@ -70,6 +73,9 @@ namespace Bat
 					DrawOutlineBox( pContext, *pCamera, model.GetAABB(), w );
 				}
 
+				// animated meshes need their own bone palette bound, so they can't be batched
+				const bool animated = e.Has<AnimationComponent>();
+
 				auto& meshes = model.GetMeshes();
 				for( auto& pMesh : meshes )
 				{
@@ -78,57 +84,125 @@ namespace Bat
 						continue;
 					}
 
-					if( !MeshInCameraFrustum( pMesh.get(), pCamera, w ) )
+					if( !fully_visible && !MeshInCameraFrustum( pMesh.get(), pCamera, w ) )
 					{
 						continue;
 					}
 
-					if( pMesh->HasRenderFlag( RenderFlags::INSTANCED ) )
+					if( pMesh->HasRenderFlag( RenderFlags::DRAW_BBOX ) )
 					{
-						LitGenericInstanceData data;
-						data.world = w;
-
-						auto& instances = m_mapInstancedMeshes[pMesh.get()];
-						instances.push_back( data );
-
-						continue;
+						DrawOutlineBox( pContext, *pCamera, pMesh->GetAABB(), w );
 					}
 
-					if( pMesh->HasRenderFlag( RenderFlags::DRAW_BBOX ) )
+					if( animated )
 					{
-						DrawOutlineBox( pContext, *pCamera, pMesh->GetAABB(), w );
+						auto pPipeline = ShaderManager::GetPipeline<LitGenericPipeline>();
+						pPipeline->Render( pContext, *pMesh, *pCamera, w, pLights, m_PbrMaps );
+						continue;
 					}
 
-					auto pPipeline = ShaderManager::GetPipeline<LitGenericPipeline>();
-					pPipeline->Render( pContext, *pMesh, *pCamera, w, light_list.entities, light_list.transforms, m_PbrMaps );
+					m_vDrawQueue.push_back( { pMesh.get(), w } );
 				}
 			}
 		}
 
 		virtual void PostRender( IGPUContext* pContext, Camera& camera, RenderData& data ) override
 		{
-			LightList light_list = SceneRenderPass::GetLights();
+			const LightClusters* pLights = SceneRenderPass::GetLights();
 			auto pPipeline = ShaderManager::GetPipeline<LitGenericPipeline>();
-			
-			for( auto& [pMesh, instances] : m_mapInstancedMeshes )
+
+			SortDrawQueue( camera );
+
+			// sorted so every run of the same mesh is contiguous, runs become a single instanced draw
+			size_t run_start = 0;
+			while( run_start < m_vSortedDraws.size() )
 			{
-				pPipeline->RenderInstanced( pContext, *pMesh, instances, camera, light_list.entities, light_list.transforms, m_PbrMaps );
-				instances.clear();
+				Mesh* pMesh = m_vDrawQueue[m_vSortedDraws[run_start]].mesh;
+				size_t run_end = run_start + 1;
+				while( run_end < m_vSortedDraws.size() && m_vDrawQueue[m_vSortedDraws[run_end]].mesh == pMesh )
+				{
+					run_end++;
+				}
+
+				const bool instance = ( run_end - run_start >= MIN_INSTANCED_RUN || pMesh->HasRenderFlag( RenderFlags::INSTANCED ) );
+				// instanced shader variant has no skinning
+				if( instance && !pMesh->HasBones() )
+				{
+					m_vInstances.clear();
+					for( size_t i = run_start; i < run_end; i++ )
+					{
+						m_vInstances.push_back( { m_vDrawQueue[m_vSortedDraws[i]].world } );
+					}
+
+					pPipeline->RenderInstanced( pContext, *pMesh, m_vInstances, camera, pLights, m_PbrMaps );
+				}
+				else
+				{
+					for( size_t i = run_start; i < run_end; i++ )
+					{
+						pPipeline->Render( pContext, *pMesh, camera, m_vDrawQueue[m_vSortedDraws[i]].world, pLights, m_PbrMaps );
+					}
+				}
+
+				run_start = run_end;
 			}
+
+			m_vDrawQueue.clear();
 		}
 
-		void DrawOutlineBox( IGPUContext* pContext, const Camera& cam, const AABB& aabb, Mat4 world_transform )
+		// Sort key layout, most significant first:
+		//   8 bits  shader variant (what BuildMacrosForMesh would pick), so pipeline switches are minimised
+		//   20 bits material, hash of the base colour texture so meshes sharing one end up next to each other
+		//   20 bits mesh id, identical meshes end up contiguous so they can be instanced
+		//   16 bits view depth, front to back within a mesh to reduce overdraw
+		// Built from the mesh every time, nothing is kept that could outlive it. Ids only affect ordering, runs are
+		// split on the mesh itself so a collision just costs a batch.
+		static uint64_t GetMeshSortKey( const Mesh* pMesh )
 		{
-			AABB transformed_aabb = aabb.Transform( world_transform );
-			DebugDraw::Box( transformed_aabb.mins, transformed_aabb.maxs );
+			const Material& material = pMesh->GetMaterial();
+
+			uint64_t variant = 0;
+			variant |= pMesh->HasTangentsAndBitangents() ? ( 1 << 0 ) : 0;
+			variant |= ( material.GetAlphaMode() == AlphaMode::MASK ) ? ( 1 << 1 ) : 0;
+			variant |= pMesh->HasBones() ? ( 1 << 2 ) : 0;
+
+			const void* base_colour = material.GetBaseColour().get();
+			const uint64_t material_id = std::hash<const void*>{}( base_colour ) & 0xFFFFF;
+			const uint64_t mesh_id = pMesh->GetId() & 0xFFFFF;
+
+			return ( variant << 56 ) | ( material_id << 36 ) | ( mesh_id << 16 );
 		}
 
-		void GetMatrixPalette( Mat4* out, const std::vector<BoneData>& bones, SkeletonPose pose ) const
+		void SortDrawQueue( const Camera& camera )
 		{
-			ASSERT( bones.size() <= MAX_BONES, "Too many bones!" );
+			const size_t count = m_vDrawQueue.size();
+			m_vSortKeys.resize( count );
+			m_vSortedDraws.resize( count );
+			m_vScratchKeys.resize( count );
+			m_vScratchDraws.resize( count );
+
+			const Vec3 camera_pos = camera.GetPosition();
+			const Vec3 camera_forward = camera.GetLookAtVector();
+			const float depth_scale = 65535.0f / camera.GetFar();
+
+			for( size_t i = 0; i < count; i++ )
+			{
+				const DrawItem& item = m_vDrawQueue[i];
+				const Vec3 offset = item.world.GetTranslation() - camera_pos;
+				const float depth = offset.x * camera_forward.x + offset.y * camera_forward.y + offset.z * camera_forward.z;
+				const uint64_t quantized_depth = (uint64_t)std::clamp( depth * depth_scale, 0.0f, 65535.0f );
 
-			auto model_pose = SkeletonPose::ToModelSpace( std::move( pose ) );
-			SkeletonPose::ToMatrixPalette( model_pose, bones, out );
+				m_vSortKeys[i] = GetMeshSortKey( item.mesh ) | quantized_depth;
+				m_vSortedDraws[i] = (uint32_t)i;
+			}
+
+			RadixSort( m_vSortKeys.data(), m_vSortedDraws.data(), count, m_vScratchKeys.data(), m_vScratchDraws.data() );
+		}
+
+		void DrawOutlineBox( IGPUContext* pContext, const Camera& cam, const AABB& aabb, Mat4 world_transform )
+		{
+			AABB transformed_aabb = aabb.Transform( world_transform );
+			DebugDraw::Box( transformed_aabb.mins, transformed_aabb.maxs );
 		}
 	private:
 		struct CB_Bones
@@ -138,7 +212,23 @@ namespace Bat
 		ConstantBuffer<CB_Bones> m_cbufBones;
 
 		PbrGlobalMaps m_PbrMaps;
-		std::unordered_map<Mesh*, std::vector<LitGenericInstanceData>> m_mapInstancedMeshes;
+
+		// render queue, filled by Render and sorted/drawn in PostRender
+		struct DrawItem
+		{
+			Mesh* mesh;
+			Mat4 world;
+		};
+		// runs of the same mesh at least this long are drawn instanced
+		static constexpr size_t MIN_INSTANCED_RUN = 2;
+
+		std::vector<DrawItem> m_vDrawQueue;
+		std::vector<uint64_t> m_vSortKeys;
+		// indices into m_vDrawQueue in draw order
+		std::vector<uint32_t> m_vSortedDraws;
+		std::vector<uint64_t> m_vScratchKeys;
+		std::vector<uint32_t> m_vScratchDraws;
+		std::vector<LitGenericInstanceData> m_vInstances;
 		std::unique_ptr<ITexture> brdf_tex;
 	};
 }
\ No newline at end of file
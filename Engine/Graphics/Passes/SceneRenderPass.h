@@ -2,6 +2,7 @@
 
 #include "Core/Entity.h"
 #include "Core/CoreEntityComponents.h"
+#include "Core/Globals.h"
 #include "../IRenderPass.h"
 #include "../Model.h"
 #include "../RenderData.h"
@@ -10,12 +11,19 @@
 #include "../Material.h"
 #include "../ShaderManager.h"
 #include "../LitGenericPipeline.h"
+#include "../LightClusters.h"
 
 namespace Bat
 {
 	class SceneRenderPass : public BaseRenderPass
 	{
 	public:
+		virtual void Prepare( IGPUContext* pContext, Camera& camera, SceneNode& scene, RenderData& data ) override
+		{
+			// first scene pass of the frame uploads the lights, shadow maps have been assigned by now
+			data.GetLightClusters().Upload( pContext );
+		}
+
 		virtual void Execute( IGPUContext* pContext, Camera& camera, SceneNode& scene, RenderData& data ) override
 		{
 			m_pCamera = &camera;
@@ -24,8 +32,7 @@ namespace Bat
 				return;
 			}
 
-			m_Lights.clear();
-			m_LightTransforms.clear();
+			m_pLights = &data.GetLightClusters();
 
 			IRenderTarget* target = data.GetRenderTarget( "dst" );
 			pContext->SetRenderTarget( target );
@@ -34,53 +41,25 @@ namespace Bat
 			m_pContext->SetDepthEnabled( true );
 			pContext->SetBlendingEnabled( false );
 
-			TraverseLights();
-
 			PreRender( pContext, camera, data );
-			Traverse();
-			PostRender( pContext, camera, data );
-		}
-	private:
-		void TraverseLights()
-		{
-			for( Entity e : world )
+			for( const SceneVisibility::VisibleEntity& visible : data.GetVisibility().GetCameraVisible() )
 			{
-				if( e.Has<LightComponent>() )
-				{
-					auto& t = e.Get<TransformComponent>();
-					m_Lights.push_back( e );
-					m_LightTransforms.push_back( Mat4( t.LocalToWorldMatrix() ) );
-				}
+				Render( visible.transform, visible.entity, visible.fully_inside );
 			}
-		}
-
-		virtual void Visit( const Mat3x4& transform, Entity e ) override
-		{
-			Render( transform, e );
+			PostRender( pContext, camera, data );
 		}
 	protected:
 		virtual void PreRender( IGPUContext* pContext, Camera& camera, RenderData& data ) {};
-		virtual void Render( const Mat3x4& transform, Entity e ) = 0;
+		// Called for every model/particle emitter inside the camera frustum.
+		// fully_visible is set when the entity's bounds are entirely inside the frustum, so meshes don't need culling.
+		virtual void Render( const Mat3x4& transform, Entity e, bool fully_visible ) = 0;
 		virtual void PostRender( IGPUContext* pContext, Camera& camera, RenderData& data ) {};
 
 		IGPUContext* GetContext() { return m_pContext; }
 		Camera* GetCamera() { return m_pCamera; }
 
-		struct LightList
-		{
-			LightList( const std::vector<Entity>& lights, const std::vector<Mat4>& light_transforms )
-				:
-				entities( lights ),
-				transforms( light_transforms )
-			{}
-
-			const std::vector<Entity>& entities;
-			const std::vector<Mat4>& transforms;
-		};
-		LightList GetLights() const
-		{
-			return LightList( m_Lights, m_LightTransforms );
-		}
+		// Lights affecting the camera's view, binned into clusters
+		const LightClusters* GetLights() const { return m_pLights; }
 
 		// Helper function that checks if a mesh is contained inside the view frustum
 		// The transform matrix passed in gets applied to mesh before doing check
@@ -99,8 +78,7 @@ namespace Bat
 		}
 	private:
 		Camera* m_pCamera = nullptr;
-		std::vector<Entity> m_Lights;
-		std::vector<Mat4> m_LightTransforms;
+		const LightClusters* m_pLights = nullptr;
 		IGPUContext* m_pContext = nullptr;
 	};
 }
\ No newline at end of file
@@ -6,106 +6,139 @@
 
 namespace Bat
 {
+	// How the camera's view distance is split up between directional light cascades
+	enum class CascadeSplitScheme
+	{
+		UNIFORM,     // Equal depth ranges, wastes resolution near the camera
+		LOGARITHMIC, // Equal ratio between split distances, matches perspective aliasing but near cascades get tiny
+		PRACTICAL    // Blend of the two, lambda of 1 is fully logarithmic and 0 is fully uniform
+	};
+
 	class ShadowPass : public BaseRenderPass
 	{
 	public:
 		static constexpr int SHADOW_MAP_SIZE = 2048;
 		static constexpr int NUM_CASCADES = 3;
+		// Cascades of the first shadowed directional light keep their projection until the camera has moved this many
+		// texels, so their static casters can be reused instead of redrawn
+		static constexpr float CACHE_TEXEL_THRESHOLD = 32.0f;
 
 		ShadowPass()
 		{
 			m_pShadowMaps = std::unique_ptr<IDepthStencil>( gpu->CreateDepthStencil( SHADOW_MAP_SIZE, SHADOW_MAP_SIZE, TEX_FORMAT_R24G8_TYPELESS, MAX_SHADOW_SOURCES ) );
+			m_pStaticShadowMaps = std::unique_ptr<IDepthStencil>( gpu->CreateDepthStencil( SHADOW_MAP_SIZE, SHADOW_MAP_SIZE, TEX_FORMAT_R24G8_TYPELESS, NUM_CASCADES ) );
 		}
 
-		virtual void Execute( IGPUContext* pContext, Camera& camera, SceneNode& scene, RenderData& data ) override
+		// shadow_distance of 0 uses the camera's far plane
+		void SetCascadeSplits( CascadeSplitScheme scheme, float lambda = 0.9f, float shadow_distance = 0.0f )
 		{
-			m_pContext = pContext;
-
-			ComparisonFunc original_comp_func = pContext->GetDepthComparisonFunc();
-
-			pContext->SetRenderTarget( nullptr );
-			pContext->SetDepthEnabled( true );
-			pContext->SetDepthWriteEnabled( true );
-			pContext->SetDepthComparisonFunc( ComparisonFunc::GREATER );
-			pContext->SetDepthClipEnabled( false );
-			pContext->SetCullMode( CullMode::NONE );
-			pContext->SetBlendingEnabled( false );
-			pContext->UnbindTextureSlot( PS_TEX_SHADOWMAPS );
+			m_SplitScheme = scheme;
+			m_flSplitLambda = std::clamp( lambda, 0.0f, 1.0f );
+			m_flShadowDistance = shadow_distance;
+		}
+		CascadeSplitScheme GetCascadeSplitScheme() const { return m_SplitScheme; }
 
-			Viewport vp;
-			vp.width = SHADOW_MAP_SIZE;
-			vp.height = SHADOW_MAP_SIZE;
-			vp.min_depth = 0.0f;
-			vp.max_depth = 1.0f;
-			vp.top_left = { 0.0f, 0.0f };
-			pContext->PushViewport( vp );
+		// Models flagged RenderFlags::STATIC are drawn into a cached copy of each cascade that is only redrawn when
+		// the cascade's projection or the static casters in it change
+		void SetStaticCachingEnabled( bool enabled )
+		{
+			m_bCacheStaticCascades = enabled;
+			if( !enabled )
+			{
+				for( CascadeProjection& cached : m_CascadeProjections )
+				{
+					cached.valid = false;
+				}
+			}
+		}
+		bool IsStaticCachingEnabled() const { return m_bCacheStaticCascades; }
 
-			IDepthStencil* original_depth = pContext->GetDepthStencil();
+		virtual void Prepare( IGPUContext* pContext, Camera& camera, SceneNode& scene, RenderData& data ) override
+		{
+			// Lights are assigned their shadow maps here rather than in Execute, later passes read the
+			// shadow indices and Execute may be recording on another thread while they do
+			m_ShadowViews.clear();
 			CB_ShadowMatrices transforms;
-			size_t shadow_map_counter = 0;
+			bool cached_light_found = false;
 
-			for( Entity e : world )
+			for( auto [e, light, t] : world.View<LightComponent, TransformComponent>() )
 			{
-				if( e.Has<LightComponent>() )
+				light.SetShadowIndex( INVALID_SHADOW_MAP_INDEX );
+				
+				if( !light.IsEnabled() || light.GetType() == LightType::POINT )
 				{
-					auto& t = e.Get<TransformComponent>();
-					auto& light = e.Get<LightComponent>();
-					light.SetShadowIndex( INVALID_SHADOW_MAP_INDEX );
-					
-					if( !light.IsEnabled() || light.GetType() == LightType::POINT )
-					{
-						continue;
-					}
-					
-					if( !light.HasFlag( LightFlags::EMIT_SHADOWS ) )
-					{
-						continue;
-					}
+					continue;
+				}
+				
+				if( !light.HasFlag( LightFlags::EMIT_SHADOWS ) )
+				{
+					continue;
+				}
 
-					switch( light.GetType() )
-					{
-					case LightType::DIRECTIONAL:
-					{
-						Mat4 rot = Mat4::RotateDeg( t.GetRotation() );
-						Vec3 up = Mat4::TransformNormal( rot, { 0.0f, 1.0f, 0.0f } );
-						Vec3 to = Mat4::TransformNormal( rot, { 0.0f, 0.0f, 1.0f } );
+				switch( light.GetType() )
+				{
+				case LightType::DIRECTIONAL:
+				{
+					Mat4 rot = Mat4::RotateDeg( t.GetRotation() );
+					Vec3 up = Mat4::TransformNormal( rot, { 0.0f, 1.0f, 0.0f } );
+					Vec3 to = Mat4::TransformNormal( rot, { 0.0f, 0.0f, 1.0f } );
 
-						Vec3 frustum_corners[8];
-						camera.CalculateFrustumCorners( frustum_corners );
+					Vec3 frustum_corners[8];
+					camera.CalculateFrustumCorners( frustum_corners );
 
-						light.SetShadowIndex( shadow_map_counter );
+					light.SetShadowIndex( m_ShadowViews.size() );
 
-						float splits[NUM_CASCADES + 1] = {
-							0.0f,
-							0.01f,
-							0.1f,
-							1.0f
-						};
+					// only the first shadowed directional light gets its static casters cached
+					const bool cache_static = m_bCacheStaticCascades && !cached_light_found;
+					cached_light_found = true;
 
-						for( int cascade = 0; cascade < NUM_CASCADES; cascade++ )
+					float splits[NUM_CASCADES + 1];
+					CalculateCascadeSplits( camera.GetNear(), camera.GetFar(), splits );
+
+					for( int cascade = 0; cascade < NUM_CASCADES; cascade++ )
+					{
+						Vec3 cascade_centre = { 0.0f, 0.0f, 0.0f };
+						Vec3 cascade_corners[8];
+						for( int i = 0; i < 8; i++ )
 						{
-							Vec3 cascade_centre = { 0.0f, 0.0f, 0.0f };
-							Vec3 cascade_corners[8];
-							for( int i = 0; i < 8; i++ )
-							{
-								// First 4 corners are near plane, next 4 are the adjacent far plane corners
-								// Lerp between the 2 corners to generate a split
+							// First 4 corners are near plane, next 4 are the adjacent far plane corners
+							// Lerp between the 2 corners to generate a split
 
-								Vec3 near_corner = frustum_corners[i % 4];
-								Vec3 far_corner = frustum_corners[(i % 4) + 4];
+							Vec3 near_corner = frustum_corners[i % 4];
+							Vec3 far_corner = frustum_corners[(i % 4) + 4];
 
-								cascade_corners[i] = Vec3::Lerp( near_corner, far_corner, splits[cascade + i/4] );
-								cascade_centre += cascade_corners[i];
-							}
-							cascade_centre /= 8.0f;
+							cascade_corners[i] = Vec3::Lerp( near_corner, far_corner, splits[cascade + i/4] );
+							cascade_centre += cascade_corners[i];
+						}
+						cascade_centre /= 8.0f;
 
-							float radius = 0.0f;
-							for( int i = 0; i < 8; i++ )
-							{
-								float dist = ( cascade_corners[i] - cascade_centre ).Length();
-								radius = std::max( dist, radius );
-							}
+						float radius = 0.0f;
+						for( int i = 0; i < 8; i++ )
+						{
+							float dist = ( cascade_corners[i] - cascade_centre ).Length();
+							radius = std::max( dist, radius );
+						}
+
+						// Padded so a cascade that moved less than the cache threshold still covers its slice of the view
+						radius += CACHE_TEXEL_THRESHOLD * ( 2.0f * radius / SHADOW_MAP_SIZE );
+
+						ShadowView shadow_view;
+						shadow_view.cull = true;
+						shadow_view.cache_slice = cache_static ? cascade : NO_CACHE;
+						shadow_view.cache_reused = false;
 
+						CascadeProjection& cached = m_CascadeProjections[cascade];
+						const float texel_size = 2.0f * radius / SHADOW_MAP_SIZE;
+						if( cache_static && cached.valid &&
+							cached.to == to && cached.up == up && std::abs( cached.radius - radius ) <= 0.5f * texel_size &&
+							( cascade_centre - cached.centre ).Length() <= CACHE_TEXEL_THRESHOLD * texel_size )
+						{
+							// keep the projection the static casters were rendered with
+							shadow_view.viewproj = cached.viewproj;
+							shadow_view.cache_reused = true;
+						}
+						else
+						{
 							Vec3 maxs = { radius, radius, radius };
 							Vec3 mins = -maxs;
 
@@ -118,56 +151,177 @@ namespace Bat
 
 							Mat4 view = Mat4::LookAt( cascade_camera_pos, cascade_centre, up );
 							Mat4 proj = Mat4::OrthoOffCentre( mins.x, maxs.x, mins.y, maxs.y, extents.z, 0.0f );
+							shadow_view.viewproj = view * proj;
 
-							m_matLightViewProj = view * proj;
-							m_bLightCull = false;
-							transforms.shadow[shadow_map_counter++] = m_matLightViewProj;
-
-							pContext->ClearDepthStencil( m_pShadowMaps.get(), CLEAR_FLAG_DEPTH, 0.0f, 0, light.GetShadowIndex() + cascade );
-							pContext->SetDepthStencil( m_pShadowMaps.get(), light.GetShadowIndex() + cascade );
+							if( cache_static )
+							{
+								cached.valid = true;
+								cached.to = to;
+								cached.up = up;
+								cached.centre = cascade_centre;
+								cached.radius = radius;
+								cached.viewproj = shadow_view.viewproj;
+							}
+						}
 
-							Traverse();
+						// Casters between the light and the cascade still cast into it, so the side facing the light
+						// is pushed out to infinity and only the sides and far end cull. The side planes are parallel
+						// to the light, only rounding makes their dot non-zero, so compare against a real threshold.
+						shadow_view.frustum = Frustum( shadow_view.viewproj );
+						for( Plane& plane : shadow_view.frustum.planes )
+						{
+							if( Vec3::Dot( plane.n, to ) > 0.5f )
+							{
+								plane.n = { 0.0f, 0.0f, 0.0f };
+								plane.d = 0.0f;
+							}
 						}
-						
-						break;
+
+						transforms.shadow[m_ShadowViews.size()] = shadow_view.viewproj;
+						m_ShadowViews.push_back( shadow_view );
 					}
-					case LightType::SPOT:
+					
+					break;
+				}
+				case LightType::SPOT:
+				{
+					Camera spot_cam( t.GetPosition(),
+						t.GetRotation(),
+						Math::RadToDeg( light.GetSpotlightAngle() * 2 ),
+						1.0f,
+						light.GetRange(),
+						0.1f);
+
+					Mat4 view = spot_cam.GetViewMatrix();
+					Mat4 proj = spot_cam.GetProjectionMatrix();
+
+					ShadowView shadow_view;
+					shadow_view.viewproj = view * proj;
+
+					// View frustum culling
+					Vec3 light_corners[8];
+					Frustum::CalculateCorners( shadow_view.viewproj, light_corners );
+					AABB light_aabb( light_corners, 8 );
+					if( !camera.GetFrustum().IsBoxInside( light_aabb.mins, light_aabb.maxs ) )
 					{
-						Camera spot_cam( t.GetPosition(),
-							t.GetRotation(),
-							Math::RadToDeg( light.GetSpotlightAngle() * 2 ),
-							1.0f,
-							light.GetRange(),
-							0.1f);
-
-						Mat4 view = spot_cam.GetViewMatrix();
-						Mat4 proj = spot_cam.GetProjectionMatrix();
-						m_matLightViewProj = view * proj;
-
-						// View frustum culling
-						Vec3 light_corners[8];
-						Frustum::CalculateCorners( m_matLightViewProj, light_corners );
-						AABB light_aabb( light_corners, 8 );
-						if( !camera.GetFrustum().IsBoxInside( light_aabb.mins, light_aabb.maxs ) )
-						{
-							continue;
-						}
+						continue;
+					}
+
+					shadow_view.frustum = Frustum( shadow_view.viewproj );
+					shadow_view.cull = true;
+					shadow_view.cache_slice = NO_CACHE;
+					shadow_view.cache_reused = false;
+
+					light.SetShadowIndex( m_ShadowViews.size() );
+					transforms.shadow[light.GetShadowIndex()] = shadow_view.viewproj;
+					m_ShadowViews.push_back( shadow_view );
+
+					break;
+				}
+				}
+			}
+
+			m_cbufShadowMatrices.Update( pContext, transforms );
+			pContext->SetConstantBuffer( ShaderType::PIXEL, m_cbufShadowMatrices, PS_CBUF_SHADOWMATRICES );
+			pContext->BindTexture( m_pShadowMaps.get(), PS_TEX_SHADOWMAPS );
+		}
 
-						m_LightFrustum = Frustum( m_matLightViewProj );
-						m_bLightCull = true;
+		virtual void Execute( IGPUContext* pContext, Camera& camera, SceneNode& scene, RenderData& data ) override
+		{
+			m_pContext = pContext;
+
+			ComparisonFunc original_comp_func = pContext->GetDepthComparisonFunc();
+
+			pContext->SetRenderTarget( nullptr );
+			pContext->SetDepthEnabled( true );
+			pContext->SetDepthWriteEnabled( true );
+			pContext->SetDepthComparisonFunc( ComparisonFunc::GREATER );
+			pContext->SetDepthClipEnabled( false );
+			pContext->SetCullMode( CullMode::NONE );
+			pContext->SetBlendingEnabled( false );
+			pContext->UnbindTextureSlot( PS_TEX_SHADOWMAPS );
+
+			Viewport vp;
+			vp.width = SHADOW_MAP_SIZE;
+			vp.height = SHADOW_MAP_SIZE;
+			vp.min_depth = 0.0f;
+			vp.max_depth = 1.0f;
+			vp.top_left = { 0.0f, 0.0f };
+			pContext->PushViewport( vp );
 
-						light.SetShadowIndex( shadow_map_counter++ );
-						transforms.shadow[light.GetShadowIndex()] = m_matLightViewProj;
+			IDepthStencil* original_depth = pContext->GetDepthStencil();
 
-						pContext->ClearDepthStencil( m_pShadowMaps.get(), CLEAR_FLAG_DEPTH, 0.0f, 0, light.GetShadowIndex() );
-						pContext->SetDepthStencil( m_pShadowMaps.get(), light.GetShadowIndex() );
+			for( size_t i = 0; i < m_ShadowViews.size(); i++ )
+			{
+				const ShadowView& shadow_view = m_ShadowViews[i];
+				m_matLightViewProj = shadow_view.viewproj;
+				m_LightFrustum = shadow_view.frustum;
+				m_bLightCull = shadow_view.cull;
+
+				// spot lights cull the scene hierarchy against their frustum, cascades cover the whole view so get everything
+				m_ShadowCasters.clear();
+				if( m_bLightCull )
+				{
+					data.GetVisibility().Cull( m_LightFrustum, m_ShadowCasters );
+				}
+				else
+				{
+					data.GetVisibility().GetAll( m_ShadowCasters );
+				}
 
-						Traverse();
+				if( shadow_view.cache_slice == NO_CACHE )
+				{
+					pContext->ClearDepthStencil( m_pShadowMaps.get(), CLEAR_FLAG_DEPTH, 0.0f, 0, i );
+					pContext->SetDepthStencil( m_pShadowMaps.get(), i );
+
+					for( const SceneVisibility::VisibleEntity& caster : m_ShadowCasters )
+					{
+						RenderCaster( caster.transform, caster.entity, caster.fully_inside );
+					}
+					continue;
+				}
 
-						break;
+				// Static casters come from the cached slice when nothing about them changed, only dynamic ones get drawn on top
+				m_StaticCasters.clear();
+				m_DynamicCasters.clear();
+				for( const SceneVisibility::VisibleEntity& caster : m_ShadowCasters )
+				{
+					if( IsStaticCaster( caster.entity ) )
+					{
+						m_StaticCasters.push_back( caster );
 					}
+					else
+					{
+						m_DynamicCasters.push_back( caster );
 					}
 				}
+
+				const int slice = shadow_view.cache_slice;
+				const uint64_t static_hash = HashCasters( m_StaticCasters );
+				if( !shadow_view.cache_reused || !m_bStaticCacheValid[slice] || m_iStaticCasterHashes[slice] != static_hash )
+				{
+					pContext->ClearDepthStencil( m_pShadowMaps.get(), CLEAR_FLAG_DEPTH, 0.0f, 0, i );
+					pContext->SetDepthStencil( m_pShadowMaps.get(), i );
+
+					for( const SceneVisibility::VisibleEntity& caster : m_StaticCasters )
+					{
+						RenderCaster( caster.transform, caster.entity, caster.fully_inside );
+					}
+
+					pContext->CopyDepthStencil( m_pStaticShadowMaps.get(), slice, m_pShadowMaps.get(), i );
+					m_iStaticCasterHashes[slice] = static_hash;
+					m_bStaticCacheValid[slice] = true;
+				}
+				else
+				{
+					pContext->CopyDepthStencil( m_pShadowMaps.get(), i, m_pStaticShadowMaps.get(), slice );
+					pContext->SetDepthStencil( m_pShadowMaps.get(), i );
+				}
+
+				for( const SceneVisibility::VisibleEntity& caster : m_DynamicCasters )
+				{
+					RenderCaster( caster.transform, caster.entity, caster.fully_inside );
+				}
 			}
 
 			pContext->SetCullMode( CullMode::BACK );
@@ -176,20 +330,87 @@ namespace Bat
 			pContext->SetDepthStencil( original_depth );
 			pContext->PopViewport();
 
-			m_cbufShadowMatrices.Update( pContext, transforms );
 			pContext->SetConstantBuffer( ShaderType::PIXEL, m_cbufShadowMatrices, PS_CBUF_SHADOWMATRICES );
 			pContext->BindTexture( m_pShadowMaps.get(), PS_TEX_SHADOWMAPS );
 		}
+
+		virtual bool CanRecordInParallel() const override { return true; }
 	private:
-		virtual void Visit( const Mat3x4& transform, Entity e ) override
+		// Fills splits with NUM_CASCADES + 1 fractions of the way between the camera's near and far planes
+		void CalculateCascadeSplits( float near_z, float far_z, float splits[NUM_CASCADES + 1] ) const
+		{
+			const float shadow_far = ( m_flShadowDistance > 0.0f ) ? std::min( m_flShadowDistance, far_z ) : far_z;
+			const float range = far_z - near_z;
+
+			splits[0] = 0.0f;
+			for( int i = 1; i <= NUM_CASCADES; i++ )
+			{
+				const float p = (float)i / NUM_CASCADES;
+				const float uniform_split = near_z + ( shadow_far - near_z ) * p;
+				const float log_near = std::max( near_z, 0.001f );
+				const float log_split = log_near * std::pow( shadow_far / log_near, p );
+
+				float split;
+				switch( m_SplitScheme )
+				{
+				case CascadeSplitScheme::UNIFORM:
+					split = uniform_split;
+					break;
+				case CascadeSplitScheme::LOGARITHMIC:
+					split = log_split;
+					break;
+				default:
+					split = m_flSplitLambda * log_split + ( 1.0f - m_flSplitLambda ) * uniform_split;
+					break;
+				}
+
+				splits[i] = ( split - near_z ) / range;
+			}
+		}
+
+		bool IsStaticCaster( Entity e ) const
+		{
+			if( e.Has<AnimationComponent>() || !e.Has<ModelComponent>() )
+			{
+				return false;
+			}
+
+			return e.Get<ModelComponent>().HasRenderFlag( RenderFlags::STATIC );
+		}
+
+		// FNV-1a over the ids and transforms of the casters, any static caster moving, appearing or leaving changes it
+		static uint64_t HashCasters( const std::vector<SceneVisibility::VisibleEntity>& casters )
+		{
+			uint64_t hash = 14695981039346656037ull;
+			auto hash_bytes = [&hash]( const void* data, size_t size )
+			{
+				const uint8_t* bytes = (const uint8_t*)data;
+				for( size_t i = 0; i < size; i++ )
+				{
+					hash ^= bytes[i];
+					hash *= 1099511628211ull;
+				}
+			};
+
+			for( const SceneVisibility::VisibleEntity& caster : casters )
+			{
+				const uint64_t id = caster.entity.GetId().Raw();
+				hash_bytes( &id, sizeof( id ) );
+				hash_bytes( &caster.transform, sizeof( caster.transform ) );
+			}
+
+			return hash;
+		}
+
+		void RenderCaster( const Mat3x4& transform, Entity e, bool fully_visible )
 		{
 			if( e.Has<AnimationComponent>() )
 			{
 				auto& anim = e.Get<AnimationComponent>();
 
+				// palette is built by the animation system
 				Mat4* cbuf = m_cbufBones.Lock( m_pContext )->bone_transforms;
-
-				GetMatrixPalette( cbuf, anim.bones, anim.current_pose );
+				std::copy( anim.matrix_palette.begin(), anim.matrix_palette.end(), cbuf );
 
 				m_cbufBones.Unlock( m_pContext );
 
@@ -219,7 +440,7 @@ namespace Bat
 						continue;
 					}
 
-					if( m_bLightCull && !MeshInLightFrustum( pMesh.get(), w ) )
+					if( m_bLightCull && !fully_visible && !MeshInLightFrustum( pMesh.get(), w ) )
 					{
 						continue;
 					}
@@ -230,14 +451,6 @@ namespace Bat
 			}
 		}
 
-		void GetMatrixPalette( Mat4* out, const std::vector<BoneData>& bones, SkeletonPose pose ) const
-		{
-			ASSERT( bones.size() <= MAX_BONES, "Too many bones!" );
-
-			auto model_pose = SkeletonPose::ToModelSpace( std::move( pose ) );
-			SkeletonPose::ToMatrixPalette( model_pose, bones, out );
-		}
-
 		bool MeshInLightFrustum( Mesh* pMesh, Mat4 transform )
 		{
 			const AABB& aabb = pMesh->GetAABB();
@@ -252,6 +465,45 @@ namespace Bat
 			return true;
 		}
 	private:
+		// One shadow map (array slice) to render, index in m_ShadowViews is the slice index
+		static constexpr int NO_CACHE = -1;
+		struct ShadowView
+		{
+			Mat4 viewproj;
+			Frustum frustum;
+			bool cull;
+			// slice of m_pStaticShadowMaps holding this view's static casters, or NO_CACHE
+			int cache_slice;
+			// viewproj is the one the cached slice was rendered with
+			bool cache_reused;
+		};
+		std::vector<ShadowView> m_ShadowViews;
+		std::vector<SceneVisibility::VisibleEntity> m_ShadowCasters;
+		std::vector<SceneVisibility::VisibleEntity> m_StaticCasters;
+		std::vector<SceneVisibility::VisibleEntity> m_DynamicCasters;
+
+		// cascade splits
+		CascadeSplitScheme m_SplitScheme = CascadeSplitScheme::PRACTICAL;
+		float m_flSplitLambda = 0.9f;
+		float m_flShadowDistance = 0.0f;
+
+		// static cascade cache, written in Prepare and read in Execute
+		struct CascadeProjection
+		{
+			bool valid = false;
+			Vec3 to;
+			Vec3 up;
+			Vec3 centre;
+			float radius;
+			Mat4 viewproj;
+		};
+		bool m_bCacheStaticCascades = true;
+		CascadeProjection m_CascadeProjections[NUM_CASCADES];
+		// only touched in Execute
+		bool m_bStaticCacheValid[NUM_CASCADES] = {};
+		uint64_t m_iStaticCasterHashes[NUM_CASCADES] = {};
+		std::unique_ptr<IDepthStencil> m_pStaticShadowMaps;
+
 		IGPUContext* m_pContext;
 		Mat4 m_matLightViewProj;
 		Frustum m_LightFrustum;
@@ -46,12 +46,12 @@ namespace Bat
 			m_PbrMaps.brdf_integration_map = data.GetTexture( "brdf" );
 		}
 
-		virtual void Render( const Mat3x4& transform, Entity e ) override
+		virtual void Render( const Mat3x4& transform, Entity e, bool fully_visible ) override
 		{
 			if( e.Has<ModelComponent>() )
 			{
 				const auto& model = e.Get<ModelComponent>();
-				RenderModel( model, transform );
+				RenderModel( model, transform, fully_visible );
 			}
 			if( e.Has<ParticleEmitterComponent>() )
 			{
@@ -60,7 +60,7 @@ namespace Bat
 			}
 		}
 
-		void RenderModel( const ModelComponent& model, const Mat3x4& transform )
+		void RenderModel( const ModelComponent& model, const Mat3x4& transform, bool fully_visible )
 		{
 			Camera* pCamera = GetCamera();
 
@@ -74,7 +74,7 @@ namespace Bat
 					continue;
 				}
 
-				if( !MeshInCameraFrustum( pMesh.get(), pCamera, w ) )
+				if( !fully_visible && !MeshInCameraFrustum( pMesh.get(), pCamera, w ) )
 				{
 					continue;
 				}
@@ -136,12 +136,12 @@ namespace Bat
 			} );
 
 			// Render the sorted meshes
-			LightList light_list = SceneRenderPass::GetLights();
+			const LightClusters* pLights = SceneRenderPass::GetLights();
 			auto pPipeline = ShaderManager::GetPipeline<LitGenericPipeline>();
 
 			for( const TranslucentMesh& translucent_mesh : m_TranslucentMeshes )
 			{
-				pPipeline->Render( pContext, *translucent_mesh.mesh, camera, translucent_mesh.world_transform, light_list.entities, light_list.transforms, m_PbrMaps );
+				pPipeline->Render( pContext, *translucent_mesh.mesh, camera, translucent_mesh.world_transform, pLights, m_PbrMaps );
 			}
 		}
 	private:
@@ -6,17 +6,27 @@ namespace Bat
 #define RENDER_NODE_DATATYPE( type, name, capname ) \
 	type* RenderData::Get##name( const std::string& resource_name ) \
 	{ \
-		auto it = m_map##name.find( resource_name ); \
-		if( it != m_map##name.end() ) \
+		for( const auto& [node_name, pResource] : m_v##name ) \
 		{ \
-			return it->second; \
+			if( node_name == resource_name ) \
+			{ \
+				return pResource; \
+			} \
 		} \
 		return nullptr; \
 	} \
 	\
 	void RenderData::Add##name( const std::string& resource_name, type* pResource ) \
 	{ \
-		m_map##name[resource_name] = pResource; \
+		for( auto& [node_name, pExisting] : m_v##name ) \
+		{ \
+			if( node_name == resource_name ) \
+			{ \
+				pExisting = pResource; \
+				return; \
+			} \
+		} \
+		m_v##name.emplace_back( resource_name, pResource ); \
 	}
 #include "RenderNodeDataTypes.def"
 }
@@ -1,12 +1,17 @@
 #pragma once
 
 #include <string>
-#include <unordered_map>
+#include <utility>
+#include <vector>
 #include "IGPUDevice.h"
 #include "Camera.h"
+#include "SceneVisibility.h"
+#include "LightClusters.h"
 
 namespace Bat
 {
+	// Resources bound to a pass's nodes. Filled in once when the render graph is compiled, a pass only has a handful
+	// of nodes so lookups are a linear search rather than a hash
 	class RenderData
 	{
 		friend class RenderGraph;
@@ -15,14 +20,22 @@ namespace Bat
 		type* Get##name( const std::string& resource_name ); \
 		void Add##name( const std::string& resource_name, type* pResource ); \
 	private: \
-		std::unordered_map<std::string, type*> m_map##name;
+		std::vector<std::pair<std::string, type*>> m_v##name;
 #include "RenderNodeDataTypes.def"
 	public:
+		// Scene visible from the camera being rendered, shared by every pass
+		const SceneVisibility& GetVisibility() const { return *m_pVisibility; }
+		// Lights affecting the camera being rendered, binned into clusters once per frame
+		LightClusters& GetLightClusters() { return *m_pLightClusters; }
+
 		void Clear()
 		{
 #define RENDER_NODE_DATATYPE( type, name, capname ) \
-			m_map##name##.clear();
+			m_v##name.clear();
 #include "RenderNodeDataTypes.def"
 		}
+	private:
+		const SceneVisibility* m_pVisibility = nullptr;
+		LightClusters* m_pLightClusters = nullptr;
 	};
 }
\ No newline at end of file
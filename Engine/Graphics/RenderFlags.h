@@ -7,9 +7,10 @@ namespace Bat
 	enum class RenderFlags
 	{
 		NONE = 0,
-		DRAW_BBOX, // Draws a bounding box around the entity's model
-		INSTANCED, // Draws all instances of mesh in a single draw call
-		NO_SHADOW  // Does not create shadows
+		DRAW_BBOX = ( 1 << 0 ), // Draws a bounding box around the entity's model
+		INSTANCED = ( 1 << 1 ), // Draws all instances of mesh in a single draw call
+		NO_SHADOW = ( 1 << 2 ), // Does not create shadows
+		STATIC    = ( 1 << 3 )  // Rarely moves, shadows can be cached
 	};
 	BAT_ENUM_OPERATORS( RenderFlags );
 }
\ No newline at end of file
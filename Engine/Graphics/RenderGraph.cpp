@@ -1,7 +1,11 @@
 #include "PCH.h"
 #include "RenderGraph.h"
 
+#include <queue>
+
 #include "IRenderPass.h"
+#include "Util/FrameAllocator.h"
+#include "Util/JobSystem.h"
 
 namespace Bat
 {
@@ -12,6 +16,10 @@ namespace Bat
 		m_vRenderPasses.emplace_back( std::move( pass ) );
 		m_vNodeAndResourceBindings.emplace_back();
 		m_vPassEnabled.emplace_back( true );
+		m_vRenderData.emplace_back();
+		m_vDeferredContexts.emplace_back();
+		m_vCommandLists.emplace_back();
+		m_bDirty = true;
 	}
 
 	size_t RenderGraph::GetPassCount() const
@@ -68,7 +76,11 @@ namespace Bat
 
 	void RenderGraph::SetPassEnabled( size_t idx, bool enabled )
 	{
-		m_vPassEnabled[idx] = enabled;
+		if( m_vPassEnabled[idx] != enabled )
+		{
+			m_vPassEnabled[idx] = enabled;
+			m_bDirty = true;
+		}
 	}
 
 #define RENDER_NODE_DATATYPE( type, name, capname ) \
@@ -77,15 +89,27 @@ namespace Bat
 		ASSERT( GetResourceType( resource_name ) == NodeDataType::INVALID, "Resource added twice" ); \
 		m_mapOwning##name[resource_name] = std::move( pResource ); \
 		m_mapResourceTypes[resource_name] = NodeDataType::capname; \
+		m_bDirty = true; \
 	} \
 	void RenderGraph::Add##name##Resource( const std::string& resource_name, type* pResource ) \
 	{ \
 		ASSERT( GetResourceType( resource_name ) == NodeDataType::INVALID, "Resource added twice" ); \
 		m_mapNonOwning##name[resource_name] = pResource; \
 		m_mapResourceTypes[resource_name] = NodeDataType::capname; \
+		m_bDirty = true; \
 	}
 #include "RenderNodeDataTypes.def"
 
+	void RenderGraph::AddTransientRenderTargetResource( const std::string& resource_name, const RenderTargetDesc& desc )
+	{
+		ASSERT( GetResourceType( resource_name ) == NodeDataType::INVALID, "Resource added twice" );
+		m_mapTransientDescs[resource_name] = desc;
+		// allocated by Compile
+		m_mapNonOwningRenderTarget[resource_name] = nullptr;
+		m_mapResourceTypes[resource_name] = NodeDataType::RENDER_TARGET;
+		m_bDirty = true;
+	}
+
 	void RenderGraph::BindToResource( const std::string& node_name, const std::string& resource )
 	{
 		std::optional<Node_t> node = CreateNodeFromString( node_name );
@@ -115,6 +139,7 @@ namespace Bat
 		nar.node = *node;
 		nar.resource = resource;
 		m_vNodeAndResourceBindings[node->pass_idx].emplace_back( nar );
+		m_bDirty = true;
 	}
 
 	void RenderGraph::MarkOutput( const std::string& out )
@@ -126,16 +151,140 @@ namespace Bat
 			ASSERT( false, "" );
 			return;
 		}
+		m_bDirty = true;
 	}
 
-	void RenderGraph::Render( Camera& camera, SceneNode& scene, IRenderTarget* target )
+	bool RenderGraph::Compile()
 	{
-		if( !m_OutputNode )
+		m_bDirty = false;
+		m_vExecutionOrder.clear();
+		m_vPassLive.assign( m_vRenderPasses.size(), false );
+
+		if( !m_OutputNode || !IsPassEnabled( m_OutputNode->pass_idx ) )
 		{
 			ASSERT( false, "Render graph has no output node" );
-			return;
+			return false;
+		}
+
+		// String bindings are resolved to handles once here, nothing after compiling looks up a resource by name
+		std::unordered_map<std::string, ResourceHandle> handles;
+		for( const auto& [name, type] : m_mapResourceTypes )
+		{
+			handles.emplace( name, handles.size() );
+		}
+
+		struct ResourceAccesses
+		{
+			int first_writer = -1;
+			int last_writer = -1;
+			// passes that read the current version, the next writer has to wait for them
+			std::vector<size_t> readers;
+			// passes that read the resource before any pass declared before them wrote it
+			std::vector<size_t> early_readers;
+		};
+		std::vector<ResourceAccesses> accesses( handles.size() );
+
+		std::vector<std::vector<PassEdge>> dependencies( m_vRenderPasses.size() );
+		std::vector<std::vector<ResourceHandle>> pass_resources( m_vRenderPasses.size() );
+
+		auto add_dependency = [&]( size_t pass_idx, size_t on, bool producer )
+		{
+			if( pass_idx != on )
+			{
+				dependencies[pass_idx].push_back( { on, producer } );
+			}
+		};
+
+		for( size_t i = 0; i < m_vRenderPasses.size(); i++ )
+		{
+			if( !IsPassEnabled( i ) )
+			{
+				continue;
+			}
+
+			IRenderPass* pPass = m_vRenderPasses[i].get();
+			for( const NodeAndResource& nar : m_vNodeAndResourceBindings[i] )
+			{
+				auto it = handles.find( nar.resource );
+				if( it == handles.end() )
+				{
+					continue;
+				}
+
+				const ResourceHandle handle = it->second;
+				ResourceAccesses& resource = accesses[handle];
+				pass_resources[i].push_back( handle );
+
+				// passes clear and draw into their input render targets, so only texture inputs are pure reads
+				const NodeDataType datatype = pPass->GetNodeDataType( nar.node.name );
+				const bool write = pPass->GetNodeType( nar.node.name ) == NodeType::OUTPUT ||
+					datatype == NodeDataType::RENDER_TARGET ||
+					datatype == NodeDataType::DEPTH_STENCIL;
+
+				if( write )
+				{
+					if( resource.last_writer != -1 )
+					{
+						add_dependency( i, (size_t)resource.last_writer, true );
+					}
+					for( size_t reader : resource.readers )
+					{
+						add_dependency( i, reader, false );
+					}
+					resource.readers.clear();
+
+					resource.last_writer = (int)i;
+					if( resource.first_writer == -1 )
+					{
+						resource.first_writer = (int)i;
+					}
+				}
+				else if( resource.last_writer != -1 )
+				{
+					add_dependency( i, (size_t)resource.last_writer, true );
+					resource.readers.push_back( i );
+				}
+				else
+				{
+					resource.early_readers.push_back( i );
+				}
+			}
+		}
+
+		// Consumers declared before their producer
+		for( const ResourceAccesses& resource : accesses )
+		{
+			if( resource.first_writer == -1 )
+			{
+				continue;
+			}
+
+			for( size_t reader : resource.early_readers )
+			{
+				add_dependency( reader, (size_t)resource.first_writer, true );
+			}
 		}
 
+		CullPasses( dependencies );
+		const bool sorted = SortPasses( dependencies );
+		AllocateTransientResources( pass_resources, handles );
+		BuildRenderData();
+
+		BAT_TRACE( "Compiled render graph, %i/%i passes live, %i transient render target allocations",
+			(int)m_vExecutionOrder.size(), (int)m_vRenderPasses.size(), (int)m_vTransientAllocations.size() );
+
+		return sorted;
+	}
+
+	const std::vector<size_t>& RenderGraph::GetExecutionOrder() const
+	{
+		return m_vExecutionOrder;
+	}
+
+	void RenderGraph::CullPasses( const std::vector<std::vector<PassEdge>>& dependencies )
+	{
+		// Walk back from the output and from passes with unknown side effects, keeping everything that produces what they read
+		std::vector<size_t> stack;
 		for( size_t i = 0; i < m_vRenderPasses.size(); i++ )
 		{
 			if( !IsPassEnabled( i ) )
@@ -143,29 +292,224 @@ namespace Bat
 				continue;
 			}
 
-			m_RenderData.Clear();
+			bool has_outputs = false;
+			for( const RenderNode& node : m_vRenderPasses[i]->GetNodes() )
+			{
+				if( node.type == NodeType::OUTPUT )
+				{
+					has_outputs = true;
+					break;
+				}
+			}
+
+			if( !has_outputs || i == (size_t)m_OutputNode->pass_idx )
+			{
+				m_vPassLive[i] = true;
+				stack.push_back( i );
+			}
+		}
+
+		while( !stack.empty() )
+		{
+			size_t pass_idx = stack.back();
+			stack.pop_back();
+
+			for( const PassEdge& edge : dependencies[pass_idx] )
+			{
+				if( edge.producer && !m_vPassLive[edge.pass_idx] )
+				{
+					m_vPassLive[edge.pass_idx] = true;
+					stack.push_back( edge.pass_idx );
+				}
+			}
+		}
+	}
+
+	bool RenderGraph::SortPasses( const std::vector<std::vector<PassEdge>>& dependencies )
+	{
+		const size_t num_passes = m_vRenderPasses.size();
+
+		std::vector<std::vector<size_t>> dependents( num_passes );
+		std::vector<size_t> num_dependencies( num_passes, 0 );
+		size_t num_live = 0;
+		for( size_t i = 0; i < num_passes; i++ )
+		{
+			if( !m_vPassLive[i] )
+			{
+				continue;
+			}
+
+			num_live++;
+			for( const PassEdge& edge : dependencies[i] )
+			{
+				// a culled reader doesn't hold back the next writer
+				if( m_vPassLive[edge.pass_idx] )
+				{
+					dependents[edge.pass_idx].push_back( i );
+					num_dependencies[i]++;
+				}
+			}
+		}
+
+		// Kahn's algorithm, always picking the earliest declared pass so independent passes keep the order they were added in
+		std::priority_queue<size_t, std::vector<size_t>, std::greater<size_t>> ready;
+		for( size_t i = 0; i < num_passes; i++ )
+		{
+			if( m_vPassLive[i] && !num_dependencies[i] )
+			{
+				ready.push( i );
+			}
+		}
+
+		while( !ready.empty() )
+		{
+			size_t pass_idx = ready.top();
+			ready.pop();
+			m_vExecutionOrder.push_back( pass_idx );
+
+			for( size_t dependent : dependents[pass_idx] )
+			{
+				if( --num_dependencies[dependent] == 0 )
+				{
+					ready.push( dependent );
+				}
+			}
+		}
+
+		if( m_vExecutionOrder.size() != num_live )
+		{
+			BAT_ERROR( "Render graph has a dependency cycle, running passes in the order they were added" );
+			m_vExecutionOrder.clear();
+			for( size_t i = 0; i < num_passes; i++ )
+			{
+				if( m_vPassLive[i] )
+				{
+					m_vExecutionOrder.push_back( i );
+				}
+			}
+			return false;
+		}
+
+		return true;
+	}
+
+	void RenderGraph::AllocateTransientResources( const std::vector<std::vector<ResourceHandle>>& pass_resources,
+		const std::unordered_map<std::string, ResourceHandle>& handles )
+	{
+		if( m_mapTransientDescs.empty() )
+		{
+			return;
+		}
+
+		// Lifetime of every transient in execution order
+		constexpr size_t UNUSED = SIZE_MAX;
+		std::vector<std::pair<size_t, size_t>> lifetimes( handles.size(), { UNUSED, 0 } );
+		for( size_t order = 0; order < m_vExecutionOrder.size(); order++ )
+		{
+			for( ResourceHandle handle : pass_resources[m_vExecutionOrder[order]] )
+			{
+				auto& [first_use, last_use] = lifetimes[handle];
+				first_use = std::min( first_use, order );
+				last_use = std::max( last_use, order );
+			}
+		}
+
+		struct TransientUse
+		{
+			const std::string* name;
+			const RenderTargetDesc* desc;
+			size_t first_use;
+			size_t last_use;
+		};
+		std::vector<TransientUse> transients;
+		for( const auto& [name, desc] : m_mapTransientDescs )
+		{
+			const auto& [first_use, last_use] = lifetimes[handles.at( name )];
+			m_mapNonOwningRenderTarget[name] = nullptr;
+			if( first_use != UNUSED )
+			{
+				transients.push_back( { &name, &desc, first_use, last_use } );
+			}
+		}
+
+		std::sort( transients.begin(), transients.end(), []( const TransientUse& a, const TransientUse& b )
+		{
+			return a.first_use < b.first_use;
+		} );
 
-			// bind to output if this is the output pass
-			if( i == (size_t)m_OutputNode->pass_idx )
+		// Greedily hand out allocations, an allocation is free once the last pass using it has run.
+		// Allocations are kept between compiles so toggling passes doesn't recreate every render target.
+		std::vector<bool> allocation_used( m_vTransientAllocations.size(), false );
+		for( const TransientUse& transient : transients )
+		{
+			size_t allocation = m_vTransientAllocations.size();
+			for( size_t i = 0; i < m_vTransientAllocations.size(); i++ )
 			{
-				m_RenderData.AddRenderTarget( m_OutputNode->name, target );
+				const TransientAllocation& candidate = m_vTransientAllocations[i];
+				if( candidate.desc == *transient.desc && ( !allocation_used[i] || candidate.busy_until < transient.first_use ) )
+				{
+					allocation = i;
+					break;
+				}
+			}
+
+			if( allocation == m_vTransientAllocations.size() )
+			{
+				const RenderTargetDesc& desc = *transient.desc;
+
+				TransientAllocation new_allocation;
+				new_allocation.desc = desc;
+				new_allocation.pRenderTarget = std::unique_ptr<IRenderTarget>( gpu->CreateRenderTarget( desc.width, desc.height, desc.format,
+					desc.ms_quality, desc.ms_samples, desc.flags ) );
+				m_vTransientAllocations.emplace_back( std::move( new_allocation ) );
+				allocation_used.push_back( false );
+			}
+
+			TransientAllocation& used = m_vTransientAllocations[allocation];
+			used.busy_until = transient.last_use;
+			allocation_used[allocation] = true;
+			m_mapNonOwningRenderTarget[*transient.name] = used.pRenderTarget.get();
+		}
+
+		// Free whatever the current graph doesn't need anymore
+		for( size_t i = m_vTransientAllocations.size(); i-- > 0; )
+		{
+			if( !allocation_used[i] )
+			{
+				m_vTransientAllocations.erase( m_vTransientAllocations.begin() + i );
+			}
+		}
+	}
+
+	void RenderGraph::BuildRenderData()
+	{
+		for( size_t pass_idx : m_vExecutionOrder )
+		{
+			RenderData& data = m_vRenderData[pass_idx];
+			data.Clear();
+			data.m_pVisibility = &m_Visibility;
+			data.m_pLightClusters = &m_LightClusters;
+
+			// bind to output if this is the output pass, the target itself is only known when rendering
+			if( pass_idx == (size_t)m_OutputNode->pass_idx )
+			{
+				data.AddRenderTarget( m_OutputNode->name, nullptr );
 			}
 
 			// bind any resources
-			const auto& nodes_and_resources = m_vNodeAndResourceBindings[i];
-			for( const NodeAndResource& nar : nodes_and_resources )
+			for( const NodeAndResource& nar : m_vNodeAndResourceBindings[pass_idx] )
 			{
 				NodeDataType type = GetResourceType( nar.resource );
 				switch( type )
 				{
 					case NodeDataType::TEXTURE:
-						m_RenderData.AddTexture( nar.node.name, GetTextureResource( nar.resource ) );
+						data.AddTexture( nar.node.name, GetTextureResource( nar.resource ) );
 						break;
 					case NodeDataType::RENDER_TARGET:
-						m_RenderData.AddRenderTarget( nar.node.name, GetRenderTargetResource( nar.resource ) );
+						data.AddRenderTarget( nar.node.name, GetRenderTargetResource( nar.resource ) );
 						break;
 					case NodeDataType::DEPTH_STENCIL:
-						m_RenderData.AddDepthStencil( nar.node.name, GetDepthStencilResource( nar.resource ) );
+						data.AddDepthStencil( nar.node.name, GetDepthStencilResource( nar.resource ) );
 						break;
 					default:
 						ASSERT( false, "Unhandled node data type" );
@@ -173,12 +517,128 @@ namespace Bat
 				}
 			}
 
-			IGPUContext* pContext = gpu->GetContext();
+			if( pass_idx == (size_t)m_OutputNode->pass_idx )
+			{
+				m_iOutputSlot = 0;
+				while( data.m_vRenderTarget[m_iOutputSlot].first != m_OutputNode->name )
+				{
+					m_iOutputSlot++;
+				}
+			}
+		}
+	}
+
+	void RenderGraph::Render( Camera& camera, SceneNode& scene, IRenderTarget* target )
+	{
+		if( m_bDirty )
+		{
+			Compile();
+		}
+
+		if( m_vExecutionOrder.empty() )
+		{
+			return;
+		}
+
+		const size_t output_pass = (size_t)m_OutputNode->pass_idx;
+		m_vRenderData[output_pass].m_vRenderTarget[m_iOutputSlot].second = target;
+
+		// flattened scene, camera culling and light clusters shared by every pass
+		m_Visibility.Build( scene, camera );
+		m_LightClusters.Build( camera );
+
+		IGPUContext* pContext = gpu->GetContext();
+
+		// Passes run in execution order on the main thread. Prepare always runs here on the immediate context,
+		// then parallel passes get a deferred context that inherits the immediate state and record on a job.
+		// Before a serial pass runs (and at the end of the graph) every outstanding command list
+		// is executed in order, so consecutive parallel passes record concurrently.
+		FrameVector<JobCounter> counters( m_vRenderPasses.size() );
+		// passes currently recording, in execution order
+		FrameVector<size_t> recording;
+		recording.reserve( m_vExecutionOrder.size() );
+
+		auto execute_recorded = [&]()
+		{
+			for( size_t i : recording )
+			{
+				JobSystem::Wait( counters[i] );
+				pContext->ExecuteCommandList( m_vCommandLists[i].get() );
+				m_vCommandLists[i].reset();
+			}
+			recording.clear();
+		};
+
+		for( size_t i : m_vExecutionOrder )
+		{
+			IRenderPass* pPass = m_vRenderPasses[i].get();
+			RenderData& data = m_vRenderData[i];
+
+			IGPUContext* pDeferred = nullptr;
+			if( m_bParallelRecording && pPass->CanRecordInParallel() )
+			{
+				pDeferred = GetDeferredContext( i );
+			}
+
+			if( !pDeferred )
+			{
+				execute_recorded();
+			}
+
+			pPass->Prepare( pContext, camera, scene, data );
+
+			if( pDeferred )
+			{
+				pDeferred->InheritState( pContext );
+
+				std::unique_ptr<IGPUCommandList>* pList = &m_vCommandLists[i];
+				const std::string* pName = &m_vPassNames[i];
+				RenderData* pData = &data;
+				Camera* pCamera = &camera;
+				SceneNode* pScene = &scene;
+				JobSystem::Execute( [=]()
+				{
+					pDeferred->BeginEvent( *pName );
+					pPass->Execute( pDeferred, *pCamera, *pScene, *pData );
+					pDeferred->EndEvent();
+					*pList = std::unique_ptr<IGPUCommandList>( pDeferred->FinishCommandList() );
+				}, &counters[i] );
+
+				recording.push_back( i );
+				continue;
+			}
 
 			pContext->BeginEvent( m_vPassNames[i] );
-			m_vRenderPasses[i]->Execute( pContext, camera, scene, m_RenderData );
+			pPass->Execute( pContext, camera, scene, data );
 			pContext->EndEvent();
 		}
+
+		execute_recorded();
+	}
+
+	void RenderGraph::SetParallelRecordingEnabled( bool enabled )
+	{
+		m_bParallelRecording = enabled;
+	}
+
+	bool RenderGraph::IsParallelRecordingEnabled() const
+	{
+		return m_bParallelRecording;
+	}
+
+	IGPUContext* RenderGraph::GetDeferredContext( size_t pass_idx )
+	{
+		if( !m_vDeferredContexts[pass_idx] )
+		{
+			m_vDeferredContexts[pass_idx] = std::unique_ptr<IGPUContext>( gpu->CreateDeferredContext() );
+			if( !m_vDeferredContexts[pass_idx] )
+			{
+				BAT_WARN( "Deferred contexts unsupported, recording render passes serially" );
+				m_bParallelRecording = false;
+			}
+		}
+
+		return m_vDeferredContexts[pass_idx].get();
 	}
 
 	void RenderGraph::ResetResources()
@@ -190,6 +650,9 @@ namespace Bat
 
 		m_mapResourceTypes.clear();
 		m_vNodeAndResourceBindings.clear();
+		m_mapTransientDescs.clear();
+		m_vTransientAllocations.clear();
+		m_bDirty = true;
 	}
 
 	void RenderGraph::ResetPasses()
@@ -198,7 +661,13 @@ namespace Bat
 		m_vPassNames.clear();
 		m_mapPassNameToIndex.clear();
 		m_vPassEnabled.clear();
+		m_vRenderData.clear();
+		m_vDeferredContexts.clear();
+		m_vCommandLists.clear();
+		m_vExecutionOrder.clear();
+		m_vPassLive.clear();
 		m_OutputNode.reset();
+		m_bDirty = true;
 	}
 
 	void RenderGraph::Reset()
@@ -10,6 +10,8 @@
 #include "RenderNode.h"
 #include "RenderData.h"
 #include "IRenderPass.h"
+#include "SceneVisibility.h"
+#include "LightClusters.h"
 
 namespace Bat
 {
@@ -17,6 +19,23 @@ namespace Bat
 	class IRenderTarget;
 	class IDepthStencil;
 
+	// Description of a render target allocated by the render graph, see RenderGraph::AddTransientRenderTargetResource
+	struct RenderTargetDesc
+	{
+		size_t width;
+		size_t height;
+		TexFormat format;
+		MsaaQuality ms_quality = MsaaQuality::NONE;
+		size_t ms_samples = 1;
+		TexFlags flags = TexFlags::NONE;
+
+		bool operator==( const RenderTargetDesc& rhs ) const
+		{
+			return width == rhs.width && height == rhs.height && format == rhs.format &&
+				ms_quality == rhs.ms_quality && ms_samples == rhs.ms_samples && flags == rhs.flags;
+		}
+	};
+
 	class RenderGraph
 	{
 	public:
@@ -38,6 +57,11 @@ namespace Bat
 		void Add##name##Resource( const std::string& resource_name, type* pResource );
 #include "RenderNodeDataTypes.def"
 
+		// Render target that is only used within the graph and is allocated by Compile. Transient render targets with the
+		// same description whose lifetimes (first to last pass using them) don't overlap share one allocation,
+		// so their contents are undefined until the first pass using them writes to them.
+		void AddTransientRenderTargetResource( const std::string& resource_name, const RenderTargetDesc& desc );
+
 		// Binds a pass node to a created resource
 		// Example usage:
 		//     BindToResource( "depthprepass.dst", "DepthPrePassBuffer" );
@@ -47,8 +71,24 @@ namespace Bat
 		//     MarkOutput( "Bloom.src" );
 		void MarkOutput( const std::string& out );
 
+		// Resolves node bindings to resources, orders passes by their dependencies, culls passes that don't contribute
+		// to the output and allocates transient resources. Called by Render when the graph changed since the last compile.
+		//
+		// Writing a node (any output, or an input render target/depth stencil since passes clear or draw into those)
+		// makes a pass depend on every earlier pass using the resource. Reading a texture depends on the last pass to write it,
+		// or the first writer when nothing declared before writes it. Passes without output nodes (e.g. shadows)
+		// can't be culled since their side effects aren't known.
+		bool Compile();
+		// Passes in the order they are executed, culled and disabled passes aren't included
+		const std::vector<size_t>& GetExecutionOrder() const;
+
 		void Render( Camera& camera, SceneNode& scene, IRenderTarget* pTarget );
 
+		// When enabled, passes that support it record into deferred contexts on the job system while
+		// the main thread moves on to the next pass. Command lists are still executed in graph order.
+		void SetParallelRecordingEnabled( bool enabled );
+		bool IsParallelRecordingEnabled() const;
+
 		// Clears all current resources
 		void ResetResources();
 		// Clears all current passes
@@ -72,6 +112,24 @@ namespace Bat
 
 		NodeDataType GetResourceType( const std::string& resource_name );
 
+		IGPUContext* GetDeferredContext( size_t pass_idx );
+
+		// Compile steps
+		using ResourceHandle = size_t;
+
+		struct PassEdge
+		{
+			size_t pass_idx;
+			// pass reads what the other pass wrote, as opposed to only having to run after it
+			bool producer;
+		};
+
+		bool SortPasses( const std::vector<std::vector<PassEdge>>& dependencies );
+		void CullPasses( const std::vector<std::vector<PassEdge>>& dependencies );
+		void AllocateTransientResources( const std::vector<std::vector<ResourceHandle>>& pass_resources,
+			const std::unordered_map<std::string, ResourceHandle>& handles );
+		void BuildRenderData();
+
 #define RENDER_NODE_DATATYPE( type, name, capname ) \
 		type* Get##name##Resource( const std::string& resource_name );
 #include "RenderNodeDataTypes.def"
@@ -86,7 +144,32 @@ namespace Bat
 		std::unordered_map<std::string, NodeDataType> m_mapResourceTypes;
 		std::vector<std::vector<NodeAndResource>> m_vNodeAndResourceBindings;
 
-		RenderData m_RenderData;
+		// compiled graph
+		bool m_bDirty = true;
+		std::vector<size_t> m_vExecutionOrder;
+		std::vector<bool> m_vPassLive;
+		// per pass, built by Compile. Only the output render target is patched every frame.
+		std::vector<RenderData> m_vRenderData;
+		// rebuilt every frame before any pass runs
+		SceneVisibility m_Visibility;
+		LightClusters m_LightClusters;
+		size_t m_iOutputSlot = 0;
+
+		// transient render targets
+		struct TransientAllocation
+		{
+			RenderTargetDesc desc;
+			std::unique_ptr<IRenderTarget> pRenderTarget;
+			// execution order index of the last pass using the allocation in the current compile
+			size_t busy_until;
+		};
+		std::unordered_map<std::string, RenderTargetDesc> m_mapTransientDescs;
+		std::vector<TransientAllocation> m_vTransientAllocations;
+
+		// parallel recording
+		bool m_bParallelRecording = true;
+		std::vector<std::unique_ptr<IGPUContext>> m_vDeferredContexts;
+		std::vector<std::unique_ptr<IGPUCommandList>> m_vCommandLists;
 
 #define RENDER_NODE_DATATYPE( type, name, capname ) \
 			std::unordered_map<std::string, std::unique_ptr<type>> m_mapOwning##name; \
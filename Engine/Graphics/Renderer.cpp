@@ -15,6 +15,8 @@
 #include "Events/WindowEvents.h"
 #include "DebugDraw.h"
 #include "Core/Scene.h"
+#include "Util/AllocationCounter.h"
+#include "Util/FrameAllocator.h"
 
 #include "imgui.h"
 #include "imgui_impl_dx11.h"
@@ -91,6 +93,8 @@ namespace Bat
 
 	void Renderer::BeginFrame()
 	{
+		m_iFrameAllocationsStart = AllocationCounter::GetTotalAllocations();
+
 		if( m_pCamera )
 		{
 			m_pCamera->Render();
@@ -105,16 +109,24 @@ namespace Bat
 
 	void Renderer::EndFrame()
 	{
+		const uint64_t allocations_before = AllocationCounter::GetTotalAllocations();
 		RenderScene();
 		if( m_pCamera )
 		{
 			DebugDraw::Flush( *m_pCamera );
 		}
+		m_iSceneHeapAllocations = AllocationCounter::GetTotalAllocations() - allocations_before;
+		m_iFrameAllocatorBytes = FrameAllocator::GetBytesUsed();
+
 		RenderUI();
 		RenderImGui();
 
 		// all done!
 		gpu->SwapBuffers();
+
+		FrameAllocator::EndFrame();
+
+		m_iFrameHeapAllocations = AllocationCounter::GetTotalAllocations() - m_iFrameAllocationsStart;
 	}
 
 	Mat4 Renderer::GetOrthoMatrix() const
@@ -47,6 +47,16 @@ namespace Bat
 		void EndFrame();
 
 		Mat4 GetOrthoMatrix() const;
+
+		// Heap allocations made (by any thread) while rendering the scene and debug draws last frame,
+		// should be 0 once the scene has been drawn a few times
+		uint64_t GetSceneHeapAllocations() const { return m_iSceneHeapAllocations; }
+		// Heap allocations made (by any thread) from the start of BeginFrame to the end of EndFrame last frame.
+		// On top of the scene this covers the application's OnRender, the console, HTML UI, ImGui and the swap,
+		// which aren't held to the zero allocation guarantee
+		uint64_t GetFrameHeapAllocations() const { return m_iFrameHeapAllocations; }
+		// Bytes taken from the frame allocator by the end of scene rendering last frame
+		size_t GetFrameAllocatorBytes() const { return m_iFrameAllocatorBytes; }
 	private:
 		void InitialiseResources( size_t width, size_t height );
 
@@ -64,6 +74,11 @@ namespace Bat
 
 		RenderGraph* m_pRenderGraph = nullptr;
 
+		uint64_t m_iSceneHeapAllocations = 0;
+		uint64_t m_iFrameHeapAllocations = 0;
+		uint64_t m_iFrameAllocationsStart = 0;
+		size_t m_iFrameAllocatorBytes = 0;
+
 		// UI
 		HtmlUI m_UI;
 	public:
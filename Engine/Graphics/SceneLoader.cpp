@@ -375,7 +375,12 @@ namespace Bat
 		animation_out->bind_pose = std::move( m_OriginalSkeleton );
 		animation_out->bones = std::move( m_Bones );
 		animation_out->clips = std::move( m_Animations );
-		animation_out->current_pose = animation_out->bind_pose;
+
+		// bind pose palette until the animation system first updates it
+		animation_out->model_pose.resize( animation_out->bind_pose.bones.size() );
+		SkeletonPose::ToModelSpace( animation_out->bind_pose, animation_out->model_pose.data() );
+		animation_out->matrix_palette.resize( animation_out->bones.size() );
+		SkeletonPose::ToMatrixPalette( animation_out->model_pose.data(), animation_out->bones, animation_out->matrix_palette.data() );
 	}
 
 	static void AddBoneWeight( std::vector<Veu4>* ids, std::vector<Vec4>* weights, unsigned int vertex_id, unsigned int bone_id, float weight )
@@ -661,7 +666,8 @@ namespace Bat
 				aiMesh* pMesh = m_pAiScene->mMeshes[pAiNode->mMeshes[i]];
 				meshes.emplace_back( ProcessMesh( pMesh ) );
 			}
-			e.Add<ModelComponent>( std::move( meshes ) );
+			e.Add<ModelComponent>( std::move( meshes ) )
+				.AddRenderFlag( m_ModelFlags );
 		}
 
 		for( unsigned int i = 0; i < pAiNode->mNumChildren; i++ )
@@ -680,15 +686,21 @@ namespace Bat
 	{
 	}
 
-	SceneNode SceneLoader::Load( const std::string& filename )
+	SceneNode SceneLoader::Load( const std::string& filename, RenderFlags model_flags )
 	{
 		if( !this->ReadFile( filename ) )
 		{
 			return {};
 		}
 
+		m_ModelFlags = model_flags;
+
 		FrameTimer ft;
 
+		// component listeners run once the load is done instead of after every component
+		const bool was_deferring = world.IsDeferringEvents();
+		world.SetDeferEvents( true );
+
 		PreProcess();
 
 		SceneNode root_node;
@@ -703,6 +715,8 @@ namespace Bat
 			LoadAnimations( &anim );
 		}
 
+		world.SetDeferEvents( was_deferring );
+
 		float time = ft.Mark();
 		BAT_LOG( "Loaded model '%s' in %.2fs", filename, time );
 
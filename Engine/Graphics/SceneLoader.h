@@ -3,6 +3,7 @@
 #include "Core/Entity.h"
 #include "Core/Scene.h"
 #include "Mesh.h"
+#include "RenderFlags.h"
 
 #include <assimp/Importer.hpp>
 #include <assimp/scene.h>
@@ -31,7 +32,8 @@ namespace Bat
 		SceneLoader();
 		~SceneLoader();
 
-		SceneNode Load( const std::string& filename );
+		// model_flags are added to every model in the scene, e.g. RenderFlags::STATIC for level geometry
+		SceneNode Load( const std::string& filename, RenderFlags model_flags = RenderFlags::NONE );
 		std::shared_ptr<Mesh> LoadMesh( const std::string& filename );
 	private:
 		bool ReadFile( const std::string& filename );
@@ -69,6 +71,7 @@ namespace Bat
 		std::string m_szFilename;
 		std::string m_szDirectory;
 		const aiScene* m_pAiScene;
+		RenderFlags m_ModelFlags = RenderFlags::NONE;
 
 		struct LoadedMesh
 		{
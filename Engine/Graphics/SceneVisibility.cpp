@@ -0,0 +1,169 @@
+#include "PCH.h"
+#include "SceneVisibility.h"
+
+#include "Core/Scene.h"
+#include "Core/CoreEntityComponents.h"
+#include "Camera.h"
+#include "Model.h"
+#include "Particles.h"
+
+namespace Bat
+{
+	static void MergeBounds( AABB& bounds, const AABB& other )
+	{
+		bounds.mins.x = std::min( bounds.mins.x, other.mins.x );
+		bounds.mins.y = std::min( bounds.mins.y, other.mins.y );
+		bounds.mins.z = std::min( bounds.mins.z, other.mins.z );
+		bounds.maxs.x = std::max( bounds.maxs.x, other.maxs.x );
+		bounds.maxs.y = std::max( bounds.maxs.y, other.maxs.y );
+		bounds.maxs.z = std::max( bounds.maxs.z, other.maxs.z );
+	}
+
+	void SceneVisibility::Build( SceneNode& scene, const Camera& camera )
+	{
+		m_Nodes.clear();
+		AddSubtree( scene );
+
+		m_CameraVisible.clear();
+		Cull( camera.GetFrustum(), m_CameraVisible );
+	}
+
+	void SceneVisibility::AddSubtree( SceneNode& scene_node )
+	{
+		const size_t index = m_Nodes.size();
+
+		Node node;
+		node.entity = scene_node.Get();
+		node.transform = Mat3x4::Identity();
+		node.drawable = false;
+		node.unbounded = false;
+
+		// nodes without a transform (e.g. the scene root) only group their children
+		if( node.entity != Entity::INVALID && node.entity.Has<TransformComponent>() )
+		{
+			node.transform = node.entity.Get<TransformComponent>().LocalToWorldMatrix();
+
+			if( node.entity.Has<ModelComponent>() )
+			{
+				node.bounds = node.entity.Get<ModelComponent>().GetAABB().TransformBounds( node.transform );
+				node.drawable = true;
+			}
+			if( node.entity.Has<ParticleEmitterComponent>() )
+			{
+				node.drawable = true;
+				node.unbounded = true;
+			}
+		}
+
+		node.subtree_bounds = node.bounds;
+		node.subtree_drawable = node.drawable;
+		node.subtree_unbounded = node.unbounded;
+		m_Nodes.push_back( node );
+
+		for( SceneNode& child : scene_node )
+		{
+			AddSubtree( child );
+		}
+
+		// children are all added now, merge their subtrees into ours
+		const size_t end = m_Nodes.size();
+		bool has_bounds = node.drawable;
+		for( size_t child = index + 1; child < end; child = m_Nodes[child].subtree_end )
+		{
+			const Node& child_node = m_Nodes[child];
+			Node& parent_node = m_Nodes[index];
+
+			if( !child_node.subtree_drawable )
+			{
+				continue;
+			}
+
+			parent_node.subtree_drawable = true;
+			parent_node.subtree_unbounded |= child_node.subtree_unbounded;
+
+			// bounds of unbounded subtrees are never tested
+			if( parent_node.subtree_unbounded )
+			{
+				continue;
+			}
+
+			if( has_bounds )
+			{
+				MergeBounds( parent_node.subtree_bounds, child_node.subtree_bounds );
+			}
+			else
+			{
+				parent_node.subtree_bounds = child_node.subtree_bounds;
+				has_bounds = true;
+			}
+		}
+
+		m_Nodes[index].subtree_end = end;
+	}
+
+	void SceneVisibility::Cull( const Frustum& frustum, std::vector<VisibleEntity>& out ) const
+	{
+		size_t i = 0;
+		while( i < m_Nodes.size() )
+		{
+			const Node& node = m_Nodes[i];
+			if( !node.subtree_drawable )
+			{
+				i = node.subtree_end;
+				continue;
+			}
+
+			if( !node.subtree_unbounded )
+			{
+				const Frustum::Intersection subtree = frustum.ClassifyBox( node.subtree_bounds.mins, node.subtree_bounds.maxs );
+				if( subtree == Frustum::Intersection::OUTSIDE )
+				{
+					i = node.subtree_end;
+					continue;
+				}
+				if( subtree == Frustum::Intersection::INSIDE )
+				{
+					AddDrawables( i, node.subtree_end, true, out );
+					i = node.subtree_end;
+					continue;
+				}
+			}
+
+			// subtree straddles the frustum, test this node on its own then move on to its children
+			if( node.drawable )
+			{
+				if( node.unbounded )
+				{
+					out.push_back( { node.entity, node.transform, false } );
+				}
+				else
+				{
+					const Frustum::Intersection own = frustum.ClassifyBox( node.bounds.mins, node.bounds.maxs );
+					if( own != Frustum::Intersection::OUTSIDE )
+					{
+						out.push_back( { node.entity, node.transform, own == Frustum::Intersection::INSIDE } );
+					}
+				}
+			}
+
+			i++;
+		}
+	}
+
+	void SceneVisibility::GetAll( std::vector<VisibleEntity>& out ) const
+	{
+		AddDrawables( 0, m_Nodes.size(), false, out );
+	}
+
+	void SceneVisibility::AddDrawables( size_t start, size_t end, bool fully_inside, std::vector<VisibleEntity>& out ) const
+	{
+		for( size_t i = start; i < end; i++ )
+		{
+			const Node& node = m_Nodes[i];
+			if( node.drawable )
+			{
+				out.push_back( { node.entity, node.transform, fully_inside && !node.unbounded } );
+			}
+		}
+	}
+}
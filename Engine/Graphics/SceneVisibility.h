@@ -0,0 +1,62 @@
+#pragma once
+
+#include <vector>
+#include "Core/Entity.h"
+#include "Util/Frustum.h"
+
+namespace Bat
+{
+	class SceneNode;
+	class Camera;
+
+	// Flattened copy of the scene graph where every node knows the world space bounds of its whole subtree,
+	// so a subtree outside a frustum is rejected with a single test. Built once per frame by the render graph,
+	// which also culls it against the camera once for every pass rendering that camera.
+	class SceneVisibility
+	{
+	public:
+		struct VisibleEntity
+		{
+			Entity entity;
+			Mat3x4 transform;
+			// entity's bounds are entirely inside the frustum, so per mesh tests can be skipped
+			bool fully_inside;
+		};
+
+		// Flattens the scene and culls it against the camera's frustum
+		void Build( SceneNode& scene, const Camera& camera );
+
+		// Appends every drawable entity (models and particle emitters) that may be inside the frustum
+		void Cull( const Frustum& frustum, std::vector<VisibleEntity>& out ) const;
+		// Appends every drawable entity
+		void GetAll( std::vector<VisibleEntity>& out ) const;
+
+		// Drawable entities visible from the camera the visibility was built with
+		const std::vector<VisibleEntity>& GetCameraVisible() const { return m_CameraVisible; }
+	private:
+		void AddSubtree( SceneNode& node );
+		void AddDrawables( size_t start, size_t end, bool fully_inside, std::vector<VisibleEntity>& out ) const;
+	private:
+		struct Node
+		{
+			Entity entity;
+			Mat3x4 transform;
+			// world space bounds of this node's entity
+			AABB bounds;
+			// world space bounds of this node and all of its descendants
+			AABB subtree_bounds;
+			// index one past this node's last descendant, descendants directly follow their parent
+			size_t subtree_end;
+			// has a model or particle emitter
+			bool drawable;
+			// something in the subtree is drawable
+			bool subtree_drawable;
+			// something in the subtree has no bounds (particles), so the subtree can't be rejected as a whole
+			bool unbounded;
+			bool subtree_unbounded;
+		};
+
+		std::vector<Node> m_Nodes;
+		std::vector<VisibleEntity> m_CameraVisible;
+	};
+}
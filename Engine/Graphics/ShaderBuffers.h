@@ -22,7 +22,7 @@ namespace Bat
 		float _pad0;
 	};
 
-	constexpr size_t MAX_LIGHTS = 16;
+	constexpr size_t MAX_LIGHTS = 256;
 	struct ShaderLight
 	{
 		Vec3  Position;
@@ -39,4 +39,17 @@ namespace Bat
 		int   Type;
 		float Pad;
 	};
-}
\ No newline at end of file
+
+	struct ShaderLightParams
+	{
+		// directional lights, shaded everywhere and stored before the clustered lights
+		uint32_t NumGlobalLights;
+		uint32_t NumLights;
+		// depth slice of a cluster = log( view z ) * ClusterDepthScale + ClusterDepthBias
+		float    ClusterDepthScale;
+		float    ClusterDepthBias;
+		// view z = dot( world position, xyz ) + w
+		Vec4     ViewDepthPlane;
+		ShaderLight Lights[MAX_LIGHTS];
+	};
+}
@@ -8,6 +8,7 @@
 namespace Bat
 {
 	std::unordered_map<std::type_index, std::unique_ptr<IPipeline>> ShaderManager::m_mapPipelines;
+	std::mutex ShaderManager::m_PipelineMutex;
 
 	struct PSGlobals
 	{
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <mutex>
 #include "IPipeline.h"
 #include "Camera.h"
 
@@ -53,6 +54,8 @@ namespace Bat
 		PS_TEX_SLOT_5,
 		PS_TEX_SLOT_6,
 		PS_TEX_SLOT_7,
+		PS_TEX_LIGHT_GRID,
+		PS_TEX_LIGHT_INDICES,
 	};
 
 	enum
@@ -82,6 +85,8 @@ namespace Bat
 
 			auto type = std::type_index(typeid( Pipeline ));
 
+			// render passes can be recorded from job threads
+			std::lock_guard<std::mutex> lock( m_PipelineMutex );
 			auto it = m_mapPipelines.find( type );
 			if( it == m_mapPipelines.end() )
 			{
@@ -97,5 +102,6 @@ namespace Bat
 		static size_t BuildMacrosForInstancedMesh( const Mesh& mesh, ShaderMacro* out_macros, size_t max );
 	private:
 		static std::unordered_map<std::type_index, std::unique_ptr<IPipeline>> m_mapPipelines;
+		static std::mutex m_PipelineMutex;
 	};
 }
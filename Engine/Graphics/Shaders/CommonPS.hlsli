@@ -26,7 +26,13 @@ struct Material
 #define INVALID_SHADOW_MAP_INDEX (~0)
 #define NUM_CASCADES 3
 
-#define MAX_LIGHTS 16
+#define MAX_LIGHTS 256
+
+// Light cluster grid, must match LightClusters
+#define CLUSTERS_X 16
+#define CLUSTERS_Y 9
+#define CLUSTERS_Z 24
+#define LIGHT_INDICES_WIDTH 1024
 struct Light
 {
 	float3 Position;
@@ -116,6 +122,8 @@ SamplerState LinearClampSampler : register(S_SLOT_LINEAR_CLAMP);
 #define T_SLOT_5 t6
 #define T_SLOT_6 t7
 #define T_SLOT_7 t8
+#define T_SLOT_LIGHT_GRID t9
+#define T_SLOT_LIGHT_INDICES t10
 
 #define GAMMA 2.2f
 
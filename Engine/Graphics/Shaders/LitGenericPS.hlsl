@@ -34,10 +34,20 @@ cbuffer Material : register(B_SLOT_0)
 
 cbuffer LightParams : register(B_SLOT_1)
 {
+	// directional lights come first and are shaded everywhere, the rest are only shaded in the clusters they touch
+	uint NumGlobalLights;
 	uint NumLights;
+	float ClusterDepthScale;
+	float ClusterDepthBias;
+	float4 ViewDepthPlane;
 	Light Lights[MAX_LIGHTS];
 }
 
+// offset/count into ClusterLightIndices for every cluster, x = tile index, y = depth slice
+Texture2D<uint2> ClusterGrid : register(T_SLOT_LIGHT_GRID);
+// indices of clustered lights, relative to the first clustered light
+Texture2D<uint> ClusterLightIndices : register(T_SLOT_LIGHT_INDICES);
+
 struct PixelInput
 {
 	float4 position : SV_POSITION;
@@ -282,11 +292,26 @@ float4 main( PixelInput input ) : SV_TARGET
 	}
 
 	float3 colour = 0.0f;
-	for( uint i = 0; i < NumLights; i++ )
+	for( uint i = 0; i < NumGlobalLights; i++ )
 	{
 		colour += DoLight( Lights[i], material, world_pos, normal );
 	}
 	
+	if( NumLights > NumGlobalLights )
+	{
+		float view_z = dot( world_pos, ViewDepthPlane.xyz ) + ViewDepthPlane.w;
+		uint slice = (uint)clamp( log( view_z ) * ClusterDepthScale + ClusterDepthBias, 0.0f, CLUSTERS_Z - 1 );
+		uint2 tile = min( (uint2)( input.position.xy / Globals.Resolution * float2( CLUSTERS_X, CLUSTERS_Y ) ), uint2( CLUSTERS_X - 1, CLUSTERS_Y - 1 ) );
+		uint2 cluster = ClusterGrid.Load( int3( tile.y * CLUSTERS_X + tile.x, slice, 0 ) );
+		
+		for( uint j = 0; j < cluster.y; j++ )
+		{
+			uint index = cluster.x + j;
+			uint light_index = NumGlobalLights + ClusterLightIndices.Load( int3( index % LIGHT_INDICES_WIDTH, index / LIGHT_INDICES_WIDTH, 0 ) );
+			colour += DoLight( Lights[light_index], material, world_pos, normal );
+		}
+	}
+	
 	float3 view_dir = normalize(Globals.CameraPos - world_pos);
 	float3 kS = FresnelSchlickRoughness(normal, view_dir, material.F0, material.Roughness);
 	float3 kD = (1.0f - kS) * (1.0f - material.Metallic);
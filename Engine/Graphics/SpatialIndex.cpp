@@ -0,0 +1,420 @@
+#include "PCH.h"
+#include "SpatialIndex.h"
+
+#include <cstring>
+
+#include "Core/CoreEntityComponents.h"
+#include "Core/Globals.h"
+#include "Model.h"
+
+namespace Bat
+{
+	SpatialIndexSystem* spatial_index = nullptr;
+
+	static bool HasCategoryComponent( SpatialCategory category, Entity entity )
+	{
+		switch( category )
+		{
+		case SpatialCategory::MODEL:
+			return entity.Has<ModelComponent>();
+		case SpatialCategory::LIGHT:
+			return entity.Has<LightComponent>();
+		default:
+			ASSERT( false, "Unhandled spatial category" );
+			return false;
+		}
+	}
+
+	SpatialIndexSystem::SpatialIndexSystem( EntityManager& world, const HierarchySystem& hierarchy )
+		:
+		m_World( world ),
+		m_Hierarchy( hierarchy )
+	{
+		ASSERT( !spatial_index, "Only one spatial index can exist at a time" );
+		spatial_index = this;
+
+		world.AddEventListener<ComponentAddedEvent<ModelComponent>>( *this );
+		world.AddEventListener<ComponentRemovedEvent<ModelComponent>>( *this );
+		world.AddEventListener<ComponentAddedEvent<LightComponent>>( *this );
+		world.AddEventListener<ComponentRemovedEvent<LightComponent>>( *this );
+		world.AddEventListener<ComponentRemovedEvent<TransformComponent>>( *this );
+		world.AddEventListener<EntityDestroyedEvent>( *this );
+
+		// pick up anything that was created before us
+		for( auto [e, model] : world.View<ModelComponent>() )
+		{
+			m_Categories[(size_t)SpatialCategory::MODEL].pending.push_back( e.GetId() );
+		}
+		for( auto [e, light] : world.View<LightComponent>() )
+		{
+			m_Categories[(size_t)SpatialCategory::LIGHT].pending.push_back( e.GetId() );
+		}
+	}
+
+	SpatialIndexSystem::~SpatialIndexSystem()
+	{
+		m_World.RemoveEventListener<ComponentAddedEvent<ModelComponent>>( *this );
+		m_World.RemoveEventListener<ComponentRemovedEvent<ModelComponent>>( *this );
+		m_World.RemoveEventListener<ComponentAddedEvent<LightComponent>>( *this );
+		m_World.RemoveEventListener<ComponentRemovedEvent<LightComponent>>( *this );
+		m_World.RemoveEventListener<ComponentRemovedEvent<TransformComponent>>( *this );
+		m_World.RemoveEventListener<EntityDestroyedEvent>( *this );
+
+		spatial_index = nullptr;
+	}
+
+	void SpatialIndexSystem::OnEvent( const ComponentAddedEvent<ModelComponent>& e )
+	{
+		// transform probably isn't set up yet, insert on the next update
+		m_Categories[(size_t)SpatialCategory::MODEL].pending.push_back( e.entity.GetId() );
+	}
+
+	void SpatialIndexSystem::OnEvent( const ComponentRemovedEvent<ModelComponent>& e )
+	{
+		Remove( SpatialCategory::MODEL, e.entity.GetId() );
+	}
+
+	void SpatialIndexSystem::OnEvent( const ComponentAddedEvent<LightComponent>& e )
+	{
+		m_Categories[(size_t)SpatialCategory::LIGHT].pending.push_back( e.entity.GetId() );
+	}
+
+	void SpatialIndexSystem::OnEvent( const ComponentRemovedEvent<LightComponent>& e )
+	{
+		Remove( SpatialCategory::LIGHT, e.entity.GetId() );
+	}
+
+	void SpatialIndexSystem::OnEvent( const ComponentRemovedEvent<TransformComponent>& e )
+	{
+		// can't be placed without a transform, it goes back to pending until it has one again
+		for( size_t i = 0; i < (size_t)SpatialCategory::COUNT; i++ )
+		{
+			Category& cat = m_Categories[i];
+			if( cat.entity_to_proxy.count( e.entity.GetId().Raw() ) )
+			{
+				Remove( (SpatialCategory)i, e.entity.GetId() );
+				cat.pending.push_back( e.entity.GetId() );
+			}
+		}
+	}
+
+	void SpatialIndexSystem::OnEvent( const EntityDestroyedEvent& e )
+	{
+		for( size_t i = 0; i < (size_t)SpatialCategory::COUNT; i++ )
+		{
+			Remove( (SpatialCategory)i, e.entity.GetId() );
+		}
+	}
+
+	void SpatialIndexSystem::Update( EntityManager& world, float dt )
+	{
+		for( size_t i = 0; i < (size_t)SpatialCategory::COUNT; i++ )
+		{
+			const SpatialCategory category = (SpatialCategory)i;
+			Category& cat = m_Categories[i];
+
+			std::vector<Entity::Id> pending = std::move( cat.pending );
+			cat.pending.clear();
+			for( Entity::Id id : pending )
+			{
+				Entity e( world, id );
+				if( world.IsStale( e ) || !HasCategoryComponent( category, e ) )
+				{
+					continue;
+				}
+
+				// not in the scene yet, try again next update
+				if( !e.Has<TransformComponent>() )
+				{
+					cat.pending.push_back( id );
+					continue;
+				}
+
+				Insert( category, e );
+			}
+		}
+
+		for( Entity::Id id : m_Hierarchy.GetMovedEntities() )
+		{
+			for( size_t i = 0; i < (size_t)SpatialCategory::COUNT; i++ )
+			{
+				const Category& cat = m_Categories[i];
+				auto it = cat.entity_to_proxy.find( id.Raw() );
+				if( it != cat.entity_to_proxy.end() )
+				{
+					Refit( (SpatialCategory)i, it->second, Entity( world, id ) );
+				}
+			}
+		}
+
+		// a light's range or type can change without it moving, there are few enough lights to check every one
+		const Category& lights = m_Categories[(size_t)SpatialCategory::LIGHT];
+		for( size_t proxy = 0; proxy < lights.proxies.size(); )
+		{
+			// a dropped proxy has the last one moved into its slot
+			if( Refit( SpatialCategory::LIGHT, proxy, Entity( world, lights.proxies[proxy].entity ) ) )
+			{
+				proxy++;
+			}
+		}
+	}
+
+	void SpatialIndexSystem::QueryFrustum( SpatialCategory category, const Frustum& frustum, std::vector<Entity>& out ) const
+	{
+		const Category& cat = m_Categories[(size_t)category];
+		cat.tree.QueryFrustum( frustum, [&]( uint32_t proxy, bool fully_inside )
+		{
+			out.emplace_back( m_World, cat.proxies[proxy].entity );
+		} );
+
+		for( size_t proxy : cat.unbounded )
+		{
+			out.emplace_back( m_World, cat.proxies[proxy].entity );
+		}
+	}
+
+	void SpatialIndexSystem::QuerySphere( SpatialCategory category, const Vec3& centre, float radius, std::vector<Entity>& out ) const
+	{
+		const Category& cat = m_Categories[(size_t)category];
+		cat.tree.QuerySphere( centre, radius, [&]( uint32_t proxy )
+		{
+			out.emplace_back( m_World, cat.proxies[proxy].entity );
+		} );
+
+		for( size_t proxy : cat.unbounded )
+		{
+			out.emplace_back( m_World, cat.proxies[proxy].entity );
+		}
+	}
+
+	void SpatialIndexSystem::QueryAABB( SpatialCategory category, const AABB& aabb, std::vector<Entity>& out ) const
+	{
+		const Category& cat = m_Categories[(size_t)category];
+		cat.tree.QueryAABB( aabb, [&]( uint32_t proxy )
+		{
+			out.emplace_back( m_World, cat.proxies[proxy].entity );
+		} );
+
+		for( size_t proxy : cat.unbounded )
+		{
+			out.emplace_back( m_World, cat.proxies[proxy].entity );
+		}
+	}
+
+	Entity SpatialIndexSystem::Raycast( SpatialCategory category, const Vec3& origin, const Vec3& direction, float max_distance, float* distance_out ) const
+	{
+		const Category& cat = m_Categories[(size_t)category];
+		const Vec3 inv_direction = { 1.0f / direction.x, 1.0f / direction.y, 1.0f / direction.z };
+
+		Entity closest = Entity::INVALID;
+		float closest_distance = max_distance;
+		cat.tree.Raycast( origin, direction, max_distance, [&]( uint32_t proxy, float distance )
+		{
+			// tree tests enlarged bounds, test the real ones
+			const float exact_distance = AABBTree::RayDistance( cat.proxies[proxy].bounds, origin, inv_direction, closest_distance );
+			if( exact_distance >= 0.0f && exact_distance < closest_distance )
+			{
+				closest = Entity( m_World, cat.proxies[proxy].entity );
+				closest_distance = exact_distance;
+			}
+
+			return closest_distance;
+		} );
+
+		if( distance_out && closest != Entity::INVALID )
+		{
+			*distance_out = closest_distance;
+		}
+
+		return closest;
+	}
+
+	bool SpatialIndexSystem::GetBounds( SpatialCategory category, Entity entity, AABB* bounds_out ) const
+	{
+		const Category& cat = m_Categories[(size_t)category];
+		auto it = cat.entity_to_proxy.find( entity.GetId().Raw() );
+		if( it == cat.entity_to_proxy.end() )
+		{
+			return false;
+		}
+
+		const Proxy& proxy = cat.proxies[it->second];
+		if( proxy.tree_proxy == AABBTree::NULL_NODE )
+		{
+			return false;
+		}
+
+		*bounds_out = proxy.bounds;
+		return true;
+	}
+
+	size_t SpatialIndexSystem::GetEntityCount( SpatialCategory category ) const
+	{
+		return m_Categories[(size_t)category].proxies.size();
+	}
+
+	void SpatialIndexSystem::Insert( SpatialCategory category, Entity entity )
+	{
+		Category& cat = m_Categories[(size_t)category];
+		if( cat.entity_to_proxy.count( entity.GetId().Raw() ) )
+		{
+			return;
+		}
+
+		const size_t index = cat.proxies.size();
+
+		Proxy proxy;
+		proxy.entity = entity.GetId();
+		proxy.transform = entity.Get<TransformComponent>().LocalToWorldMatrix();
+		proxy.range = 0.0f;
+		proxy.light_type = LightType::POINT;
+		if( category == SpatialCategory::LIGHT )
+		{
+			const LightComponent& light = entity.Get<LightComponent>();
+			proxy.range = light.GetRange();
+			proxy.light_type = light.GetType();
+		}
+
+		if( CalculateBounds( category, entity, &proxy.bounds ) )
+		{
+			proxy.tree_proxy = cat.tree.CreateProxy( proxy.bounds, (uint32_t)index );
+		}
+		else
+		{
+			proxy.tree_proxy = AABBTree::NULL_NODE;
+			cat.unbounded.push_back( index );
+		}
+
+		cat.proxies.push_back( proxy );
+		cat.entity_to_proxy[entity.GetId().Raw()] = index;
+	}
+
+	void SpatialIndexSystem::Remove( SpatialCategory category, Entity::Id entity )
+	{
+		Category& cat = m_Categories[(size_t)category];
+		auto it = cat.entity_to_proxy.find( entity.Raw() );
+		if( it == cat.entity_to_proxy.end() )
+		{
+			return;
+		}
+
+		const size_t index = it->second;
+		cat.entity_to_proxy.erase( it );
+
+		if( cat.proxies[index].tree_proxy != AABBTree::NULL_NODE )
+		{
+			cat.tree.DestroyProxy( cat.proxies[index].tree_proxy );
+		}
+		else
+		{
+			cat.unbounded.erase( std::find( cat.unbounded.begin(), cat.unbounded.end(), index ) );
+		}
+
+		// move the last proxy into the hole
+		const size_t last = cat.proxies.size() - 1;
+		if( index != last )
+		{
+			Proxy& moved = cat.proxies[index];
+			moved = cat.proxies[last];
+			cat.entity_to_proxy[moved.entity.Raw()] = index;
+
+			if( moved.tree_proxy != AABBTree::NULL_NODE )
+			{
+				cat.tree.SetUserData( moved.tree_proxy, (uint32_t)index );
+			}
+			else
+			{
+				*std::find( cat.unbounded.begin(), cat.unbounded.end(), last ) = index;
+			}
+		}
+		cat.proxies.pop_back();
+	}
+
+	bool SpatialIndexSystem::Refit( SpatialCategory category, size_t proxy_index, Entity entity )
+	{
+		Category& cat = m_Categories[(size_t)category];
+		Proxy& proxy = cat.proxies[proxy_index];
+
+		if( m_World.IsStale( entity ) )
+		{
+			Remove( category, proxy.entity );
+			return false;
+		}
+		// transform was removed but the model/light kept, it goes back to pending until it has one again
+		if( !entity.Has<TransformComponent>() )
+		{
+			Remove( category, proxy.entity );
+			cat.pending.push_back( entity.GetId() );
+			return false;
+		}
+
+		const Mat3x4& transform = entity.Get<TransformComponent>().LocalToWorldMatrix();
+		float range = 0.0f;
+		LightType light_type = LightType::POINT;
+		if( category == SpatialCategory::LIGHT )
+		{
+			const LightComponent& light = entity.Get<LightComponent>();
+			range = light.GetRange();
+			light_type = light.GetType();
+		}
+
+		if( std::memcmp( &transform, &proxy.transform, sizeof( Mat3x4 ) ) == 0 && range == proxy.range && light_type == proxy.light_type )
+		{
+			return true;
+		}
+
+		proxy.transform = transform;
+		proxy.range = range;
+		proxy.light_type = light_type;
+
+		const bool bounded = CalculateBounds( category, entity, &proxy.bounds );
+		const bool was_bounded = ( proxy.tree_proxy != AABBTree::NULL_NODE );
+		if( bounded && was_bounded )
+		{
+			cat.tree.MoveProxy( proxy.tree_proxy, proxy.bounds );
+		}
+		else if( bounded )
+		{
+			proxy.tree_proxy = cat.tree.CreateProxy( proxy.bounds, (uint32_t)proxy_index );
+			cat.unbounded.erase( std::find( cat.unbounded.begin(), cat.unbounded.end(), proxy_index ) );
+		}
+		else if( was_bounded )
+		{
+			cat.tree.DestroyProxy( proxy.tree_proxy );
+			proxy.tree_proxy = AABBTree::NULL_NODE;
+			cat.unbounded.push_back( proxy_index );
+		}
+
+		return true;
+	}
+
+	bool SpatialIndexSystem::CalculateBounds( SpatialCategory category, Entity entity, AABB* bounds_out )
+	{
+		const Mat3x4& transform = entity.Get<TransformComponent>().LocalToWorldMatrix();
+
+		switch( category )
+		{
+		case SpatialCategory::MODEL:
+		{
+			*bounds_out = entity.Get<ModelComponent>().GetAABB().TransformBounds( transform );
+			return true;
+		}
+		case SpatialCategory::LIGHT:
+		{
+			const LightComponent& light = entity.Get<LightComponent>();
+			if( light.GetType() == LightType::DIRECTIONAL )
+			{
+				return false;
+			}
+
+			const Vec3 position = transform.GetTranslation();
+			const float range = light.GetRange();
+			*bounds_out = AABB( position - Vec3{ range, range, range }, position + Vec3{ range, range, range } );
+			return true;
+		}
+		default:
+			ASSERT( false, "Unhandled spatial category" );
+			return false;
+		}
+	}
+}
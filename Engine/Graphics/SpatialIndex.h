@@ -0,0 +1,96 @@
+#pragma once
+
+#include <vector>
+#include <unordered_map>
+#include "Core/Entity.h"
+#include "Events/EntityEvents.h"
+#include "Util/AABBTree.h"
+#include "Light.h"
+
+namespace Bat
+{
+	class ModelComponent;
+	class HierarchySystem;
+
+	enum class SpatialCategory
+	{
+		MODEL,
+		LIGHT,
+
+		COUNT
+	};
+
+	// Keeps entities with a ModelComponent or LightComponent in an AABB tree per category so scene queries cost
+	// roughly the number of results instead of the number of entities. New components are picked up and entities
+	// the hierarchy reports as moved are refit in Update, which has to run after every HierarchySystem update.
+	//
+	// Models are bounded by their transformed model AABB and point/spot lights by the sphere of their range.
+	// Directional lights have no bounds and are returned by every light query.
+	// The index can be accessed globally through spatial_index while it exists.
+	class SpatialIndexSystem
+	{
+	public:
+		SpatialIndexSystem( EntityManager& world, const HierarchySystem& hierarchy );
+		~SpatialIndexSystem();
+		SpatialIndexSystem( const SpatialIndexSystem& ) = delete;
+		SpatialIndexSystem& operator=( const SpatialIndexSystem& ) = delete;
+		SpatialIndexSystem( SpatialIndexSystem&& ) = delete;
+		SpatialIndexSystem& operator=( SpatialIndexSystem&& ) = delete;
+
+		void Update( EntityManager& world, float dt );
+
+		void OnEvent( const ComponentAddedEvent<ModelComponent>& e );
+		void OnEvent( const ComponentRemovedEvent<ModelComponent>& e );
+		void OnEvent( const ComponentAddedEvent<LightComponent>& e );
+		void OnEvent( const ComponentRemovedEvent<LightComponent>& e );
+		void OnEvent( const ComponentRemovedEvent<TransformComponent>& e );
+		void OnEvent( const EntityDestroyedEvent& e );
+
+		// Queries append every entity whose bounds may overlap the shape to out, bounds are slightly enlarged so
+		// results are conservative
+		void QueryFrustum( SpatialCategory category, const Frustum& frustum, std::vector<Entity>& out ) const;
+		void QuerySphere( SpatialCategory category, const Vec3& centre, float radius, std::vector<Entity>& out ) const;
+		void QueryAABB( SpatialCategory category, const AABB& aabb, std::vector<Entity>& out ) const;
+		// Returns the entity whose bounds are hit closest along the ray, or Entity::INVALID. direction must be normalized.
+		Entity Raycast( SpatialCategory category, const Vec3& origin, const Vec3& direction, float max_distance, float* distance_out = nullptr ) const;
+
+		// World space bounds of an indexed entity as of the last update, returns false if it isn't indexed or has no bounds
+		bool GetBounds( SpatialCategory category, Entity entity, AABB* bounds_out ) const;
+		size_t GetEntityCount( SpatialCategory category ) const;
+	private:
+		struct Proxy
+		{
+			Entity::Id entity;
+			// AABBTree::NULL_NODE when the entity has no bounds
+			int32_t tree_proxy;
+			AABB bounds;
+			// what the bounds were calculated from, bounds are only recalculated when these change
+			Mat3x4 transform;
+			float range;
+			LightType light_type;
+		};
+
+		struct Category
+		{
+			AABBTree tree;
+			// tree proxies store their index in here
+			std::vector<Proxy> proxies;
+			std::unordered_map<uint64_t, size_t> entity_to_proxy;
+			// proxies without bounds
+			std::vector<size_t> unbounded;
+			// entities that got the category's component since the last update
+			std::vector<Entity::Id> pending;
+		};
+
+		void Insert( SpatialCategory category, Entity entity );
+		void Remove( SpatialCategory category, Entity::Id entity );
+		// Returns false if the proxy was dropped because the entity is gone or lost its transform
+		bool Refit( SpatialCategory category, size_t proxy_index, Entity entity );
+		// Returns false when the entity has no bounds
+		static bool CalculateBounds( SpatialCategory category, Entity entity, AABB* bounds_out );
+	private:
+		EntityManager& m_World;
+		const HierarchySystem& m_Hierarchy;
+		Category m_Categories[(size_t)SpatialCategory::COUNT];
+	};
+}
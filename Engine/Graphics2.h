@@ -6,6 +6,8 @@
 #include "Graphics/DebugDraw.h"
 #include "Graphics/Renderer.h"
 #include "Graphics/GraphicsConvert.h"
+#include "Graphics/HeadlessGPUDevice.h"
+#include "Graphics/LightClusters.h"
 #include "Graphics/Material.h"
 #include "Graphics/Mesh.h"
 #include "Graphics/MeshBuilder.h"
@@ -19,6 +21,7 @@
 #include "Graphics/ShaderManager.h"
 #include "Graphics/ShadowPipeline.h"
 #include "Graphics/SkyboxPipeline.h"
+#include "Graphics/SpatialIndex.h"
 #include "Graphics/Texture.h"
 #include "Graphics/TexturePipeline.h"
 
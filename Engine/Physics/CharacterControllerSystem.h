@@ -50,15 +50,9 @@ namespace Bat
 
 		void Update( EntityManager& world, float deltatime )
 		{
-			for( Entity ent : world )
+			for( auto [ent, cont, t] : world.View<CharacterControllerComponent, TransformComponent>() )
 			{
-				if( ent.Has<CharacterControllerComponent>() )
-				{
-					auto& cont = ent.Get<CharacterControllerComponent>();
-					auto& t = ent.Get<TransformComponent>();
-
-					t.SetPosition( cont.m_pController->GetPosition() );
-				}
+				t.SetPosition( cont.m_pController->GetPosition() );
 			}
 		}
 	};
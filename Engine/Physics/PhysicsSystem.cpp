@@ -25,57 +25,51 @@ namespace Bat
 	}
 	void PhysicsSystem::Update( EntityManager& world, float deltatime )
 	{
-		for( Entity ent : world )
+		for( auto [ent, phys, t] : world.View<PhysicsComponent, TransformComponent>() )
 		{
-			if( ent.Has<PhysicsComponent>() )
-			{
-				auto& phys = ent.Get<PhysicsComponent>();
-				auto& t = ent.Get<TransformComponent>();
-
-				IPhysicsObject* obj = phys.m_pObject.get();
+			IPhysicsObject* obj = phys.m_pObject.get();
 
-				if( phys.m_AddMeshShape != PhysicsComponent::AddMeshType::NONE )
+			if( phys.m_AddMeshShape != PhysicsComponent::AddMeshType::NONE )
+			{
+				if( phys.m_AddMeshShape == PhysicsComponent::AddMeshType::SHAPE )
 				{
-					if( phys.m_AddMeshShape == PhysicsComponent::AddMeshType::SHAPE )
+					const auto& model = ent.Get<ModelComponent>();
+					for( const auto& mesh : model.GetMeshes() )
 					{
-						const auto& model = ent.Get<ModelComponent>();
-						for( const auto& mesh : model.GetMeshes() )
-						{
-							obj->AddMeshShape(
-								mesh->GetVertexData(), mesh->GetVertexCount(),
-								mesh->GetIndexData(), mesh->GetIndexCount(),
-								t.GetScale(),
-								phys.m_Material );
-						}
+						obj->AddMeshShape(
+							mesh->GetVertexData(), mesh->GetVertexCount(),
+							mesh->GetIndexData(), mesh->GetIndexCount(),
+							t.GetScale(),
+							phys.m_Material );
 					}
-					else if( phys.m_AddMeshShape == PhysicsComponent::AddMeshType::TRIGGER )
+				}
+				else if( phys.m_AddMeshShape == PhysicsComponent::AddMeshType::TRIGGER )
+				{
+					const auto& model = ent.Get<ModelComponent>();
+					for( const auto& mesh : model.GetMeshes() )
 					{
-						const auto& model = ent.Get<ModelComponent>();
-						for( const auto& mesh : model.GetMeshes() )
-						{
-							obj->AddMeshTrigger(
-								mesh->GetVertexData(), mesh->GetVertexCount(),
-								mesh->GetIndexData(), mesh->GetIndexCount(),
-								t.GetScale() );
-						}
+						obj->AddMeshTrigger(
+							mesh->GetVertexData(), mesh->GetVertexCount(),
+							mesh->GetIndexData(), mesh->GetIndexCount(),
+							t.GetScale() );
 					}
-					phys.m_AddMeshShape = PhysicsComponent::AddMeshType::NONE;
 				}
+				phys.m_AddMeshShape = PhysicsComponent::AddMeshType::NONE;
+			}
 
-				// Kinematic objects update physics system, non-kinematic objects are updated by physics system
-				if( phys.GetType() == PhysicsObjectType::DYNAMIC )
+			// Kinematic objects update physics system, non-kinematic objects are updated by physics system
+			if( phys.GetType() == PhysicsObjectType::DYNAMIC )
+			{
+				if( phys.IsKinematic() )
 				{
-					if( phys.IsKinematic() )
-					{
-						static_cast<IDynamicObject*>( obj )->MoveTo( t.GetPosition(), t.GetRotation() );
-					}
-					else
-					{
-						t.SetPosition( obj->GetPosition() );
-						t.SetRotation( obj->GetRotation() );
-					}
-					;
+					static_cast<IDynamicObject*>( obj )->MoveTo( t.GetPosition(), t.GetRotation() );
+				}
+				else
+				{
+					t.SetPosition( obj->GetPosition() );
+					t.SetRotation( obj->GetRotation() );
 				}
+				;
 			}
 		}
 	}
@@ -1,9 +1,15 @@
 #pragma once
 
+#include "Util/AABBTree.h"
+#include "Util/AllocationCounter.h"
 #include "Util/BatAssert.h"
+#include "Util/Bits.h"
+#include "Util/BoundsSoA.h"
 #include "Util/ByteSwap.h"
+#include "Util/Delegate.h"
 #include "Util/FileSystem.h"
 #include "Util/FileWatchdog.h"
+#include "Util/FrameAllocator.h"
 #include "Util/FrameTimer.h"
 #include "Util/Frustum.h"
 #include "Util/Hash.h"
@@ -12,6 +18,7 @@
 #include "Util/MemoryStream.h"
 #include "Util/Mutex.h"
 #include "Util/PoolAllocator.h"
+#include "Util/RadixSort.h"
 #include "Util/Reflect.h"
 #include "Util/StackAllocator.h"
 #include "Util/StateMachine.h"
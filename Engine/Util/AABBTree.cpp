@@ -0,0 +1,354 @@
+#include "PCH.h"
+#include "AABBTree.h"
+
+namespace Bat
+{
+	static float SurfaceArea( const AABB& aabb )
+	{
+		const Vec3 size = aabb.maxs - aabb.mins;
+		return 2.0f * ( size.x * size.y + size.y * size.z + size.z * size.x );
+	}
+
+	AABBTree::AABBTree( float margin )
+		:
+		m_flMargin( margin )
+	{}
+
+	int32_t AABBTree::CreateProxy( const AABB& aabb, uint32_t user_data )
+	{
+		const int32_t proxy = AllocateNode();
+		Node& node = m_Nodes[proxy];
+
+		const Vec3 margin = { m_flMargin, m_flMargin, m_flMargin };
+		node.aabb = AABB( aabb.mins - margin, aabb.maxs + margin );
+		node.user_data = user_data;
+		node.height = 0;
+
+		InsertLeaf( proxy );
+		m_iProxyCount++;
+
+		return proxy;
+	}
+
+	void AABBTree::DestroyProxy( int32_t proxy )
+	{
+		ASSERT( proxy >= 0 && proxy < (int32_t)m_Nodes.size() && m_Nodes[proxy].IsLeaf(), "Invalid proxy" );
+
+		RemoveLeaf( proxy );
+		FreeNode( proxy );
+		m_iProxyCount--;
+	}
+
+	bool AABBTree::MoveProxy( int32_t proxy, const AABB& aabb )
+	{
+		ASSERT( proxy >= 0 && proxy < (int32_t)m_Nodes.size() && m_Nodes[proxy].IsLeaf(), "Invalid proxy" );
+
+		if( Contains( m_Nodes[proxy].aabb, aabb ) )
+		{
+			return false;
+		}
+
+		RemoveLeaf( proxy );
+
+		const Vec3 margin = { m_flMargin, m_flMargin, m_flMargin };
+		m_Nodes[proxy].aabb = AABB( aabb.mins - margin, aabb.maxs + margin );
+
+		InsertLeaf( proxy );
+
+		return true;
+	}
+
+	void AABBTree::Clear()
+	{
+		m_Nodes.clear();
+		m_iRoot = NULL_NODE;
+		m_iFreeList = NULL_NODE;
+		m_iProxyCount = 0;
+	}
+
+	uint32_t AABBTree::GetUserData( int32_t proxy ) const
+	{
+		ASSERT( proxy >= 0 && proxy < (int32_t)m_Nodes.size(), "Invalid proxy" );
+		return m_Nodes[proxy].user_data;
+	}
+
+	void AABBTree::SetUserData( int32_t proxy, uint32_t user_data )
+	{
+		ASSERT( proxy >= 0 && proxy < (int32_t)m_Nodes.size() && m_Nodes[proxy].IsLeaf(), "Invalid proxy" );
+		m_Nodes[proxy].user_data = user_data;
+	}
+
+	const AABB& AABBTree::GetFatAABB( int32_t proxy ) const
+	{
+		ASSERT( proxy >= 0 && proxy < (int32_t)m_Nodes.size(), "Invalid proxy" );
+		return m_Nodes[proxy].aabb;
+	}
+
+	int AABBTree::GetHeight() const
+	{
+		return ( m_iRoot == NULL_NODE ) ? 0 : m_Nodes[m_iRoot].height;
+	}
+
+	bool AABBTree::Overlaps( const AABB& a, const AABB& b )
+	{
+		return a.mins.x <= b.maxs.x && a.maxs.x >= b.mins.x &&
+			a.mins.y <= b.maxs.y && a.maxs.y >= b.mins.y &&
+			a.mins.z <= b.maxs.z && a.maxs.z >= b.mins.z;
+	}
+
+	bool AABBTree::Contains( const AABB& outer, const AABB& inner )
+	{
+		return outer.mins.x <= inner.mins.x && outer.mins.y <= inner.mins.y && outer.mins.z <= inner.mins.z &&
+			outer.maxs.x >= inner.maxs.x && outer.maxs.y >= inner.maxs.y && outer.maxs.z >= inner.maxs.z;
+	}
+
+	AABB AABBTree::Union( const AABB& a, const AABB& b )
+	{
+		return AABB(
+			{ std::min( a.mins.x, b.mins.x ), std::min( a.mins.y, b.mins.y ), std::min( a.mins.z, b.mins.z ) },
+			{ std::max( a.maxs.x, b.maxs.x ), std::max( a.maxs.y, b.maxs.y ), std::max( a.maxs.z, b.maxs.z ) }
+		);
+	}
+
+	bool AABBTree::SphereOverlaps( const AABB& aabb, const Vec3& centre, float radius )
+	{
+		// distance from the centre to the closest point in the box
+		const float dx = std::max( { aabb.mins.x - centre.x, 0.0f, centre.x - aabb.maxs.x } );
+		const float dy = std::max( { aabb.mins.y - centre.y, 0.0f, centre.y - aabb.maxs.y } );
+		const float dz = std::max( { aabb.mins.z - centre.z, 0.0f, centre.z - aabb.maxs.z } );
+
+		return dx * dx + dy * dy + dz * dz <= radius * radius;
+	}
+
+	float AABBTree::RayDistance( const AABB& aabb, const Vec3& origin, const Vec3& inv_direction, float max_distance )
+	{
+		// slab test, infinities from axis aligned rays fall out of the min/max naturally
+		const float tx1 = ( aabb.mins.x - origin.x ) * inv_direction.x;
+		const float tx2 = ( aabb.maxs.x - origin.x ) * inv_direction.x;
+		const float ty1 = ( aabb.mins.y - origin.y ) * inv_direction.y;
+		const float ty2 = ( aabb.maxs.y - origin.y ) * inv_direction.y;
+		const float tz1 = ( aabb.mins.z - origin.z ) * inv_direction.z;
+		const float tz2 = ( aabb.maxs.z - origin.z ) * inv_direction.z;
+
+		const float t_enter = std::max( { std::min( tx1, tx2 ), std::min( ty1, ty2 ), std::min( tz1, tz2 ), 0.0f } );
+		const float t_exit = std::min( { std::max( tx1, tx2 ), std::max( ty1, ty2 ), std::max( tz1, tz2 ), max_distance } );
+
+		return ( t_enter <= t_exit ) ? t_enter : -1.0f;
+	}
+
+	int32_t AABBTree::AllocateNode()
+	{
+		int32_t node;
+		if( m_iFreeList != NULL_NODE )
+		{
+			node = m_iFreeList;
+			m_iFreeList = m_Nodes[node].parent;
+		}
+		else
+		{
+			node = (int32_t)m_Nodes.size();
+			m_Nodes.emplace_back();
+		}
+
+		m_Nodes[node].parent = NULL_NODE;
+		m_Nodes[node].left = NULL_NODE;
+		m_Nodes[node].right = NULL_NODE;
+		m_Nodes[node].height = 0;
+		m_Nodes[node].user_data = 0;
+
+		return node;
+	}
+
+	void AABBTree::FreeNode( int32_t node )
+	{
+		m_Nodes[node].parent = m_iFreeList;
+		m_Nodes[node].height = -1;
+		m_iFreeList = node;
+	}
+
+	void AABBTree::InsertLeaf( int32_t leaf )
+	{
+		if( m_iRoot == NULL_NODE )
+		{
+			m_iRoot = leaf;
+			m_Nodes[leaf].parent = NULL_NODE;
+			return;
+		}
+
+		// walk down to the sibling that grows the tree's surface area the least
+		const AABB leaf_aabb = m_Nodes[leaf].aabb;
+		int32_t sibling = m_iRoot;
+		while( !m_Nodes[sibling].IsLeaf() )
+		{
+			const Node& node = m_Nodes[sibling];
+			const float area = SurfaceArea( node.aabb );
+			const float combined_area = SurfaceArea( Union( node.aabb, leaf_aabb ) );
+
+			// cost of pairing the leaf with this node
+			const float cost = 2.0f * combined_area;
+			// every node below here grows by at least this much if the leaf goes further down
+			const float inheritance_cost = 2.0f * ( combined_area - area );
+
+			auto descend_cost = [&]( int32_t child )
+			{
+				const Node& child_node = m_Nodes[child];
+				const float new_area = SurfaceArea( Union( child_node.aabb, leaf_aabb ) );
+				if( child_node.IsLeaf() )
+				{
+					return new_area + inheritance_cost;
+				}
+				return ( new_area - SurfaceArea( child_node.aabb ) ) + inheritance_cost;
+			};
+
+			const float left_cost = descend_cost( node.left );
+			const float right_cost = descend_cost( node.right );
+
+			if( cost < left_cost && cost < right_cost )
+			{
+				break;
+			}
+
+			sibling = ( left_cost < right_cost ) ? node.left : node.right;
+		}
+
+		// new parent takes the sibling's place with the sibling and leaf as its children
+		const int32_t old_parent = m_Nodes[sibling].parent;
+		const int32_t new_parent = AllocateNode();
+		m_Nodes[new_parent].parent = old_parent;
+		m_Nodes[new_parent].aabb = Union( leaf_aabb, m_Nodes[sibling].aabb );
+		m_Nodes[new_parent].height = m_Nodes[sibling].height + 1;
+		m_Nodes[new_parent].left = sibling;
+		m_Nodes[new_parent].right = leaf;
+		m_Nodes[sibling].parent = new_parent;
+		m_Nodes[leaf].parent = new_parent;
+
+		if( old_parent == NULL_NODE )
+		{
+			m_iRoot = new_parent;
+		}
+		else if( m_Nodes[old_parent].left == sibling )
+		{
+			m_Nodes[old_parent].left = new_parent;
+		}
+		else
+		{
+			m_Nodes[old_parent].right = new_parent;
+		}
+
+		RefitAncestors( m_Nodes[leaf].parent );
+	}
+
+	void AABBTree::RemoveLeaf( int32_t leaf )
+	{
+		if( leaf == m_iRoot )
+		{
+			m_iRoot = NULL_NODE;
+			return;
+		}
+
+		// sibling takes the parent's place
+		const int32_t parent = m_Nodes[leaf].parent;
+		const int32_t grandparent = m_Nodes[parent].parent;
+		const int32_t sibling = ( m_Nodes[parent].left == leaf ) ? m_Nodes[parent].right : m_Nodes[parent].left;
+
+		m_Nodes[sibling].parent = grandparent;
+		FreeNode( parent );
+
+		if( grandparent == NULL_NODE )
+		{
+			m_iRoot = sibling;
+			return;
+		}
+
+		if( m_Nodes[grandparent].left == parent )
+		{
+			m_Nodes[grandparent].left = sibling;
+		}
+		else
+		{
+			m_Nodes[grandparent].right = sibling;
+		}
+
+		RefitAncestors( grandparent );
+	}
+
+	void AABBTree::RefitAncestors( int32_t node )
+	{
+		while( node != NULL_NODE )
+		{
+			node = Balance( node );
+
+			Node& n = m_Nodes[node];
+			n.height = 1 + std::max( m_Nodes[n.left].height, m_Nodes[n.right].height );
+			n.aabb = Union( m_Nodes[n.left].aabb, m_Nodes[n.right].aabb );
+
+			node = n.parent;
+		}
+	}
+
+	int32_t AABBTree::Balance( int32_t a )
+	{
+		if( m_Nodes[a].IsLeaf() || m_Nodes[a].height < 2 )
+		{
+			return a;
+		}
+
+		const int32_t b = m_Nodes[a].left;
+		const int32_t c = m_Nodes[a].right;
+		const int32_t balance = m_Nodes[c].height - m_Nodes[b].height;
+		if( balance >= -1 && balance <= 1 )
+		{
+			return a;
+		}
+
+		// promote the taller child, a becomes its child along with the taller of its grandchildren
+		const int32_t up = ( balance > 1 ) ? c : b;
+		const int32_t other = ( balance > 1 ) ? b : c;
+		const int32_t f = m_Nodes[up].left;
+		const int32_t g = m_Nodes[up].right;
+
+		// up takes a's place
+		const int32_t a_parent = m_Nodes[a].parent;
+		m_Nodes[up].left = a;
+		m_Nodes[up].parent = a_parent;
+		m_Nodes[a].parent = up;
+
+		if( a_parent == NULL_NODE )
+		{
+			m_iRoot = up;
+		}
+		else if( m_Nodes[a_parent].left == a )
+		{
+			m_Nodes[a_parent].left = up;
+		}
+		else
+		{
+			m_Nodes[a_parent].right = up;
+		}
+
+		// taller grandchild stays with up, the shorter one moves under a next to a's other child
+		const bool keep_f = m_Nodes[f].height > m_Nodes[g].height;
+		const int32_t kept = keep_f ? f : g;
+		const int32_t moved = keep_f ? g : f;
+
+		m_Nodes[up].right = kept;
+		if( balance > 1 )
+		{
+			m_Nodes[a].left = other;
+			m_Nodes[a].right = moved;
+		}
+		else
+		{
+			m_Nodes[a].left = moved;
+			m_Nodes[a].right = other;
+		}
+		m_Nodes[moved].parent = a;
+
+		m_Nodes[a].aabb = Union( m_Nodes[m_Nodes[a].left].aabb, m_Nodes[m_Nodes[a].right].aabb );
+		m_Nodes[a].height = 1 + std::max( m_Nodes[m_Nodes[a].left].height, m_Nodes[m_Nodes[a].right].height );
+		m_Nodes[up].aabb = Union( m_Nodes[a].aabb, m_Nodes[kept].aabb );
+		m_Nodes[up].height = 1 + std::max( m_Nodes[a].height, m_Nodes[kept].height );
+
+		return up;
+	}
+}
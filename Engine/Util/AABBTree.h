@@ -0,0 +1,244 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+#include "MathLib.h"
+#include "Frustum.h"
+#include "BatAssert.h"
+
+namespace Bat
+{
+	// Dynamic bounding volume hierarchy of axis aligned boxes, each leaf (proxy) carries a user value.
+	// Leaves store their box enlarged by a margin so small movements don't touch the tree, and the tree is kept
+	// balanced with rotations as proxies come and go, so queries only visit branches overlapping the query shape
+	// and cost roughly O(log n + number of results).
+	class AABBTree
+	{
+	public:
+		static constexpr int32_t NULL_NODE = -1;
+
+		AABBTree( float margin = 0.1f );
+
+		// Returns the proxy handle, which stays valid until the proxy is destroyed
+		int32_t CreateProxy( const AABB& aabb, uint32_t user_data );
+		void DestroyProxy( int32_t proxy );
+		// Returns true if the box left its enlarged bounds and the proxy had to be reinserted
+		bool MoveProxy( int32_t proxy, const AABB& aabb );
+		void Clear();
+
+		uint32_t GetUserData( int32_t proxy ) const;
+		void SetUserData( int32_t proxy, uint32_t user_data );
+		// Enlarged bounds of the proxy
+		const AABB& GetFatAABB( int32_t proxy ) const;
+		size_t GetProxyCount() const { return m_iProxyCount; }
+		int GetHeight() const;
+
+		// callback( uint32_t user_data ) is called for every proxy whose enlarged bounds overlap the query
+		template <typename Callback>
+		void QueryAABB( const AABB& aabb, Callback&& callback ) const;
+		template <typename Callback>
+		void QuerySphere( const Vec3& centre, float radius, Callback&& callback ) const;
+		// callback( uint32_t user_data, bool fully_inside ), fully_inside is set when the proxy's enlarged bounds are
+		// entirely inside the frustum
+		template <typename Callback>
+		void QueryFrustum( const Frustum& frustum, Callback&& callback ) const;
+		// callback( uint32_t user_data, float distance ) is called for every proxy whose enlarged bounds the ray hits within
+		// max_distance, with the distance along the ray to the bounds. It returns the max distance to use for the rest
+		// of the ray, so returning distance finds the closest hit and returning max_distance finds all of them.
+		// direction must be normalized.
+		template <typename Callback>
+		void Raycast( const Vec3& origin, const Vec3& direction, float max_distance, Callback&& callback ) const;
+
+		static bool Overlaps( const AABB& a, const AABB& b );
+		static bool Contains( const AABB& outer, const AABB& inner );
+		static AABB Union( const AABB& a, const AABB& b );
+		static bool SphereOverlaps( const AABB& aabb, const Vec3& centre, float radius );
+		// Returns distance along the ray to the box or a negative number on a miss. inv_direction is 1 / direction per axis.
+		static float RayDistance( const AABB& aabb, const Vec3& origin, const Vec3& inv_direction, float max_distance );
+	private:
+		struct Node
+		{
+			AABB aabb;
+			// next free node when this node is in the free list
+			int32_t parent;
+			int32_t left;
+			int32_t right;
+			// leaves have a height of 0, free nodes -1
+			int32_t height;
+			uint32_t user_data;
+
+			bool IsLeaf() const { return left == NULL_NODE; }
+		};
+
+		// Deep enough for any balanced tree that fits in memory
+		static constexpr int MAX_QUERY_DEPTH = 128;
+
+		int32_t AllocateNode();
+		void FreeNode( int32_t node );
+		void InsertLeaf( int32_t leaf );
+		void RemoveLeaf( int32_t leaf );
+		// Rotates the subtree at node if it's unbalanced and returns the new subtree root
+		int32_t Balance( int32_t node );
+		// Fixes up heights and bounds from node to the root, balancing on the way
+		void RefitAncestors( int32_t node );
+	private:
+		std::vector<Node> m_Nodes;
+		int32_t m_iRoot = NULL_NODE;
+		int32_t m_iFreeList = NULL_NODE;
+		size_t m_iProxyCount = 0;
+		float m_flMargin;
+	};
+
+	template <typename Callback>
+	inline void AABBTree::QueryAABB( const AABB& aabb, Callback&& callback ) const
+	{
+		if( m_iRoot == NULL_NODE )
+		{
+			return;
+		}
+
+		int32_t stack[MAX_QUERY_DEPTH];
+		int stack_size = 0;
+		stack[stack_size++] = m_iRoot;
+
+		while( stack_size )
+		{
+			const Node& node = m_Nodes[stack[--stack_size]];
+			if( !Overlaps( node.aabb, aabb ) )
+			{
+				continue;
+			}
+
+			if( node.IsLeaf() )
+			{
+				callback( node.user_data );
+			}
+			else
+			{
+				ASSERT( stack_size + 2 <= MAX_QUERY_DEPTH, "AABB tree is too deep" );
+				stack[stack_size++] = node.left;
+				stack[stack_size++] = node.right;
+			}
+		}
+	}
+
+	template <typename Callback>
+	inline void AABBTree::QuerySphere( const Vec3& centre, float radius, Callback&& callback ) const
+	{
+		if( m_iRoot == NULL_NODE )
+		{
+			return;
+		}
+
+		int32_t stack[MAX_QUERY_DEPTH];
+		int stack_size = 0;
+		stack[stack_size++] = m_iRoot;
+
+		while( stack_size )
+		{
+			const Node& node = m_Nodes[stack[--stack_size]];
+			if( !SphereOverlaps( node.aabb, centre, radius ) )
+			{
+				continue;
+			}
+
+			if( node.IsLeaf() )
+			{
+				callback( node.user_data );
+			}
+			else
+			{
+				ASSERT( stack_size + 2 <= MAX_QUERY_DEPTH, "AABB tree is too deep" );
+				stack[stack_size++] = node.left;
+				stack[stack_size++] = node.right;
+			}
+		}
+	}
+
+	template <typename Callback>
+	inline void AABBTree::QueryFrustum( const Frustum& frustum, Callback&& callback ) const
+	{
+		if( m_iRoot == NULL_NODE )
+		{
+			return;
+		}
+
+		struct Entry
+		{
+			int32_t node;
+			// an ancestor is entirely inside, nothing below needs testing
+			bool inside;
+		};
+
+		Entry stack[MAX_QUERY_DEPTH];
+		int stack_size = 0;
+		stack[stack_size++] = { m_iRoot, false };
+
+		while( stack_size )
+		{
+			Entry entry = stack[--stack_size];
+			const Node& node = m_Nodes[entry.node];
+
+			if( !entry.inside )
+			{
+				const Frustum::Intersection result = frustum.ClassifyBox( node.aabb.mins, node.aabb.maxs );
+				if( result == Frustum::Intersection::OUTSIDE )
+				{
+					continue;
+				}
+				entry.inside = ( result == Frustum::Intersection::INSIDE );
+			}
+
+			if( node.IsLeaf() )
+			{
+				callback( node.user_data, entry.inside );
+			}
+			else
+			{
+				ASSERT( stack_size + 2 <= MAX_QUERY_DEPTH, "AABB tree is too deep" );
+				stack[stack_size++] = { node.left, entry.inside };
+				stack[stack_size++] = { node.right, entry.inside };
+			}
+		}
+	}
+
+	template <typename Callback>
+	inline void AABBTree::Raycast( const Vec3& origin, const Vec3& direction, float max_distance, Callback&& callback ) const
+	{
+		if( m_iRoot == NULL_NODE )
+		{
+			return;
+		}
+
+		const Vec3 inv_direction = { 1.0f / direction.x, 1.0f / direction.y, 1.0f / direction.z };
+
+		int32_t stack[MAX_QUERY_DEPTH];
+		int stack_size = 0;
+		stack[stack_size++] = m_iRoot;
+
+		while( stack_size )
+		{
+			const Node& node = m_Nodes[stack[--stack_size]];
+			const float distance = RayDistance( node.aabb, origin, inv_direction, max_distance );
+			if( distance < 0.0f )
+			{
+				continue;
+			}
+
+			if( node.IsLeaf() )
+			{
+				max_distance = callback( node.user_data, distance );
+				if( max_distance <= 0.0f )
+				{
+					return;
+				}
+			}
+			else
+			{
+				ASSERT( stack_size + 2 <= MAX_QUERY_DEPTH, "AABB tree is too deep" );
+				stack[stack_size++] = node.left;
+				stack[stack_size++] = node.right;
+			}
+		}
+	}
+}
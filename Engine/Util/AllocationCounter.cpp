@@ -0,0 +1,84 @@
+#include "PCH.h"
+#include "AllocationCounter.h"
+
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+namespace Bat
+{
+	static std::atomic<uint64_t> g_iTotalAllocations = 0;
+
+	uint64_t AllocationCounter::GetTotalAllocations()
+	{
+		return g_iTotalAllocations.load( std::memory_order_relaxed );
+	}
+
+	static void* CountedAlloc( size_t size )
+	{
+		g_iTotalAllocations.fetch_add( 1, std::memory_order_relaxed );
+		return std::malloc( size ? size : 1 );
+	}
+}
+
+// Replacements for the global allocation functions, over-aligned new/delete are left as the defaults
+
+void* operator new( size_t size )
+{
+	void* pAlloc = Bat::CountedAlloc( size );
+	if( !pAlloc )
+	{
+		throw std::bad_alloc();
+	}
+	return pAlloc;
+}
+
+void* operator new[]( size_t size )
+{
+	void* pAlloc = Bat::CountedAlloc( size );
+	if( !pAlloc )
+	{
+		throw std::bad_alloc();
+	}
+	return pAlloc;
+}
+
+void* operator new( size_t size, const std::nothrow_t& ) noexcept
+{
+	return Bat::CountedAlloc( size );
+}
+
+void* operator new[]( size_t size, const std::nothrow_t& ) noexcept
+{
+	return Bat::CountedAlloc( size );
+}
+
+void operator delete( void* ptr ) noexcept
+{
+	std::free( ptr );
+}
+
+void operator delete[]( void* ptr ) noexcept
+{
+	std::free( ptr );
+}
+
+void operator delete( void* ptr, size_t ) noexcept
+{
+	std::free( ptr );
+}
+
+void operator delete[]( void* ptr, size_t ) noexcept
+{
+	std::free( ptr );
+}
+
+void operator delete( void* ptr, const std::nothrow_t& ) noexcept
+{
+	std::free( ptr );
+}
+
+void operator delete[]( void* ptr, const std::nothrow_t& ) noexcept
+{
+	std::free( ptr );
+}
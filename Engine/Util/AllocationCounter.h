@@ -0,0 +1,14 @@
+#pragma once
+
+#include <cstdint>
+
+namespace Bat
+{
+	// Counts every heap allocation made through the global operator new, so code that is meant to be allocation free
+	// can be checked by comparing the count before and after it runs. Counts allocations from every thread.
+	class AllocationCounter
+	{
+	public:
+		static uint64_t GetTotalAllocations();
+	};
+}
@@ -0,0 +1,31 @@
+#pragma once
+
+#include <cstdint>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+namespace Bat
+{
+	// Index of the lowest set bit, value must be non-zero
+	inline uint32_t CountTrailingZeros( uint64_t value )
+	{
+#ifdef _MSC_VER
+		unsigned long index;
+		_BitScanForward64( &index, value );
+		return (uint32_t)index;
+#else
+		return (uint32_t)__builtin_ctzll( value );
+#endif
+	}
+
+	// Number of set bits
+	inline uint32_t PopCount( uint64_t value )
+	{
+#ifdef _MSC_VER
+		return (uint32_t)__popcnt64( value );
+#else
+		return (uint32_t)__builtin_popcountll( value );
+#endif
+	}
+}
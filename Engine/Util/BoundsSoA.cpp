@@ -0,0 +1,106 @@
+#include "PCH.h"
+#include "BoundsSoA.h"
+
+namespace Bat
+{
+	static size_t RoundUpToBatch( size_t count )
+	{
+		return (count + BoxesSoA::BATCH_SIZE - 1) / BoxesSoA::BATCH_SIZE * BoxesSoA::BATCH_SIZE;
+	}
+
+	void BoxesSoA::Clear()
+	{
+		m_iCount = 0;
+		m_CentreX.clear();
+		m_CentreY.clear();
+		m_CentreZ.clear();
+		m_ExtentX.clear();
+		m_ExtentY.clear();
+		m_ExtentZ.clear();
+	}
+
+	void BoxesSoA::Reserve( size_t count )
+	{
+		const size_t padded = RoundUpToBatch( count );
+		m_CentreX.reserve( padded );
+		m_CentreY.reserve( padded );
+		m_CentreZ.reserve( padded );
+		m_ExtentX.reserve( padded );
+		m_ExtentY.reserve( padded );
+		m_ExtentZ.reserve( padded );
+	}
+
+	size_t BoxesSoA::Add( const AABB& aabb )
+	{
+		const size_t index = m_iCount++;
+		if( index == m_CentreX.size() )
+		{
+			const size_t padded = RoundUpToBatch( m_iCount );
+			m_CentreX.resize( padded, 0.0f );
+			m_CentreY.resize( padded, 0.0f );
+			m_CentreZ.resize( padded, 0.0f );
+			m_ExtentX.resize( padded, 0.0f );
+			m_ExtentY.resize( padded, 0.0f );
+			m_ExtentZ.resize( padded, 0.0f );
+		}
+
+		Set( index, aabb );
+		return index;
+	}
+
+	void BoxesSoA::Set( size_t index, const AABB& aabb )
+	{
+		ASSERT( index < m_iCount, "Invalid box index" );
+
+		m_CentreX[index] = (aabb.mins.x + aabb.maxs.x) * 0.5f;
+		m_CentreY[index] = (aabb.mins.y + aabb.maxs.y) * 0.5f;
+		m_CentreZ[index] = (aabb.mins.z + aabb.maxs.z) * 0.5f;
+		m_ExtentX[index] = (aabb.maxs.x - aabb.mins.x) * 0.5f;
+		m_ExtentY[index] = (aabb.maxs.y - aabb.mins.y) * 0.5f;
+		m_ExtentZ[index] = (aabb.maxs.z - aabb.mins.z) * 0.5f;
+	}
+
+	void SpheresSoA::Clear()
+	{
+		m_iCount = 0;
+		m_CentreX.clear();
+		m_CentreY.clear();
+		m_CentreZ.clear();
+		m_Radius.clear();
+	}
+
+	void SpheresSoA::Reserve( size_t count )
+	{
+		const size_t padded = RoundUpToBatch( count );
+		m_CentreX.reserve( padded );
+		m_CentreY.reserve( padded );
+		m_CentreZ.reserve( padded );
+		m_Radius.reserve( padded );
+	}
+
+	size_t SpheresSoA::Add( const Vec3& centre, float radius )
+	{
+		const size_t index = m_iCount++;
+		if( index == m_CentreX.size() )
+		{
+			const size_t padded = RoundUpToBatch( m_iCount );
+			m_CentreX.resize( padded, 0.0f );
+			m_CentreY.resize( padded, 0.0f );
+			m_CentreZ.resize( padded, 0.0f );
+			m_Radius.resize( padded, 0.0f );
+		}
+
+		Set( index, centre, radius );
+		return index;
+	}
+
+	void SpheresSoA::Set( size_t index, const Vec3& centre, float radius )
+	{
+		ASSERT( index < m_iCount, "Invalid sphere index" );
+
+		m_CentreX[index] = centre.x;
+		m_CentreY[index] = centre.y;
+		m_CentreZ[index] = centre.z;
+		m_Radius[index] = radius;
+	}
+}
@@ -0,0 +1,69 @@
+#pragma once
+
+#include <vector>
+#include "MathLib.h"
+
+namespace Bat
+{
+	// Axis aligned boxes stored as centre/extent arrays for batch culling (see Frustum::CullBoxes).
+	// Arrays are padded with empty boxes to a multiple of BATCH_SIZE so SIMD kernels never need a scalar tail.
+	class BoxesSoA
+	{
+	public:
+		static constexpr size_t BATCH_SIZE = 8;
+
+		void Clear();
+		void Reserve( size_t count );
+		// Returns the index of the new box
+		size_t Add( const AABB& aabb );
+		void Set( size_t index, const AABB& aabb );
+
+		size_t GetCount() const { return m_iCount; }
+		// Count rounded up to BATCH_SIZE, every array has this many elements
+		size_t GetPaddedCount() const { return m_CentreX.size(); }
+
+		const float* GetCentreX() const { return m_CentreX.data(); }
+		const float* GetCentreY() const { return m_CentreY.data(); }
+		const float* GetCentreZ() const { return m_CentreZ.data(); }
+		const float* GetExtentX() const { return m_ExtentX.data(); }
+		const float* GetExtentY() const { return m_ExtentY.data(); }
+		const float* GetExtentZ() const { return m_ExtentZ.data(); }
+	private:
+		size_t m_iCount = 0;
+		std::vector<float> m_CentreX;
+		std::vector<float> m_CentreY;
+		std::vector<float> m_CentreZ;
+		std::vector<float> m_ExtentX;
+		std::vector<float> m_ExtentY;
+		std::vector<float> m_ExtentZ;
+	};
+
+	// Bounding spheres stored as centre/radius arrays for batch culling (see Frustum::CullSpheres).
+	// Padded the same way as BoxesSoA.
+	class SpheresSoA
+	{
+	public:
+		static constexpr size_t BATCH_SIZE = BoxesSoA::BATCH_SIZE;
+
+		void Clear();
+		void Reserve( size_t count );
+		// Returns the index of the new sphere
+		size_t Add( const Vec3& centre, float radius );
+		void Set( size_t index, const Vec3& centre, float radius );
+
+		size_t GetCount() const { return m_iCount; }
+		// Count rounded up to BATCH_SIZE, every array has this many elements
+		size_t GetPaddedCount() const { return m_CentreX.size(); }
+
+		const float* GetCentreX() const { return m_CentreX.data(); }
+		const float* GetCentreY() const { return m_CentreY.data(); }
+		const float* GetCentreZ() const { return m_CentreZ.data(); }
+		const float* GetRadius() const { return m_Radius.data(); }
+	private:
+		size_t m_iCount = 0;
+		std::vector<float> m_CentreX;
+		std::vector<float> m_CentreY;
+		std::vector<float> m_CentreZ;
+		std::vector<float> m_Radius;
+	};
+}
@@ -0,0 +1,63 @@
+#pragma once
+
+#include <new>
+#include <type_traits>
+#include <utility>
+
+namespace Bat
+{
+	template <typename Signature>
+	class Delegate;
+
+	// Non-allocating replacement for std::function for small callbacks.
+	// Stores the callable inline next to a single invoke thunk, so calling it is one indirect call
+	// and copying it is a memcpy. Callables must be trivially copyable/destructible and fit in STORAGE_SIZE,
+	// which covers member function bindings and lambdas capturing a few pointers/references.
+	template <typename R, typename... Args>
+	class Delegate<R( Args... )>
+	{
+	public:
+		static constexpr size_t STORAGE_SIZE = 3 * sizeof( void* );
+
+		Delegate() = default;
+
+		template <typename F, typename = std::enable_if_t<!std::is_same_v<std::decay_t<F>, Delegate>>>
+		Delegate( F&& func )
+		{
+			using Func_t = std::decay_t<F>;
+			static_assert( sizeof( Func_t ) <= STORAGE_SIZE, "Callable too large for Delegate, capture less or capture by reference" );
+			static_assert( alignof( Func_t ) <= alignof( void* ), "Callable alignment too large for Delegate" );
+			static_assert( std::is_trivially_copyable_v<Func_t> && std::is_trivially_destructible_v<Func_t>,
+				"Delegate callables must be trivially copyable and destructible" );
+
+			new( m_Storage ) Func_t( std::forward<F>( func ) );
+			m_pInvoke = []( const void* pStorage, Args... args ) -> R
+			{
+				return (*const_cast<Func_t*>( static_cast<const Func_t*>( pStorage ) ))( std::forward<Args>( args )... );
+			};
+		}
+
+		// Binds a member function, e.g. Delegate<void( int )>::FromMember<&Foo::Bar>( foo )
+		template <auto Method, typename T>
+		static Delegate FromMember( T& object )
+		{
+			T* pObject = &object;
+			return Delegate( [pObject]( Args... args ) -> R
+			{
+				return (pObject->*Method)( std::forward<Args>( args )... );
+			} );
+		}
+
+		R operator()( Args... args ) const
+		{
+			return m_pInvoke( m_Storage, std::forward<Args>( args )... );
+		}
+
+		explicit operator bool() const { return m_pInvoke != nullptr; }
+	private:
+		using Invoke_t = R(*)( const void* pStorage, Args... args );
+
+		alignas( void* ) char m_Storage[STORAGE_SIZE] = {};
+		Invoke_t m_pInvoke = nullptr;
+	};
+}
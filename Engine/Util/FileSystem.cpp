@@ -171,4 +171,74 @@ namespace Bat
 	{
 		return m_pFileSystem->Tell( m_hFile );
 	}
-}
+
+	MappedFile::MappedFile( const char* filename )
+	{
+		HANDLE file = CreateFileA( filename, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL );
+		if( file == INVALID_HANDLE_VALUE )
+		{
+			return;
+		}
+		m_hFile = file;
+
+		LARGE_INTEGER size;
+		if( !GetFileSizeEx( file, &size ) || size.QuadPart == 0 )
+		{
+			Close();
+			return;
+		}
+
+		m_hMapping = CreateFileMappingA( file, NULL, PAGE_WRITECOPY, 0, 0, NULL );
+		if( !m_hMapping )
+		{
+			BAT_WARN( "Failed to map file %s: %s", filename, GetLastWinErrorAsString() );
+			Close();
+			return;
+		}
+
+		m_pData = (char*)MapViewOfFile( m_hMapping, FILE_MAP_COPY, 0, 0, 0 );
+		if( !m_pData )
+		{
+			BAT_WARN( "Failed to map view of file %s: %s", filename, GetLastWinErrorAsString() );
+			Close();
+			return;
+		}
+		m_iSize = (size_t)size.QuadPart;
+	}
+	MappedFile::~MappedFile()
+	{
+		Close();
+	}
+	MappedFile::MappedFile( MappedFile&& donor )
+	{
+		*this = std::move( donor );
+	}
+	MappedFile& MappedFile::operator=( MappedFile&& donor )
+	{
+		std::swap( m_hFile, donor.m_hFile );
+		std::swap( m_hMapping, donor.m_hMapping );
+		std::swap( m_pData, donor.m_pData );
+		std::swap( m_iSize, donor.m_iSize );
+
+		return *this;
+	}
+	void MappedFile::Close()
+	{
+		if( m_pData )
+		{
+			UnmapViewOfFile( m_pData );
+			m_pData = nullptr;
+		}
+		if( m_hMapping )
+		{
+			CloseHandle( m_hMapping );
+			m_hMapping = nullptr;
+		}
+		if( m_hFile )
+		{
+			CloseHandle( m_hFile );
+			m_hFile = nullptr;
+		}
+		m_iSize = 0;
+	}
+}
\ No newline at end of file
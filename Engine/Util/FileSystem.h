@@ -73,4 +73,28 @@ namespace Bat
 		FileHandle_t m_hFile = FileSystem::INVALID_HANDLE;
 		FileSystem* m_pFileSystem = nullptr;
 	};
+
+	// Maps a whole file into memory. Pages are copy on write, writes to the mapping never reach the file.
+	class MappedFile
+	{
+	public:
+		MappedFile() = default;
+		MappedFile( const char* filename );
+		~MappedFile();
+		MappedFile( const MappedFile& ) = delete;
+		MappedFile& operator=( const MappedFile& ) = delete;
+		MappedFile( MappedFile&& donor );
+		MappedFile& operator=( MappedFile&& donor );
+
+		bool IsOpen() const { return m_pData != nullptr; }
+		void Close();
+
+		char* Data() const { return m_pData; }
+		size_t Size() const { return m_iSize; }
+	private:
+		void* m_hFile = nullptr;
+		void* m_hMapping = nullptr;
+		char* m_pData = nullptr;
+		size_t m_iSize = 0;
+	};
 }
\ No newline at end of file
@@ -0,0 +1,172 @@
+#include "PCH.h"
+#include "FrameAllocator.h"
+
+#include <cstring>
+#include <memory>
+#include <mutex>
+
+#include "JobSystem.h"
+
+namespace Bat
+{
+	struct FrameArena
+	{
+		char* data = nullptr;
+		size_t capacity = 0;
+		size_t used = 0;
+		// allocations that didn't fit, freed when the arena is reset
+		std::vector<void*> overflow;
+		size_t overflow_bytes = 0;
+	};
+
+	struct alignas( 64 ) FrameThreadState
+	{
+		FrameArena arenas[2];
+	};
+
+	static std::unique_ptr<FrameThreadState[]> g_pFrameStates;
+	// one state per job system thread, plus a shared one at the end for every other thread
+	static uint32_t g_iNumFrameStates = 0;
+	static std::mutex g_SharedArenaMutex;
+	static uint32_t g_iCurrentArena = 0;
+
+	static void* AlignPointer( void* ptr, size_t alignment )
+	{
+		const uintptr_t address = (uintptr_t)ptr;
+		return (void*)( ( address + alignment - 1 ) & ~( alignment - 1 ) );
+	}
+
+	static void* AllocFromArena( FrameArena& arena, size_t size, size_t alignment )
+	{
+		const size_t offset = ( ( arena.used + alignment - 1 ) & ~( alignment - 1 ) );
+		if( offset + size <= arena.capacity )
+		{
+			arena.used = offset + size;
+			return arena.data + offset;
+		}
+
+		// out of room, the arena grows to fit this next time it is reset
+		void* pAlloc = ::operator new( size + alignment );
+		arena.overflow.push_back( pAlloc );
+		arena.overflow_bytes += size + alignment;
+		return AlignPointer( pAlloc, alignment );
+	}
+
+	static void ResetArena( FrameArena& arena )
+	{
+		if( arena.overflow_bytes )
+		{
+			for( void* pAlloc : arena.overflow )
+			{
+				::operator delete( pAlloc );
+			}
+
+			size_t new_capacity = arena.capacity;
+			while( new_capacity < arena.used + arena.overflow_bytes )
+			{
+				new_capacity *= 2;
+			}
+
+			BAT_WARN( "Frame allocator arena overflowed by %zu bytes, growing to %zu bytes", arena.overflow_bytes, new_capacity );
+
+			delete[] arena.data;
+			arena.data = new char[new_capacity];
+			arena.capacity = new_capacity;
+			arena.overflow.clear();
+			arena.overflow_bytes = 0;
+		}
+
+		arena.used = 0;
+	}
+
+	void FrameAllocator::Initialize()
+	{
+		const uint32_t num_threads = JobSystem::GetThreadCount();
+		ASSERT( num_threads > 0, "Job system must be initialized before the frame allocator" );
+
+		g_iNumFrameStates = num_threads + 1;
+		g_pFrameStates = std::make_unique<FrameThreadState[]>( g_iNumFrameStates );
+		for( uint32_t i = 0; i < g_iNumFrameStates; i++ )
+		{
+			for( FrameArena& arena : g_pFrameStates[i].arenas )
+			{
+				arena.data = new char[DEFAULT_ARENA_SIZE];
+				arena.capacity = DEFAULT_ARENA_SIZE;
+				arena.overflow.reserve( 16 );
+			}
+		}
+
+		g_iCurrentArena = 0;
+	}
+
+	void FrameAllocator::Shutdown()
+	{
+		for( uint32_t i = 0; i < g_iNumFrameStates; i++ )
+		{
+			for( FrameArena& arena : g_pFrameStates[i].arenas )
+			{
+				for( void* pAlloc : arena.overflow )
+				{
+					::operator delete( pAlloc );
+				}
+				delete[] arena.data;
+			}
+		}
+
+		g_pFrameStates.reset();
+		g_iNumFrameStates = 0;
+	}
+
+	void* FrameAllocator::Alloc( size_t size, size_t alignment )
+	{
+		ASSERT( g_pFrameStates, "Frame allocator used before it was initialized" );
+		ASSERT( alignment && ( alignment & ( alignment - 1 ) ) == 0, "Alignment must be a power of 2" );
+
+		const uint32_t thread_index = JobSystem::GetThreadIndex();
+		if( thread_index != JobSystem::INVALID_THREAD_INDEX )
+		{
+			return AllocFromArena( g_pFrameStates[thread_index].arenas[g_iCurrentArena], size, alignment );
+		}
+
+		std::lock_guard<std::mutex> lock( g_SharedArenaMutex );
+		return AllocFromArena( g_pFrameStates[g_iNumFrameStates - 1].arenas[g_iCurrentArena], size, alignment );
+	}
+
+	const char* FrameAllocator::CopyString( const char* str )
+	{
+		const size_t size = std::strlen( str ) + 1;
+		char* pCopy = Alloc<char>( size );
+		std::memcpy( pCopy, str, size );
+		return pCopy;
+	}
+
+	void FrameAllocator::EndFrame()
+	{
+		g_iCurrentArena ^= 1;
+		for( uint32_t i = 0; i < g_iNumFrameStates; i++ )
+		{
+			ResetArena( g_pFrameStates[i].arenas[g_iCurrentArena] );
+		}
+	}
+
+	size_t FrameAllocator::GetBytesUsed()
+	{
+		size_t total = 0;
+		for( uint32_t i = 0; i < g_iNumFrameStates; i++ )
+		{
+			const FrameArena& arena = g_pFrameStates[i].arenas[g_iCurrentArena];
+			total += arena.used + arena.overflow_bytes;
+		}
+		return total;
+	}
+
+	size_t FrameAllocator::GetOverflowBytes()
+	{
+		size_t total = 0;
+		for( uint32_t i = 0; i < g_iNumFrameStates; i++ )
+		{
+			total += g_pFrameStates[i].arenas[g_iCurrentArena].overflow_bytes;
+		}
+		return total;
+	}
+}
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <type_traits>
+#include <vector>
+
+namespace Bat
+{
+	// Linear allocator for data that only lives for a frame. Every job system thread gets its own pair of arenas so
+	// allocating is a pointer bump with no locking, threads the job system doesn't own share one behind a lock.
+	// The arenas are double buffered, memory allocated during a frame stays valid until the end of the next one,
+	// so anything handed to work that lags a frame behind (e.g. deferred command recording) doesn't need copying.
+	// Nothing is ever freed individually and destructors are never run.
+	class FrameAllocator
+	{
+	public:
+		// Size each thread's arenas start with, they grow at the end of a frame that didn't fit
+		static constexpr size_t DEFAULT_ARENA_SIZE = 1024 * 1024;
+
+		// Must be called after the job system has been initialized
+		static void Initialize();
+		static void Shutdown();
+
+		static void* Alloc( size_t size, size_t alignment = alignof( std::max_align_t ) );
+		// Uninitialized storage for count objects
+		template <typename T>
+		static T* Alloc( size_t count )
+		{
+			static_assert( std::is_trivially_destructible_v<T>, "Frame allocations never get destructed" );
+			return reinterpret_cast<T*>( Alloc( sizeof( T ) * count, alignof( T ) ) );
+		}
+		// Copy of a null terminated string
+		static const char* CopyString( const char* str );
+
+		// Flips every thread's arenas and resets the ones for the new frame, which frees everything allocated
+		// the frame before last. Called by the renderer at the end of the frame, nothing can be allocating while it runs.
+		static void EndFrame();
+
+		// Bytes allocated by every thread in the current frame
+		static size_t GetBytesUsed();
+		// Bytes that didn't fit in the arenas this frame and went to the heap instead
+		static size_t GetOverflowBytes();
+	};
+
+	// STL allocator adapter, containers using it must not outlive the frame after the one they were filled in
+	template <typename T>
+	class FrameStlAllocator
+	{
+	public:
+		using value_type = T;
+
+		FrameStlAllocator() = default;
+		template <typename U>
+		FrameStlAllocator( const FrameStlAllocator<U>& ) {}
+
+		T* allocate( size_t count )
+		{
+			return reinterpret_cast<T*>( FrameAllocator::Alloc( sizeof( T ) * count, alignof( T ) ) );
+		}
+		void deallocate( T*, size_t ) {}
+
+		template <typename U>
+		bool operator==( const FrameStlAllocator<U>& ) const { return true; }
+		template <typename U>
+		bool operator!=( const FrameStlAllocator<U>& ) const { return false; }
+	};
+
+	template <typename T>
+	using FrameVector = std::vector<T, FrameStlAllocator<T>>;
+}
@@ -1,8 +1,164 @@
 #include "PCH.h"
 #include "Frustum.h"
 
+#include <immintrin.h>
+#include "Bits.h"
+
 namespace Bat
 {
+	// SIMD helpers for the batch culling kernels
+#ifdef __AVX__
+	using SimdFloat = __m256;
+	static constexpr size_t SIMD_WIDTH = 8;
+
+	static inline SimdFloat SimdSet( float value ) { return _mm256_set1_ps( value ); }
+	static inline SimdFloat SimdLoad( const float* values ) { return _mm256_loadu_ps( values ); }
+	static inline SimdFloat SimdAdd( SimdFloat a, SimdFloat b ) { return _mm256_add_ps( a, b ); }
+	static inline SimdFloat SimdMul( SimdFloat a, SimdFloat b ) { return _mm256_mul_ps( a, b ); }
+	static inline SimdFloat SimdOr( SimdFloat a, SimdFloat b ) { return _mm256_or_ps( a, b ); }
+	static inline SimdFloat SimdLess( SimdFloat a, SimdFloat b ) { return _mm256_cmp_ps( a, b, _CMP_LT_OQ ); }
+	static inline uint32_t SimdMoveMask( SimdFloat a ) { return (uint32_t)_mm256_movemask_ps( a ); }
+#else
+	using SimdFloat = __m128;
+	static constexpr size_t SIMD_WIDTH = 4;
+
+	static inline SimdFloat SimdSet( float value ) { return _mm_set1_ps( value ); }
+	static inline SimdFloat SimdLoad( const float* values ) { return _mm_loadu_ps( values ); }
+	static inline SimdFloat SimdAdd( SimdFloat a, SimdFloat b ) { return _mm_add_ps( a, b ); }
+	static inline SimdFloat SimdMul( SimdFloat a, SimdFloat b ) { return _mm_mul_ps( a, b ); }
+	static inline SimdFloat SimdOr( SimdFloat a, SimdFloat b ) { return _mm_or_ps( a, b ); }
+	static inline SimdFloat SimdLess( SimdFloat a, SimdFloat b ) { return _mm_cmplt_ps( a, b ); }
+	static inline uint32_t SimdMoveMask( SimdFloat a ) { return (uint32_t)_mm_movemask_ps( a ); }
+#endif
+	static_assert( BoxesSoA::BATCH_SIZE % SIMD_WIDTH == 0, "Bounding volume arrays must be padded to a multiple of the SIMD width" );
+
+	static constexpr uint32_t SIMD_ALL_LANES = (1u << SIMD_WIDTH) - 1;
+
+	// Frustum planes splatted across SIMD lanes
+	struct SimdPlanes
+	{
+		SimdFloat nx[Frustum::TOTAL_PLANES];
+		SimdFloat ny[Frustum::TOTAL_PLANES];
+		SimdFloat nz[Frustum::TOTAL_PLANES];
+		SimdFloat d[Frustum::TOTAL_PLANES];
+		// absolute normal, projects box extents onto the plane normal
+		SimdFloat abs_nx[Frustum::TOTAL_PLANES];
+		SimdFloat abs_ny[Frustum::TOTAL_PLANES];
+		SimdFloat abs_nz[Frustum::TOTAL_PLANES];
+	};
+
+	static SimdPlanes SplatPlanes( const Plane* planes )
+	{
+		SimdPlanes splat;
+		for( int i = 0; i < Frustum::TOTAL_PLANES; i++ )
+		{
+			splat.nx[i] = SimdSet( planes[i].n.x );
+			splat.ny[i] = SimdSet( planes[i].n.y );
+			splat.nz[i] = SimdSet( planes[i].n.z );
+			splat.d[i] = SimdSet( planes[i].d );
+			splat.abs_nx[i] = SimdSet( std::abs( planes[i].n.x ) );
+			splat.abs_ny[i] = SimdSet( std::abs( planes[i].n.y ) );
+			splat.abs_nz[i] = SimdSet( std::abs( planes[i].n.z ) );
+		}
+
+		return splat;
+	}
+
+	static inline SimdFloat SimdPlaneDistance( const SimdPlanes& planes, int plane, SimdFloat x, SimdFloat y, SimdFloat z )
+	{
+		return SimdAdd( SimdAdd( SimdMul( planes.nx[plane], x ), SimdMul( planes.ny[plane], y ) ),
+			SimdAdd( SimdMul( planes.nz[plane], z ), planes.d[plane] ) );
+	}
+
+	// Calls emit( first_index, visible_lanes, inside_lanes ) for every SIMD_WIDTH boxes, including padding
+	template <typename Emit>
+	static void ClassifyBoxBatches( const Plane* planes, const BoxesSoA& boxes, Emit&& emit )
+	{
+		const SimdPlanes splat = SplatPlanes( planes );
+		const SimdFloat zero = SimdSet( 0.0f );
+
+		const size_t padded_count = boxes.GetPaddedCount();
+		for( size_t i = 0; i < padded_count; i += SIMD_WIDTH )
+		{
+			const SimdFloat cx = SimdLoad( boxes.GetCentreX() + i );
+			const SimdFloat cy = SimdLoad( boxes.GetCentreY() + i );
+			const SimdFloat cz = SimdLoad( boxes.GetCentreZ() + i );
+			const SimdFloat ex = SimdLoad( boxes.GetExtentX() + i );
+			const SimdFloat ey = SimdLoad( boxes.GetExtentY() + i );
+			const SimdFloat ez = SimdLoad( boxes.GetExtentZ() + i );
+
+			SimdFloat outside = zero;
+			SimdFloat intersects = zero;
+			for( int plane = 0; plane < Frustum::TOTAL_PLANES; plane++ )
+			{
+				const SimdFloat distance = SimdPlaneDistance( splat, plane, cx, cy, cz );
+				const SimdFloat radius = SimdAdd( SimdAdd( SimdMul( splat.abs_nx[plane], ex ), SimdMul( splat.abs_ny[plane], ey ) ),
+					SimdMul( splat.abs_nz[plane], ez ) );
+
+				// distance < -radius: entirely behind the plane, distance < radius: straddles it
+				outside = SimdOr( outside, SimdLess( SimdAdd( distance, radius ), zero ) );
+				intersects = SimdOr( intersects, SimdLess( distance, radius ) );
+			}
+
+			const uint32_t visible = ~SimdMoveMask( outside ) & SIMD_ALL_LANES;
+			const uint32_t inside = ~SimdMoveMask( intersects ) & visible;
+			emit( i, visible, inside );
+		}
+	}
+
+	// Calls emit( first_index, visible_lanes ) for every SIMD_WIDTH spheres, including padding
+	template <typename Emit>
+	static void ClassifySphereBatches( const Plane* planes, const SpheresSoA& spheres, Emit&& emit )
+	{
+		const SimdPlanes splat = SplatPlanes( planes );
+		const SimdFloat zero = SimdSet( 0.0f );
+
+		const size_t padded_count = spheres.GetPaddedCount();
+		for( size_t i = 0; i < padded_count; i += SIMD_WIDTH )
+		{
+			const SimdFloat cx = SimdLoad( spheres.GetCentreX() + i );
+			const SimdFloat cy = SimdLoad( spheres.GetCentreY() + i );
+			const SimdFloat cz = SimdLoad( spheres.GetCentreZ() + i );
+			const SimdFloat radius = SimdLoad( spheres.GetRadius() + i );
+
+			SimdFloat outside = zero;
+			for( int plane = 0; plane < Frustum::TOTAL_PLANES; plane++ )
+			{
+				const SimdFloat distance = SimdPlaneDistance( splat, plane, cx, cy, cz );
+				outside = SimdOr( outside, SimdLess( SimdAdd( distance, radius ), zero ) );
+			}
+
+			emit( i, ~SimdMoveMask( outside ) & SIMD_ALL_LANES );
+		}
+	}
+
+	// Padding volumes past count can pass the test, clears their bits from the last mask word
+	static void ClearPaddingBits( uint64_t* mask, size_t count )
+	{
+		if( count % 64 )
+		{
+			mask[count / 64] &= (1ull << (count % 64)) - 1;
+		}
+	}
+
+	// Appends the indices of the set lanes, skipping padding
+	static inline size_t CompactLanes( size_t first_index, uint32_t lanes, size_t count, uint32_t* out_indices, size_t num_indices )
+	{
+		while( lanes )
+		{
+			const size_t index = first_index + CountTrailingZeros( lanes );
+			if( index >= count )
+			{
+				break;
+			}
+
+			out_indices[num_indices++] = (uint32_t)index;
+			lanes &= lanes - 1;
+		}
+
+		return num_indices;
+	}
+
 	Frustum::Frustum( const Mat4& transform )
 	{
 		planes[LEFT_PLANE]   = Plane::Normalize( transform.GetRow( 3 ) + transform.GetRow( 0 ) );
@@ -79,6 +235,93 @@ namespace Bat
 		return true;
 	}
 
+	Frustum::Intersection Frustum::ClassifyBox( const Vec3& mins, const Vec3& maxs ) const
+	{
+		Vec3 centre = (mins + maxs) * 0.5f;
+		Vec3 extents = (maxs - mins) * 0.5f;
+
+		Intersection result = Intersection::INSIDE;
+		for( int i = 0; i < TOTAL_PLANES; i++ )
+		{
+			const Plane& plane = planes[i];
+			// projected radius of the box onto the plane normal
+			const float radius = extents.x * std::abs( plane.n.x ) + extents.y * std::abs( plane.n.y ) + extents.z * std::abs( plane.n.z );
+			const float distance = PlaneDotCoord( plane, centre );
+
+			if( distance < -radius )
+			{
+				return Intersection::OUTSIDE;
+			}
+			if( distance < radius )
+			{
+				result = Intersection::INTERSECTS;
+			}
+		}
+
+		return result;
+	}
+
+	void Frustum::CullBoxes( const BoxesSoA& boxes, uint64_t* out_visible, uint64_t* out_inside ) const
+	{
+		const size_t num_words = (boxes.GetCount() + 63) / 64;
+		std::fill( out_visible, out_visible + num_words, 0ull );
+		if( out_inside )
+		{
+			std::fill( out_inside, out_inside + num_words, 0ull );
+		}
+
+		ClassifyBoxBatches( planes, boxes, [=]( size_t first_index, uint32_t visible, uint32_t inside )
+		{
+			out_visible[first_index / 64] |= (uint64_t)visible << (first_index % 64);
+			if( out_inside )
+			{
+				out_inside[first_index / 64] |= (uint64_t)inside << (first_index % 64);
+			}
+		} );
+
+		ClearPaddingBits( out_visible, boxes.GetCount() );
+		if( out_inside )
+		{
+			ClearPaddingBits( out_inside, boxes.GetCount() );
+		}
+	}
+
+	void Frustum::CullSpheres( const SpheresSoA& spheres, uint64_t* out_visible ) const
+	{
+		std::fill( out_visible, out_visible + (spheres.GetCount() + 63) / 64, 0ull );
+
+		ClassifySphereBatches( planes, spheres, [=]( size_t first_index, uint32_t visible )
+		{
+			out_visible[first_index / 64] |= (uint64_t)visible << (first_index % 64);
+		} );
+
+		ClearPaddingBits( out_visible, spheres.GetCount() );
+	}
+
+	size_t Frustum::CullBoxesCompact( const BoxesSoA& boxes, uint32_t* out_indices ) const
+	{
+		const size_t count = boxes.GetCount();
+		size_t num_visible = 0;
+		ClassifyBoxBatches( planes, boxes, [&]( size_t first_index, uint32_t visible, uint32_t inside )
+		{
+			num_visible = CompactLanes( first_index, visible, count, out_indices, num_visible );
+		} );
+
+		return num_visible;
+	}
+
+	size_t Frustum::CullSpheresCompact( const SpheresSoA& spheres, uint32_t* out_indices ) const
+	{
+		const size_t count = spheres.GetCount();
+		size_t num_visible = 0;
+		ClassifySphereBatches( planes, spheres, [&]( size_t first_index, uint32_t visible )
+		{
+			num_visible = CompactLanes( first_index, visible, count, out_indices, num_visible );
+		} );
+
+		return num_visible;
+	}
+
 	Frustum Frustum::Transform( const Frustum& frustum, const Mat4& transform )
 	{
 		Frustum transformed;
@@ -1,6 +1,7 @@
 #pragma once
 
 #include "MathLib.h"
+#include "BoundsSoA.h"
 
 namespace Bat
 {
@@ -17,6 +18,13 @@ namespace Bat
 			FAR_PLANE,
 			TOTAL_PLANES
 		};
+
+		enum class Intersection
+		{
+			OUTSIDE,
+			INTERSECTS,
+			INSIDE
+		};
 	public:
 		Frustum() = default;
 		Frustum( const Mat4& transform );
@@ -24,6 +32,18 @@ namespace Bat
 		bool IsPointInside( const Vec3& point ) const;
 		bool IsBoxInside( const Vec3& mins, const Vec3& maxs ) const;
 		bool IsSphereInside( const Vec3& centre, float radius ) const;
+		// Like IsBoxInside, but also tells whether the box is entirely inside so anything contained in it can skip testing
+		Intersection ClassifyBox( const Vec3& mins, const Vec3& maxs ) const;
+
+		// Batch versions of the tests above, testing 8 volumes at a time with AVX when compiled with it, 4 with SSE otherwise.
+		// Masks get one bit per volume (bit i % 64 of word i / 64) set when the volume is visible, and must have room
+		// for (count + 63) / 64 words. out_inside is optional and gets bits set for boxes entirely inside the frustum.
+		void CullBoxes( const BoxesSoA& boxes, uint64_t* out_visible, uint64_t* out_inside = nullptr ) const;
+		void CullSpheres( const SpheresSoA& spheres, uint64_t* out_visible ) const;
+		// Writes the indices of the visible volumes in ascending order and returns how many there are.
+		// out_indices must have room for every volume.
+		size_t CullBoxesCompact( const BoxesSoA& boxes, uint32_t* out_indices ) const;
+		size_t CullSpheresCompact( const SpheresSoA& spheres, uint32_t* out_indices ) const;
 
 		static Frustum Transform( const Frustum& frustum, const Mat4& transform );
 		static void CalculateCorners( const Mat4& transform, Vec3 corners_out[8] );
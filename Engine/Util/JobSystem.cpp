@@ -1,74 +1,382 @@
 #include "JobSystem.h"
 
 #include <algorithm>    // std::max
-#include <future>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
 
 #include "BatAssert.h"
 
 namespace Bat
 {
-	static std::vector<std::future<void>> g_ThreadPromises;
+	static constexpr uint32_t JOB_POOL_SIZE = 2048; // must be a power of 2
+	static constexpr uint32_t JOB_POOL_MASK = JOB_POOL_SIZE - 1;
 
-	void JobSystem::Initialize()
+	// Fixed-size Chase-Lev deque. The owning thread pushes/pops at the bottom, other threads steal from the top.
+	// https://www.di.ens.fr/~zappa/readings/ppopp13.pdf
+	class WorkStealingQueue
+	{
+	public:
+		bool Push( Job* pJob )
+		{
+			const int64_t b = m_iBottom.load( std::memory_order_relaxed );
+			const int64_t t = m_iTop.load( std::memory_order_acquire );
+			if( b - t >= (int64_t)JOB_POOL_SIZE )
+			{
+				return false;
+			}
+
+			m_Jobs[b & JOB_POOL_MASK].store( pJob, std::memory_order_relaxed );
+			m_iBottom.store( b + 1, std::memory_order_release );
+			return true;
+		}
+
+		Job* Pop()
+		{
+			const int64_t b = m_iBottom.load( std::memory_order_relaxed ) - 1;
+			m_iBottom.store( b, std::memory_order_relaxed );
+			std::atomic_thread_fence( std::memory_order_seq_cst );
+			int64_t t = m_iTop.load( std::memory_order_relaxed );
+
+			if( t > b )
+			{
+				// queue was empty
+				m_iBottom.store( b + 1, std::memory_order_relaxed );
+				return nullptr;
+			}
+
+			Job* pJob = m_Jobs[b & JOB_POOL_MASK].load( std::memory_order_relaxed );
+			if( t == b )
+			{
+				// last job in the queue, race against any thieves for it
+				if( !m_iTop.compare_exchange_strong( t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed ) )
+				{
+					pJob = nullptr;
+				}
+				m_iBottom.store( b + 1, std::memory_order_relaxed );
+			}
+			return pJob;
+		}
+
+		Job* Steal()
+		{
+			int64_t t = m_iTop.load( std::memory_order_acquire );
+			std::atomic_thread_fence( std::memory_order_seq_cst );
+			const int64_t b = m_iBottom.load( std::memory_order_acquire );
+
+			if( t >= b )
+			{
+				return nullptr;
+			}
+
+			Job* pJob = m_Jobs[t & JOB_POOL_MASK].load( std::memory_order_relaxed );
+			if( !m_iTop.compare_exchange_strong( t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed ) )
+			{
+				// lost the race to another thief or the owner
+				return nullptr;
+			}
+			return pJob;
+		}
+	private:
+		alignas( 64 ) std::atomic<int64_t> m_iTop = 0;
+		alignas( 64 ) std::atomic<int64_t> m_iBottom = 0;
+		std::atomic<Job*> m_Jobs[JOB_POOL_SIZE];
+	};
+
+	// Ring of job slots, a slot can only be reused once the job in it has finished running
+	struct JobPool
+	{
+		Job* Alloc()
+		{
+			for( uint32_t i = 0; i < JOB_POOL_SIZE; i++ )
+			{
+				Job& job = jobs[alloc_index++ & JOB_POOL_MASK];
+				if( job.TryAcquire() )
+				{
+					return &job;
+				}
+			}
+			return nullptr;
+		}
+
+		Job jobs[JOB_POOL_SIZE];
+		uint32_t alloc_index = 0;
+	};
+
+	struct JobThreadState
 	{
+		WorkStealingQueue queue;
+		JobPool pool;
+		uint32_t rng_state = 0;
+	};
+
+	static std::unique_ptr<JobThreadState[]> g_pThreadStates;
+	static std::vector<std::thread> g_Workers;
+	static uint32_t g_iThreadCount = 0;
+	static std::atomic<bool> g_bRunning = false;
+	static thread_local uint32_t g_iThreadIndex = JobSystem::INVALID_THREAD_INDEX;
+	// Jobs the calling thread is in the middle of running, more than one when a job waits and helps out
+	static thread_local uint32_t g_iJobDepth = 0;
+
+	// Jobs submitted from threads the job system doesn't own go through here
+	static std::mutex g_InjectMutex;
+	static std::vector<Job*> g_InjectedJobs;
+	static std::atomic<uint32_t> g_iInjectedJobCount = 0;
+	static JobPool g_InjectPool;
+
+	// Number of jobs submitted but not finished yet
+	static std::atomic<uint32_t> g_iPendingJobs = 0;
+	// Number of jobs sitting in a queue waiting for a thread to pick them up
+	static std::atomic<uint32_t> g_iQueuedJobs = 0;
+
+	static std::mutex g_WakeMutex;
+	static std::condition_variable g_WakeCondition;
+	static std::atomic<uint32_t> g_iSleepingWorkers = 0;
+
+	static uint32_t NextRandom( uint32_t& state )
+	{
+		// xorshift32
+		state ^= state << 13;
+		state ^= state >> 17;
+		state ^= state << 5;
+		return state;
 	}
 
-	void JobSystem::Shutdown()
+	static Job* FindJob( uint32_t thread_index )
 	{
+		if( thread_index != JobSystem::INVALID_THREAD_INDEX )
+		{
+			JobThreadState& state = g_pThreadStates[thread_index];
+			if( Job* pJob = state.queue.Pop() )
+			{
+				return pJob;
+			}
+
+			// try stealing, starting from a random victim so threads don't all gang up on the same one
+			if( g_iThreadCount > 1 )
+			{
+				const uint32_t start = NextRandom( state.rng_state ) % g_iThreadCount;
+				for( uint32_t i = 0; i < g_iThreadCount; i++ )
+				{
+					const uint32_t victim = (start + i) % g_iThreadCount;
+					if( victim == thread_index )
+					{
+						continue;
+					}
+
+					if( Job* pJob = g_pThreadStates[victim].queue.Steal() )
+					{
+						return pJob;
+					}
+				}
+			}
+		}
+
+		if( g_iInjectedJobCount.load( std::memory_order_acquire ) > 0 )
+		{
+			std::lock_guard<std::mutex> lock( g_InjectMutex );
+			if( !g_InjectedJobs.empty() )
+			{
+				Job* pJob = g_InjectedJobs.back();
+				g_InjectedJobs.pop_back();
+				g_iInjectedJobCount.fetch_sub( 1, std::memory_order_release );
+				return pJob;
+			}
+		}
+
+		return nullptr;
 	}
 
-	void JobSystem::Execute(const std::function<void()>& job)
+	void JobSystem::RunJob( Job* pJob )
 	{
-		g_ThreadPromises.emplace_back(
-			std::async( std::launch::async, job )
-		);
+		g_iQueuedJobs.fetch_sub( 1, std::memory_order_relaxed );
+
+		g_iJobDepth++;
+		pJob->Run();
+		g_iJobDepth--;
+
+		// grab the counter before releasing the slot, the slot can be reused as soon as it's released
+		JobCounter* pCounter = pJob->GetCounter();
+		pJob->Release();
+
+		if( pCounter )
+		{
+			pCounter->m_iPending.fetch_sub( 1, std::memory_order_acq_rel );
+		}
+		g_iPendingJobs.fetch_sub( 1, std::memory_order_acq_rel );
 	}
 
-	bool JobSystem::IsBusy()
+	bool JobSystem::TryRunJob()
 	{
-		return !g_ThreadPromises.empty();
+		Job* pJob = FindJob( g_iThreadIndex );
+		if( !pJob )
+		{
+			return false;
+		}
+
+		RunJob( pJob );
+		return true;
 	}
 
-	void JobSystem::Wait()
+	void JobSystem::WorkerMain( uint32_t thread_index )
 	{
-		for( const auto& promise : g_ThreadPromises )
+		g_iThreadIndex = thread_index;
+
+		while( g_bRunning.load( std::memory_order_acquire ) )
 		{
-			promise.wait();
+			if( TryRunJob() )
+			{
+				continue;
+			}
+
+			std::unique_lock<std::mutex> lock( g_WakeMutex );
+			g_iSleepingWorkers.fetch_add( 1 );
+			g_WakeCondition.wait( lock, []()
+			{
+				return g_iQueuedJobs.load() > 0 || !g_bRunning.load();
+			} );
+			g_iSleepingWorkers.fetch_sub( 1 );
+		}
+	}
+
+	void JobSystem::Initialize()
+	{
+		ASSERT( !g_bRunning, "Job system initialized twice" );
+
+		// Retrieve the number of hardware threads in this system, main thread counts as one of them
+		const uint32_t num_cores = std::thread::hardware_concurrency();
+		g_iThreadCount = (std::max)(1u, num_cores);
+
+		g_pThreadStates = std::make_unique<JobThreadState[]>( g_iThreadCount );
+		for( uint32_t i = 0; i < g_iThreadCount; i++ )
+		{
+			g_pThreadStates[i].rng_state = 0x9E3779B9u * (i + 1);
 		}
 
-		g_ThreadPromises.clear();
+		g_iThreadIndex = 0;
+		g_bRunning = true;
+
+		g_Workers.reserve( g_iThreadCount - 1 );
+		for( uint32_t i = 1; i < g_iThreadCount; i++ )
+		{
+			g_Workers.emplace_back( WorkerMain, i );
+		}
 	}
 
-	void JobSystem::Dispatch(uint32_t jobCount, uint32_t groupSize, const std::function<void(JobDispatchArgs)>& job)
+	void JobSystem::Shutdown()
 	{
-		ASSERT( !(jobCount == 0 || groupSize == 0), "Invalid parameters" );
+		Wait();
+
+		{
+			std::lock_guard<std::mutex> lock( g_WakeMutex );
+			g_bRunning = false;
+		}
+		g_WakeCondition.notify_all();
+
+		for( std::thread& worker : g_Workers )
+		{
+			worker.join();
+		}
+		g_Workers.clear();
+
+		g_pThreadStates.reset();
+		g_iThreadCount = 0;
+		g_iThreadIndex = INVALID_THREAD_INDEX;
+	}
+
+	Job* JobSystem::AllocJob()
+	{
+		const uint32_t thread_index = g_iThreadIndex;
+		if( thread_index != INVALID_THREAD_INDEX )
+		{
+			return g_pThreadStates[thread_index].pool.Alloc();
+		}
+
+		std::lock_guard<std::mutex> lock( g_InjectMutex );
+		return g_InjectPool.Alloc();
+	}
+
+	void JobSystem::Submit( Job* pJob )
+	{
+		if( JobCounter* pCounter = pJob->GetCounter() )
+		{
+			pCounter->m_iPending.fetch_add( 1, std::memory_order_relaxed );
+		}
+		g_iPendingJobs.fetch_add( 1, std::memory_order_relaxed );
+		g_iQueuedJobs.fetch_add( 1 );
 
-		// Calculate the amount of job groups to dispatch (overestimate, or "ceil"):
-		const uint32_t groupCount = (jobCount + groupSize - 1) / groupSize;
+		const uint32_t thread_index = g_iThreadIndex;
+		if( thread_index != INVALID_THREAD_INDEX && g_bRunning.load( std::memory_order_relaxed ) )
+		{
+			if( !g_pThreadStates[thread_index].queue.Push( pJob ) )
+			{
+				// queue is full, just run it here
+				RunJob( pJob );
+				return;
+			}
+		}
+		else if( g_bRunning.load( std::memory_order_relaxed ) )
+		{
+			std::lock_guard<std::mutex> lock( g_InjectMutex );
+			g_InjectedJobs.push_back( pJob );
+			g_iInjectedJobCount.fetch_add( 1, std::memory_order_release );
+		}
+		else
+		{
+			// job system isn't running, nothing else is going to pick this up
+			RunJob( pJob );
+			return;
+		}
 
-		for (uint32_t groupIndex = 0; groupIndex < groupCount; ++groupIndex)
+		if( g_iSleepingWorkers.load() > 0 )
 		{
-			// For each group, generate one real job:
-			auto& jobGroup = [jobCount, groupSize, job, groupIndex]()
+			// take the lock so a worker that is about to sleep can't miss this notification
 			{
-				// Calculate the current group's offset into the jobs:
-				const uint32_t groupJobOffset = groupIndex * groupSize;
-				const uint32_t groupJobEnd = std::min(groupJobOffset + groupSize, jobCount);
+				std::lock_guard<std::mutex> lock( g_WakeMutex );
+			}
+			g_WakeCondition.notify_one();
+		}
+	}
 
-				JobDispatchArgs args;
-				args.groupIndex = groupIndex;
+	bool JobSystem::IsBusy()
+	{
+		return g_iPendingJobs.load( std::memory_order_acquire ) > 0;
+	}
 
-				// Inside the group, loop through all job indices and execute job for each index:
-				for (uint32_t i = groupJobOffset; i < groupJobEnd; ++i)
-				{
-					args.jobIndex = i;
-					job(args);
-				}
-			};
+	void JobSystem::Wait()
+	{
+		// a job waiting here keeps the job system busy itself, so this would never return
+		ASSERT( g_iThreadIndex == 0 && g_iJobDepth == 0, "JobSystem::Wait() is main thread only and can't be called from a job, wait on a JobCounter instead" );
 
-			g_ThreadPromises.emplace_back(
-				std::async( std::launch::async, jobGroup )
-			);
+		while( IsBusy() )
+		{
+			if( !TryRunJob() )
+			{
+				std::this_thread::yield();
+			}
 		}
 	}
-}
\ No newline at end of file
+
+	void JobSystem::Wait( const JobCounter& counter )
+	{
+		while( !counter.IsDone() )
+		{
+			if( !TryRunJob() )
+			{
+				std::this_thread::yield();
+			}
+		}
+	}
+
+	uint32_t JobSystem::GetThreadCount()
+	{
+		return g_iThreadCount;
+	}
+
+	uint32_t JobSystem::GetThreadIndex()
+	{
+		return g_iThreadIndex;
+	}
+}
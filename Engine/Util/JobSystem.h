@@ -1,8 +1,18 @@
 #pragma once
 
 // https://turanszkij.wordpress.com/2018/11/24/simple-job-system-using-standard-c/
+// Jobs are run by a persistent pool of worker threads, each with its own work-stealing deque
+// https://blog.molecular-matters.com/2015/09/25/job-system-2-0-lock-free-work-stealing-part-2-a-specific-allocator/
 
-#include <functional>
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+#include "BatAssert.h"
 
 namespace Bat
 {
@@ -13,27 +23,149 @@ namespace Bat
 		uint32_t groupIndex;
 	};
 
+	// Tracks a set of jobs, becomes done once every job that was submitted with it has finished
+	class JobCounter
+	{
+	public:
+		JobCounter() = default;
+		JobCounter( const JobCounter& ) = delete;
+		JobCounter& operator=( const JobCounter& ) = delete;
+
+		bool IsDone() const { return m_iPending.load( std::memory_order_acquire ) == 0; }
+	private:
+		friend class JobSystem;
+
+		std::atomic<uint32_t> m_iPending = 0;
+	};
+
+	// Fixed-size type-erased job, the callable is stored inline so submitting a job never allocates
+	class alignas( 64 ) Job
+	{
+	public:
+		static constexpr size_t STORAGE_SIZE = 96;
+
+		template <typename F>
+		void Set( F&& func, JobCounter* counter )
+		{
+			using Func = std::decay_t<F>;
+			static_assert( sizeof( Func ) <= STORAGE_SIZE, "Job captures too much state, capture by reference/pointer instead" );
+			static_assert( alignof( Func ) <= alignof( std::max_align_t ), "Job callable is over-aligned" );
+
+			new( m_Storage ) Func( std::forward<F>( func ) );
+			m_pInvoke = []( void* pStorage )
+			{
+				Func& f = *reinterpret_cast<Func*>( pStorage );
+				f();
+				f.~Func();
+			};
+			m_pCounter = counter;
+		}
+
+		void Run() { m_pInvoke( m_Storage ); }
+		JobCounter* GetCounter() const { return m_pCounter; }
+
+		// Claims this job slot, returns false if the slot is still holding an unfinished job
+		bool TryAcquire()
+		{
+			if( m_bInUse.load( std::memory_order_acquire ) )
+			{
+				return false;
+			}
+			m_bInUse.store( true, std::memory_order_relaxed );
+			return true;
+		}
+		void Release() { m_bInUse.store( false, std::memory_order_release ); }
+	private:
+		alignas( std::max_align_t ) char m_Storage[STORAGE_SIZE];
+		void (*m_pInvoke)( void* ) = nullptr;
+		JobCounter* m_pCounter = nullptr;
+		std::atomic<bool> m_bInUse = false;
+	};
+
 	class JobSystem
 	{
 	public:
+		static constexpr uint32_t INVALID_THREAD_INDEX = UINT32_MAX;
+
 		// Create the internal resources such as worker threads, etc. Call it once when initializing the application.
+		// The thread that calls this becomes thread index 0 of the job system.
 		static void Initialize();
 		// Clean up any allocated resource
 		static void Shutdown();
 
 		// Add a job to execute asynchronously. Any idle thread will execute this job.
-		static void Execute(const std::function<void()>& job);
+		// If a counter is given, it will be incremented now and decremented once the job has finished.
+		template <typename F>
+		static void Execute( F&& job, JobCounter* counter = nullptr )
+		{
+			Job* pJob = AllocJob();
+			if( !pJob )
+			{
+				// job pool is exhausted, run it right here instead
+				job();
+				return;
+			}
+
+			pJob->Set( std::forward<F>( job ), counter );
+			Submit( pJob );
+		}
 
 		// Divide a job onto multiple jobs and execute in parallel.
 		//	jobCount	: how many jobs to generate for this task.
 		//	groupSize	: how many jobs to execute per thread. Jobs inside a group execute serially. It might be worth to increase for small jobs
 		//	func		: receives a JobDispatchArgs as parameter
-		static void Dispatch(uint32_t jobCount, uint32_t groupSize, const std::function<void(JobDispatchArgs)>& job);
+		//	counter		: optional counter that will track every group of this dispatch
+		template <typename F>
+		static void Dispatch( uint32_t jobCount, uint32_t groupSize, const F& job, JobCounter* counter = nullptr )
+		{
+			ASSERT( !(jobCount == 0 || groupSize == 0), "Invalid parameters" );
+
+			// Calculate the amount of job groups to dispatch (overestimate, or "ceil"):
+			const uint32_t groupCount = (jobCount + groupSize - 1) / groupSize;
+
+			for( uint32_t groupIndex = 0; groupIndex < groupCount; ++groupIndex )
+			{
+				// For each group, generate one real job:
+				Execute( [jobCount, groupSize, groupIndex, job]()
+				{
+					// Calculate the current group's offset into the jobs:
+					const uint32_t groupJobOffset = groupIndex * groupSize;
+					const uint32_t groupJobEnd = (std::min)(groupJobOffset + groupSize, jobCount);
+
+					JobDispatchArgs args;
+					args.groupIndex = groupIndex;
+
+					// Inside the group, loop through all job indices and execute job for each index:
+					for( uint32_t i = groupJobOffset; i < groupJobEnd; ++i )
+					{
+						args.jobIndex = i;
+						job( args );
+					}
+				}, counter );
+			}
+		}
 
 		// Check if any threads are working currently or not
 		static bool IsBusy();
 
-		// Wait until all threads become idle
+		// Wait until all threads become idle. The calling thread helps run jobs while it waits.
+		// Main thread only and never from inside a job, the job itself would keep the system busy forever.
 		static void Wait();
+		// Wait until every job tracked by the counter has finished. The calling thread helps run jobs while it waits.
+		static void Wait( const JobCounter& counter );
+
+		// Runs one queued job on the calling thread, returns false if there was nothing to run.
+		// Useful for threads that are waiting on something other than a JobCounter.
+		static bool TryRunJob();
+
+		// Number of threads that run jobs, including the thread that called Initialize
+		static uint32_t GetThreadCount();
+		// Index of the calling thread in [0, GetThreadCount()), or INVALID_THREAD_INDEX if the thread isn't owned by the job system
+		static uint32_t GetThreadIndex();
+	private:
+		static Job* AllocJob();
+		static void Submit( Job* pJob );
+		static void RunJob( Job* pJob );
+		static void WorkerMain( uint32_t thread_index );
 	};
-}
\ No newline at end of file
+}
@@ -1552,6 +1552,17 @@ namespace Bat
 
 		return aabb;
 	}
+	AABB AABB::TransformBounds( const Mat3x4& transform ) const
+	{
+		Vec3 points[8];
+		GetPoints( points );
+		for( Vec3& point : points )
+		{
+			point = Mat3x4::Transform( transform, point );
+		}
+
+		return AABB( points, 8 );
+	}
 	void AABB::GetPoints( Vec3 out[8] ) const
 	{
 		out[0] = { mins.x, mins.y, mins.z };
@@ -755,6 +755,8 @@ namespace Bat
 		// This just gets the AABB of the rotated AABB of the mesh
 		// Will have lots of empty space, but better than recalculating AABB for rotated mesh vertices
 		AABB Transform( const Mat4& transform ) const;
+		// Bounds of all 8 transformed corners, unlike Transform this stays correct for rotated boxes
+		AABB TransformBounds( const Mat3x4& transform ) const;
 		void GetPoints( Vec3 out[8] ) const;
 	public:
 		Vec3 mins;
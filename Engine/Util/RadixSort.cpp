@@ -0,0 +1,68 @@
+#include "PCH.h"
+#include "RadixSort.h"
+
+namespace Bat
+{
+	void RadixSort( uint64_t* keys, uint32_t* values, size_t count, uint64_t* scratch_keys, uint32_t* scratch_values )
+	{
+		static constexpr int NUM_PASSES = 8;
+		static constexpr int NUM_BUCKETS = 256;
+
+		if( count < 2 )
+		{
+			return;
+		}
+
+		// histogram every byte in one read of the keys
+		uint32_t counts[NUM_PASSES][NUM_BUCKETS] = {};
+		for( size_t i = 0; i < count; i++ )
+		{
+			const uint64_t key = keys[i];
+			for( int pass = 0; pass < NUM_PASSES; pass++ )
+			{
+				counts[pass][( key >> ( pass * 8 ) ) & 0xFF]++;
+			}
+		}
+
+		uint64_t* src_keys = keys;
+		uint32_t* src_values = values;
+		uint64_t* dst_keys = scratch_keys;
+		uint32_t* dst_values = scratch_values;
+
+		for( int pass = 0; pass < NUM_PASSES; pass++ )
+		{
+			const int shift = pass * 8;
+
+			// every key has the same byte here, order wouldn't change
+			if( counts[pass][( src_keys[0] >> shift ) & 0xFF] == count )
+			{
+				continue;
+			}
+
+			uint32_t offsets[NUM_BUCKETS];
+			uint32_t total = 0;
+			for( int bucket = 0; bucket < NUM_BUCKETS; bucket++ )
+			{
+				offsets[bucket] = total;
+				total += counts[pass][bucket];
+			}
+
+			for( size_t i = 0; i < count; i++ )
+			{
+				const uint32_t dst = offsets[( src_keys[i] >> shift ) & 0xFF]++;
+				dst_keys[dst] = src_keys[i];
+				dst_values[dst] = src_values[i];
+			}
+
+			std::swap( src_keys, dst_keys );
+			std::swap( src_values, dst_values );
+		}
+
+		// odd number of passes leaves the results in the scratch buffers
+		if( src_keys != keys )
+		{
+			std::copy( src_keys, src_keys + count, keys );
+			std::copy( src_values, src_values + count, values );
+		}
+	}
+}
@@ -0,0 +1,12 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+
+namespace Bat
+{
+	// Sorts keys in ascending order along with a value per key using an LSD radix sort, 8 bits per pass.
+	// Passes over bytes that are the same in every key are skipped, so keys that only use some of their bits are cheaper.
+	// The sort is stable. scratch_keys/scratch_values must have room for count elements, results end up in keys/values.
+	void RadixSort( uint64_t* keys, uint32_t* values, size_t count, uint64_t* scratch_keys, uint32_t* scratch_values );
+}